@@ -0,0 +1,81 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "warcpp/warcpp.hpp"
+
+#include "forward_index_builder.hpp"
+#include "parsing/html.hpp"
+#include "util/do_not_optimize_away.hpp"
+#include "util/util.hpp"
+
+using pisa::do_not_optimize_away;
+using pisa::get_time_usecs;
+using pisa::parsing::html::Html_Parser;
+
+[[nodiscard]] auto read_pages(char const* warc_filename) -> std::vector<std::string>
+{
+    std::vector<std::string> pages;
+    std::ifstream is(warc_filename);
+    while (not is.eof()) {
+        warcpp::match(
+            warcpp::read_subsequent_record(is),
+            [&](warcpp::Record const& rec) {
+                if (rec.valid_response()) {
+                    pages.push_back(rec.content());
+                }
+            },
+            [](warcpp::Error const&) {});
+    }
+    return pages;
+}
+
+void perftest(std::vector<std::string> const& pages, Html_Parser parser, std::string const& name)
+{
+    std::size_t bytes = 0;
+    for (auto const& page: pages) {
+        bytes += page.size();
+    }
+    // Pages are moved into the parser, so copy them beforehand.
+    auto contents = pages;
+    std::size_t terms = 0;
+    auto tick = get_time_usecs();
+    for (auto& content: contents) {
+        pisa::parse_html_content(
+            std::move(content),
+            [&](std::string_view term) {
+                do_not_optimize_away(term.data());
+                terms += 1;
+            },
+            parser);
+    }
+    double elapsed = get_time_usecs() - tick;
+    spdlog::info(
+        "{}: parsed {} pages ({} terms) in {:.2f} seconds, {:.1f} MB/s",
+        name,
+        pages.size(),
+        terms,
+        elapsed / 1000000,
+        bytes / elapsed);
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <WARC filename>" << std::endl;
+        return 1;
+    }
+    auto pages = read_pages(argv[1]);
+    spdlog::info("Read {} pages", pages.size());
+
+    perftest(pages, Html_Parser::gumbo, "gumbo");
+    perftest(pages, Html_Parser::fast, "fast");
+
+    pisa::parsing::html::Text_Extractor extractor(Html_Parser::fast);
+    for (auto const& page: pages) {
+        extractor.extract(page, [](std::string_view) {});
+    }
+    spdlog::info("fast: {} pages fell back to gumbo", extractor.fallbacks());
+}
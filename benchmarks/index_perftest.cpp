@@ -59,8 +59,13 @@ void perftest(IndexType const& index, std::string const& type)
 
     uint64_t min_calls_per_list = 100;
     uint64_t max_calls_per_list = 20000;
-    for (uint64_t skip = 1; skip <= 16384; skip <<= 1) {
-        uint64_t min_length = min_calls_per_list * skip;
+    // Skips above this jump over hundreds of blocks, which exercises the block-max search of
+    // block-based indexes; lists long enough for many such calls are rare, so require fewer.
+    uint64_t long_skip = 16384;
+    uint64_t min_calls_per_list_long_skip = 10;
+    for (uint64_t skip = 1; skip <= 64 * long_skip; skip <<= 1) {
+        uint64_t min_length =
+            (skip <= long_skip ? min_calls_per_list : min_calls_per_list_long_skip) * skip;
         std::vector<std::pair<size_t, std::vector<uint64_t>>> skip_values;
         for (size_t i = 0; i < index.size(); ++i) {
             auto reader = index[i];
@@ -74,6 +79,9 @@ void perftest(IndexType const& index, std::string const& type)
                 skip_values.back().second.push_back(reader.docid());
             }
         }
+        if (skip_values.empty()) {
+            break;
+        }
 
         auto tick = get_time_usecs();
         size_t calls = 0;
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "fmt/format.h"
+
 #include "bit_vector.hpp"
 #include "mappable/mappable_vector.hpp"
 
@@ -8,15 +14,35 @@
 
 namespace pisa {
 
-template <typename BlockCodec, bool Profile = false>
+/// If `BlockMaxScores` is true, each posting list embeds the maximum score of its blocks
+/// (see `block_posting_list`). Such an index is built with the `add_posting_list` overload
+/// taking the posting scores, and has the same file layout otherwise. Whether the lists embed
+/// block-max scores is stored in the index, which is rejected when mapped with the other
+/// layout, along with the scorer that computed them (see `check_scorer`).
+template <typename BlockCodec, bool Profile = false, bool BlockMaxScores = false>
 class block_freq_index {
+    using posting_list_type = block_posting_list<BlockCodec, Profile, BlockMaxScores>;
+
   public:
+    static constexpr bool block_max_scores = BlockMaxScores;
+
+    static constexpr uint64_t magic = 0x4B434C4241534950ULL;  // "PISABLCK"
+    /// Incremented whenever the layout changes; version 1 added the block-max scores flag and
+    /// the scorer.
+    static constexpr uint64_t version = 1;
+
     block_freq_index() : m_size(0) {}
 
     class builder {
       public:
-        builder(uint64_t num_docs, global_parameters const& params) : m_params(params)
+        /// `scorer` describes the scorer computing the scores passed to `add_posting_list`
+        /// (see `scorer::describe`), and is only stored along with block-max scores.
+        builder(uint64_t num_docs, global_parameters const& params, std::string const& scorer = "")
+            : m_params(params)
         {
+            if constexpr (BlockMaxScores) {
+                m_scorer.assign(scorer.begin(), scorer.end());
+            }
             m_num_docs = num_docs;
             m_endpoints.push_back(0);
         }
@@ -30,7 +56,23 @@ class block_freq_index {
         {
             if (!n)
                 throw std::invalid_argument("List must be nonempty");
-            block_posting_list<BlockCodec, Profile>::write(m_lists, n, docs_begin, freqs_begin);
+            posting_list_type::write(m_lists, n, docs_begin, freqs_begin);
+            m_endpoints.push_back(m_lists.size());
+        }
+
+        /// Adds a posting list along with the score of each posting, from which the block-max
+        /// scores are computed.
+        template <typename DocsIterator, typename FreqsIterator, typename ScoresIterator>
+        void add_posting_list(
+            uint64_t n,
+            DocsIterator docs_begin,
+            FreqsIterator freqs_begin,
+            ScoresIterator scores_begin,
+            uint64_t /* occurrences */)
+        {
+            if (!n)
+                throw std::invalid_argument("List must be nonempty");
+            posting_list_type::write(m_lists, n, docs_begin, freqs_begin, scores_begin);
             m_endpoints.push_back(m_lists.size());
         }
 
@@ -39,7 +81,7 @@ class block_freq_index {
         {
             if (!n)
                 throw std::invalid_argument("List must be nonempty");
-            block_posting_list<BlockCodec>::write_blocks(m_lists, n, blocks);
+            posting_list_type::write_blocks(m_lists, n, blocks);
             m_endpoints.push_back(m_lists.size());
         }
 
@@ -56,6 +98,7 @@ class block_freq_index {
             sq.m_size = m_endpoints.size() - 1;
             sq.m_num_docs = m_num_docs;
             sq.m_lists.steal(m_lists);
+            sq.m_scorer.steal(m_scorer);
 
             bit_vector_builder bvb;
             compact_elias_fano::write(
@@ -72,13 +115,31 @@ class block_freq_index {
         size_t m_num_docs;
         std::vector<uint64_t> m_endpoints;
         std::vector<uint8_t> m_lists;
+        std::vector<char> m_scorer;
     };
 
     size_t size() const { return m_size; }
 
+    /// Description of the scorer that computed the block-max scores (see `scorer::describe`),
+    /// empty if the lists do not embed them.
+    [[nodiscard]] auto scorer() const -> std::string
+    {
+        return std::string(m_scorer.begin(), m_scorer.end());
+    }
+
+    /// Throws if the block-max scores were not computed by the scorer described by `scorer`,
+    /// as pruning with them would silently lose results.
+    void check_scorer(std::string const& scorer) const
+    {
+        if (this->scorer() != scorer) {
+            throw std::invalid_argument(fmt::format(
+                "The block-max scores were computed by {}, not {}", this->scorer(), scorer));
+        }
+    }
+
     uint64_t num_docs() const { return m_num_docs; }
 
-    typedef typename block_posting_list<BlockCodec, Profile>::document_enumerator document_enumerator;
+    typedef typename posting_list_type::document_enumerator document_enumerator;
 
     document_enumerator operator[](size_t i) const
     {
@@ -109,6 +170,8 @@ class block_freq_index {
 
     void swap(block_freq_index& other)
     {
+        std::swap(m_block_max_scores, other.m_block_max_scores);
+        m_scorer.swap(other.m_scorer);
         std::swap(m_params, other.m_params);
         std::swap(m_size, other.m_size);
         m_endpoints.swap(other.m_endpoints);
@@ -118,15 +181,53 @@ class block_freq_index {
     template <typename Visitor>
     void map(Visitor& visit)
     {
-        visit(m_params, "m_params")(m_size, "m_size")(m_num_docs, "m_num_docs")(
-            m_endpoints, "m_endpoints")(m_lists, "m_lists");
+        visit(m_magic, "m_magic")(m_version, "m_version");
+        if (m_magic != magic || m_version != version) {
+            throw std::runtime_error(fmt::format(
+                "Unsupported block index format{}: rebuild it with create_freq_index",
+                m_magic == magic ? fmt::format(" (version {})", m_version) : ""));
+        }
+        visit(m_block_max_scores, "m_block_max_scores");
+        if (m_block_max_scores != static_cast<uint64_t>(BlockMaxScores)) {
+            throw std::invalid_argument(fmt::format(
+                "The posting lists {} block-max scores: query the index {} --block-max-scores",
+                m_block_max_scores != 0U ? "embed" : "do not embed",
+                m_block_max_scores != 0U ? "with" : "without"));
+        }
+        visit(m_scorer, "m_scorer")(m_params, "m_params")(m_size, "m_size")(
+            m_num_docs, "m_num_docs")(m_endpoints, "m_endpoints")(m_lists, "m_lists");
     }
 
   private:
+    uint64_t m_magic = magic;
+    uint64_t m_version = version;
+    uint64_t m_block_max_scores = BlockMaxScores;
+    mapper::mappable_vector<char> m_scorer;
     global_parameters m_params;
     size_t m_size;
     size_t m_num_docs;
     bit_vector m_endpoints;
     mapper::mappable_vector<uint8_t> m_lists;
 };
+
+/// Whether the posting lists of `Index` embed their block-max scores.
+template <typename Index, typename = void>
+struct has_block_max_scores: std::false_type {};
+
+template <typename Index>
+struct has_block_max_scores<Index, std::void_t<decltype(Index::block_max_scores)>>
+    : std::bool_constant<Index::block_max_scores> {};
+
+/// Maps a block index type to the same type with embedded block-max scores.
+template <typename Index>
+struct with_block_max_scores;
+
+template <typename BlockCodec, bool Profile>
+struct with_block_max_scores<block_freq_index<BlockCodec, Profile>> {
+    using type = block_freq_index<BlockCodec, Profile, true>;
+};
+
+template <typename Index>
+using with_block_max_scores_t = typename with_block_max_scores<Index>::type;
+
 }  // namespace pisa
@@ -1,16 +1,90 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <limits>
+
 #include "codec/block_codecs.hpp"
 #include "util/block_profiler.hpp"
+#include "util/intrinsics.hpp"
+#include "util/query_counters.hpp"
 #include "util/util.hpp"
 
 namespace pisa {
 
-template <typename BlockCodec, bool Profile = false>
+/// Lists with at least this many blocks left to search are first skipped through by groups
+/// of `block_max_skip_group` blocks.
+constexpr uint32_t block_max_skip_threshold = 512;
+constexpr uint32_t block_max_skip_group = 64;
+
+/// Returns the first block in `[first, last)` whose maximum docid is at least `lower_bound`.
+/// The block maxima are sorted, and such a block must exist.
+///
+/// The search is two-level: on long ranges, it first compares only the last maximum of each
+/// group of `block_max_skip_group` blocks; it then scans maxima linearly, eight at a time
+/// with AVX2 if available.
+PISA_ALWAYSINLINE auto find_block_geq(
+    uint32_t const* block_maxs, uint32_t first, uint32_t last, uint32_t lower_bound) -> uint32_t
+{
+    assert(first < last && block_maxs[last - 1] >= lower_bound);
+    // Most skips land in the next block.
+    if (block_maxs[first] >= lower_bound) {
+        return first;
+    }
+    if (last - first >= block_max_skip_threshold) {
+        while (first + block_max_skip_group <= last
+               && block_maxs[first + block_max_skip_group - 1] < lower_bound) {
+            first += block_max_skip_group;
+        }
+    }
+#if defined(__AVX2__)
+    // AVX2 only has signed comparisons: flipping the sign bits preserves the unsigned order.
+    __m256i const sign = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+    __m256i const bound = _mm256_xor_si256(_mm256_set1_epi32(lower_bound), sign);
+    while (first + 8 <= last) {
+        __m256i maxs = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(block_maxs + first));
+        __m256i less = _mm256_cmpgt_epi32(bound, _mm256_xor_si256(maxs, sign));
+        auto mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+        if (mask != 0xFF) {
+            return first + __builtin_ctz(~mask);
+        }
+        first += 8;
+    }
+#endif
+    while (block_maxs[first] < lower_bound) {
+        ++first;
+    }
+    return first;
+}
+
+/// Posting list compressed in blocks of `BlockCodec::block_size` postings.
+///
+/// If `BlockMaxScores` is true, the header also stores the maximum score of each block, so that
+/// block-max algorithms can read upper bounds from the list itself (see `block_scores()`).
+template <typename BlockCodec, bool Profile = false, bool BlockMaxScores = false>
 struct block_posting_list {
+    /// Size of each block-max score in the header.
+    static constexpr uint64_t block_score_bytes = BlockMaxScores ? sizeof(float) : 0;
+
     template <typename DocsIterator, typename FreqsIterator>
     static void
     write(std::vector<uint8_t>& out, uint32_t n, DocsIterator docs_begin, FreqsIterator freqs_begin)
+    {
+        static_assert(!BlockMaxScores, "Block-max scores require the scores of the postings");
+        write(out, n, docs_begin, freqs_begin, nullptr);
+    }
+
+    /// Writes a posting list, where `scores_begin` points to the score of each posting; the
+    /// scores are only used to compute the block-max scores, and ignored if `BlockMaxScores`
+    /// is false.
+    template <typename DocsIterator, typename FreqsIterator, typename ScoresIterator>
+    static void write(
+        std::vector<uint8_t>& out,
+        uint32_t n,
+        DocsIterator docs_begin,
+        FreqsIterator freqs_begin,
+        ScoresIterator scores_begin)
     {
         TightVariableByte::encode_single(n, out);
 
@@ -18,7 +92,8 @@ struct block_posting_list {
         uint64_t blocks = ceil_div(n, block_size);
         size_t begin_block_maxs = out.size();
         size_t begin_block_endpoints = begin_block_maxs + 4 * blocks;
-        size_t begin_blocks = begin_block_endpoints + 4 * (blocks - 1);
+        size_t begin_block_scores = begin_block_endpoints + 4 * (blocks - 1);
+        size_t begin_blocks = begin_block_scores + block_score_bytes * blocks;
         out.resize(begin_blocks);
 
         DocsIterator docs_it(docs_begin);
@@ -38,6 +113,13 @@ struct block_posting_list {
                 freqs_buf[i] = *freqs_it++ - 1;
             }
             *((uint32_t*)&out[begin_block_maxs + 4 * b]) = last_doc;
+            if constexpr (BlockMaxScores) {
+                float max_score = 0;
+                for (size_t i = 0; i < cur_block_size; ++i) {
+                    max_score = std::max(max_score, static_cast<float>(*scores_begin++));
+                }
+                *((float*)&out[begin_block_scores + block_score_bytes * b]) = max_score;
+            }
 
             BlockCodec::encode(
                 docs_buf.data(), last_doc - block_base - (cur_block_size - 1), cur_block_size, out);
@@ -58,7 +140,8 @@ struct block_posting_list {
         uint64_t blocks = input_blocks.size();
         size_t begin_block_maxs = out.size();
         size_t begin_block_endpoints = begin_block_maxs + 4 * blocks;
-        size_t begin_blocks = begin_block_endpoints + 4 * (blocks - 1);
+        size_t begin_block_scores = begin_block_endpoints + 4 * (blocks - 1);
+        size_t begin_blocks = begin_block_scores + block_score_bytes * blocks;
         out.resize(begin_blocks);
 
         for (auto const& block: input_blocks) {
@@ -70,6 +153,9 @@ struct block_posting_list {
 
             // write max
             *((uint32_t*)&out[begin_block_maxs + 4 * b]) = block.max;
+            if constexpr (BlockMaxScores) {
+                *((float*)&out[begin_block_scores + block_score_bytes * b]) = block.max_score;
+            }
 
             // copy block
             block.append_docs_block(out);
@@ -89,15 +175,14 @@ struct block_posting_list {
               m_blocks(ceil_div(m_n, BlockCodec::block_size)),
               m_block_maxs(m_base),
               m_block_endpoints(m_block_maxs + 4 * m_blocks),
-              m_blocks_data(m_block_endpoints + 4 * (m_blocks - 1)),
+              m_block_scores(m_block_endpoints + 4 * (m_blocks - 1)),
+              m_blocks_data(m_block_scores + block_score_bytes * m_blocks),
               m_universe(universe)
         {
             if (Profile) {
                 // std::cout << "OPEN\t" << m_term_id << "\t" << m_blocks << "\n";
                 m_block_profile = block_profiler::open_list(term_id, m_blocks);
             }
-            m_docs_buf.resize(BlockCodec::block_size);
-            m_freqs_buf.resize(BlockCodec::block_size);
             reset();
         }
 
@@ -113,30 +198,31 @@ struct block_posting_list {
                 }
                 decode_docs_block(m_cur_block + 1);
             } else {
-                m_cur_docid += m_docs_buf[m_pos_in_block] + 1;
+                m_cur_docid += m_buffers.docs[m_pos_in_block] + 1;
             }
         }
 
         void PISA_ALWAYSINLINE next_geq(uint64_t lower_bound)
         {
+            PISA_QUERY_COUNT(next_geq, 1);
             assert(lower_bound >= m_cur_docid || position() == 0);
             if (PISA_UNLIKELY(lower_bound > m_cur_block_max)) {
-                // binary search seems to perform worse here
+                // Skips are mostly short, which the strided scan of `find_block_geq` favors
+                // over a binary search.
                 if (lower_bound > block_max(m_blocks - 1)) {
                     m_cur_docid = m_universe;
                     return;
                 }
 
-                uint64_t block = m_cur_block + 1;
-                while (block_max(block) < lower_bound) {
-                    ++block;
-                }
-
-                decode_docs_block(block);
+                decode_docs_block(find_block_geq(
+                    reinterpret_cast<uint32_t const*>(m_block_maxs),
+                    m_cur_block + 1,
+                    m_blocks,
+                    lower_bound));
             }
 
             while (docid() < lower_bound) {
-                m_cur_docid += m_docs_buf[++m_pos_in_block] + 1;
+                m_cur_docid += m_buffers.docs[++m_pos_in_block] + 1;
                 assert(m_pos_in_block < m_cur_block_size);
             }
         }
@@ -149,18 +235,63 @@ struct block_posting_list {
                 decode_docs_block(block);
             }
             while (position() < pos) {
-                m_cur_docid += m_docs_buf[++m_pos_in_block] + 1;
+                m_cur_docid += m_buffers.docs[++m_pos_in_block] + 1;
             }
         }
 
         uint64_t docid() const { return m_cur_docid; }
 
+        /// Moves to the block containing the first docid greater than or equal to `lower_bound`,
+        /// or past the end if there is none. Unlike `next_geq`, it does not move within the
+        /// block, so `docid()` may still be lower than `lower_bound`.
+        void PISA_ALWAYSINLINE next_geq_block(uint64_t lower_bound)
+        {
+            if (PISA_UNLIKELY(lower_bound > m_cur_block_max)) {
+                if (lower_bound > block_max(m_blocks - 1)) {
+                    m_cur_docid = m_universe;
+                    return;
+                }
+                decode_docs_block(find_block_geq(
+                    reinterpret_cast<uint32_t const*>(m_block_maxs),
+                    m_cur_block + 1,
+                    m_blocks,
+                    lower_bound));
+            }
+        }
+
+        /// Moves to the first posting of the next block, or past the end after the last block.
+        void PISA_ALWAYSINLINE next_block()
+        {
+            if (m_cur_block + 1 == m_blocks) {
+                m_cur_docid = m_universe;
+                return;
+            }
+            decode_docs_block(m_cur_block + 1);
+        }
+
+        /// Docids of the postings of the current block, computed from the gaps on first use.
+        /// The current posting is at `block_position()`.
+        PISA_ALWAYSINLINE uint32_t const* block_docids()
+        {
+            if (m_buffers.docids_size == 0) {
+                decode_docids();
+            }
+            return m_buffers.docids.data();
+        }
+
+        uint32_t block_position() const { return m_pos_in_block; }
+
+        uint32_t current_block_size() const { return m_cur_block_size; }
+
+        /// Last docid of the current block.
+        uint64_t block_last_docid() const { return m_cur_block_max; }
+
         uint64_t PISA_ALWAYSINLINE freq()
         {
-            if (!m_freqs_decoded) {
+            if (m_buffers.freqs_size == 0) {
                 decode_freqs_block();
             }
-            return m_freqs_buf[m_pos_in_block] + 1;
+            return m_buffers.freqs[m_pos_in_block] + 1;
         }
 
         uint64_t position() const { return m_cur_block * BlockCodec::block_size + m_pos_in_block; }
@@ -195,6 +326,7 @@ struct block_posting_list {
             uint32_t max;
             uint32_t size;
             uint32_t doc_gaps_universe;
+            float max_score = 0;  // only stored if `BlockMaxScores` is true
 
             void append_docs_block(std::vector<uint8_t>& out) const
             {
@@ -246,6 +378,9 @@ struct block_posting_list {
                 blocks.back().docs_begin = ptr;
                 blocks.back().doc_gaps_universe = gaps_universe;
                 blocks.back().max = block_max(b);
+                if constexpr (BlockMaxScores) {
+                    blocks.back().max_score = block_score(b);
+                }
 
                 uint8_t const* freq_ptr =
                     BlockCodec::decode(ptr, buf.data(), gaps_universe, cur_block_size);
@@ -258,9 +393,55 @@ struct block_posting_list {
             return blocks;
         }
 
+        /// Shallow cursor over the block-max scores embedded in the list. It has the same
+        /// interface as the enumerators of `wand_data`, so that block-max algorithms can use
+        /// it in place of a separate block-max index.
+        class block_score_enumerator {
+          public:
+            block_score_enumerator(
+                uint32_t const* block_maxs, float const* block_scores, uint32_t blocks)
+                : m_block_maxs(block_maxs), m_block_scores(block_scores), m_blocks(blocks)
+            {}
+
+            /// Moves to the first block whose last docid is at least `lower_bound`, or to the
+            /// last block if there is none.
+            void PISA_ALWAYSINLINE next_geq(uint64_t lower_bound)
+            {
+                if (PISA_UNLIKELY(lower_bound > m_block_maxs[m_cur_block])) {
+                    m_cur_block = lower_bound > m_block_maxs[m_blocks - 1]
+                        ? m_blocks - 1
+                        : find_block_geq(m_block_maxs, m_cur_block + 1, m_blocks, lower_bound);
+                }
+            }
+
+            /// Maximum score of the current block.
+            float score() const { return m_block_scores[m_cur_block]; }
+
+            /// Last docid of the current block.
+            uint64_t docid() const { return m_block_maxs[m_cur_block]; }
+
+          private:
+            uint32_t const* m_block_maxs;
+            float const* m_block_scores;
+            uint32_t m_blocks;
+            uint32_t m_cur_block = 0;
+        };
+
+        block_score_enumerator block_scores() const
+        {
+            static_assert(BlockMaxScores, "The list does not store block-max scores");
+            return block_score_enumerator(
+                (uint32_t const*)m_block_maxs, (float const*)m_block_scores, m_blocks);
+        }
+
       private:
         uint32_t block_max(uint32_t block) const { return ((uint32_t const*)m_block_maxs)[block]; }
 
+        float block_score(uint32_t block) const
+        {
+            return ((float const*)m_block_scores)[block];
+        }
+
         void PISA_NOINLINE decode_docs_block(uint64_t block)
         {
             static const uint64_t block_size = BlockCodec::block_size;
@@ -272,28 +453,44 @@ struct block_posting_list {
             m_cur_block_max = block_max(block);
             m_freqs_block_data = BlockCodec::decode(
                 block_data,
-                m_docs_buf.data(),
+                m_buffers.docs.data(),
                 m_cur_block_max - cur_base - (m_cur_block_size - 1),
                 m_cur_block_size);
             intrinsics::prefetch(m_freqs_block_data);
 
-            m_docs_buf[0] += cur_base;
+            m_buffers.docs[0] += cur_base;
 
             m_cur_block = block;
             m_pos_in_block = 0;
-            m_cur_docid = m_docs_buf[0];
-            m_freqs_decoded = false;
+            m_cur_docid = m_buffers.docs[0];
+            m_buffers.docs_size = m_cur_block_size;
+            m_buffers.freqs_size = 0;
+            m_buffers.docids_size = 0;
+            PISA_QUERY_COUNT(docs_blocks, 1);
+            PISA_QUERY_COUNT(postings, m_cur_block_size);
             if (Profile) {
                 ++m_block_profile[2 * m_cur_block];
             }
         }
 
+        void decode_docids()
+        {
+            uint32_t docid = m_buffers.docs[0];
+            m_buffers.docids[0] = docid;
+            for (uint32_t pos = 1; pos < m_cur_block_size; ++pos) {
+                docid += m_buffers.docs[pos] + 1;
+                m_buffers.docids[pos] = docid;
+            }
+            m_buffers.docids_size = m_cur_block_size;
+        }
+
         void PISA_NOINLINE decode_freqs_block()
         {
             uint8_t const* next_block = BlockCodec::decode(
-                m_freqs_block_data, m_freqs_buf.data(), uint32_t(-1), m_cur_block_size);
+                m_freqs_block_data, m_buffers.freqs.data(), uint32_t(-1), m_cur_block_size);
             intrinsics::prefetch(next_block);
-            m_freqs_decoded = true;
+            m_buffers.freqs_size = m_cur_block_size;
+            PISA_QUERY_COUNT(freqs_blocks, 1);
 
             if (Profile) {
                 ++m_block_profile[2 * m_cur_block + 1];
@@ -305,6 +502,7 @@ struct block_posting_list {
         uint32_t m_blocks;
         uint8_t const* m_block_maxs;
         uint8_t const* m_block_endpoints;
+        uint8_t const* m_block_scores;
         uint8_t const* m_blocks_data;
         uint64_t m_universe;
 
@@ -314,11 +512,37 @@ struct block_posting_list {
         uint32_t m_cur_block_size;
         uint32_t m_cur_docid;
 
-        uint8_t const* m_freqs_block_data;
-        bool m_freqs_decoded;
+        /// Decoded gaps, frequencies, and docids of the current block, inline rather than
+        /// heap-allocated so that opening a cursor does not allocate. Frequencies and docids are
+        /// decoded on first use; a size of 0 means not decoded yet. Copying an enumerator, as
+        /// when building cursors, only copies the decoded part of each buffer.
+        struct block_buffers {
+            block_buffers() = default;
+            block_buffers(block_buffers const& other) { *this = other; }
+
+            block_buffers& operator=(block_buffers const& other)
+            {
+                if (this != &other) {
+                    docs_size = other.docs_size;
+                    freqs_size = other.freqs_size;
+                    docids_size = other.docids_size;
+                    std::copy_n(other.docs.begin(), docs_size, docs.begin());
+                    std::copy_n(other.freqs.begin(), freqs_size, freqs.begin());
+                    std::copy_n(other.docids.begin(), docids_size, docids.begin());
+                }
+                return *this;
+            }
+
+            uint32_t docs_size = 0;
+            uint32_t freqs_size = 0;
+            uint32_t docids_size = 0;
+            std::array<uint32_t, BlockCodec::block_size> docs;
+            std::array<uint32_t, BlockCodec::block_size> freqs;
+            std::array<uint32_t, BlockCodec::block_size> docids;
+        };
 
-        std::vector<uint32_t> m_docs_buf;
-        std::vector<uint32_t> m_freqs_buf;
+        uint8_t const* m_freqs_block_data;
+        block_buffers m_buffers;
 
         block_profiler::counter_type* m_block_profile;
     };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "block_freq_index.hpp"
 #include "query/queries.hpp"
 #include "scorer/index_scorer.hpp"
 #include "wand_data.hpp"
@@ -7,15 +8,44 @@
 
 namespace pisa {
 
-template <typename Index, typename WandType>
+namespace detail {
+
+    template <typename Index, typename WandType, bool Embedded = has_block_max_scores<Index>::value>
+    struct block_max_enumerator {
+        using type = typename WandType::wand_data_enumerator;
+
+        static auto
+        get(typename Index::document_enumerator const&, WandType const& wdata, term_id_type term)
+        {
+            return wdata.getenum(term);
+        }
+    };
+
+    /// Reads the block-max scores from the posting list itself rather than from `wdata`.
+    template <typename Index, typename WandType>
+    struct block_max_enumerator<Index, WandType, true> {
+        using type = typename Index::document_enumerator::block_score_enumerator;
+
+        static auto
+        get(typename Index::document_enumerator const& list, WandType const&, term_id_type)
+        {
+            return list.block_scores();
+        }
+    };
+
+}  // namespace detail
+
+/// Cursor with block-max scores, which come from `wdata` or, if the index embeds them, from
+/// the posting list.
+template <typename Index, typename WandType, typename TermScorer = term_scorer_t>
 struct block_max_scored_cursor {
     using enum_type = typename Index::document_enumerator;
-    using wdata_enum = typename WandType::wand_data_enumerator;
+    using wdata_enum = typename detail::block_max_enumerator<Index, WandType>::type;
 
     enum_type docs_enum;
     wdata_enum w;
     float q_weight;
-    term_scorer_t scorer;
+    TermScorer scorer;
     float max_weight;
 };
 
@@ -26,18 +56,43 @@ template <typename Index, typename WandType, typename Scorer>
     auto terms = query.terms;
     auto query_term_freqs = query_freqs(terms);
 
-    std::vector<block_max_scored_cursor<Index, WandType>> cursors;
+    using cursor_type =
+        block_max_scored_cursor<Index, WandType, typename Scorer::term_scorer_type>;
+    std::vector<cursor_type> cursors;
     cursors.reserve(query_term_freqs.size());
     std::transform(
         query_term_freqs.begin(), query_term_freqs.end(), std::back_inserter(cursors), [&](auto&& term) {
             auto list = index[term.first];
-            auto w_enum = wdata.getenum(term.first);
+            auto w_enum =
+                detail::block_max_enumerator<Index, WandType>::get(list, wdata, term.first);
             float q_weight = term.second;
             auto max_weight = q_weight * wdata.max_term_weight(term.first);
-            return block_max_scored_cursor<Index, WandType>{
-                std::move(list), w_enum, q_weight, scorer.term_scorer(term.first), max_weight};
+            return cursor_type{
+                std::move(list), w_enum, q_weight, scorer.typed_term_scorer(term.first), max_weight};
         });
     return cursors;
 }
 
+/// Same as above, but builds the cursors in `context.cursors` (see `QueryContext`),
+/// reusing its memory.
+template <typename Index, typename WandType, typename Scorer, typename Context>
+auto make_block_max_scored_cursors(
+    Index const& index,
+    WandType const& wdata,
+    Scorer const& scorer,
+    Query const& query,
+    Context& context) -> decltype(context.cursors)&
+{
+    context.cursors.clear();
+    for (auto&& [term, freq]: context.query_freqs(query)) {
+        float q_weight = freq;
+        auto max_weight = q_weight * wdata.max_term_weight(term);
+        auto list = index[term];
+        auto w_enum = detail::block_max_enumerator<Index, WandType>::get(list, wdata, term);
+        context.cursors.push_back(
+            {std::move(list), w_enum, q_weight, scorer.typed_term_scorer(term), max_weight});
+    }
+    return context.cursors;
+}
+
 }  // namespace pisa
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "impact_ordered_index.hpp"
+#include "query/queries.hpp"
+
+namespace pisa {
+
+/// Impact segments of a query term, along with the frequency of the term in the query,
+/// by which its impacts are multiplied, as scored cursors do with their scores.
+struct impact_cursor {
+    impact_ordered_index::segment_list segments;
+    uint32_t q_weight;
+};
+
+/// Returns the impact segments of each distinct query term.
+[[nodiscard]] inline auto make_impact_cursors(impact_ordered_index const& index, Query query)
+{
+    auto terms = query.terms;
+    auto query_term_freqs = query_freqs(terms);
+
+    std::vector<impact_cursor> cursors;
+    cursors.reserve(query_term_freqs.size());
+    std::transform(
+        query_term_freqs.begin(),
+        query_term_freqs.end(),
+        std::back_inserter(cursors),
+        [&](auto&& term) {
+            return impact_cursor{index[term.first], static_cast<uint32_t>(term.second)};
+        });
+    return cursors;
+}
+
+/// Same as above, but builds the cursors in `context.cursors` (see `QueryContext`),
+/// reusing its memory.
+template <typename Context>
+auto make_impact_cursors(impact_ordered_index const& index, Query const& query, Context& context)
+    -> decltype(context.cursors)&
+{
+    context.cursors.clear();
+    for (auto&& [term, freq]: context.query_freqs(query)) {
+        context.cursors.push_back({index[term], static_cast<uint32_t>(freq)});
+    }
+    return context.cursors;
+}
+
+}  // namespace pisa
@@ -7,12 +7,12 @@
 
 namespace pisa {
 
-template <typename Index>
+template <typename Index, typename TermScorer = term_scorer_t>
 struct max_scored_cursor {
     using enum_type = typename Index::document_enumerator;
     enum_type docs_enum;
     float q_weight;
-    term_scorer_t scorer;
+    TermScorer scorer;
     float max_weight;
 };
 
@@ -23,17 +23,38 @@ make_max_scored_cursors(Index const& index, WandType const& wdata, Scorer const&
     auto terms = query.terms;
     auto query_term_freqs = query_freqs(terms);
 
-    std::vector<max_scored_cursor<Index>> cursors;
+    using cursor_type = max_scored_cursor<Index, typename Scorer::term_scorer_type>;
+    std::vector<cursor_type> cursors;
     cursors.reserve(query_term_freqs.size());
     std::transform(
         query_term_freqs.begin(), query_term_freqs.end(), std::back_inserter(cursors), [&](auto&& term) {
             auto list = index[term.first];
             float q_weight = term.second;
             auto max_weight = q_weight * wdata.max_term_weight(term.first);
-            return max_scored_cursor<Index>{
-                std::move(list), q_weight, scorer.term_scorer(term.first), max_weight};
+            return cursor_type{
+                std::move(list), q_weight, scorer.typed_term_scorer(term.first), max_weight};
         });
     return cursors;
 }
 
+/// Same as above, but builds the cursors in `context.cursors` (see `QueryContext`),
+/// reusing its memory.
+template <typename Index, typename WandType, typename Scorer, typename Context>
+auto make_max_scored_cursors(
+    Index const& index,
+    WandType const& wdata,
+    Scorer const& scorer,
+    Query const& query,
+    Context& context) -> decltype(context.cursors)&
+{
+    context.cursors.clear();
+    for (auto&& [term, freq]: context.query_freqs(query)) {
+        float q_weight = freq;
+        auto max_weight = q_weight * wdata.max_term_weight(term);
+        context.cursors.push_back(
+            {index[term], q_weight, scorer.typed_term_scorer(term), max_weight});
+    }
+    return context.cursors;
+}
+
 }  // namespace pisa
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "cursor/block_max_scored_cursor.hpp"
+#include "cursor/scored_cursor.hpp"
+#include "pair_index.hpp"
+#include "query/queries.hpp"
+
+namespace pisa {
+
+/// Scores the postings of a single term or, if `second` is set, the postings of a pair list
+/// (see `pair_index`), whose packed frequencies are split between the scorers of both terms.
+template <typename TermScorer>
+struct pair_term_scorer {
+    TermScorer first;
+    std::optional<TermScorer> second;
+
+    float operator()(uint32_t doc, uint32_t freq) const
+    {
+        if (!second) {
+            return first(doc, freq);
+        }
+        auto [first_freq, second_freq] = unpack_freqs(freq);
+        return first(doc, first_freq) + (*second)(doc, second_freq);
+    }
+};
+
+namespace detail {
+
+    /// Calls `on_pair(pair)` for disjoint pairs of query terms stored in `pairs`, selected
+    /// greedily from the shortest pair list, and `on_term(term, freq)` for the other terms.
+    /// Repeated terms are never part of a pair, since the scores of pair lists do not account
+    /// for the query term frequencies.
+    template <typename PairIndex, typename PairFn, typename TermFn>
+    void for_each_pair_or_term(
+        PairIndex const& pairs, term_freq_vec const& term_freqs, PairFn on_pair, TermFn on_term)
+    {
+        // Buffers are reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<std::tuple<uint64_t, uint64_t, size_t, size_t>> candidates;
+        thread_local std::vector<bool> paired;
+        candidates.clear();
+        for (size_t i = 0; i < term_freqs.size(); ++i) {
+            for (size_t j = i + 1; j < term_freqs.size(); ++j) {
+                if (term_freqs[i].second != 1 || term_freqs[j].second != 1) {
+                    continue;
+                }
+                if (auto pair = pairs.find(term_freqs[i].first, term_freqs[j].first); pair) {
+                    candidates.emplace_back(pairs[*pair].size(), *pair, i, j);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        paired.assign(term_freqs.size(), false);
+        for (auto [size, pair, i, j]: candidates) {
+            if (!paired[i] && !paired[j]) {
+                paired[i] = true;
+                paired[j] = true;
+                on_pair(pair);
+            }
+        }
+        for (size_t i = 0; i < term_freqs.size(); ++i) {
+            if (!paired[i]) {
+                on_term(term_freqs[i].first, term_freqs[i].second);
+            }
+        }
+    }
+
+}  // namespace detail
+
+/// Same as `make_scored_cursors`, but replaces the cursors of two terms with a single cursor
+/// over their intersection whenever `pairs` stores it.
+template <typename Index, typename Scorer, typename Context>
+auto make_pair_scored_cursors(
+    Index const& index,
+    pair_index<Index> const& pairs,
+    Scorer const& scorer,
+    Query const& query,
+    Context& context) -> decltype(context.cursors)&
+{
+    context.cursors.clear();
+    detail::for_each_pair_or_term(
+        pairs,
+        context.query_freqs(query),
+        [&](uint64_t pair) {
+            auto [first, second] = pairs.terms(pair);
+            context.cursors.push_back(
+                {pairs[pair],
+                 1.0F,
+                 {scorer.typed_term_scorer(first), scorer.typed_term_scorer(second)}});
+        },
+        [&](term_id_type term, uint64_t freq) {
+            context.cursors.push_back(
+                {index[term], float(freq), {scorer.typed_term_scorer(term), std::nullopt}});
+        });
+    return context.cursors;
+}
+
+/// Same as `make_block_max_scored_cursors`, but replaces the cursors of two terms with a single
+/// cursor over their intersection whenever `pairs` stores it, using the block-max scores of
+/// the pair list. Requires block-max scores in the layout of `wand_data_raw`.
+template <typename Index, typename WandType, typename Scorer, typename Context>
+auto make_pair_block_max_scored_cursors(
+    Index const& index,
+    pair_index<Index> const& pairs,
+    WandType const& wdata,
+    Scorer const& scorer,
+    Query const& query,
+    Context& context) -> decltype(context.cursors)&
+{
+    using block_max_enumerator = detail::block_max_enumerator<Index, WandType>;
+    static_assert(
+        std::is_same_v<typename block_max_enumerator::type,
+                       typename pair_index<Index>::block_max_enumerator>,
+        "Pair lists can only replace cursors using raw WAND data");
+    context.cursors.clear();
+    detail::for_each_pair_or_term(
+        pairs,
+        context.query_freqs(query),
+        [&](uint64_t pair) {
+            auto [first, second] = pairs.terms(pair);
+            context.cursors.push_back(
+                {pairs[pair],
+                 pairs.block_max(pair),
+                 1.0F,
+                 {scorer.typed_term_scorer(first), scorer.typed_term_scorer(second)},
+                 pairs.max_score(pair)});
+        },
+        [&](term_id_type term, uint64_t freq) {
+            float q_weight = freq;
+            auto list = index[term];
+            auto w_enum = block_max_enumerator::get(list, wdata, term);
+            context.cursors.push_back(
+                {std::move(list),
+                 w_enum,
+                 q_weight,
+                 {scorer.typed_term_scorer(term), std::nullopt},
+                 q_weight * wdata.max_term_weight(term)});
+        });
+    return context.cursors;
+}
+
+}  // namespace pisa
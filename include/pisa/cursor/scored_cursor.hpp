@@ -7,12 +7,12 @@
 
 namespace pisa {
 
-template <typename Index>
+template <typename Index, typename TermScorer = term_scorer_t>
 struct scored_cursor {
     using enum_type = typename Index::document_enumerator;
     enum_type docs_enum;
     float q_weight;
-    term_scorer_t scorer;
+    TermScorer scorer;
 };
 
 template <typename Index, typename Scorer>
@@ -21,15 +21,30 @@ template <typename Index, typename Scorer>
     auto terms = query.terms;
     auto query_term_freqs = query_freqs(terms);
 
-    std::vector<scored_cursor<Index>> cursors;
+    using cursor_type = scored_cursor<Index, typename Scorer::term_scorer_type>;
+    std::vector<cursor_type> cursors;
     cursors.reserve(query_term_freqs.size());
     std::transform(
         query_term_freqs.begin(), query_term_freqs.end(), std::back_inserter(cursors), [&](auto&& term) {
             auto list = index[term.first];
             float q_weight = term.second;
-            return scored_cursor<Index>{std::move(list), q_weight, scorer.term_scorer(term.first)};
+            return cursor_type{std::move(list), q_weight, scorer.typed_term_scorer(term.first)};
         });
     return cursors;
 }
 
+/// Same as above, but builds the cursors in `context.cursors` (see `QueryContext`),
+/// reusing its memory.
+template <typename Index, typename Scorer, typename Context>
+auto make_scored_cursors(
+    Index const& index, Scorer const& scorer, Query const& query, Context& context)
+    -> decltype(context.cursors)&
+{
+    context.cursors.clear();
+    for (auto&& [term, freq]: context.query_freqs(query)) {
+        context.cursors.push_back({index[term], float(freq), scorer.typed_term_scorer(term)});
+    }
+    return context.cursors;
+}
+
 }  // namespace pisa
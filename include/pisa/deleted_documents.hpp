@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <fmt/format.h>
+#include <mio/mmap.hpp>
+
+#include "bit_vector.hpp"
+#include "mappable/mapper.hpp"
+#include "util/broadword.hpp"
+#include "util/likely.hpp"
+
+namespace pisa {
+
+/// Documents taken down from an index without rebuilding it.
+///
+/// Deletions are stored as a `bit_vector` with one bit per document, set for deleted documents,
+/// and frozen with `mapper::freeze` (see the `delete_documents` tool). It is memory-mapped next
+/// to the index at load time and passed to `topk_queue`. Document-at-a-time algorithms skip the
+/// documents deleted in its bit vector (see `topk_queue::deleted`) before scoring them, and the
+/// queue drops those that other algorithms score before inserting them. The scores of the
+/// remaining documents do not change, so the upper bounds of the WAND data and the block-max
+/// scores remain safe. WAND data can be rebuilt with lower bounds for lists with many deletions
+/// (see `wand_data`), which then must not be undeleted.
+class Deleted_Documents {
+  public:
+    /// Maps the deleted documents of an index of `num_docs` documents from `filename`.
+    Deleted_Documents(std::string const& filename, std::uint64_t num_docs)
+        : m_source(filename.c_str())
+    {
+        mapper::map(m_deleted, m_source);
+        if (m_deleted.size() != num_docs) {
+            throw std::invalid_argument(fmt::format(
+                "Deleted documents of {} documents but the index has {}",
+                m_deleted.size(),
+                num_docs));
+        }
+    }
+
+    [[nodiscard]] auto bits() const noexcept -> bit_vector const& { return m_deleted; }
+
+  private:
+    mio::mmap_source m_source;
+    bit_vector m_deleted;
+};
+
+/// Returns whether `docid` is deleted, where `deleted` is null if no document is.
+[[nodiscard]] inline auto is_deleted(bit_vector const* deleted, std::uint64_t docid) -> bool
+{
+    return PISA_UNLIKELY(deleted != nullptr) && (*deleted)[docid];
+}
+
+/// Returns the number of deleted documents.
+[[nodiscard]] inline auto deleted_count(bit_vector const& deleted) -> std::uint64_t
+{
+    std::uint64_t count = 0;
+    for (auto word: deleted.data()) {
+        count += broadword::popcount(word);
+    }
+    return count;
+}
+
+/// Returns the fraction of the documents of a posting list that are deleted.
+template <typename Docs>
+[[nodiscard]] auto deleted_fraction(bit_vector const& deleted, Docs const& docs) -> double
+{
+    if (docs.size() == 0) {
+        return 0.0;
+    }
+    std::uint64_t count = 0;
+    for (auto docid: docs) {
+        count += deleted[docid] ? 1 : 0;
+    }
+    return static_cast<double>(count) / docs.size();
+}
+
+}  // namespace pisa
@@ -1,12 +1,21 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <gsl/span>
+#include <mio/mmap.hpp>
+
 #include "binary_collection.hpp"
 #include "codec/block_codecs.hpp"
 #include "codec/varintgb.hpp"
+#include "mappable/mappable_vector.hpp"
+#include "mappable/mapper.hpp"
 #include "util/progress.hpp"
 
 namespace pisa {
@@ -17,60 +26,64 @@ using id_type = std::uint32_t;
 //!
 //! The documents IDs are assumed to be consecutive numbers [0, N), where N is the collection size.
 //! Each entry contains an encoded list of terms for the given document.
-class forward_index: public std::vector<std::vector<std::uint8_t>> {
+//!
+//! Entries are concatenated in a single payload, delimited by an array of offsets, so that the
+//! index is written with `mapper::freeze` and memory-mapped by `read`: a collection larger than
+//! RAM is paged in on demand, and loading it does not allocate one buffer per document.
+class forward_index {
   public:
     using id_type = uint32_t;
-    using entry_type = std::vector<std::uint8_t>;
 
-    //! Initializes a new forward index with empty containers.
-    forward_index(size_t document_count, size_t term_count, bool compressed = true)
-        : std::vector<entry_type>(document_count),
-          m_term_count(term_count),
-          m_term_counts(document_count),
-          m_compressed(compressed)
-    {}
+    //! Identifies flat forward indexes, stored right after the flags of `mapper::freeze`.
+    static constexpr std::uint64_t magic = 0x3144574641534950ULL;  // "PISAFWD1"
+    //! Bytes past the last entry, which VarIntGB decoding may read.
+    static constexpr std::size_t padding = 8;
 
-    const std::size_t& term_count() const { return m_term_count; }
-    const std::size_t& term_count(id_type document) const { return m_term_counts[document]; }
+    forward_index() = default;
+    forward_index(forward_index const&) = delete;
+    forward_index& operator=(forward_index const&) = delete;
+    forward_index(forward_index&& other) noexcept { swap(other); }
+    forward_index& operator=(forward_index&& other) noexcept
+    {
+        forward_index(std::move(other)).swap(*this);
+        return *this;
+    }
+    ~forward_index() = default;
 
-    //! Compresses each document in `fwd` with a faster codec.
-    static forward_index read(const std::string& input_file)
+    void swap(forward_index& other) noexcept
     {
-        std::ifstream in(input_file.c_str());
-        bool compressed;
-        size_t term_count, docs_count;
-        in.read(reinterpret_cast<char*>(&compressed), sizeof(compressed));
-        in.read(reinterpret_cast<char*>(&term_count), sizeof(term_count));
-        in.read(reinterpret_cast<char*>(&docs_count), sizeof(docs_count));
-        forward_index fwd(docs_count, term_count, compressed);
-        for (id_type doc = 0; doc < docs_count; ++doc) {
-            size_t block_size;
-            in.read(reinterpret_cast<char*>(&term_count), sizeof(term_count));
-            in.read(reinterpret_cast<char*>(&block_size), sizeof(block_size));
-            fwd.m_term_counts[doc] = term_count;
-            fwd[doc].resize(block_size);
-            in.read(reinterpret_cast<char*>(fwd[doc].data()), block_size);
-        }
-        return fwd;
+        std::swap(m_magic, other.m_magic);
+        std::swap(m_compressed, other.m_compressed);
+        std::swap(m_term_count, other.m_term_count);
+        m_offsets.swap(other.m_offsets);
+        m_term_counts.swap(other.m_term_counts);
+        m_payload.swap(other.m_payload);
+        m_source.swap(other.m_source);
+    }
+
+    std::size_t size() const { return m_term_counts.size(); }
+    std::size_t term_count() const { return m_term_count; }
+    std::size_t term_count(id_type document) const { return m_term_counts[document]; }
+
+    //! Returns the encoded list of terms of a given document.
+    gsl::span<std::uint8_t const> encoded_terms(id_type document) const
+    {
+        return gsl::make_span(
+            m_payload.data() + m_offsets[document],
+            m_offsets[document + 1] - m_offsets[document]);
     }
 
-    static forward_index& compress(forward_index& fwd)
+    //! Reads a forward index, memory-mapping it unless it was written before entries were
+    //! concatenated, in which case it is loaded in memory.
+    static forward_index read(const std::string& input_file)
     {
-        progress p("Compressing forward index", fwd.size());
-        for (id_type doc = 0u; doc < fwd.size(); ++doc) {
-            auto& encoded_terms = fwd[doc];
-            std::vector<id_type> terms(encoded_terms.size() * 5);
-            std::size_t n = 0;
-            TightVariableByte::decode(encoded_terms.data(), terms.data(), encoded_terms.size(), n);
-            fwd.m_term_counts[doc] = n;
-            encoded_terms.clear();
-            encoded_terms.resize(2 * n * sizeof(id_type));
-            VarIntGB<false> varintgb_codec;
-            std::size_t byte_size = varintgb_codec.encodeArray(terms.data(), n, encoded_terms.data());
-            encoded_terms.resize(byte_size);
-            encoded_terms.shrink_to_fit();
-            p.update(1);
+        mio::mmap_source source(input_file.c_str());
+        if (not is_flat(source)) {
+            return read_entries(input_file);
         }
+        forward_index fwd;
+        fwd.m_source = std::move(source);
+        mapper::map(fwd, fwd.m_source);
         return fwd;
     }
 
@@ -86,7 +99,8 @@ class forward_index: public std::vector<std::vector<std::uint8_t>> {
         auto num_docs = *firstseq.begin();
         auto num_terms = std::distance(++coll.begin(), coll.end());
 
-        forward_index fwd(num_docs, num_terms, use_compression);
+        std::vector<std::vector<std::uint8_t>> entries(num_docs);
+        std::vector<std::uint32_t> term_counts(num_docs, 0U);
         {
             progress p("Building forward index", num_terms);
             id_type tid = 0;
@@ -94,63 +108,166 @@ class forward_index: public std::vector<std::vector<std::uint8_t>> {
             for (auto it = ++coll.begin(); it != coll.end(); ++it) {
                 for (const auto& d: *it) {
                     if (it->size() >= min_len) {
-                        TightVariableByte::encode_single(tid - prev[d], fwd[d]);
+                        TightVariableByte::encode_single(tid - prev[d], entries[d]);
                         prev[d] = tid;
-                        fwd.m_term_counts[d]++;
+                        term_counts[d]++;
                     }
                 }
                 p.update(1);
                 ++tid;
             }
         }
+
+        Builder builder(num_terms, use_compression);
+        std::unique_ptr<progress> p;
         if (use_compression) {
-            compress(fwd);
+            p = std::make_unique<progress>("Compressing forward index", num_docs);
         }
-
-        return fwd;
+        std::vector<id_type> gaps;
+        for (id_type doc = 0u; doc < num_docs; ++doc) {
+            auto& entry = entries[doc];
+            if (use_compression) {
+                gaps.resize(term_counts[doc]);
+                std::size_t n = 0;
+                TightVariableByte::decode(entry.data(), gaps.data(), entry.size(), n);
+                builder.add_terms(gaps);
+                p->update(1);
+            } else {
+                builder.add_entry(entry, term_counts[doc]);
+            }
+            std::vector<std::uint8_t>().swap(entry);
+        }
+        return builder.build();
     }
 
-    static void write(const forward_index& fwd, const std::string& output_file)
+    static void write(forward_index& fwd, const std::string& output_file)
     {
-        std::ofstream out(output_file.c_str());
-        size_t size = fwd.size();
-        out.write(reinterpret_cast<const char*>(&fwd.m_compressed), sizeof(fwd.m_compressed));
-        out.write(reinterpret_cast<const char*>(&fwd.m_term_count), sizeof(fwd.m_term_count));
-        out.write(reinterpret_cast<const char*>(&size), sizeof(size));
-        for (id_type doc = 0; doc < fwd.size(); ++doc) {
-            size = fwd[doc].size();
-            out.write(
-                reinterpret_cast<const char*>(&fwd.m_term_counts[doc]),
-                sizeof(fwd.m_term_counts[doc]));
-            out.write(reinterpret_cast<const char*>(&size), sizeof(size));
-            out.write(reinterpret_cast<const char*>(fwd[doc].data()), size);
-        }
+        mapper::freeze(fwd, output_file.c_str());
     }
 
-    //! Decodes and returns the list of terms for a given document.
-    std::vector<id_type> terms(id_type document) const
+    //! Decodes the list of terms for a given document into `terms`.
+    void terms(id_type document, std::vector<id_type>& terms) const
     {
-        const entry_type& encoded_terms = (*this)[document];
-        std::vector<uint32_t> terms;
-        if (m_compressed) {
-            std::size_t term_count = m_term_counts[document];
-            terms.resize(term_count);
+        auto encoded_terms = this->encoded_terms(document);
+        std::size_t term_count = m_term_counts[document];
+        terms.resize(term_count);
+        if (m_compressed != 0U) {
             VarIntGB<true> varintgb_codec;
             varintgb_codec.decodeArray(encoded_terms.data(), term_count, terms.data());
         } else {
-            terms.resize(encoded_terms.size() * 5);
             size_t n = 0;
             TightVariableByte::decode(encoded_terms.data(), terms.data(), encoded_terms.size(), n);
-            terms.resize(n);
-            terms.shrink_to_fit();
         }
+    }
+
+    //! Decodes and returns the list of terms for a given document.
+    std::vector<id_type> terms(id_type document) const
+    {
+        std::vector<id_type> terms;
+        this->terms(document, terms);
         return terms;
     }
 
+    template <typename Visitor>
+    void map(Visitor& visit)
+    {
+        visit(m_magic, "m_magic")(m_compressed, "m_compressed")(m_term_count, "m_term_count")(
+            m_offsets, "m_offsets")(m_term_counts, "m_term_counts")(m_payload, "m_payload");
+        if (m_magic != magic) {
+            throw std::runtime_error("Not a flat forward index");
+        }
+    }
+
   private:
-    std::size_t m_term_count;
-    std::vector<std::size_t> m_term_counts;
-    bool m_compressed;
+    //! Appends entries to the payload of a new forward index.
+    class Builder {
+      public:
+        Builder(std::size_t term_count, bool compressed)
+            : m_term_count(term_count), m_compressed(compressed), m_offsets{0}
+        {}
+
+        //! Appends an entry of `term_count` terms encoded as by `from_inverted_index`.
+        void add_entry(gsl::span<std::uint8_t const> entry, std::uint32_t term_count)
+        {
+            m_payload.insert(m_payload.end(), entry.begin(), entry.end());
+            m_offsets.push_back(m_payload.size());
+            m_term_counts.push_back(term_count);
+        }
+
+        //! Compresses and appends an entry of terms given as gaps.
+        void add_terms(std::vector<id_type> const& gaps)
+        {
+            auto offset = m_payload.size();
+            m_payload.resize(offset + 2 * gaps.size() * sizeof(id_type));
+            VarIntGB<false> varintgb_codec;
+            auto byte_size =
+                varintgb_codec.encodeArray(gaps.data(), gaps.size(), m_payload.data() + offset);
+            m_payload.resize(offset + byte_size);
+            m_offsets.push_back(m_payload.size());
+            m_term_counts.push_back(gaps.size());
+        }
+
+        forward_index build()
+        {
+            forward_index fwd;
+            fwd.m_compressed = m_compressed ? 1U : 0U;
+            fwd.m_term_count = m_term_count;
+            m_payload.resize(m_payload.size() + padding, 0U);
+            m_payload.shrink_to_fit();
+            fwd.m_offsets.steal(m_offsets);
+            fwd.m_term_counts.steal(m_term_counts);
+            fwd.m_payload.steal(m_payload);
+            return fwd;
+        }
+
+      private:
+        std::size_t m_term_count;
+        bool m_compressed;
+        std::vector<std::uint64_t> m_offsets;
+        std::vector<std::uint32_t> m_term_counts;
+        std::vector<std::uint8_t> m_payload;
+    };
+
+    [[nodiscard]] static bool is_flat(mio::mmap_source const& source)
+    {
+        std::uint64_t header[2];
+        if (source.size() < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(header, source.data(), sizeof(header));
+        return header[1] == magic;
+    }
+
+    //! Reads a forward index written with a header for each entry.
+    static forward_index read_entries(const std::string& input_file)
+    {
+        std::ifstream in(input_file.c_str());
+        bool compressed;
+        size_t term_count, docs_count;
+        in.read(reinterpret_cast<char*>(&compressed), sizeof(compressed));
+        in.read(reinterpret_cast<char*>(&term_count), sizeof(term_count));
+        in.read(reinterpret_cast<char*>(&docs_count), sizeof(docs_count));
+        Builder builder(term_count, compressed);
+        std::vector<std::uint8_t> entry;
+        for (id_type doc = 0; doc < docs_count; ++doc) {
+            size_t block_size;
+            in.read(reinterpret_cast<char*>(&term_count), sizeof(term_count));
+            in.read(reinterpret_cast<char*>(&block_size), sizeof(block_size));
+            entry.resize(block_size);
+            in.read(reinterpret_cast<char*>(entry.data()), block_size);
+            builder.add_entry(entry, term_count);
+        }
+        return builder.build();
+    }
+
+    std::uint64_t m_magic = magic;
+    std::uint64_t m_compressed = 1;
+    std::uint64_t m_term_count = 0;
+    //! The entry of document `d` spans `[m_offsets[d], m_offsets[d + 1])` of the payload.
+    mapper::mappable_vector<std::uint64_t> m_offsets;
+    mapper::mappable_vector<std::uint32_t> m_term_counts;
+    mapper::mappable_vector<std::uint8_t> m_payload;
+    mio::mmap_source m_source;
 };
 
 }  // namespace pisa
@@ -9,6 +9,7 @@
 #include <sstream>
 #include <stack>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -55,14 +56,22 @@ struct Document_Record {
 
 using process_term_function_type = std::function<std::string(std::string&&)>;
 using process_content_function_type =
-    std::function<void(std::string&&, std::function<void(std::string&&)>)>;
+    std::function<void(std::string&&, std::function<void(std::string_view)>)>;
 
-void parse_plaintext_content(std::string&& content, std::function<void(std::string&&)> process)
+/// Calls `process` with each whitespace-separated term of `content`. Terms are views into
+/// `content`, valid only during the call.
+void parse_plaintext_content(std::string&& content, std::function<void(std::string_view)> process)
 {
-    std::istringstream content_stream(content);
-    std::string term;
-    while (content_stream >> term) {
-        process(std::move(term));
+    auto is_space = [](unsigned char ch) { return std::isspace(ch) != 0; };
+    auto pos = content.begin();
+    while (true) {
+        pos = std::find_if_not(pos, content.end(), is_space);
+        if (pos == content.end()) {
+            break;
+        }
+        auto term_end = std::find_if(pos, content.end(), is_space);
+        process(std::string_view(&*pos, std::distance(pos, term_end)));
+        pos = term_end;
     }
 }
 
@@ -76,9 +85,14 @@ void parse_plaintext_content(std::string&& content, std::function<void(std::stri
     return std::string_view(&*start, 4) == "HTTP"sv;
 }
 
-void parse_html_content(std::string&& content, std::function<void(std::string&&)> process)
+/// Parses the terms of an HTML page, possibly preceded by HTTP headers, with `parser`.
+/// Terms passed to `process` are valid only during the call.
+void parse_html_content(
+    std::string&& content,
+    std::function<void(std::string_view)> process,
+    parsing::html::Html_Parser parser = parsing::html::Html_Parser::gumbo)
 {
-    content = parsing::html::cleantext([&]() {
+    auto html = [&]() {
         auto pos = content.begin();
         if (is_http(content)) {
             while (pos != content.end()) {
@@ -93,12 +107,19 @@ void parse_html_content(std::string&& content, std::function<void(std::string&&)
             return ""sv;
         }
         return std::string_view(content);
-    }());
-    if (content.empty()) {
+    }();
+    if (html.empty()) {
         return;
     }
-    TermTokenizer tokenizer(content);
-    std::for_each(tokenizer.begin(), tokenizer.end(), process);
+    thread_local parsing::html::Text_Extractor gumbo_extractor(parsing::html::Html_Parser::gumbo);
+    thread_local parsing::html::Text_Extractor fast_extractor(parsing::html::Html_Parser::fast);
+    thread_local Tokenizer tokenizer;
+    auto& extractor = parser == parsing::html::Html_Parser::fast ? fast_extractor : gumbo_extractor;
+    extractor.extract(html, [&](std::string_view run) {
+        for (auto term: tokenizer.tokenize(run)) {
+            process(term);
+        }
+    });
 }
 
 class Forward_Index_Builder {
@@ -153,6 +174,9 @@ class Forward_Index_Builder {
         write_header(os, bp.records.size());
 
         std::map<std::string, uint32_t> map;
+        // Terms are processed in this buffer, whose capacity is reused from term to term, and
+        // copied into `map` only when they are new.
+        std::string buffer;
 
         for (auto&& record: bp.records) {
             title_os << record.title() << '\n';
@@ -160,15 +184,16 @@ class Forward_Index_Builder {
 
             std::vector<uint32_t> term_ids;
 
-            auto process = [&](auto&& term) {
-                term = process_term(std::move(term));
+            auto process = [&](std::string_view term) {
+                buffer.assign(term.data(), term.size());
+                buffer = process_term(std::move(buffer));
                 uint32_t id = 0;
-                if (auto pos = map.find(term); pos != map.end()) {
+                if (auto pos = map.find(buffer); pos != map.end()) {
                     id = pos->second;
                 } else {
                     id = map.size();
-                    map[term] = id;
-                    term_os << term << '\n';
+                    map.emplace(buffer, id);
+                    term_os << buffer << '\n';
                 }
                 term_ids.push_back(id);
             };
@@ -6,6 +6,7 @@
 #include "codec/compact_elias_fano.hpp"
 #include "codec/integer_codes.hpp"
 #include "global_parameters.hpp"
+#include "util/query_counters.hpp"
 
 namespace pisa {
 
@@ -77,6 +78,7 @@ class freq_index {
 
         void PISA_FLATTEN_FUNC next()
         {
+            PISA_QUERY_COUNT(postings, 1);
             auto val = m_docs_enum.next();
             m_cur_pos = val.first;
             m_cur_docid = val.second;
@@ -84,6 +86,9 @@ class freq_index {
 
         void PISA_FLATTEN_FUNC next_geq(uint64_t lower_bound)
         {
+            PISA_QUERY_COUNT(next_geq, 1);
+            // Only the posting landed on is decoded, and none if the cursor does not move.
+            PISA_QUERY_COUNT(postings, lower_bound > m_cur_docid ? 1 : 0);
             auto val = m_docs_enum.next_geq(lower_bound);
             m_cur_pos = val.first;
             m_cur_docid = val.second;
@@ -91,6 +96,7 @@ class freq_index {
 
         void PISA_FLATTEN_FUNC move(uint64_t position)
         {
+            PISA_QUERY_COUNT(postings, position != m_cur_pos ? 1 : 0);
             auto val = m_docs_enum.move(position);
             m_cur_pos = val.first;
             m_cur_docid = val.second;
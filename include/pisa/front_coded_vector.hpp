@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+#include <gsl/span>
+
+#include "payload_vector.hpp"
+#include "util/intrinsics.hpp"
+
+namespace pisa {
+
+namespace detail {
+
+    inline void write_varint(std::uint64_t value, std::vector<std::byte>& out)
+    {
+        while (value >= 128U) {
+            out.push_back(static_cast<std::byte>((value & 127U) | 128U));
+            value >>= 7U;
+        }
+        out.push_back(static_cast<std::byte>(value));
+    }
+
+    [[nodiscard]] inline auto read_varint(std::byte const*& pos) -> std::uint64_t
+    {
+        std::uint64_t value = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            auto byte = static_cast<std::uint64_t>(*pos++);
+            value |= (byte & 127U) << shift;
+            if (byte < 128U) {
+                return value;
+            }
+        }
+    }
+
+    /// Returns the length of the longest common prefix of `lhs` and `rhs`, both of size `n`,
+    /// comparing 16 bytes at a time with SSE2.
+    [[nodiscard]] inline auto common_prefix(char const* lhs, char const* rhs, std::size_t n)
+        -> std::size_t
+    {
+        std::size_t pos = 0;
+#if defined(__SSE2__)
+        for (; pos + 16 <= n; pos += 16) {
+            __m128i lhs_chars = _mm_loadu_si128(reinterpret_cast<__m128i const*>(lhs + pos));
+            __m128i rhs_chars = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rhs + pos));
+            auto equal = static_cast<std::uint32_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(lhs_chars, rhs_chars)));
+            if (equal != 0xFFFFU) {
+                return pos + __builtin_ctz(~equal);
+            }
+        }
+#endif
+        while (pos < n && lhs[pos] == rhs[pos]) {
+            ++pos;
+        }
+        return pos;
+    }
+
+}  // namespace detail
+
+/// Front-coded vector of strings, such as a term or document lexicon.
+///
+/// Strings are split into buckets of `bucket_size` consecutive strings. The first string of a
+/// bucket is stored in full, and each following one as the length of the prefix it shares with
+/// the previous string and the remaining suffix, all lengths as varints. Only the offset of each
+/// bucket is stored, instead of one per string as in `Payload_Vector`, which takes 8 bytes per
+/// string, and sorted lexicons, whose neighbours share long prefixes, shrink further.
+///
+/// Strings are decoded into `std::string`s: random access decodes up to `bucket_size` strings,
+/// and iteration decodes each string once. For sorted strings, `lower_bound` binary searches the
+/// first strings of the buckets, then scans one bucket by comparing suffixes with the searched
+/// string without decoding them.
+///
+/// The layout is a 64-bit magic number, the number of strings, the bucket size, the number of
+/// buckets, the `num_buckets + 1` bucket offsets into the data, all 64-bit, then the data.
+class Front_Coded_Vector {
+  public:
+    using size_type = std::uint64_t;
+    static constexpr std::uint64_t magic = 0x3156434641534950ULL;  // "PISAFCV1"
+    static constexpr std::uint64_t default_bucket_size = 16;
+
+    class Iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::string const*;
+        using reference = std::string const&;
+
+        Iterator(Front_Coded_Vector const* vector, size_type idx) : m_vector(vector), m_idx(idx)
+        {
+            if (m_idx < m_vector->size()) {
+                m_pos = m_vector->bucket(m_idx / m_vector->m_bucket_size);
+                decode();
+            }
+        }
+
+        [[nodiscard]] auto operator*() const -> reference { return m_current; }
+        [[nodiscard]] auto operator->() const -> pointer { return &m_current; }
+
+        auto operator++() -> Iterator&
+        {
+            if (++m_idx < m_vector->size()) {
+                decode();
+            }
+            return *this;
+        }
+
+        [[nodiscard]] auto operator++(int) -> Iterator
+        {
+            auto copy = *this;
+            ++(*this);
+            return copy;
+        }
+
+        [[nodiscard]] auto operator==(Iterator const& other) const -> bool
+        {
+            return m_idx == other.m_idx;
+        }
+        [[nodiscard]] auto operator!=(Iterator const& other) const -> bool
+        {
+            return m_idx != other.m_idx;
+        }
+
+      private:
+        void decode()
+        {
+            std::uint64_t prefix = 0;
+            if (m_idx % m_vector->m_bucket_size != 0) {
+                prefix = detail::read_varint(m_pos);
+            }
+            auto suffix = detail::read_varint(m_pos);
+            m_current.resize(prefix);
+            m_current.append(reinterpret_cast<char const*>(m_pos), suffix);
+            m_pos += suffix;
+        }
+
+        Front_Coded_Vector const* m_vector;
+        size_type m_idx;
+        std::byte const* m_pos = nullptr;
+        std::string m_current;
+    };
+
+    Front_Coded_Vector(
+        size_type size,
+        size_type bucket_size,
+        gsl::span<std::uint64_t const> offsets,
+        gsl::span<std::byte const> data)
+        : m_size(size), m_bucket_size(bucket_size), m_offsets(offsets), m_data(data)
+    {}
+
+    /// Returns whether `mem` holds a front-coded vector rather than a `Payload_Vector`.
+    [[nodiscard]] static auto is_front_coded(gsl::span<std::byte const> mem) -> bool
+    {
+        std::uint64_t header = 0;
+        if (mem.size() < static_cast<std::ptrdiff_t>(sizeof(header))) {
+            return false;
+        }
+        std::memcpy(&header, mem.data(), sizeof(header));
+        return header == magic;
+    }
+
+    template <typename ContiguousContainer>
+    [[nodiscard]] static auto from(ContiguousContainer&& mem) -> Front_Coded_Vector
+    {
+        return from(gsl::make_span(reinterpret_cast<std::byte const*>(mem.data()), mem.size()));
+    }
+
+    [[nodiscard]] static auto from(gsl::span<std::byte const> mem) -> Front_Coded_Vector
+    {
+        if (not is_front_coded(mem)) {
+            throw std::runtime_error("Not a front-coded vector");
+        }
+        auto [header_magic, size, bucket_size, num_buckets, tail] =
+            unpack_head<std::uint64_t, std::uint64_t, std::uint64_t, std::uint64_t>(mem);
+        (void)header_magic;
+        gsl::span<std::byte const> offsets, data;
+        try {
+            std::tie(offsets, data) = split(tail, (num_buckets + 1) * sizeof(std::uint64_t));
+        } catch (std::runtime_error const& err) {
+            throw std::runtime_error(
+                std::string("Failed to parse front-coded vector offsets: ") + err.what());
+        }
+        return Front_Coded_Vector(size, bucket_size, cast_span<std::uint64_t>(offsets), data);
+    }
+
+    /// Returns the string at `idx`.
+    [[nodiscard]] auto operator[](size_type idx) const -> std::string
+    {
+        if (idx >= m_size) {
+            throw std::out_of_range(fmt::format(
+                "Index {} too large for front-coded vector of size {}", idx, m_size));
+        }
+        std::byte const* pos = bucket(idx / m_bucket_size);
+        std::string value;
+        for (size_type entry = 0; entry <= idx % m_bucket_size; ++entry) {
+            std::uint64_t prefix = entry == 0 ? 0 : detail::read_varint(pos);
+            auto suffix = detail::read_varint(pos);
+            value.resize(prefix);
+            value.append(reinterpret_cast<char const*>(pos), suffix);
+            pos += suffix;
+        }
+        return value;
+    }
+
+    /// Returns the position of the first string not less than `value`, or `size()` if there is
+    /// none. Strings must be sorted.
+    [[nodiscard]] auto lower_bound(std::string_view value) const -> size_type
+    {
+        // Finds the first bucket whose head is greater than `value`, which is in the previous one.
+        size_type first = 0;
+        size_type last = m_offsets.size() - 1;
+        while (first < last) {
+            auto middle = first + (last - first) / 2;
+            if (head(middle) <= value) {
+                first = middle + 1;
+            } else {
+                last = middle;
+            }
+        }
+        return first == 0 ? 0 : scan(first - 1, value);
+    }
+
+    [[nodiscard]] auto size() const -> size_type { return m_size; }
+    [[nodiscard]] auto bucket_size() const -> size_type { return m_bucket_size; }
+    [[nodiscard]] auto begin() const -> Iterator { return Iterator(this, 0); }
+    [[nodiscard]] auto end() const -> Iterator { return Iterator(this, m_size); }
+
+  private:
+    [[nodiscard]] auto bucket(size_type bucket_idx) const -> std::byte const*
+    {
+        return m_data.data() + m_offsets[bucket_idx];
+    }
+
+    /// Returns the first string of a bucket, which is stored in full.
+    [[nodiscard]] auto head(size_type bucket_idx) const -> std::string_view
+    {
+        std::byte const* pos = bucket(bucket_idx);
+        auto length = detail::read_varint(pos);
+        return std::string_view(reinterpret_cast<char const*>(pos), length);
+    }
+
+    /// Returns the position of the first string not less than `value` in a bucket whose head is
+    /// not greater than `value`, or the position of the next bucket.
+    ///
+    /// Each string is compared with `value` through the length `matched` of the prefix that the
+    /// previous string, which is less than `value`, shares with it. A string sharing fewer than
+    /// `matched` characters with the previous one differs from `value` at a larger character, so
+    /// it is greater; a string sharing more is still less; and only a string sharing exactly
+    /// `matched` characters has its suffix compared.
+    [[nodiscard]] auto scan(size_type bucket_idx, std::string_view value) const -> size_type
+    {
+        std::byte const* pos = bucket(bucket_idx);
+        size_type idx = bucket_idx * m_bucket_size;
+        size_type last = std::min(idx + m_bucket_size, m_size);
+        std::uint64_t prefix = 0;
+        std::size_t matched = 0;
+        for (; idx < last; ++idx) {
+            if (idx % m_bucket_size != 0) {
+                prefix = detail::read_varint(pos);
+            }
+            auto suffix_length = detail::read_varint(pos);
+            auto suffix = reinterpret_cast<char const*>(pos);
+            pos += suffix_length;
+            if (prefix < matched) {
+                return idx;
+            }
+            if (prefix > matched) {
+                continue;
+            }
+            auto rest = value.substr(matched);
+            auto common = detail::common_prefix(
+                suffix, rest.data(), std::min<std::size_t>(suffix_length, rest.size()));
+            matched += common;
+            if (common == rest.size()
+                || (common < suffix_length
+                    && static_cast<unsigned char>(suffix[common])
+                        > static_cast<unsigned char>(rest[common]))) {
+                return idx;
+            }
+        }
+        return last;
+    }
+
+    size_type m_size;
+    size_type m_bucket_size;
+    gsl::span<std::uint64_t const> m_offsets;
+    gsl::span<std::byte const> m_data;
+};
+
+/// Encoded front-coded vector, to be written to a file and mapped as a `Front_Coded_Vector`.
+struct Front_Coded_Vector_Buffer {
+    std::vector<std::byte> bytes;
+
+    template <typename InputIterator>
+    [[nodiscard]] static auto make(
+        InputIterator first,
+        InputIterator last,
+        std::uint64_t bucket_size = Front_Coded_Vector::default_bucket_size)
+        -> Front_Coded_Vector_Buffer
+    {
+        if (bucket_size == 0) {
+            throw std::invalid_argument("Bucket size must be positive");
+        }
+        std::vector<std::uint64_t> offsets;
+        std::vector<std::byte> data;
+        std::uint64_t size = 0;
+        std::string previous;
+        for (; first != last; ++first, ++size) {
+            std::string_view value(*first);
+            std::size_t prefix = 0;
+            if (size % bucket_size == 0) {
+                offsets.push_back(data.size());
+            } else {
+                prefix = detail::common_prefix(
+                    previous.data(), value.data(), std::min(previous.size(), value.size()));
+                detail::write_varint(prefix, data);
+            }
+            detail::write_varint(value.size() - prefix, data);
+            std::transform(
+                value.begin() + prefix, value.end(), std::back_inserter(data), [](char ch) {
+                    return static_cast<std::byte>(ch);
+                });
+            previous.assign(value);
+        }
+        offsets.push_back(data.size());
+
+        Front_Coded_Vector_Buffer buffer;
+        auto write = [&](auto const* values, std::size_t count) {
+            auto bytes = reinterpret_cast<std::byte const*>(values);
+            buffer.bytes.insert(buffer.bytes.end(), bytes, bytes + count * sizeof(*values));
+        };
+        std::uint64_t header[] = {Front_Coded_Vector::magic, size, bucket_size, offsets.size() - 1};
+        write(header, 4);
+        write(offsets.data(), offsets.size());
+        write(data.data(), data.size());
+        return buffer;
+    }
+
+    void to_file(std::string const& filename) const
+    {
+        std::ofstream os(filename);
+        to_stream(os);
+    }
+
+    void to_stream(std::ostream& os) const
+    {
+        os.write(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+    }
+};
+
+template <typename InputIterator>
+auto encode_front_coded_vector(
+    InputIterator first,
+    InputIterator last,
+    std::uint64_t bucket_size = Front_Coded_Vector::default_bucket_size)
+{
+    return Front_Coded_Vector_Buffer::make(first, last, bucket_size);
+}
+
+inline auto encode_front_coded_vector(
+    gsl::span<std::string const> values,
+    std::uint64_t bucket_size = Front_Coded_Vector::default_bucket_size)
+{
+    return encode_front_coded_vector(values.begin(), values.end(), bucket_size);
+}
+
+}  // namespace pisa
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+#include <gsl/span>
+
+#include "mappable/mappable_vector.hpp"
+#include "util/likely.hpp"
+
+namespace pisa {
+
+namespace detail {
+
+    [[nodiscard]] constexpr auto mix64(std::uint64_t x) noexcept -> std::uint64_t
+    {
+        x = (x ^ (x >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27U)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31U);
+    }
+
+    /// Hashes a term eight bytes at a time.
+    [[nodiscard]] inline auto hash_term(std::string_view term, std::uint64_t seed) noexcept
+        -> std::uint64_t
+    {
+        std::uint64_t hash = seed ^ (term.size() * 0x9e3779b97f4a7c15ULL);
+        char const* pos = term.data();
+        char const* last = term.data() + term.size();
+        for (; pos + 8 <= last; pos += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, pos, 8);
+            hash = mix64(hash ^ word);
+        }
+        std::uint64_t word = 0;
+        if (pos != last) {
+            std::memcpy(&word, pos, last - pos);
+        }
+        return mix64(hash ^ word);
+    }
+
+    /// Maps `x` uniformly to `[0, n)`.
+    [[nodiscard]] constexpr auto fastrange(std::uint64_t x, std::uint64_t n) noexcept
+        -> std::uint64_t
+    {
+        return static_cast<std::uint64_t>((static_cast<unsigned __int128>(x) * n) >> 64U);
+    }
+
+}  // namespace detail
+
+/// Maps the terms of a lexicon to their IDs in constant time.
+///
+/// Terms are mapped to slots with a minimal perfect hash function built by hash and displace, as
+/// in PTHash: terms are split into buckets by hash, and each bucket stores the pilot, the
+/// smallest number that, mixed with the hash of each of its terms, sends them to free slots.
+/// Positions range over `num_terms / load_factor` slots, so that the last buckets still find free
+/// slots quickly; the few terms sent past the last slot are remapped to the slots left free.
+/// Each slot stores the ID of its term next to a 32-bit fingerprint of its hash, which rejects all
+/// but about one in four billion of the terms missing from the lexicon. Terms themselves are not
+/// stored.
+///
+/// A lookup reads one pilot and one slot, instead of the log2(V) string comparisons of a binary
+/// search over the terms, which on a memory-mapped lexicon are mostly cache misses.
+class Hash_Lexicon {
+  public:
+    /// Identifies hash lexicons, stored right after the flags of `mapper::freeze`.
+    static constexpr std::uint64_t magic = 0x3148584c41534950ULL;  // "PISALXH1"
+    /// Incremented whenever the layout changes; version 2 added the remapped slots.
+    static constexpr std::uint64_t version = 2;
+    static constexpr std::uint64_t average_bucket_size = 4;
+    static constexpr double load_factor = 0.98;
+    static constexpr std::uint64_t max_seeds = 16;
+    static constexpr std::uint32_t default_max_pilot = 1U << 24U;
+
+    Hash_Lexicon() = default;
+
+    /// Builds the hash function of `terms`, whose IDs are their positions. Throws
+    /// `std::invalid_argument` if a term occurs twice, and `std::runtime_error` if some bucket
+    /// has no pilot below `max_pilot` with any seed.
+    template <typename Terms>
+    explicit Hash_Lexicon(Terms const& terms, std::uint32_t max_pilot = default_max_pilot)
+    {
+        std::uint64_t num_terms = std::distance(std::begin(terms), std::end(terms));
+        if (num_terms > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::invalid_argument("Too many terms for a hash lexicon");
+        }
+        check_unique(terms);
+        std::vector<std::uint64_t> hashes;
+        hashes.reserve(num_terms);
+        auto status = Build_Status::built;
+        for (std::uint64_t seed = 0; seed < max_seeds; ++seed) {
+            m_seed = detail::mix64(seed);
+            hashes.clear();
+            for (auto const& term: terms) {
+                hashes.push_back(detail::hash_term(std::string_view(term), m_seed));
+            }
+            status = build(hashes, max_pilot);
+            if (status == Build_Status::built) {
+                return;
+            }
+        }
+        if (status == Build_Status::pilot_exhausted) {
+            throw std::runtime_error(fmt::format(
+                "Failed to build hash lexicon of {} terms: a bucket has no pilot below {}",
+                num_terms,
+                max_pilot));
+        }
+        throw std::runtime_error(fmt::format(
+            "Failed to build hash lexicon of {} terms: hashes collide with all {} seeds",
+            num_terms,
+            max_seeds));
+    }
+
+    /// Returns whether the memory-mapped file `mem` is a frozen hash lexicon.
+    [[nodiscard]] static auto is_hash_lexicon(gsl::span<std::byte const> mem) -> bool
+    {
+        std::uint64_t header[2];
+        if (mem.size() < static_cast<std::ptrdiff_t>(sizeof(header))) {
+            return false;
+        }
+        std::memcpy(header, mem.data(), sizeof(header));
+        return header[1] == magic;
+    }
+
+    /// Returns the ID of `term`, or `std::nullopt` if it is not in the lexicon.
+    [[nodiscard]] auto operator()(std::string_view term) const -> std::optional<std::uint32_t>
+    {
+        if (m_slots.size() == 0) {
+            return std::nullopt;
+        }
+        auto hash = detail::hash_term(term, m_seed);
+        auto pilot = m_pilots[detail::fastrange(hash, m_pilots.size())];
+        auto pos = position(hash, pilot, m_slots.size() + m_remapped.size());
+        if (PISA_UNLIKELY(pos >= m_slots.size())) {
+            pos = m_remapped[pos - m_slots.size()];
+        }
+        auto slot = m_slots[pos];
+        if (static_cast<std::uint32_t>(slot) != static_cast<std::uint32_t>(hash)) {
+            return std::nullopt;
+        }
+        return static_cast<std::uint32_t>(slot >> 32U);
+    }
+
+    [[nodiscard]] auto size() const -> std::uint64_t { return m_slots.size(); }
+
+    template <typename Visitor>
+    void map(Visitor& visit)
+    {
+        // Checked before anything else is read, so that older files are not read past their end.
+        visit(m_magic, "m_magic")(m_version, "m_version");
+        if (m_magic != magic) {
+            throw std::runtime_error("Not a hash lexicon");
+        }
+        if (m_version != version) {
+            throw std::runtime_error(
+                "Unsupported hash lexicon format: rebuild it with lexicon build --hash");
+        }
+        visit(m_seed, "m_seed")(m_pilots, "m_pilots")(m_slots, "m_slots")(
+            m_remapped, "m_remapped");
+    }
+
+  private:
+    enum class Build_Status { built, hash_collision, pilot_exhausted };
+
+    /// Throws `std::invalid_argument` if a term occurs twice.
+    template <typename Terms>
+    static void check_unique(Terms const& terms)
+    {
+        std::vector<std::string_view> sorted;
+        for (auto const& term: terms) {
+            sorted.emplace_back(term);
+        }
+        if (not std::is_sorted(sorted.begin(), sorted.end())) {
+            std::sort(sorted.begin(), sorted.end());
+        }
+        if (auto pos = std::adjacent_find(sorted.begin(), sorted.end()); pos != sorted.end()) {
+            throw std::invalid_argument(
+                fmt::format("Duplicate term in hash lexicon: {}", std::string(*pos)));
+        }
+    }
+
+    [[nodiscard]] static auto
+    position(std::uint64_t hash, std::uint32_t pilot, std::uint64_t num_slots) -> std::uint64_t
+    {
+        return detail::fastrange(detail::mix64(hash ^ detail::mix64(pilot)), num_slots);
+    }
+
+    /// Finds the pilots of all buckets, unless two terms have the same hash or a bucket has no
+    /// pilot below `max_pilot`.
+    [[nodiscard]] auto build(std::vector<std::uint64_t> const& hashes, std::uint32_t max_pilot)
+        -> Build_Status
+    {
+        std::uint64_t num_terms = hashes.size();
+        if (num_terms == 0) {
+            return Build_Status::built;
+        }
+        {
+            auto sorted = hashes;
+            std::sort(sorted.begin(), sorted.end());
+            if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+                return Build_Status::hash_collision;
+            }
+        }
+        std::uint64_t num_buckets = (num_terms + average_bucket_size - 1) / average_bucket_size;
+        auto num_slots = std::max<std::uint64_t>(
+            num_terms, static_cast<std::uint64_t>(std::ceil(num_terms / load_factor)));
+
+        // Terms sorted by bucket, then buckets sorted by decreasing size.
+        std::vector<std::uint64_t> bucket_ends(num_buckets + 1, 0);
+        for (auto hash: hashes) {
+            bucket_ends[detail::fastrange(hash, num_buckets) + 1] += 1;
+        }
+        for (std::uint64_t bucket = 0; bucket < num_buckets; ++bucket) {
+            bucket_ends[bucket + 1] += bucket_ends[bucket];
+        }
+        std::vector<std::uint32_t> terms(num_terms);
+        {
+            auto next = bucket_ends;
+            for (std::uint64_t term = 0; term < num_terms; ++term) {
+                terms[next[detail::fastrange(hashes[term], num_buckets)]++] = term;
+            }
+        }
+        std::vector<std::uint32_t> buckets(num_buckets);
+        std::iota(buckets.begin(), buckets.end(), 0U);
+        auto bucket_size = [&](auto bucket) {
+            return bucket_ends[bucket + 1] - bucket_ends[bucket];
+        };
+        std::stable_sort(buckets.begin(), buckets.end(), [&](auto lhs, auto rhs) {
+            return bucket_size(lhs) > bucket_size(rhs);
+        });
+
+        std::vector<std::uint32_t> pilots(num_buckets, 0);
+        std::vector<std::uint64_t> table(num_slots);
+        std::vector<bool> taken(num_slots, false);
+        std::vector<std::uint64_t> bucket_slots;
+        for (auto bucket: buckets) {
+            auto first = terms.begin() + bucket_ends[bucket];
+            auto last = terms.begin() + bucket_ends[bucket + 1];
+            if (first == last) {
+                break;
+            }
+            for (std::uint32_t pilot = 0;; ++pilot) {
+                if (pilot == max_pilot) {
+                    return Build_Status::pilot_exhausted;
+                }
+                bucket_slots.clear();
+                for (auto term = first; term != last; ++term) {
+                    auto slot = position(hashes[*term], pilot, num_slots);
+                    if (taken[slot]
+                        || std::find(bucket_slots.begin(), bucket_slots.end(), slot)
+                            != bucket_slots.end()) {
+                        break;
+                    }
+                    bucket_slots.push_back(slot);
+                }
+                if (bucket_slots.size() == static_cast<std::size_t>(last - first)) {
+                    pilots[bucket] = pilot;
+                    break;
+                }
+            }
+            for (auto term = first; term != last; ++term) {
+                auto slot = bucket_slots[term - first];
+                taken[slot] = true;
+                table[slot] = static_cast<std::uint64_t>(*term) << 32U
+                    | static_cast<std::uint32_t>(hashes[*term]);
+            }
+        }
+
+        // As many slots are free below `num_terms` as are taken past it: moves each term past
+        // it to the next free slot, and remaps its position there.
+        std::vector<std::uint32_t> remapped(num_slots - num_terms, 0);
+        std::uint64_t free_slot = 0;
+        for (auto slot = num_terms; slot < num_slots; ++slot) {
+            if (taken[slot]) {
+                while (taken[free_slot]) {
+                    ++free_slot;
+                }
+                table[free_slot] = table[slot];
+                taken[free_slot] = true;
+                remapped[slot - num_terms] = free_slot;
+            }
+        }
+        table.resize(num_terms);
+        m_pilots.steal(pilots);
+        m_slots.steal(table);
+        m_remapped.steal(remapped);
+        return Build_Status::built;
+    }
+
+    std::uint64_t m_magic = magic;
+    std::uint64_t m_version = version;
+    std::uint64_t m_seed = 0;
+    mapper::mappable_vector<std::uint32_t> m_pilots;
+    /// The ID of the term of each slot in the high 32 bits, and its fingerprint in the low ones.
+    mapper::mappable_vector<std::uint64_t> m_slots;
+    /// The slot of each position past the last slot that a term was sent to.
+    mapper::mappable_vector<std::uint32_t> m_remapped;
+};
+
+}  // namespace pisa
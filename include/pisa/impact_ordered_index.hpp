@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "bitvector_collection.hpp"
+#include "codec/compact_elias_fano.hpp"
+#include "codec/integer_codes.hpp"
+#include "global_parameters.hpp"
+#include "mappable/mappable_vector.hpp"
+#include "util/query_counters.hpp"
+
+namespace pisa {
+
+/// Inverted index in which the postings of each term are grouped into segments of equal
+/// quantized impact, sorted by decreasing impact. Documents within a segment are sorted
+/// and encoded with Elias-Fano. This is the layout used by score-at-a-time processing
+/// (see `saat_query`).
+class impact_ordered_index {
+  public:
+    impact_ordered_index() = default;
+
+    class builder {
+      public:
+        builder(uint64_t num_docs, global_parameters const& params)
+            : m_params(params), m_num_docs(num_docs), m_segments(params)
+        {
+            m_term_endpoints.push_back(0);
+        }
+
+        /// Adds the posting list of the next term, where `impacts_begin` points to
+        /// the quantized score of each posting (e.g., the output of `LinearQuantizer`).
+        template <typename DocsIterator, typename ImpactsIterator>
+        void add_posting_list(uint64_t n, DocsIterator docs_begin, ImpactsIterator impacts_begin)
+        {
+            if (!n) {
+                throw std::invalid_argument("List must be nonempty");
+            }
+
+            std::vector<std::pair<uint32_t, uint32_t>> postings;
+            postings.reserve(n);
+            for (uint64_t pos = 0; pos < n; ++pos, ++docs_begin, ++impacts_begin) {
+                postings.emplace_back(*impacts_begin, *docs_begin);
+            }
+            std::sort(postings.begin(), postings.end(), [](auto const& lhs, auto const& rhs) {
+                return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+            });
+
+            std::vector<uint64_t> docs;
+            for (auto first = postings.begin(); first != postings.end();) {
+                auto impact = first->first;
+                auto last = std::find_if(
+                    first, postings.end(), [impact](auto const& p) { return p.first != impact; });
+                docs.clear();
+                std::transform(first, last, std::back_inserter(docs), [](auto const& p) {
+                    return p.second;
+                });
+
+                bit_vector_builder bits;
+                write_gamma_nonzero(bits, docs.size());
+                compact_elias_fano::write(bits, docs.begin(), m_num_docs, docs.size(), m_params);
+                m_segments.append(bits);
+                m_impacts.push_back(impact);
+                first = last;
+            }
+            m_term_endpoints.push_back(m_impacts.size());
+        }
+
+        void build(impact_ordered_index& index)
+        {
+            index.m_params = m_params;
+            index.m_num_docs = m_num_docs;
+            index.m_term_endpoints.steal(m_term_endpoints);
+            index.m_impacts.steal(m_impacts);
+            m_segments.build(index.m_segments);
+        }
+
+      private:
+        global_parameters m_params;
+        uint64_t m_num_docs;
+        std::vector<uint64_t> m_term_endpoints;
+        std::vector<uint32_t> m_impacts;
+        bitvector_collection::builder m_segments;
+    };
+
+    /// A run of documents sharing the same impact.
+    class segment {
+      public:
+        segment(uint32_t impact, compact_elias_fano::enumerator docs)
+            : m_impact(impact), m_docs(docs)
+        {}
+
+        [[nodiscard]] auto impact() const -> uint32_t { return m_impact; }
+        [[nodiscard]] auto size() const -> uint64_t { return m_docs.size(); }
+
+        /// Calls `fn(docid)` for the first `n` documents of the segment, in docid order.
+        template <typename Fn>
+        void for_each(uint64_t n, Fn fn)
+        {
+            if (n == 0) {
+                return;
+            }
+            PISA_QUERY_COUNT(postings, n);
+            fn(m_docs.move(0).second);
+            for (uint64_t pos = 1; pos < n; ++pos) {
+                fn(m_docs.next().second);
+            }
+        }
+
+      private:
+        uint32_t m_impact;
+        compact_elias_fano::enumerator m_docs;
+    };
+
+    /// Segments of a single term, in decreasing order of impact.
+    class segment_list {
+      public:
+        [[nodiscard]] auto num_segments() const -> uint64_t { return m_last - m_first; }
+
+        [[nodiscard]] auto impact(uint64_t idx) const -> uint32_t
+        {
+            return m_index->m_impacts[m_first + idx];
+        }
+
+        [[nodiscard]] auto operator[](uint64_t idx) const -> segment
+        {
+            return m_index->get_segment(m_first + idx);
+        }
+
+      private:
+        friend class impact_ordered_index;
+
+        segment_list(impact_ordered_index const* index, uint64_t first, uint64_t last)
+            : m_index(index), m_first(first), m_last(last)
+        {}
+
+        impact_ordered_index const* m_index;
+        uint64_t m_first;
+        uint64_t m_last;
+    };
+
+    [[nodiscard]] auto size() const -> uint64_t
+    {
+        return m_term_endpoints.size() == 0 ? 0 : m_term_endpoints.size() - 1;
+    }
+
+    [[nodiscard]] auto num_docs() const -> uint64_t { return m_num_docs; }
+
+    [[nodiscard]] auto num_segments() const -> uint64_t { return m_impacts.size(); }
+
+    [[nodiscard]] auto operator[](size_t term_id) const -> segment_list
+    {
+        assert(term_id < size());
+        return segment_list(this, m_term_endpoints[term_id], m_term_endpoints[term_id + 1]);
+    }
+
+    void warmup(size_t /* term_id */) const {}
+
+    global_parameters const& params() const { return m_params; }
+
+    template <typename Visitor>
+    void map(Visitor& visit)
+    {
+        visit(m_params, "m_params")(m_num_docs, "m_num_docs")(
+            m_term_endpoints, "m_term_endpoints")(m_impacts, "m_impacts")(
+            m_segments, "m_segments");
+    }
+
+  private:
+    [[nodiscard]] auto get_segment(uint64_t idx) const -> segment
+    {
+        auto it = m_segments.get(m_params, idx);
+        uint64_t n = read_gamma_nonzero(it);
+        return segment(
+            m_impacts[idx],
+            compact_elias_fano::enumerator(
+                m_segments.bits(), it.position(), m_num_docs, n, m_params));
+    }
+
+    global_parameters m_params;
+    uint64_t m_num_docs = 0;
+    mapper::mappable_vector<uint64_t> m_term_endpoints;
+    mapper::mappable_vector<uint32_t> m_impacts;
+    bitvector_collection m_segments;
+};
+
+}  // namespace pisa
@@ -1,14 +1,17 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <numeric>
 #include <optional>
+#include <queue>
 #include <sstream>
 #include <thread>
+#include <tuple>
 #include <unordered_map>
 
 #include "boost/filesystem.hpp"
@@ -18,6 +21,7 @@
 #include "range/v3/view/iota.hpp"
 #include "spdlog/spdlog.h"
 #include "tbb/concurrent_queue.h"
+#include "tbb/parallel_for.h"
 #include "tbb/task_group.h"
 #include "type_safe.hpp"
 
@@ -26,22 +30,6 @@
 
 namespace pisa {
 
-template <typename T>
-std::vector<T> concatenate(std::vector<std::vector<T>> const& containers)
-{
-    auto full_size = std::accumulate(
-        containers.begin(), containers.end(), 0, [](auto const& acc, auto const& container) {
-            return acc + container.size();
-        });
-    std::vector<T> vec(full_size);
-    auto next_begin = std::begin(vec);
-    for (auto const& container: containers) {
-        std::copy(container.begin(), container.end(), next_begin);
-        next_begin = std::next(next_begin, container.size());
-    }
-    return vec;
-}
-
 template <typename T>
 std::ostream& write_sequence(std::ostream& os, gsl::span<T> sequence)
 {
@@ -191,45 +179,106 @@ namespace invert {
         write_sequence(sstream, gsl::span<uint32_t const>(index.document_sizes));
     }
 
-    auto invert_range(
-        gsl::span<gsl::span<Term_Id const>> documents, Document_Id first_document_id, size_t threads)
+    /// Postings of a range of documents laid out term after term in flat arrays: the postings
+    /// of term `t` are at positions `[offsets[t], offsets[t + 1])` of `documents` and
+    /// `frequencies`, in increasing order of document.
+    struct Flat_Inverted_Index {
+        std::vector<std::size_t> offsets{};
+        std::vector<Document_Id> documents{};
+        std::vector<Frequency> frequencies{};
+        std::vector<std::uint32_t> document_sizes{};
+
+        [[nodiscard]] auto term_documents(Term_Id term) const -> gsl::span<Document_Id const>
+        {
+            auto first = offsets[static_cast<std::size_t>(term)];
+            auto last = offsets[static_cast<std::size_t>(term) + 1];
+            return gsl::span<Document_Id const>(documents).subspan(first, last - first);
+        }
+
+        [[nodiscard]] auto term_frequencies(Term_Id term) const -> gsl::span<Frequency const>
+        {
+            auto first = offsets[static_cast<std::size_t>(term)];
+            auto last = offsets[static_cast<std::size_t>(term) + 1];
+            return gsl::span<Frequency const>(frequencies).subspan(first, last - first);
+        }
+    };
+
+    void write(std::string const& basename, Flat_Inverted_Index const& index)
     {
-        std::vector<uint32_t> document_sizes(documents.size());
-        std::transform(
-            std::execution::par_unseq,
-            documents.begin(),
-            documents.end(),
-            document_sizes.begin(),
-            [](auto const& terms) { return terms.size(); });
-        gsl::index batch_size = (documents.size() + threads - 1) / threads;
-        std::vector<Batch> batches;
-        for (gsl::index first_idx_in_batch = 0; first_idx_in_batch < documents.size();
-             first_idx_in_batch += batch_size) {
-            auto last_idx_in_batch = std::min(first_idx_in_batch + batch_size, documents.size());
-            auto first_document_in_batch = first_document_id + first_idx_in_batch;
-            auto last_document_in_batch = first_document_id + last_idx_in_batch;
-            auto current_batch_size = last_idx_in_batch - first_idx_in_batch;
-            batches.push_back(
-                Batch{documents.subspan(first_idx_in_batch, current_batch_size),
-                      ranges::views::iota(first_document_in_batch, last_document_in_batch)});
+        std::ofstream dstream(basename + ".docs");
+        std::ofstream fstream(basename + ".freqs");
+        std::ofstream sstream(basename + ".sizes");
+        std::uint32_t count = index.document_sizes.size();
+        write_sequence(dstream, gsl::make_span<uint32_t const>(&count, 1));
+        for (std::size_t term = 0; term + 1 < index.offsets.size(); ++term) {
+            write_sequence(dstream, index.term_documents(Term_Id(term)));
+            write_sequence(fstream, index.term_frequencies(Term_Id(term)));
         }
-        std::vector<std::vector<std::pair<Term_Id, Document_Id>>> posting_vectors(batches.size());
-        std::transform(
-            std::execution::par_unseq,
-            batches.begin(),
-            batches.end(),
-            std::begin(posting_vectors),
-            map_to_postings);
-        auto postings = concatenate(posting_vectors);
-        posting_vectors.clear();
-        posting_vectors.shrink_to_fit();
+        write_sequence(sstream, gsl::span<uint32_t const>(index.document_sizes));
+    }
 
-        std::sort(std::execution::par_unseq, postings.begin(), postings.end());
+    /// Inverts `documents` with a counting sort on their (dense) term IDs, without hashing nor
+    /// sorting the postings of the range. The terms of each document are first sorted, in
+    /// parallel chunks of documents, to count the occurrences of each term. Then, the number of
+    /// documents of each term is counted, prefix-summed into the offsets of the terms, and the
+    /// postings are scattered at these offsets in order of document. Terms not lower than
+    /// `term_count` are ignored.
+    auto invert_range_flat(
+        gsl::span<gsl::span<Term_Id const>> documents,
+        Document_Id first_document_id,
+        std::uint32_t term_count,
+        size_t threads) -> Flat_Inverted_Index
+    {
+        Flat_Inverted_Index index;
+        index.document_sizes.resize(documents.size());
+        std::vector<std::size_t> document_offsets(documents.size() + 1, 0);
+        for (std::size_t idx = 0; idx < documents.size(); ++idx) {
+            index.document_sizes[idx] = documents[idx].size();
+            document_offsets[idx + 1] = document_offsets[idx] + documents[idx].size();
+        }
+
+        std::vector<Term_Id> terms(document_offsets.back());
+        auto grain = std::max<std::size_t>(1, (documents.size() + threads - 1) / threads);
+        tbb::parallel_for(
+            tbb::blocked_range<std::size_t>(0, documents.size(), grain), [&](auto const& range) {
+                for (auto idx = range.begin(); idx != range.end(); ++idx) {
+                    auto first = std::next(terms.data(), document_offsets[idx]);
+                    auto last = std::copy(documents[idx].begin(), documents[idx].end(), first);
+                    std::sort(first, last);
+                }
+            });
+
+        auto for_each_posting = [&](auto fn) {
+            for (std::size_t idx = 0; idx < documents.size(); ++idx) {
+                auto first = std::next(terms.data(), document_offsets[idx]);
+                auto end = std::next(terms.data(), document_offsets[idx + 1]);
+                while (first != end) {
+                    auto term = *first;
+                    auto last = std::find_if(first, end, [&](auto t) { return t != term; });
+                    if (static_cast<std::size_t>(term) < term_count) {
+                        fn(idx, static_cast<std::size_t>(term), std::distance(first, last));
+                    }
+                    first = last;
+                }
+            }
+        };
+
+        index.offsets.assign(std::size_t(term_count) + 1, 0);
+        for_each_posting([&](auto, auto term, auto) { index.offsets[term + 1] += 1; });
+        std::partial_sum(index.offsets.begin(), index.offsets.end(), index.offsets.begin());
+        index.documents.resize(index.offsets.back());
+        index.frequencies.resize(index.offsets.back());
 
-        using iterator_type = decltype(postings.begin());
-        invert::Inverted_Index<iterator_type> index;
-        tbb::parallel_reduce(tbb::blocked_range(postings.begin(), postings.end()), index);
-        index.document_sizes = std::move(document_sizes);
+        // Each offset is used as the write position of its term, so that it ends up at the
+        // offset of the next term, and the offsets are shifted back once all are scattered.
+        for_each_posting([&](auto idx, auto term, auto frequency) {
+            auto pos = index.offsets[term]++;
+            index.documents[pos] = first_document_id + static_cast<std::int32_t>(idx);
+            index.frequencies[pos] = Frequency(static_cast<std::int32_t>(frequency));
+        });
+        std::copy_backward(
+            index.offsets.begin(), std::prev(index.offsets.end()), index.offsets.end());
+        index.offsets.front() = 0;
         return index;
     }
 
@@ -254,8 +303,9 @@ namespace invert {
             }
             spdlog::info(
                 "Inverting [{}, {})", documents_processed, documents_processed + documents.size());
-            auto index = invert_range(documents, Document_Id(documents_processed), threads);
-            write(fmt::format("{}.batch.{}", output_basename, batch), index, term_count);
+            auto index = invert_range_flat(
+                documents, Document_Id(documents_processed), term_count, threads);
+            write(fmt::format("{}.batch.{}", output_basename, batch), index);
             documents_processed += documents.size();
             batch += 1;
         }
@@ -356,6 +406,211 @@ namespace invert {
         }
     }
 
+    /// A posting of a sorted run spilled to disk by `invert_forward_index_out_of_core`.
+    struct Run_Posting {
+        std::uint32_t term;
+        std::uint32_t document;
+        std::uint32_t frequency;
+    };
+
+    /// Sorts `postings`, counts the occurrences of each term in each document, and writes the
+    /// resulting postings to `filename`.
+    void spill_run(
+        std::vector<std::pair<std::uint32_t, std::uint32_t>>& postings, std::string const& filename)
+    {
+        std::sort(std::execution::par_unseq, postings.begin(), postings.end());
+        std::ofstream os(filename, std::ios::binary);
+        std::array<Run_Posting, 4096> buffer{};
+        std::size_t size = 0;
+        auto flush = [&]() {
+            os.write(reinterpret_cast<char const*>(buffer.data()), size * sizeof(Run_Posting));
+            size = 0;
+        };
+        for (auto first = postings.begin(); first != postings.end();) {
+            auto last = std::find_if(first, postings.end(), [&](auto const& posting) {
+                return posting != *first;
+            });
+            if (size == buffer.size()) {
+                flush();
+            }
+            auto frequency = static_cast<std::uint32_t>(std::distance(first, last));
+            buffer[size++] = Run_Posting{first->first, first->second, frequency};
+            first = last;
+        }
+        flush();
+    }
+
+    /// Reads the postings of a run in order, loading `capacity` of them at a time.
+    class Run_Reader {
+      public:
+        Run_Reader(std::string const& filename, std::size_t capacity)
+            : m_is(filename, std::ios::binary), m_capacity(capacity)
+        {
+            fill();
+        }
+
+        [[nodiscard]] auto empty() const -> bool { return m_position == m_buffer.size(); }
+        [[nodiscard]] auto front() const -> Run_Posting const& { return m_buffer[m_position]; }
+
+        void pop()
+        {
+            if (++m_position == m_buffer.size()) {
+                fill();
+            }
+        }
+
+      private:
+        void fill()
+        {
+            m_buffer.resize(m_capacity);
+            m_is.read(
+                reinterpret_cast<char*>(m_buffer.data()), m_buffer.size() * sizeof(Run_Posting));
+            m_buffer.resize(m_is.gcount() / sizeof(Run_Posting));
+            m_position = 0;
+        }
+
+        std::ifstream m_is;
+        std::size_t m_capacity;
+        std::vector<Run_Posting> m_buffer{};
+        std::size_t m_position = 0;
+    };
+
+    /// Merges the sorted runs of `run_files` into the `.docs` and `.freqs` files of an inverted
+    /// index of `document_count` documents, reading each run through a buffer of a share of
+    /// `memory_budget` bytes.
+    void merge_runs(
+        std::vector<std::string> const& run_files,
+        std::string const& output_basename,
+        uint32_t term_count,
+        uint32_t document_count,
+        std::size_t memory_budget)
+    {
+        auto capacity =
+            std::max<std::size_t>(1, memory_budget / (run_files.size() * sizeof(Run_Posting)));
+        std::vector<Run_Reader> runs;
+        runs.reserve(run_files.size());
+        for (auto const& filename: run_files) {
+            runs.emplace_back(filename, capacity);
+        }
+        auto greater = [&](std::size_t lhs, std::size_t rhs) {
+            auto const& l = runs[lhs].front();
+            auto const& r = runs[rhs].front();
+            return std::tie(l.term, l.document) > std::tie(r.term, r.document);
+        };
+        std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater)> heap(
+            greater);
+        for (std::size_t run = 0; run < runs.size(); ++run) {
+            if (not runs[run].empty()) {
+                heap.push(run);
+            }
+        }
+
+        std::ofstream dos(output_basename + ".docs");
+        std::ofstream fos(output_basename + ".freqs");
+        write_sequence(dos, gsl::make_span<uint32_t const>(&document_count, 1));
+        std::vector<uint32_t> documents;
+        std::vector<uint32_t> frequencies;
+        uint32_t current_term = 0;
+        size_t postings_count = 0;
+        auto write_term = [&]() {
+            if (documents.empty()) {
+                auto msg = fmt::format("Posting list must be non-empty (term {})", current_term);
+                spdlog::error(msg);
+                throw std::runtime_error(msg);
+            }
+            postings_count += documents.size();
+            write_sequence(dos, gsl::span<uint32_t const>(documents));
+            write_sequence(fos, gsl::span<uint32_t const>(frequencies));
+            documents.clear();
+            frequencies.clear();
+            current_term += 1;
+        };
+        while (not heap.empty()) {
+            auto run = heap.top();
+            heap.pop();
+            auto posting = runs[run].front();
+            runs[run].pop();
+            if (not runs[run].empty()) {
+                heap.push(run);
+            }
+            if (posting.term >= term_count) {
+                continue;
+            }
+            while (current_term < posting.term) {
+                write_term();
+            }
+            // A document spans two runs if the buffer was spilled in the middle of it.
+            if (not documents.empty() && documents.back() == posting.document) {
+                frequencies.back() += posting.frequency;
+            } else {
+                documents.push_back(posting.document);
+                frequencies.push_back(posting.frequency);
+            }
+        }
+        while (current_term < term_count) {
+            write_term();
+        }
+
+        spdlog::info("Number of terms: {}", term_count);
+        spdlog::info("Number of documents: {}", document_count);
+        spdlog::info("Number of postings: {}", postings_count);
+    }
+
+    /// Inverts the forward index `input_basename` like `invert_forward_index`, but holding at
+    /// most `memory_budget` bytes of postings in memory.
+    ///
+    /// The postings are collected in a buffer, which is sorted and spilled to disk as a run of
+    /// (term, document, frequency) triples whenever it is full. The runs are then merged with a
+    /// heap. Only the posting list being written must fit in memory beside the budget.
+    void invert_forward_index_out_of_core(
+        std::string const& input_basename,
+        std::string const& output_basename,
+        uint32_t term_count,
+        std::size_t memory_budget)
+    {
+        using posting_type = std::pair<std::uint32_t, std::uint32_t>;
+        auto capacity = std::max<std::size_t>(1, memory_budget / sizeof(posting_type));
+        std::vector<posting_type> postings;
+        postings.reserve(capacity);
+        std::vector<std::string> run_files;
+        auto spill = [&]() {
+            run_files.push_back(fmt::format("{}.run.{}", output_basename, run_files.size()));
+            spdlog::info("Writing run {} with {} postings", run_files.size(), postings.size());
+            spill_run(postings, run_files.back());
+            postings.clear();
+        };
+
+        // Sizes are written as documents are read, and their count is filled in at the end.
+        std::ofstream sos(output_basename + ".sizes");
+        uint32_t document_count = 0;
+        write_sequence(sos, gsl::span<uint32_t const>());
+        binary_collection coll(input_basename.c_str());
+        for (auto doc_iter = ++coll.begin(); doc_iter != coll.end(); ++doc_iter) {
+            auto document = *doc_iter;
+            auto size = static_cast<uint32_t>(document.size());
+            sos.write(reinterpret_cast<char const*>(&size), sizeof(size));
+            for (auto term: document) {
+                if (postings.size() == capacity) {
+                    spill();
+                }
+                postings.emplace_back(term, document_count);
+            }
+            document_count += 1;
+        }
+        if (not postings.empty() or run_files.empty()) {
+            spill();
+        }
+        sos.seekp(0);
+        sos.write(reinterpret_cast<char const*>(&document_count), sizeof(document_count));
+        sos.close();
+        postings = {};
+
+        merge_runs(run_files, output_basename, term_count, document_count, memory_budget);
+        for (auto const& filename: run_files) {
+            boost::filesystem::remove(boost::filesystem::path{filename});
+        }
+    }
+
 }  // namespace invert
 
 }  // namespace pisa
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fmt/format.h"
+
+#include "global_parameters.hpp"
+#include "mappable/mappable_vector.hpp"
+#include "query/queries.hpp"
+#include "wand_data_raw.hpp"
+
+namespace pisa {
+
+/// Packs the frequencies of two terms in the same document into a single frequency with the
+/// Cantor pairing function, so that small pairs of frequencies stay small.
+[[nodiscard]] inline auto pack_freqs(uint64_t first, uint64_t second) -> uint64_t
+{
+    uint64_t x = first - 1;
+    uint64_t y = second - 1;
+    return (x + y) * (x + y + 1) / 2 + y + 1;
+}
+
+/// Inverse of `pack_freqs`.
+[[nodiscard]] inline auto unpack_freqs(uint64_t packed) -> std::pair<uint64_t, uint64_t>
+{
+    uint64_t z = packed - 1;
+    auto w = static_cast<uint64_t>((std::sqrt(8.0 * z + 1) - 1) / 2);
+    // Corrects the rounding of the square root.
+    while (w * (w + 1) / 2 > z) {
+        --w;
+    }
+    while ((w + 1) * (w + 2) / 2 <= z) {
+        ++w;
+    }
+    uint64_t y = z - w * (w + 1) / 2;
+    return {w - y + 1, y + 1};
+}
+
+/// Posting lists of the intersections of frequent pairs of terms, stored in an index of type
+/// `Index` next to the inverted index they come from.
+///
+/// The frequency of each posting packs the frequencies of both terms (see `pack_freqs`), so
+/// that the score of a document can be computed exactly as with the two source lists. The pair
+/// index also stores the maximum score of each list and of each block of postings, computed
+/// with the scorer used to build it, in the layout of `wand_data_raw`. That scorer is recorded
+/// (see `scorer::describe`) so that the pair index is not used to prune with the bounds of
+/// another scorer (see `check_scorer`).
+template <typename Index>
+class pair_index {
+  public:
+    using index_type = Index;
+    using document_enumerator = typename Index::document_enumerator;
+    using block_max_enumerator = wand_data_raw::enumerator;
+
+    /// Identifies pair indexes, stored right after the flags of `mapper::freeze`.
+    static constexpr uint64_t magic = 0x5249415041534950ULL;  // "PISAPAIR"
+    /// Incremented whenever the layout changes; version 2 added the scorer, and version 3 the
+    /// header of block indexes (see `block_freq_index::version`).
+    static constexpr uint64_t version = 3;
+
+    pair_index() = default;
+
+    class builder {
+      public:
+        /// `scorer` describes the scorer computing the scores passed to `add_pair`.
+        builder(uint64_t num_docs, global_parameters const& params, std::string scorer)
+            : m_lists(num_docs, params), m_scorer(scorer.begin(), scorer.end())
+        {
+            m_blocks_start.push_back(0);
+        }
+
+        /// Adds the intersection of the lists of `first` and `second`: `n` documents, along with
+        /// their packed frequencies and scores. Pairs must be added in increasing order.
+        template <typename DocsIterator, typename FreqsIterator, typename ScoresIterator>
+        void add_pair(
+            term_id_type first,
+            term_id_type second,
+            uint64_t n,
+            DocsIterator docs_begin,
+            FreqsIterator freqs_begin,
+            ScoresIterator scores_begin,
+            uint64_t block_size)
+        {
+            auto key = make_key(first, second);
+            if (first >= second) {
+                throw std::invalid_argument("The first term of a pair must be the smallest");
+            }
+            if (!m_pairs.empty() && key <= m_pairs.back()) {
+                throw std::invalid_argument("Pairs must be added in increasing order");
+            }
+            uint64_t occurrences = 0;
+            auto freqs = freqs_begin;
+            for (uint64_t pos = 0; pos < n; ++pos, ++freqs) {
+                occurrences += *freqs;
+            }
+            m_lists.add_posting_list(n, docs_begin, freqs_begin, occurrences);
+
+            float max_score = 0;
+            float block_max_score = 0;
+            uint64_t last_docid = 0;
+            auto docs = docs_begin;
+            for (uint64_t pos = 0; pos < n; ++pos, ++docs, ++scores_begin) {
+                if (pos > 0 && pos % block_size == 0) {
+                    m_block_docid.push_back(*docs - 1);
+                    m_block_max_score.push_back(block_max_score);
+                    block_max_score = 0;
+                }
+                block_max_score = std::max(block_max_score, static_cast<float>(*scores_begin));
+                max_score = std::max(max_score, block_max_score);
+                last_docid = *docs;
+            }
+            m_block_docid.push_back(last_docid);
+            m_block_max_score.push_back(block_max_score);
+            m_blocks_start.push_back(m_block_docid.size());
+            m_pairs.push_back(key);
+            m_max_scores.push_back(max_score);
+        }
+
+        void build(pair_index& index)
+        {
+            m_lists.build(index.m_lists);
+            index.m_pairs.steal(m_pairs);
+            index.m_max_scores.steal(m_max_scores);
+            index.m_blocks_start.steal(m_blocks_start);
+            index.m_block_max_score.steal(m_block_max_score);
+            index.m_block_docid.steal(m_block_docid);
+            index.m_scorer.steal(m_scorer);
+        }
+
+      private:
+        typename Index::builder m_lists;
+        std::vector<uint64_t> m_pairs;
+        std::vector<float> m_max_scores;
+        std::vector<uint64_t> m_blocks_start;
+        std::vector<float> m_block_max_score;
+        std::vector<uint32_t> m_block_docid;
+        std::vector<char> m_scorer;
+    };
+
+    /// Number of pairs.
+    [[nodiscard]] auto size() const -> uint64_t { return m_pairs.size(); }
+
+    [[nodiscard]] auto num_docs() const -> uint64_t { return m_lists.num_docs(); }
+
+    /// Description of the scorer that computed the max scores (see `scorer::describe`).
+    [[nodiscard]] auto scorer() const -> std::string
+    {
+        return std::string(m_scorer.begin(), m_scorer.end());
+    }
+
+    /// Throws if the max scores were not computed by the scorer described by `scorer`, as
+    /// pruning with them would silently lose results.
+    void check_scorer(std::string const& scorer) const
+    {
+        if (this->scorer() != scorer) {
+            throw std::invalid_argument(fmt::format(
+                "The pair index was built with scorer {} but queries use {}: rebuild it with "
+                "create_pair_index",
+                this->scorer(),
+                scorer));
+        }
+    }
+
+    /// Returns the position of the pair of `first` and `second`, in any order, if it is stored.
+    [[nodiscard]] auto find(term_id_type first, term_id_type second) const
+        -> std::optional<uint64_t>
+    {
+        auto key = make_key(std::min(first, second), std::max(first, second));
+        auto pos = std::lower_bound(m_pairs.begin(), m_pairs.end(), key);
+        if (pos == m_pairs.end() || *pos != key) {
+            return std::nullopt;
+        }
+        return pos - m_pairs.begin();
+    }
+
+    /// Returns the terms of the pair at position `pair`.
+    [[nodiscard]] auto terms(uint64_t pair) const -> std::pair<term_id_type, term_id_type>
+    {
+        return {static_cast<term_id_type>(m_pairs[pair] >> 32U),
+                static_cast<term_id_type>(m_pairs[pair] & std::numeric_limits<uint32_t>::max())};
+    }
+
+    [[nodiscard]] auto operator[](uint64_t pair) const -> document_enumerator
+    {
+        return m_lists[pair];
+    }
+
+    [[nodiscard]] auto max_score(uint64_t pair) const -> float { return m_max_scores[pair]; }
+
+    [[nodiscard]] auto block_max(uint64_t pair) const -> block_max_enumerator
+    {
+        return block_max_enumerator(
+            m_blocks_start[pair],
+            m_blocks_start[pair + 1] - m_blocks_start[pair],
+            m_block_max_score,
+            m_block_docid);
+    }
+
+    void warmup(uint64_t pair) const { m_lists.warmup(pair); }
+
+    template <typename Visitor>
+    void map(Visitor& visit)
+    {
+        // Checked before anything else is read, so that older files are not read past their end.
+        visit(m_magic, "m_magic")(m_version, "m_version");
+        if (m_magic != magic || m_version != version) {
+            throw std::runtime_error(fmt::format(
+                "Unsupported pair index format{}: rebuild it with create_pair_index",
+                m_magic == magic ? fmt::format(" (version {})", m_version) : ""));
+        }
+        visit(m_scorer, "m_scorer")(m_lists, "m_lists")(m_pairs, "m_pairs")(m_max_scores, "m_max_scores")(
+            m_blocks_start, "m_blocks_start")(m_block_max_score, "m_block_max_score")(
+            m_block_docid, "m_block_docid");
+    }
+
+  private:
+    [[nodiscard]] static auto make_key(term_id_type first, term_id_type second) -> uint64_t
+    {
+        return (static_cast<uint64_t>(first) << 32U) | second;
+    }
+
+    uint64_t m_magic = magic;
+    uint64_t m_version = version;
+    mapper::mappable_vector<char> m_scorer;
+    Index m_lists;
+    mapper::mappable_vector<uint64_t> m_pairs;
+    mapper::mappable_vector<float> m_max_scores;
+    mapper::mappable_vector<uint64_t> m_blocks_start;
+    mapper::mappable_vector<float> m_block_max_score;
+    mapper::mappable_vector<uint32_t> m_block_docid;
+};
+
+}  // namespace pisa
@@ -1,44 +1,253 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "gumbo.h"
 
 namespace pisa::parsing::html {
 
-[[nodiscard]] auto cleantext(GumboNode* node) -> std::string
-{
-    if (node->type == GUMBO_NODE_TEXT) {
-        return std::string(node->v.text.text);
+/// How HTML pages are parsed.
+enum class Html_Parser {
+    /// Builds a DOM with Gumbo, which recovers from any markup errors.
+    gumbo,
+    /// Scans the markup without building a DOM (see `scan_text`), and falls back to Gumbo for
+    /// pages that are not well-formed.
+    fast,
+};
+
+namespace detail {
+
+    [[nodiscard]] inline auto
+    starts_with_nocase(char const* pos, char const* last, std::string_view prefix) -> bool
+    {
+        if (static_cast<std::size_t>(last - pos) < prefix.size()) {
+            return false;
+        }
+        return std::equal(prefix.begin(), prefix.end(), pos, [](char lhs, char rhs) {
+            return lhs == std::tolower(static_cast<unsigned char>(rhs));
+        });
+    }
+
+    [[nodiscard]] inline auto is_name_char(char ch) -> bool
+    {
+        return std::isalnum(static_cast<unsigned char>(ch)) != 0;
+    }
+
+    /// Returns the position past the `>` closing the tag whose name ends at `pos`, or null if
+    /// the tag is not closed. A `>` within a quoted attribute value does not close the tag.
+    [[nodiscard]] inline auto skip_tag(char const* pos, char const* last) -> char const*
+    {
+        char previous = ' ';
+        while (pos != last) {
+            char ch = *pos++;
+            if (ch == '>') {
+                return pos;
+            }
+            if ((ch == '"' || ch == '\'') && previous == '=') {
+                pos = std::find(pos, last, ch);
+                if (pos == last) {
+                    return nullptr;
+                }
+                ++pos;
+            }
+            if (not std::isspace(static_cast<unsigned char>(ch))) {
+                previous = ch;
+            }
+        }
+        return nullptr;
+    }
+
+    /// Returns the position past `terminator`, searched from `pos`, or null if there is none.
+    [[nodiscard]] inline auto
+    skip_past(char const* pos, char const* last, std::string_view terminator) -> char const*
+    {
+        auto found = std::search(pos, last, terminator.begin(), terminator.end());
+        return found == last ? nullptr : found + terminator.size();
+    }
+
+    /// Returns the lowercase name of the tag `[first, last)` if its content is not parsed
+    /// (`script` or `style`), or an empty string.
+    [[nodiscard]] inline auto raw_text_element(char const* first, char const* last)
+        -> std::string_view
+    {
+        for (std::string_view name: {"script", "style"}) {
+            if (static_cast<std::size_t>(last - first) == name.size()
+                && starts_with_nocase(first, last, name)) {
+                return name;
+            }
+        }
+        return {};
+    }
+
+    /// Returns the position past the end tag of the raw text element `name` (such as `script`),
+    /// whose content starts at `pos`, or null if the element is not closed.
+    [[nodiscard]] inline auto
+    skip_raw_text(char const* pos, char const* last, std::string_view name) -> char const*
+    {
+        while ((pos = std::find(pos, last, '<')) != last) {
+            char const* name_end = pos + 2 + name.size();
+            if (pos + 1 != last && pos[1] == '/' && starts_with_nocase(pos + 2, last, name)
+                && (name_end == last || not is_name_char(*name_end))) {
+                return skip_tag(name_end, last);
+            }
+            ++pos;
+        }
+        return nullptr;
     }
-    if (node->type == GUMBO_NODE_ELEMENT && node->v.element.tag != GUMBO_TAG_SCRIPT
-        && node->v.element.tag != GUMBO_TAG_STYLE) {
-        std::string contents;
-        GumboVector* children = &node->v.element.children;
-        for (unsigned int i = 0; i < children->length; ++i) {
-            const std::string text = cleantext(reinterpret_cast<GumboNode*>(children->data[i]));
-            if (i != 0 && not contents.empty() && not text.empty()) {
-                contents.append(" ");
+
+}  // namespace detail
+
+/// Appends the text runs of `html` to `runs` without building a DOM, and returns whether the
+/// page is well-formed enough to do so: all comments, tags, quoted attribute values, and
+/// `script` and `style` elements must be closed. Otherwise, the content of `runs` is undefined.
+///
+/// Runs are separated by tags, which are dropped along with comments, declarations, and the
+/// content of `script` and `style` elements. Character references, such as `&amp;`, are not
+/// decoded but separate runs, and so terms.
+[[nodiscard]] inline auto scan_text(std::string_view html, std::vector<std::string_view>& runs)
+    -> bool
+{
+    char const* pos = html.data();
+    char const* last = html.data() + html.size();
+    char const* text_start = pos;
+    auto emit = [&](char const* text_end) {
+        if (text_end != text_start) {
+            runs.emplace_back(text_start, text_end - text_start);
+        }
+    };
+    while ((pos = std::find_if(pos, last, [](char ch) { return ch == '<' || ch == '&'; }))
+           != last) {
+        char const* next = pos + 1;
+        if (*pos == '&') {
+            char const* name_end = std::find_if_not(
+                next != last && *next == '#' ? next + 1 : next, last, detail::is_name_char);
+            emit(pos);
+            pos = name_end != last && *name_end == ';' ? name_end + 1 : next;
+            text_start = pos;
+            continue;
+        }
+        if (next == last) {
+            break;
+        }
+        char const* tag_end = nullptr;
+        if (detail::starts_with_nocase(next, last, "!--")) {
+            tag_end = detail::skip_past(next + 3, last, "-->");
+        } else if (detail::starts_with_nocase(next, last, "![cdata[")) {
+            tag_end = detail::skip_past(next + 8, last, "]]>");
+        } else if (*next == '!' || *next == '?') {
+            tag_end = detail::skip_past(next, last, ">");
+        } else if (
+            *next == '/' && next + 1 != last
+            && std::isalpha(static_cast<unsigned char>(next[1])) != 0) {
+            tag_end = detail::skip_tag(next + 1, last);
+        } else if (std::isalpha(static_cast<unsigned char>(*next)) != 0) {
+            char const* name_end = std::find_if_not(next, last, detail::is_name_char);
+            tag_end = detail::skip_tag(name_end, last);
+            auto raw_text = detail::raw_text_element(next, name_end);
+            if (tag_end != nullptr && not raw_text.empty() && *(tag_end - 2) != '/') {
+                tag_end = detail::skip_raw_text(tag_end, last, raw_text);
             }
-            contents.append(text);
+        } else {
+            // Not markup, such as in `a < b`.
+            pos = next;
+            continue;
         }
-        return contents;
+        if (tag_end == nullptr) {
+            return false;
+        }
+        emit(pos);
+        pos = tag_end;
+        text_start = pos;
     }
-    return std::string();
+    emit(last);
+    return true;
 }
 
-[[nodiscard]] auto cleantext(std::string_view html) -> std::string
+/// Calls `emit` with the text of each text node under `node`, in document order, skipping
+/// `script` and `style` elements.
+template <typename Fn>
+void for_each_text(GumboNode* node, Fn&& emit, std::vector<GumboNode*>& stack)
 {
-    GumboOptions options = kGumboDefaultOptions;
-    options.max_errors = 1000;
-    GumboOutput* output = gumbo_parse_with_options(&options, html.data(), html.size());
-    if (output->errors.length >= options.max_errors) {
+    stack.clear();
+    stack.push_back(node);
+    while (not stack.empty()) {
+        node = stack.back();
+        stack.pop_back();
+        if (node->type == GUMBO_NODE_TEXT) {
+            emit(std::string_view(node->v.text.text));
+        } else if (
+            node->type == GUMBO_NODE_ELEMENT && node->v.element.tag != GUMBO_TAG_SCRIPT
+            && node->v.element.tag != GUMBO_TAG_STYLE) {
+            GumboVector* children = &node->v.element.children;
+            for (auto idx = children->length; idx > 0; --idx) {
+                stack.push_back(reinterpret_cast<GumboNode*>(children->data[idx - 1]));
+            }
+        }
+    }
+}
+
+/// Extracts the text of HTML pages as runs of characters that no term spans.
+///
+/// Runs are views of the page or of its DOM and are passed to a callback as soon as they are
+/// found, so extracting does not copy text. Buffers are reused from one page to the next.
+class Text_Extractor {
+  public:
+    explicit Text_Extractor(Html_Parser parser = Html_Parser::gumbo) : m_parser(parser) {}
+
+    /// Calls `emit` with each text run of `html`. Pages with too many markup errors have no
+    /// text.
+    template <typename Fn>
+    void extract(std::string_view html, Fn&& emit)
+    {
+        if (m_parser == Html_Parser::fast) {
+            m_runs.clear();
+            if (scan_text(html, m_runs)) {
+                for (auto run: m_runs) {
+                    emit(run);
+                }
+                return;
+            }
+            m_fallbacks += 1;
+        }
+        GumboOptions options = kGumboDefaultOptions;
+        options.max_errors = 1000;
+        GumboOutput* output = gumbo_parse_with_options(&options, html.data(), html.size());
+        if (output->errors.length < options.max_errors) {
+            for_each_text(output->root, emit, m_stack);
+        }
         gumbo_destroy_output(&kGumboDefaultOptions, output);
-        return std::string();
     }
-    std::string content = cleantext(output->root);
-    gumbo_destroy_output(&kGumboDefaultOptions, output);
+
+    /// Returns the number of pages that were not well-formed and were parsed with Gumbo
+    /// instead of the fast parser.
+    [[nodiscard]] auto fallbacks() const noexcept -> std::size_t { return m_fallbacks; }
+
+  private:
+    Html_Parser m_parser;
+    std::vector<std::string_view> m_runs;
+    std::vector<GumboNode*> m_stack;
+    std::size_t m_fallbacks = 0;
+};
+
+/// Returns the text of `html`, with runs separated by spaces.
+[[nodiscard]] inline auto
+cleantext(std::string_view html, Html_Parser parser = Html_Parser::gumbo) -> std::string
+{
+    std::string content;
+    Text_Extractor(parser).extract(html, [&](std::string_view run) {
+        if (run.empty()) {
+            return;
+        }
+        if (not content.empty()) {
+            content.append(" ");
+        }
+        content.append(run);
+    });
     return content;
 }
 
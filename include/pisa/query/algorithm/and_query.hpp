@@ -4,12 +4,20 @@
 #include <cstdint>
 #include <vector>
 
+#include "deleted_documents.hpp"
+#include "query/algorithm/block_intersection.hpp"
 #include "query/queries.hpp"
 #include "util/do_not_optimize_away.hpp"
 
 namespace pisa {
 
+/// Returns the documents containing all query terms.
+///
+/// If `deleted` is not null, the documents whose bits are set are left out of the results
+/// (see `deleted_documents.hpp`).
 struct and_query {
+    explicit and_query(bit_vector const* deleted = nullptr) : m_deleted(deleted) {}
+
     template <typename CursorRange>
     auto operator()(CursorRange&& cursors, uint32_t max_docid) const
     {
@@ -33,6 +41,17 @@ struct and_query {
             return lhs->size() < rhs->size();
         });
 
+        if constexpr (has_block_docids<Cursor>::value) {
+            for_each_block_intersection<false>(
+                ordered_cursors,
+                max_docid,
+                [](Cursor& cursor) -> Cursor& { return cursor; },
+                [](Cursor&, uint32_t) { return 0.0F; },
+                [&](uint32_t docid, float) { results.push_back(docid); },
+                m_deleted);
+            return results;
+        }
+
         uint32_t candidate = ordered_cursors[0]->docid();
         size_t i = 1;
 
@@ -47,7 +66,9 @@ struct and_query {
             }
 
             if (i == ordered_cursors.size()) {
-                results.push_back(candidate);
+                if (not is_deleted(m_deleted, candidate)) {
+                    results.push_back(candidate);
+                }
 
                 ordered_cursors[0]->next();
                 candidate = ordered_cursors[0]->docid();
@@ -56,9 +77,17 @@ struct and_query {
         }
         return results;
     }
+
+  private:
+    bit_vector const* m_deleted;
 };
 
+/// Returns the documents containing all query terms, along with their scores.
+///
+/// If `deleted` is not null, the documents whose bits are set are left out of the results.
 struct scored_and_query {
+    explicit scored_and_query(bit_vector const* deleted = nullptr) : m_deleted(deleted) {}
+
     template <typename CursorRange>
     auto operator()(CursorRange&& cursors, uint32_t max_docid) const
     {
@@ -84,6 +113,20 @@ struct scored_and_query {
             return lhs->docs_enum.size() < rhs->docs_enum.size();
         });
 
+        if constexpr (has_block_docids<typename Cursor::enum_type>::value) {
+            for_each_block_intersection<true>(
+                ordered_cursors,
+                max_docid,
+                [](Cursor& cursor) -> auto& { return cursor.docs_enum; },
+                [](Cursor& cursor, uint32_t docid) {
+                    cursor.docs_enum.next_geq(docid);
+                    return cursor.scorer(docid, cursor.docs_enum.freq());
+                },
+                [&](uint32_t docid, float score) { results.emplace_back(docid, score); },
+                m_deleted);
+            return results;
+        }
+
         uint32_t candidate = ordered_cursors[0]->docs_enum.docid();
         size_t i = 1;
 
@@ -98,12 +141,15 @@ struct scored_and_query {
             }
 
             if (i == ordered_cursors.size()) {
-                auto score = 0.0F;
-                for (i = 0; i < ordered_cursors.size(); ++i) {
-                    score += ordered_cursors[i]->scorer(
-                        ordered_cursors[i]->docs_enum.docid(), ordered_cursors[i]->docs_enum.freq());
+                if (not is_deleted(m_deleted, candidate)) {
+                    auto score = 0.0F;
+                    for (i = 0; i < ordered_cursors.size(); ++i) {
+                        score += ordered_cursors[i]->scorer(
+                            ordered_cursors[i]->docs_enum.docid(),
+                            ordered_cursors[i]->docs_enum.freq());
+                    }
+                    results.emplace_back(candidate, score);
                 }
-                results.emplace_back(candidate, score);
 
                 ordered_cursors[0]->docs_enum.next();
                 candidate = ordered_cursors[0]->docs_enum.docid();
@@ -112,6 +158,9 @@ struct scored_and_query {
         }
         return results;
     }
+
+  private:
+    bit_vector const* m_deleted;
 };
 
 }  // namespace pisa
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "deleted_documents.hpp"
+#include "util/intrinsics.hpp"
+
+namespace pisa {
+
+/// Writes the values found in both of the sorted arrays `a` and `b` to `out`, which must not
+/// alias them, and returns their number.
+///
+/// With AVX2, it runs the V1 algorithm of Lemire et al.: for each value of the shorter array,
+/// it skips the longer array eight values at a time, then compares the value to eight values
+/// at once. The rest is merged with scalar code.
+inline auto
+intersect_sorted(uint32_t const* a, size_t a_size, uint32_t const* b, size_t b_size, uint32_t* out)
+    -> size_t
+{
+    if (a_size > b_size) {
+        std::swap(a, b);
+        std::swap(a_size, b_size);
+    }
+    size_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+#if defined(__AVX2__)
+    while (i < a_size && j + 8 <= b_size) {
+        uint32_t value = a[i];
+        if (b[j + 7] < value) {
+            j += 8;
+            continue;
+        }
+        __m256i values = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + j));
+        __m256i equal = _mm256_cmpeq_epi32(values, _mm256_set1_epi32(value));
+        out[count] = value;
+        count += static_cast<size_t>(_mm256_movemask_ps(_mm256_castsi256_ps(equal)) != 0);
+        ++i;
+    }
+#endif
+    while (i < a_size && j < b_size) {
+        if (a[i] < b[j]) {
+            ++i;
+        } else if (b[j] < a[i]) {
+            ++j;
+        } else {
+            out[count++] = a[i];
+            ++i;
+            ++j;
+        }
+    }
+    return count;
+}
+
+/// Lists longer than this many times the first list are searched with `next_geq` for each
+/// candidate, rather than with `intersect_sorted` for each block.
+constexpr uint64_t skewed_list_ratio = 16;
+
+/// Whether the cursor exposes the docids of its current block (see `block_posting_list`).
+template <typename Enum, typename = void>
+struct has_block_docids: std::false_type {};
+
+template <typename Enum>
+struct has_block_docids<Enum, std::void_t<decltype(std::declval<Enum&>().block_docids())>>
+    : std::true_type {};
+
+/// Intersects the posting lists of `cursors`, sorted by increasing length, one block of the
+/// first list at a time, and calls `fn(docid, score)` for each document of the intersection
+/// lower than `max_docid`, in increasing order. `docs(cursor)` returns the document enumerator
+/// of a cursor, which must satisfy `has_block_docids`.
+///
+/// The docids of a block of the first list are the candidates, filtered by each other list in
+/// turn with `intersect_sorted`, block by block, or with `next_geq` if the list is much longer
+/// (see `skewed_list_ratio`). Blocks whose docid ranges do not overlap are skipped using the
+/// last docid of each block, without being decoded.
+///
+/// If `Scored` is true, `score(cursor, docid)` is called for each cursor and each document of
+/// the intersection, in increasing docid order, and `fn` receives the sum of the scores;
+/// otherwise, `score` is not called and the score is 0.
+///
+/// If `deleted` is not null, deleted documents are dropped from the candidates before any
+/// other list is searched for them or any score is computed.
+template <bool Scored, typename Cursor, typename Docs, typename Score, typename Fn>
+void for_each_block_intersection(
+    std::vector<Cursor*> const& cursors,
+    uint64_t max_docid,
+    Docs docs,
+    Score score,
+    Fn fn,
+    bit_vector const* deleted = nullptr)
+{
+    // Buffers are reused by subsequent queries on this thread to avoid allocations.
+    thread_local std::vector<uint32_t> candidates;
+    thread_local std::vector<uint32_t> matches;
+    thread_local std::vector<float> scores;
+    thread_local std::vector<float> match_scores;
+
+    auto& lead = docs(*cursors[0]);
+    while (lead.docid() < max_docid) {
+        // Moves the lead list to the first block that may overlap all the other lists.
+        bool aligned = true;
+        for (size_t c = 1; c < cursors.size(); ++c) {
+            auto& list = docs(*cursors[c]);
+            list.next_geq_block(lead.docid());
+            if (list.docid() >= max_docid) {
+                return;
+            }
+            if (list.docid() > lead.block_last_docid()) {
+                lead.next_geq(list.docid());
+                aligned = false;
+                break;
+            }
+        }
+        if (not aligned) {
+            continue;
+        }
+
+        auto const* lead_docids = lead.block_docids();
+        candidates.assign(
+            lead_docids + lead.block_position(), lead_docids + lead.current_block_size());
+        if (deleted != nullptr) {
+            candidates.erase(
+                std::remove_if(
+                    candidates.begin(),
+                    candidates.end(),
+                    [&](uint32_t docid) { return (*deleted)[docid]; }),
+                candidates.end());
+        }
+        size_t num_candidates = candidates.size();
+        if constexpr (Scored) {
+            scores.assign(num_candidates, 0.0F);
+        }
+        for (size_t c = 1; c < cursors.size() && num_candidates > 0; ++c) {
+            auto& list = docs(*cursors[c]);
+            matches.resize(num_candidates);
+            if constexpr (Scored) {
+                match_scores.resize(num_candidates);
+            }
+            size_t num_matches = 0;
+            auto add_match = [&](size_t candidate) {
+                matches[num_matches] = candidates[candidate];
+                if constexpr (Scored) {
+                    match_scores[num_matches] =
+                        scores[candidate] + score(*cursors[c], candidates[candidate]);
+                }
+                ++num_matches;
+            };
+            if (list.size() > lead.size() * skewed_list_ratio) {
+                // Candidates are sparse in this list: most of its blocks hold none of them.
+                for (size_t candidate = 0; candidate < num_candidates; ++candidate) {
+                    if (candidates[candidate] > list.docid()) {
+                        list.next_geq(candidates[candidate]);
+                    }
+                    if (candidates[candidate] == list.docid()) {
+                        add_match(candidate);
+                    }
+                }
+            } else {
+                size_t begin = 0;
+                while (begin < num_candidates) {
+                    list.next_geq_block(candidates[begin]);
+                    if (list.docid() >= max_docid) {
+                        break;
+                    }
+                    auto end = begin + 1;
+                    while (end < num_candidates && candidates[end] <= list.block_last_docid()) {
+                        ++end;
+                    }
+                    auto const* list_docids = list.block_docids();
+                    auto found = intersect_sorted(
+                        candidates.data() + begin,
+                        end - begin,
+                        list_docids + list.block_position(),
+                        list.current_block_size() - list.block_position(),
+                        matches.data() + num_matches);
+                    if constexpr (Scored) {
+                        size_t candidate = begin;
+                        for (size_t match = num_matches; match < num_matches + found; ++match) {
+                            while (candidates[candidate] != matches[match]) {
+                                ++candidate;
+                            }
+                            match_scores[match] =
+                                scores[candidate] + score(*cursors[c], matches[match]);
+                        }
+                    }
+                    num_matches += found;
+                    begin = end;
+                }
+            }
+            std::swap(candidates, matches);
+            if constexpr (Scored) {
+                std::swap(scores, match_scores);
+            }
+            num_candidates = num_matches;
+        }
+
+        for (size_t pos = 0; pos < num_candidates; ++pos) {
+            if (candidates[pos] >= max_docid) {
+                break;
+            }
+            if constexpr (Scored) {
+                fn(candidates[pos], scores[pos] + score(*cursors[0], candidates[pos]));
+            } else {
+                fn(candidates[pos], 0.0F);
+            }
+        }
+        lead.next_block();
+    }
+}
+
+}  // namespace pisa
@@ -1,13 +1,18 @@
 #pragma once
 
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
+#include "query/query_budget.hpp"
 #include "topk_queue.hpp"
+#include "util/query_counters.hpp"
 #include <vector>
 
 namespace pisa {
 
 struct block_max_maxscore_query {
-    block_max_maxscore_query(topk_queue& topk) : m_topk(topk) {}
+    block_max_maxscore_query(topk_queue& topk, QueryBudget* budget = nullptr)
+        : m_topk(topk), m_budget(budget)
+    {}
 
     template <typename CursorRange>
     void operator()(CursorRange&& cursors, uint64_t max_docid)
@@ -16,8 +21,9 @@ struct block_max_maxscore_query {
         if (cursors.empty())
             return;
 
-        std::vector<Cursor*> ordered_cursors;
-        ordered_cursors.reserve(cursors.size());
+        // Buffers are reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<Cursor*> ordered_cursors;
+        ordered_cursors.clear();
         for (auto& en: cursors) {
             ordered_cursors.push_back(&en);
         }
@@ -27,7 +33,8 @@ struct block_max_maxscore_query {
             return lhs->max_weight < rhs->max_weight;
         });
 
-        std::vector<float> upper_bounds(ordered_cursors.size());
+        thread_local std::vector<float> upper_bounds;
+        upper_bounds.resize(ordered_cursors.size());
         upper_bounds[0] = ordered_cursors[0]->max_weight;
         for (size_t i = 1; i < ordered_cursors.size(); ++i) {
             upper_bounds[i] = upper_bounds[i - 1] + ordered_cursors[i]->max_weight;
@@ -42,56 +49,72 @@ struct block_max_maxscore_query {
         while (non_essential_lists < ordered_cursors.size() && cur_doc < max_docid) {
             float score = 0;
             uint64_t next_doc = max_docid;
+            uint64_t postings = 0;
+            // Deleted documents are skipped without being scored, and the non-essential lists
+            // are not moved to them.
+            bool deleted = is_deleted(m_topk.deleted(), cur_doc);
             for (size_t i = non_essential_lists; i < ordered_cursors.size(); ++i) {
                 if (ordered_cursors[i]->docs_enum.docid() == cur_doc) {
-                    score += ordered_cursors[i]->scorer(
-                        ordered_cursors[i]->docs_enum.docid(), ordered_cursors[i]->docs_enum.freq());
+                    if (!deleted) {
+                        score += ordered_cursors[i]->scorer(
+                            ordered_cursors[i]->docs_enum.docid(),
+                            ordered_cursors[i]->docs_enum.freq());
+                    }
                     ordered_cursors[i]->docs_enum.next();
+                    postings += 1;
                 }
                 if (ordered_cursors[i]->docs_enum.docid() < next_doc) {
                     next_doc = ordered_cursors[i]->docs_enum.docid();
                 }
             }
 
-            double block_upper_bound =
-                non_essential_lists > 0 ? upper_bounds[non_essential_lists - 1] : 0;
-            for (int i = non_essential_lists - 1; i + 1 > 0; --i) {
-                if (ordered_cursors[i]->w.docid() < cur_doc) {
-                    ordered_cursors[i]->w.next_geq(cur_doc);
-                }
-                block_upper_bound -= ordered_cursors[i]->max_weight
-                    - ordered_cursors[i]->w.score() * ordered_cursors[i]->q_weight;
-                if (!m_topk.would_enter(score + block_upper_bound)) {
-                    break;
-                }
-            }
-            if (m_topk.would_enter(score + block_upper_bound)) {
-                // try to complete evaluation with non-essential lists
-                for (size_t i = non_essential_lists - 1; i + 1 > 0; --i) {
-                    ordered_cursors[i]->docs_enum.next_geq(cur_doc);
-                    if (ordered_cursors[i]->docs_enum.docid() == cur_doc) {
-                        auto s = ordered_cursors[i]->scorer(
-                            ordered_cursors[i]->docs_enum.docid(),
-                            ordered_cursors[i]->docs_enum.freq());
-                        // score += s;
-                        block_upper_bound += s;
+            if (!deleted) {
+                double block_upper_bound =
+                    non_essential_lists > 0 ? upper_bounds[non_essential_lists - 1] : 0;
+                for (int i = non_essential_lists - 1; i + 1 > 0; --i) {
+                    if (ordered_cursors[i]->w.docid() < cur_doc) {
+                        ordered_cursors[i]->w.next_geq(cur_doc);
                     }
-                    block_upper_bound -= ordered_cursors[i]->w.score() * ordered_cursors[i]->q_weight;
-
+                    block_upper_bound -= ordered_cursors[i]->max_weight
+                        - ordered_cursors[i]->w.score() * ordered_cursors[i]->q_weight;
                     if (!m_topk.would_enter(score + block_upper_bound)) {
                         break;
                     }
                 }
-                score += block_upper_bound;
-            }
-            if (m_topk.insert(score, cur_doc)) {
-                // update non-essential lists
-                while (non_essential_lists < ordered_cursors.size()
-                       && !m_topk.would_enter(upper_bounds[non_essential_lists])) {
-                    non_essential_lists += 1;
+                if (m_topk.would_enter(score + block_upper_bound)) {
+                    PISA_QUERY_COUNT(evaluations, 1);
+                    // try to complete evaluation with non-essential lists
+                    for (size_t i = non_essential_lists - 1; i + 1 > 0; --i) {
+                        ordered_cursors[i]->docs_enum.next_geq(cur_doc);
+                        postings += 1;
+                        if (ordered_cursors[i]->docs_enum.docid() == cur_doc) {
+                            auto s = ordered_cursors[i]->scorer(
+                                ordered_cursors[i]->docs_enum.docid(),
+                                ordered_cursors[i]->docs_enum.freq());
+                            // score += s;
+                            block_upper_bound += s;
+                        }
+                        block_upper_bound -=
+                            ordered_cursors[i]->w.score() * ordered_cursors[i]->q_weight;
+
+                        if (!m_topk.would_enter(score + block_upper_bound)) {
+                            break;
+                        }
+                    }
+                    score += block_upper_bound;
+                }
+                if (m_topk.insert(score, cur_doc)) {
+                    // update non-essential lists
+                    while (non_essential_lists < ordered_cursors.size()
+                           && !m_topk.would_enter(upper_bounds[non_essential_lists])) {
+                        non_essential_lists += 1;
+                    }
                 }
             }
             cur_doc = next_doc;
+            if (m_budget != nullptr && cur_doc < max_docid && m_budget->spend(postings, cur_doc)) {
+                break;
+            }
         }
     }
 
@@ -99,5 +122,6 @@ struct block_max_maxscore_query {
 
   private:
     topk_queue& m_topk;
+    QueryBudget* m_budget;
 };
 }  // namespace pisa
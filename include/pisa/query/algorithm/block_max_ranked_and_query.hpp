@@ -1,7 +1,9 @@
 #pragma once
 
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
 #include "topk_queue.hpp"
+#include "util/query_counters.hpp"
 #include <vector>
 
 namespace pisa {
@@ -17,8 +19,9 @@ struct block_max_ranked_and_query {
         if (cursors.empty())
             return;
 
-        std::vector<Cursor*> ordered_cursors;
-        ordered_cursors.reserve(cursors.size());
+        // Buffers are reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<Cursor*> ordered_cursors;
+        ordered_cursors.clear();
         for (auto& en: cursors) {
             ordered_cursors.push_back(&en);
         }
@@ -49,15 +52,19 @@ struct block_max_ranked_and_query {
                     }
                 }
                 if (candidate_list == ordered_cursors.size()) {
-                    float score = 0;
-                    for (candidate_list = 0; candidate_list < ordered_cursors.size();
-                         ++candidate_list) {
-                        score += ordered_cursors[candidate_list]->scorer(
-                            ordered_cursors[candidate_list]->docs_enum.docid(),
-                            ordered_cursors[candidate_list]->docs_enum.freq());
-                    }
+                    // Deleted documents are skipped without being scored.
+                    if (!is_deleted(m_topk.deleted(), candidate)) {
+                        float score = 0;
+                        for (candidate_list = 0; candidate_list < ordered_cursors.size();
+                             ++candidate_list) {
+                            score += ordered_cursors[candidate_list]->scorer(
+                                ordered_cursors[candidate_list]->docs_enum.docid(),
+                                ordered_cursors[candidate_list]->docs_enum.freq());
+                        }
 
-                    m_topk.insert(score, ordered_cursors[0]->docs_enum.docid());
+                        PISA_QUERY_COUNT(evaluations, 1);
+                        m_topk.insert(score, candidate);
+                    }
                     ordered_cursors[0]->docs_enum.next();
                     candidate = ordered_cursors[0]->docs_enum.docid();
                     candidate_list = 1;
@@ -1,12 +1,17 @@
 #pragma once
 
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
+#include "query/query_budget.hpp"
 #include "topk_queue.hpp"
+#include "util/query_counters.hpp"
 #include <vector>
 namespace pisa {
 
 struct block_max_wand_query {
-    block_max_wand_query(topk_queue& topk) : m_topk(topk) {}
+    block_max_wand_query(topk_queue& topk, QueryBudget* budget = nullptr)
+        : m_topk(topk), m_budget(budget)
+    {}
 
     template <typename CursorRange>
     void operator()(CursorRange&& cursors, uint64_t max_docid)
@@ -15,8 +20,9 @@ struct block_max_wand_query {
         if (cursors.empty())
             return;
 
-        std::vector<Cursor*> ordered_cursors;
-        ordered_cursors.reserve(cursors.size());
+        // Buffers are reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<Cursor*> ordered_cursors;
+        ordered_cursors.clear();
         for (auto& en: cursors) {
             ordered_cursors.push_back(&en);
         }
@@ -58,7 +64,9 @@ struct block_max_wand_query {
             if (!found_pivot) {
                 break;
             }
+            PISA_QUERY_COUNT(pivots, 1);
 
+            uint64_t postings = 1;
             double block_upper_bound = 0;
 
             for (size_t i = 0; i < pivot + 1; ++i) {
@@ -71,7 +79,20 @@ struct block_max_wand_query {
 
             if (m_topk.would_enter(block_upper_bound)) {
                 // check if pivot is a possible match
-                if (pivot_id == ordered_cursors[0]->docs_enum.docid()) {
+                if (is_deleted(m_topk.deleted(), pivot_id)) {
+                    // A deleted pivot is skipped without being scored: the lists up to the pivot
+                    // move past it, since no document before it can enter the top-k either.
+                    postings = 0;
+                    for (Cursor* en: ordered_cursors) {
+                        if (en->docs_enum.docid() > pivot_id) {
+                            break;
+                        }
+                        en->docs_enum.next_geq(pivot_id + 1);
+                        postings += 1;
+                    }
+                    sort_cursors();
+                } else if (pivot_id == ordered_cursors[0]->docs_enum.docid()) {
+                    PISA_QUERY_COUNT(evaluations, 1);
                     float score = 0;
                     for (Cursor* en: ordered_cursors) {
                         if (en->docs_enum.docid() != pivot_id) {
@@ -84,11 +105,13 @@ struct block_max_wand_query {
                             break;
                         }
                     }
+                    postings = 0;
                     for (Cursor* en: ordered_cursors) {
                         if (en->docs_enum.docid() != pivot_id) {
                             break;
                         }
                         en->docs_enum.next();
+                        postings += 1;
                     }
 
                     m_topk.insert(score, pivot_id);
@@ -154,6 +177,10 @@ struct block_max_wand_query {
                     }
                 }
             }
+            if (m_budget != nullptr && ordered_cursors[0]->docs_enum.docid() < max_docid
+                && m_budget->spend(postings, ordered_cursors[0]->docs_enum.docid())) {
+                break;
+            }
         }
     }
 
@@ -165,6 +192,7 @@ struct block_max_wand_query {
 
   private:
     topk_queue& m_topk;
+    QueryBudget* m_budget;
 };
 
 }  // namespace pisa
@@ -1,13 +1,18 @@
 #pragma once
 
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
+#include "query/query_budget.hpp"
 #include "topk_queue.hpp"
+#include "util/query_counters.hpp"
 #include <vector>
 
 namespace pisa {
 
 struct maxscore_query {
-    maxscore_query(topk_queue& topk) : m_topk(topk) {}
+    maxscore_query(topk_queue& topk, QueryBudget* budget = nullptr)
+        : m_topk(topk), m_budget(budget)
+    {}
 
     template <typename CursorRange>
     void operator()(CursorRange&& cursors, uint64_t max_docid)
@@ -16,8 +21,9 @@ struct maxscore_query {
         if (cursors.empty())
             return;
 
-        std::vector<Cursor*> ordered_cursors;
-        ordered_cursors.reserve(cursors.size());
+        // Buffers are reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<Cursor*> ordered_cursors;
+        ordered_cursors.clear();
         for (auto& en: cursors) {
             ordered_cursors.push_back(&en);
         }
@@ -27,7 +33,8 @@ struct maxscore_query {
             return lhs->max_weight < rhs->max_weight;
         });
 
-        std::vector<float> upper_bounds(ordered_cursors.size());
+        thread_local std::vector<float> upper_bounds;
+        upper_bounds.resize(ordered_cursors.size());
         upper_bounds[0] = ordered_cursors[0]->max_weight;
         for (size_t i = 1; i < ordered_cursors.size(); ++i) {
             upper_bounds[i] = upper_bounds[i - 1] + ordered_cursors[i]->max_weight;
@@ -50,34 +57,50 @@ struct maxscore_query {
         while (non_essential_lists < ordered_cursors.size() && cur_doc < max_docid) {
             float score = 0;
             uint64_t next_doc = max_docid;
+            uint64_t postings = 0;
+            // Deleted documents are skipped without being scored, and the non-essential lists
+            // are not moved to them.
+            bool deleted = is_deleted(m_topk.deleted(), cur_doc);
             for (size_t i = non_essential_lists; i < ordered_cursors.size(); ++i) {
                 if (ordered_cursors[i]->docs_enum.docid() == cur_doc) {
-                    score += ordered_cursors[i]->scorer(
-                        ordered_cursors[i]->docs_enum.docid(), ordered_cursors[i]->docs_enum.freq());
+                    if (!deleted) {
+                        score += ordered_cursors[i]->scorer(
+                            ordered_cursors[i]->docs_enum.docid(),
+                            ordered_cursors[i]->docs_enum.freq());
+                    }
                     ordered_cursors[i]->docs_enum.next();
+                    postings += 1;
                 }
                 if (ordered_cursors[i]->docs_enum.docid() < next_doc) {
                     next_doc = ordered_cursors[i]->docs_enum.docid();
                 }
             }
 
-            // try to complete evaluation with non-essential lists
-            for (size_t i = non_essential_lists - 1; i + 1 > 0; --i) {
-                if (!m_topk.would_enter(score + upper_bounds[i])) {
-                    break;
+            if (!deleted) {
+                PISA_QUERY_COUNT(evaluations, 1);
+                // try to complete evaluation with non-essential lists
+                for (size_t i = non_essential_lists - 1; i + 1 > 0; --i) {
+                    if (!m_topk.would_enter(score + upper_bounds[i])) {
+                        break;
+                    }
+                    ordered_cursors[i]->docs_enum.next_geq(cur_doc);
+                    postings += 1;
+                    if (ordered_cursors[i]->docs_enum.docid() == cur_doc) {
+                        score += ordered_cursors[i]->scorer(
+                            ordered_cursors[i]->docs_enum.docid(),
+                            ordered_cursors[i]->docs_enum.freq());
+                    }
                 }
-                ordered_cursors[i]->docs_enum.next_geq(cur_doc);
-                if (ordered_cursors[i]->docs_enum.docid() == cur_doc) {
-                    score += ordered_cursors[i]->scorer(
-                        ordered_cursors[i]->docs_enum.docid(), ordered_cursors[i]->docs_enum.freq());
-                }
-            }
 
-            if (m_topk.insert(score, cur_doc)) {
-                update_non_essential_lists();
+                if (m_topk.insert(score, cur_doc)) {
+                    update_non_essential_lists();
+                }
             }
 
             cur_doc = next_doc;
+            if (m_budget != nullptr && cur_doc < max_docid && m_budget->spend(postings, cur_doc)) {
+                break;
+            }
         }
     }
 
@@ -85,6 +108,7 @@ struct maxscore_query {
 
   private:
     topk_queue& m_topk;
+    QueryBudget* m_budget;
 };
 
 }  // namespace pisa
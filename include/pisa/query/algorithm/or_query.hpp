@@ -1,12 +1,19 @@
 #pragma once
 
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
 #include <vector>
 
 namespace pisa {
 
+/// Counts the documents containing any query term.
+///
+/// If `deleted` is not null, the documents whose bits are set are not counted
+/// (see `deleted_documents.hpp`).
 template <bool with_freqs>
 struct or_query {
+    explicit or_query(bit_vector const* deleted = nullptr) : m_deleted(deleted) {}
+
     template <typename CursorRange>
     uint64_t operator()(CursorRange&& cursors, uint64_t max_docid) const
     {
@@ -21,7 +28,9 @@ struct or_query {
             })->docid();
 
         while (cur_doc < max_docid) {
-            results += 1;
+            if (not is_deleted(m_deleted, cur_doc)) {
+                results += 1;
+            }
             uint64_t next_doc = max_docid;
             for (size_t i = 0; i < cursors.size(); ++i) {
                 if (cursors[i].docid() == cur_doc) {
@@ -40,6 +49,9 @@ struct or_query {
 
         return results;
     }
+
+  private:
+    bit_vector const* m_deleted;
 };
 
 }  // namespace pisa
\ No newline at end of file
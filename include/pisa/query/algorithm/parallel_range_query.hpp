@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
+#include "query/queries.hpp"
+#include "query/query_context.hpp"
+#include "topk_queue.hpp"
+#include "util/util.hpp"
+
+namespace pisa {
+
+/// Processes a query over docid ranges in parallel.
+///
+/// Unlike `range_query`, each range is processed as a separate TBB task with its own cursors,
+/// moved to the beginning of the range with `next_geq`, and its own top-k queue. The queues
+/// share their threshold (see `topk_queue::share_threshold`), so that results found in one
+/// range raise the pruning threshold of all others. Local results are merged into `topk`.
+///
+/// The cursors and the top-k queue of a range are held in a `QueryContext<Cursor>` per thread,
+/// reused by the ranges and queries it processes next, so that once each thread has processed
+/// the longest query, a range no longer allocates.
+template <typename QueryAlg, typename Cursor>
+struct parallel_range_query {
+    explicit parallel_range_query(topk_queue& topk) : m_topk(topk) {}
+
+    /// `make_cursors(context)` is called once per range with a `QueryContext<Cursor>`, and must
+    /// build fresh cursors for the query in it, e.g., with the `make_*_cursors` overloads taking
+    /// a context, and return them.
+    template <typename CursorFactory>
+    void operator()(CursorFactory&& make_cursors, uint64_t max_docid, size_t range_size)
+    {
+        size_t num_ranges = ceil_div(max_docid, range_size);
+        std::atomic<Threshold> threshold(m_topk.threshold());
+        std::vector<topk_queue::entry_type> results;
+        std::mutex results_mutex;
+        tbb::parallel_for(size_t(0), num_ranges, [&](size_t range) {
+            uint64_t first = range * range_size;
+            uint64_t last = std::min<uint64_t>(first + range_size, max_docid);
+            // A range runs to completion on its thread, so the context is never shared.
+            thread_local std::optional<QueryContext<Cursor>> context;
+            if (!context || context->topk.size() != m_topk.size()
+                || context->topk.deleted() != m_topk.deleted()) {
+                context.emplace(m_topk.size(), m_topk.deleted());
+            }
+            context->reset(threshold.load(std::memory_order_relaxed));
+            auto& cursors = make_cursors(*context);
+            if (cursors.empty()) {
+                return;
+            }
+            for (auto&& cursor: cursors) {
+                cursor.docs_enum.next_geq(first);
+            }
+            context->topk.share_threshold(&threshold);
+            QueryAlg query_alg(context->topk);
+            query_alg(cursors, last);
+            context->topk.share_threshold(nullptr);
+            context->topk.finalize();
+            std::lock_guard<std::mutex> lock(results_mutex);
+            results.insert(results.end(), context->topk.topk().begin(), context->topk.topk().end());
+        });
+        // Ranges finish in any order: sorting makes the merged top-k deterministic.
+        std::sort(results.begin(), results.end(), [](auto const& lhs, auto const& rhs) {
+            return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+        });
+        for (auto const& [score, docid]: results) {
+            if (!m_topk.would_enter(score)) {
+                break;
+            }
+            m_topk.insert(score, docid);
+        }
+    }
+
+    /// Splits the documents in a few ranges per available worker thread.
+    template <typename CursorFactory>
+    void operator()(CursorFactory&& make_cursors, uint64_t max_docid)
+    {
+        size_t range_size = std::max<size_t>(
+            ceil_div(max_docid, ranges_per_thread * tbb::this_task_arena::max_concurrency()),
+            min_range_size);
+        operator()(std::forward<CursorFactory>(make_cursors), max_docid, range_size);
+    }
+
+    std::vector<std::pair<float, uint64_t>> const& topk() const { return m_topk.topk(); }
+
+    constexpr static size_t ranges_per_thread = 4;
+    constexpr static size_t min_range_size = 1U << 16U;
+
+  private:
+    topk_queue& m_topk;
+};
+
+}  // namespace pisa
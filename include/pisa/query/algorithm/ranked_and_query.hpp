@@ -1,7 +1,10 @@
 #pragma once
 
+#include "query/algorithm/block_intersection.hpp"
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
 #include "topk_queue.hpp"
+#include "util/query_counters.hpp"
 #include <vector>
 
 namespace pisa {
@@ -16,8 +19,9 @@ struct ranked_and_query {
         if (cursors.empty())
             return;
 
-        std::vector<Cursor*> ordered_cursors;
-        ordered_cursors.reserve(cursors.size());
+        // Buffers are reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<Cursor*> ordered_cursors;
+        ordered_cursors.clear();
         for (auto& en: cursors) {
             ordered_cursors.push_back(&en);
         }
@@ -27,6 +31,23 @@ struct ranked_and_query {
             return lhs->docs_enum.size() < rhs->docs_enum.size();
         });
 
+        if constexpr (has_block_docids<typename Cursor::enum_type>::value) {
+            for_each_block_intersection<true>(
+                ordered_cursors,
+                max_docid,
+                [](Cursor& cursor) -> auto& { return cursor.docs_enum; },
+                [](Cursor& cursor, uint32_t docid) {
+                    cursor.docs_enum.next_geq(docid);
+                    return cursor.scorer(docid, cursor.docs_enum.freq());
+                },
+                [&](uint32_t docid, float score) {
+                    PISA_QUERY_COUNT(evaluations, 1);
+                    m_topk.insert(score, docid);
+                },
+                m_topk.deleted());
+            return;
+        }
+
         uint64_t candidate = ordered_cursors[0]->docs_enum.docid();
         size_t i = 1;
         while (candidate < max_docid) {
@@ -40,13 +61,18 @@ struct ranked_and_query {
             }
 
             if (i == ordered_cursors.size()) {
-                float score = 0;
-                for (i = 0; i < ordered_cursors.size(); ++i) {
-                    score += ordered_cursors[i]->scorer(
-                        ordered_cursors[i]->docs_enum.docid(), ordered_cursors[i]->docs_enum.freq());
-                }
+                // Deleted documents are skipped without being scored.
+                if (!is_deleted(m_topk.deleted(), candidate)) {
+                    float score = 0;
+                    for (i = 0; i < ordered_cursors.size(); ++i) {
+                        score += ordered_cursors[i]->scorer(
+                            ordered_cursors[i]->docs_enum.docid(),
+                            ordered_cursors[i]->docs_enum.freq());
+                    }
 
-                m_topk.insert(score, ordered_cursors[0]->docs_enum.docid());
+                    PISA_QUERY_COUNT(evaluations, 1);
+                    m_topk.insert(score, candidate);
+                }
                 ordered_cursors[0]->docs_enum.next();
                 candidate = ordered_cursors[0]->docs_enum.docid();
                 i = 1;
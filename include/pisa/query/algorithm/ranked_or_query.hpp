@@ -1,14 +1,19 @@
 #pragma once
 
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
+#include "query/query_budget.hpp"
 #include "topk_queue.hpp"
+#include "util/query_counters.hpp"
 #include <string>
 #include <vector>
 
 namespace pisa {
 
 struct ranked_or_query {
-    ranked_or_query(topk_queue& topk) : m_topk(topk) {}
+    ranked_or_query(topk_queue& topk, QueryBudget* budget = nullptr)
+        : m_topk(topk), m_budget(budget)
+    {}
 
     template <typename CursorRange>
     void operator()(CursorRange&& cursors, uint64_t max_docid)
@@ -24,19 +29,31 @@ struct ranked_or_query {
         while (cur_doc < max_docid) {
             float score = 0;
             uint64_t next_doc = max_docid;
+            uint64_t postings = 0;
+            // Deleted documents are skipped without being scored.
+            bool deleted = is_deleted(m_topk.deleted(), cur_doc);
             for (size_t i = 0; i < cursors.size(); ++i) {
                 if (cursors[i].docs_enum.docid() == cur_doc) {
-                    score +=
-                        cursors[i].scorer(cursors[i].docs_enum.docid(), cursors[i].docs_enum.freq());
+                    if (!deleted) {
+                        score += cursors[i].scorer(
+                            cursors[i].docs_enum.docid(), cursors[i].docs_enum.freq());
+                    }
                     cursors[i].docs_enum.next();
+                    postings += 1;
                 }
                 if (cursors[i].docs_enum.docid() < next_doc) {
                     next_doc = cursors[i].docs_enum.docid();
                 }
             }
 
-            m_topk.insert(score, cur_doc);
+            if (!deleted) {
+                PISA_QUERY_COUNT(evaluations, 1);
+                m_topk.insert(score, cur_doc);
+            }
             cur_doc = next_doc;
+            if (m_budget != nullptr && cur_doc < max_docid && m_budget->spend(postings, cur_doc)) {
+                break;
+            }
         }
     }
 
@@ -44,6 +61,7 @@ struct ranked_or_query {
 
   private:
     topk_queue& m_topk;
+    QueryBudget* m_budget;
 };
 
 }  // namespace pisa
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "query/queries.hpp"
+#include "query/query_budget.hpp"
 #include "topk_queue.hpp"
 #include "util/intrinsics.hpp"
+#include "util/query_counters.hpp"
 
 #include "accumulator/simple_accumulator.hpp"
 
@@ -12,7 +14,9 @@ namespace pisa {
 
 class ranked_or_taat_query {
   public:
-    ranked_or_taat_query(topk_queue& topk) : m_topk(topk) {}
+    ranked_or_taat_query(topk_queue& topk, QueryBudget* budget = nullptr)
+        : m_topk(topk), m_budget(budget)
+    {}
 
     template <typename CursorRange, typename Acc>
     void operator()(CursorRange&& cursors, uint64_t max_docid, Acc&& accumulator)
@@ -23,13 +27,24 @@ class ranked_or_taat_query {
         }
         accumulator.init();
 
-        for (auto&& cursor: cursors) {
+        for (size_t term = 0; term < cursors.size(); ++term) {
+            auto& cursor = cursors[term];
+            // Scores are exact only for the documents already reached in the last list.
+            bool last = term + 1 == cursors.size();
             while (cursor.docs_enum.docid() < max_docid) {
+                if (m_budget != nullptr
+                    && m_budget->spend(1, last ? cursor.docs_enum.docid() : 0)) {
+                    break;
+                }
+                PISA_QUERY_COUNT(evaluations, 1);
                 accumulator.accumulate(
                     cursor.docs_enum.docid(),
                     cursor.scorer(cursor.docs_enum.docid(), cursor.docs_enum.freq()));
                 cursor.docs_enum.next();
             }
+            if (m_budget != nullptr && m_budget->exhausted()) {
+                break;
+            }
         }
         accumulator.aggregate(m_topk);
     }
@@ -38,6 +53,7 @@ class ranked_or_taat_query {
 
   private:
     topk_queue& m_topk;
+    QueryBudget* m_budget;
 };
 
 };  // namespace pisa
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "query/queries.hpp"
+#include "topk_queue.hpp"
+#include "util/query_counters.hpp"
+
+namespace pisa {
+
+/// Score-at-a-time processing over an `impact_ordered_index`.
+///
+/// Segments of all query terms are processed in decreasing order of impact, adding each
+/// impact, multiplied by the frequency of the term in the query (see `impact_cursor`), to the
+/// accumulators of the segment's documents. Processing stops after
+/// `postings_budget` postings, in which case the results are an approximation of the
+/// exhaustive top-k computed from the highest-impact postings (anytime ranking).
+class saat_query {
+  public:
+    explicit saat_query(
+        topk_queue& topk, uint64_t postings_budget = std::numeric_limits<uint64_t>::max())
+        : m_topk(topk), m_postings_budget(postings_budget)
+    {}
+
+    template <typename CursorRange, typename Acc>
+    void operator()(CursorRange&& cursors, uint64_t /* max_docid */, Acc&& accumulator)
+    {
+        m_postings = 0;
+        m_early_terminated = false;
+        if (cursors.empty()) {
+            return;
+        }
+        accumulator.init();
+
+        // Reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<segment_entry> order;
+        order.clear();
+        for (uint32_t term = 0; term < cursors.size(); ++term) {
+            auto const& segments = cursors[term].segments;
+            for (uint32_t idx = 0; idx < segments.num_segments(); ++idx) {
+                order.push_back({segments.impact(idx) * cursors[term].q_weight, term, idx});
+            }
+        }
+        std::stable_sort(order.begin(), order.end(), [](auto const& lhs, auto const& rhs) {
+            return lhs.impact > rhs.impact;
+        });
+
+        for (auto const& entry: order) {
+            if (m_postings >= m_postings_budget) {
+                m_early_terminated = true;
+                break;
+            }
+            auto segment = cursors[entry.term].segments[entry.segment];
+            auto n = std::min(segment.size(), m_postings_budget - m_postings);
+            auto score = static_cast<float>(entry.impact);
+            segment.for_each(n, [&](auto docid) { accumulator.accumulate(docid, score); });
+            PISA_QUERY_COUNT(evaluations, n);
+            m_postings += n;
+            m_early_terminated = n < segment.size();
+        }
+        accumulator.aggregate(m_topk);
+    }
+
+    std::vector<std::pair<float, uint64_t>> const& topk() const { return m_topk.topk(); }
+
+    /// Number of postings processed by the last query.
+    [[nodiscard]] auto postings() const -> uint64_t { return m_postings; }
+
+    /// Whether the last query was stopped by the postings budget.
+    [[nodiscard]] auto early_terminated() const -> bool { return m_early_terminated; }
+
+  private:
+    struct segment_entry {
+        uint32_t impact;
+        uint32_t term;
+        uint32_t segment;
+    };
+
+    topk_queue& m_topk;
+    uint64_t m_postings_budget;
+    uint64_t m_postings = 0;
+    bool m_early_terminated = false;
+};
+
+}  // namespace pisa
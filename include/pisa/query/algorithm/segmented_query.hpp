@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <gsl/span>
+#include <tbb/parallel_for.h>
+
+#include "topk_queue.hpp"
+
+namespace pisa {
+
+/// Processes a query over the segments of a segmented index (see `segmented_index.hpp`).
+///
+/// Each segment is processed as a separate TBB task with its own cursors and top-k queue, as in
+/// `parallel_range_query`, and the queues share their threshold. The docids of each segment are
+/// shifted by the number of documents of the previous segments when merged into `topk`. Since
+/// their scores are compared, all segments must be scored with the statistics of the whole index
+/// (see `Segmented_Index_Writer`).
+template <typename QueryAlg>
+struct segmented_query {
+    explicit segmented_query(topk_queue& topk) : m_topk(topk) {}
+
+    /// `make_cursors(segment)` must return the cursors of the query over the segment, which has
+    /// `num_docs[segment]` documents. If `deleted` is not empty, `deleted[segment]` holds the
+    /// deleted documents of the segment, in its own docids, or is null if it has none.
+    template <typename CursorFactory>
+    void operator()(
+        CursorFactory&& make_cursors,
+        gsl::span<std::uint64_t const> num_docs,
+        gsl::span<bit_vector const* const> deleted = {})
+    {
+        std::vector<std::uint64_t> offsets(num_docs.size(), 0);
+        for (std::size_t segment = 1; segment < num_docs.size(); ++segment) {
+            offsets[segment] = offsets[segment - 1] + num_docs[segment - 1];
+        }
+        std::atomic<Threshold> threshold(m_topk.threshold());
+        std::vector<std::vector<topk_queue::entry_type>> results(num_docs.size());
+        tbb::parallel_for(std::size_t(0), std::size_t(num_docs.size()), [&](std::size_t segment) {
+            auto cursors = make_cursors(segment);
+            if (cursors.empty()) {
+                return;
+            }
+            topk_queue topk(m_topk.size(), deleted.empty() ? nullptr : deleted[segment]);
+            topk.set_threshold(threshold.load(std::memory_order_relaxed));
+            topk.share_threshold(&threshold);
+            QueryAlg query_alg(topk);
+            query_alg(cursors, num_docs[segment]);
+            topk.finalize();
+            results[segment] = topk.topk();
+        });
+        for (std::size_t segment = 0; segment < results.size(); ++segment) {
+            for (auto const& [score, docid]: results[segment]) {
+                m_topk.insert(score, docid + offsets[segment]);
+            }
+        }
+    }
+
+    std::vector<std::pair<float, uint64_t>> const& topk() const { return m_topk.topk(); }
+
+  private:
+    topk_queue& m_topk;
+};
+
+}  // namespace pisa
@@ -2,13 +2,17 @@
 
 #include <vector>
 
+#include "deleted_documents.hpp"
 #include "query/queries.hpp"
+#include "query/query_budget.hpp"
 #include "topk_queue.hpp"
+#include "util/query_counters.hpp"
 
 namespace pisa {
 
 struct wand_query {
-    wand_query(topk_queue& topk) : m_topk(topk) {}
+    wand_query(topk_queue& topk, QueryBudget* budget = nullptr) : m_topk(topk), m_budget(budget)
+    {}
 
     template <typename CursorRange>
     void operator()(CursorRange&& cursors, uint64_t max_docid)
@@ -17,8 +21,9 @@ struct wand_query {
         if (cursors.empty())
             return;
 
-        std::vector<Cursor*> ordered_cursors;
-        ordered_cursors.reserve(cursors.size());
+        // Buffers are reused by subsequent queries on this thread to avoid allocations.
+        thread_local std::vector<Cursor*> ordered_cursors;
+        ordered_cursors.clear();
         for (auto& en: cursors) {
             ordered_cursors.push_back(&en);
         }
@@ -51,17 +56,34 @@ struct wand_query {
             if (!found_pivot) {
                 break;
             }
+            PISA_QUERY_COUNT(pivots, 1);
 
             // check if pivot is a possible match
             uint64_t pivot_id = ordered_cursors[pivot]->docs_enum.docid();
-            if (pivot_id == ordered_cursors[0]->docs_enum.docid()) {
+            uint64_t postings = 1;
+            if (is_deleted(m_topk.deleted(), pivot_id)) {
+                // A deleted pivot is skipped without being scored: the lists up to the pivot
+                // move past it, since no document before it can enter the top-k either.
+                postings = 0;
+                for (Cursor* en: ordered_cursors) {
+                    if (en->docs_enum.docid() > pivot_id) {
+                        break;
+                    }
+                    en->docs_enum.next_geq(pivot_id + 1);
+                    postings += 1;
+                }
+                sort_enums();
+            } else if (pivot_id == ordered_cursors[0]->docs_enum.docid()) {
+                PISA_QUERY_COUNT(evaluations, 1);
                 float score = 0;
+                postings = 0;
                 for (Cursor* en: ordered_cursors) {
                     if (en->docs_enum.docid() != pivot_id) {
                         break;
                     }
                     score += en->scorer(en->docs_enum.docid(), en->docs_enum.freq());
                     en->docs_enum.next();
+                    postings += 1;
                 }
 
                 m_topk.insert(score, pivot_id);
@@ -83,6 +105,11 @@ struct wand_query {
                     }
                 }
             }
+            // All the cursors are past the documents processed so far.
+            if (m_budget != nullptr && ordered_cursors[0]->docs_enum.docid() < max_docid
+                && m_budget->spend(postings, ordered_cursors[0]->docs_enum.docid())) {
+                break;
+            }
         }
     }
 
@@ -90,6 +117,7 @@ struct wand_query {
 
   private:
     topk_queue& m_topk;
+    QueryBudget* m_budget;
 };
 
 }  // namespace pisa
\ No newline at end of file
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "query/queries.hpp"
+
+namespace pisa {
+
+/// Cheap features of a query used to predict the processing time of each algorithm:
+/// a constant (bias) term, the number of unique terms, the logarithms of the shortest, longest,
+/// and total posting list lengths, and the score skew, i.e., the fraction of the sum of
+/// the term upper bounds contributed by the highest one.
+///
+/// As in the query algorithms, a repeated term is processed as a single posting list whose
+/// scores are weighted by its number of occurrences (see `query_freqs`).
+struct QueryFeatures {
+    static constexpr std::size_t size = 6;
+    std::array<double, size> values{};
+
+    /// Computes the features of `query` from the term statistics stored in `wdata`.
+    /// Only reads the terms once, so it is negligible compared to processing the query.
+    template <typename Wand>
+    [[nodiscard]] static auto compute(Wand const& wdata, Query const& query) -> QueryFeatures
+    {
+        double shortest = std::numeric_limits<double>::max();
+        double longest = 0;
+        double total = 0;
+        float max_weight = 0;
+        float sum_weights = 0;
+        auto term_freqs = query_freqs(query.terms);
+        for (auto [term, freq]: term_freqs) {
+            auto length = static_cast<double>(wdata.term_posting_count(term));
+            shortest = std::min(shortest, length);
+            longest = std::max(longest, length);
+            total += length;
+            auto weight = freq * wdata.max_term_weight(term);
+            max_weight = std::max(max_weight, weight);
+            sum_weights += weight;
+        }
+        if (term_freqs.empty()) {
+            shortest = 0;
+        }
+        QueryFeatures features;
+        features.values = {
+            1.0,
+            static_cast<double>(term_freqs.size()),
+            std::log2(1.0 + shortest),
+            std::log2(1.0 + longest),
+            std::log2(1.0 + total),
+            sum_weights > 0 ? max_weight / sum_weights : 1.0};
+        return features;
+    }
+};
+
+/// Picks the algorithm expected to process a query the fastest.
+///
+/// For each candidate algorithm, the selector holds a linear model predicting the logarithm
+/// of the processing time of a query from its `QueryFeatures`. The models are fitted offline
+/// from the per-query times of `queries --extract` (see `train_algorithm_selector`), and stored
+/// as a small text file with one line per algorithm: its name followed by its coefficients.
+class AlgorithmSelector {
+  public:
+    /// Features and processing time of a query with a given algorithm.
+    struct Sample {
+        QueryFeatures features;
+        double usecs;
+    };
+
+    AlgorithmSelector() = default;
+
+    /// Fits a model per algorithm with ridge regression, where `ridge` is the weight
+    /// of the regularization of the (non-bias) coefficients.
+    [[nodiscard]] static auto train(
+        std::map<std::string, std::vector<Sample>> const& samples, double ridge = 1e-3)
+        -> AlgorithmSelector
+    {
+        AlgorithmSelector selector;
+        for (auto const& [algorithm, algorithm_samples]: samples) {
+            if (algorithm_samples.empty()) {
+                continue;
+            }
+            selector.m_algorithms.push_back(algorithm);
+            selector.m_coefficients.push_back(fit(algorithm_samples, ridge));
+        }
+        return selector;
+    }
+
+    /// Reads a model written by `write`.
+    [[nodiscard]] static auto read(std::istream& is) -> AlgorithmSelector
+    {
+        AlgorithmSelector selector;
+        std::string line;
+        while (std::getline(is, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            std::string algorithm;
+            coefficients_type coefficients{};
+            fields >> algorithm;
+            for (auto& coefficient: coefficients) {
+                if (!(fields >> coefficient)) {
+                    throw std::invalid_argument("Invalid algorithm selector model: " + line);
+                }
+            }
+            selector.m_algorithms.push_back(algorithm);
+            selector.m_coefficients.push_back(coefficients);
+        }
+        if (selector.m_algorithms.empty()) {
+            throw std::invalid_argument("Algorithm selector model has no algorithms");
+        }
+        return selector;
+    }
+
+    void write(std::ostream& os) const
+    {
+        os << "# algorithm";
+        for (std::size_t idx = 0; idx < QueryFeatures::size; ++idx) {
+            os << "\tc" << idx;
+        }
+        os << '\n' << std::setprecision(std::numeric_limits<double>::max_digits10);
+        for (std::size_t alg = 0; alg < m_algorithms.size(); ++alg) {
+            os << m_algorithms[alg];
+            for (auto coefficient: m_coefficients[alg]) {
+                os << '\t' << coefficient;
+            }
+            os << '\n';
+        }
+    }
+
+    [[nodiscard]] auto algorithms() const -> std::vector<std::string> const&
+    {
+        return m_algorithms;
+    }
+
+    /// Returns the predicted processing time of algorithm `alg` in microseconds.
+    [[nodiscard]] auto predict(std::size_t alg, QueryFeatures const& features) const -> double
+    {
+        double log_usecs = 0;
+        for (std::size_t idx = 0; idx < QueryFeatures::size; ++idx) {
+            log_usecs += m_coefficients[alg][idx] * features.values[idx];
+        }
+        return std::expm1(log_usecs);
+    }
+
+    /// Returns the position in `algorithms()` of the algorithm with the lowest predicted time.
+    [[nodiscard]] auto select(QueryFeatures const& features) const -> std::size_t
+    {
+        std::size_t selected = 0;
+        double best = std::numeric_limits<double>::max();
+        for (std::size_t alg = 0; alg < m_algorithms.size(); ++alg) {
+            if (auto usecs = predict(alg, features); usecs < best) {
+                best = usecs;
+                selected = alg;
+            }
+        }
+        return selected;
+    }
+
+  private:
+    using coefficients_type = std::array<double, QueryFeatures::size>;
+
+    /// Solves the normal equations of the ridge regression of `log(1 + usecs)` on the features
+    /// with Gaussian elimination.
+    [[nodiscard]] static auto fit(std::vector<Sample> const& samples, double ridge)
+        -> coefficients_type
+    {
+        constexpr std::size_t n = QueryFeatures::size;
+        std::array<std::array<double, n + 1>, n> system{};
+        for (auto const& sample: samples) {
+            auto const& x = sample.features.values;
+            double y = std::log1p(sample.usecs);
+            for (std::size_t row = 0; row < n; ++row) {
+                for (std::size_t col = 0; col < n; ++col) {
+                    system[row][col] += x[row] * x[col];
+                }
+                system[row][n] += x[row] * y;
+            }
+        }
+        for (std::size_t row = 1; row < n; ++row) {
+            system[row][row] += ridge * samples.size();
+        }
+        for (std::size_t col = 0; col < n; ++col) {
+            auto pivot = std::max_element(
+                system.begin() + col, system.end(), [col](auto const& lhs, auto const& rhs) {
+                    return std::abs(lhs[col]) < std::abs(rhs[col]);
+                });
+            std::swap(system[col], *pivot);
+            if (std::abs(system[col][col]) < std::numeric_limits<double>::epsilon()) {
+                continue;
+            }
+            for (std::size_t row = 0; row < n; ++row) {
+                if (row == col) {
+                    continue;
+                }
+                double factor = system[row][col] / system[col][col];
+                for (std::size_t idx = col; idx <= n; ++idx) {
+                    system[row][idx] -= factor * system[col][idx];
+                }
+            }
+        }
+        coefficients_type coefficients{};
+        for (std::size_t row = 0; row < n; ++row) {
+            if (std::abs(system[row][row]) >= std::numeric_limits<double>::epsilon()) {
+                coefficients[row] = system[row][n] / system[row][row];
+            }
+        }
+        return coefficients;
+    }
+
+    std::vector<std::string> m_algorithms;
+    std::vector<coefficients_type> m_coefficients;
+};
+
+}  // namespace pisa
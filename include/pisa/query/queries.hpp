@@ -42,4 +42,8 @@ void remove_duplicate_terms(term_id_vec& terms);
 
 term_freq_vec query_freqs(term_id_vec terms);
 
+/// Same as `query_freqs(terms)` but writes to `query_term_freqs`, reusing its memory.
+/// Sorts `terms` in place.
+void query_freqs(term_id_vec& terms, term_freq_vec& query_term_freqs);
+
 }  // namespace pisa
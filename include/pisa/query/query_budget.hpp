@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#include "util/likely.hpp"
+
+namespace pisa {
+
+/// Bounds the work of a ranked query by a deadline, a number of postings, or both.
+///
+/// Ranked algorithms taking a budget charge it with the postings they process (scored or
+/// skipped to with `next_geq`) as they go, and stop once it is exhausted, leaving in the
+/// top-k queue the results of the documents processed so far. They record the docid before
+/// which the processing was exact: every document lower than `exact_until()` was evaluated
+/// (or safely pruned) as without a budget.
+///
+/// The clock is read only once every `check_interval` postings, so that charging the budget
+/// is an addition and a comparison in the common case.
+class QueryBudget {
+  public:
+    static constexpr std::uint64_t check_interval = 1024;
+    static constexpr std::uint64_t unlimited = std::numeric_limits<std::uint64_t>::max();
+
+    /// Constructs an unlimited budget.
+    QueryBudget() = default;
+
+    QueryBudget(std::chrono::microseconds time, std::uint64_t postings = unlimited)
+        : m_time(time), m_postings_limit(postings), m_timed(true)
+    {}
+
+    explicit QueryBudget(std::uint64_t postings) : m_postings_limit(postings) {}
+
+    /// Whether the budget may stop a query.
+    [[nodiscard]] auto limited() const -> bool
+    {
+        return m_timed or m_postings_limit != unlimited;
+    }
+
+    /// Starts the budget of a new query: the deadline is counted from now.
+    void start()
+    {
+        m_postings = 0;
+        m_exhausted = false;
+        m_exact_until = unlimited;
+        m_next_check = m_timed ? std::min(check_interval, m_postings_limit) : m_postings_limit;
+        if (m_timed) {
+            m_deadline = std::chrono::steady_clock::now() + m_time;
+        }
+    }
+
+    /// Charges `postings` to the budget, and returns whether it is exhausted, in which case the
+    /// query must stop with the documents lower than `docid` processed exactly.
+    auto spend(std::uint64_t postings, std::uint64_t docid) -> bool
+    {
+        m_postings += postings;
+        if (PISA_LIKELY(m_postings < m_next_check)) {
+            return false;
+        }
+        if (m_postings >= m_postings_limit
+            or (m_timed and std::chrono::steady_clock::now() >= m_deadline)) {
+            m_exhausted = true;
+            m_exact_until = docid;
+            return true;
+        }
+        m_next_check = std::min(m_postings + check_interval, m_postings_limit);
+        return false;
+    }
+
+    /// Whether the last query was stopped by the budget.
+    [[nodiscard]] auto exhausted() const -> bool { return m_exhausted; }
+
+    /// The docid before which the last query was processed exactly, which is the maximum
+    /// integer if it was not stopped.
+    [[nodiscard]] auto exact_until() const -> std::uint64_t { return m_exact_until; }
+
+    /// Number of postings charged by the last query.
+    [[nodiscard]] auto postings() const -> std::uint64_t { return m_postings; }
+
+  private:
+    std::chrono::microseconds m_time{0};
+    std::uint64_t m_postings_limit = unlimited;
+    bool m_timed = false;
+
+    std::chrono::steady_clock::time_point m_deadline{};
+    std::uint64_t m_postings = 0;
+    std::uint64_t m_next_check = unlimited;
+    std::uint64_t m_exact_until = unlimited;
+    bool m_exhausted = false;
+};
+
+}  // namespace pisa
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "query/queries.hpp"
+#include "topk_queue.hpp"
+
+namespace pisa {
+
+/// Per-worker state reused across queries: the top-k queue, the cursors, the query term
+/// buffers, and (for TAAT algorithms) the accumulator.
+///
+/// `reset` clears the state of the previous query but keeps the allocated memory, so once the
+/// buffers have grown to fit the longest query, processing a query no longer allocates.
+/// Cursors are built in place with the `make_*_cursors` overloads taking a context.
+///
+/// If `deleted` is not null, the top-k queue skips deleted documents (see `topk_queue`).
+template <typename Cursor, typename Accumulator = std::nullptr_t>
+struct QueryContext {
+    explicit QueryContext(uint64_t k, Accumulator acc = {}, bit_vector const* deleted = nullptr)
+        : topk(k, deleted), accumulator(std::move(acc))
+    {}
+
+    QueryContext(uint64_t k, bit_vector const* deleted) : QueryContext(k, Accumulator{}, deleted) {}
+
+    void reset(Threshold threshold = 0)
+    {
+        topk.clear();
+        topk.set_threshold(threshold);
+        cursors.clear();
+    }
+
+    /// Returns the distinct terms of `query` along with their frequencies.
+    [[nodiscard]] auto query_freqs(Query const& query) -> term_freq_vec const&
+    {
+        terms.assign(query.terms.begin(), query.terms.end());
+        pisa::query_freqs(terms, term_freqs);
+        return term_freqs;
+    }
+
+    topk_queue topk;
+    Accumulator accumulator;
+    std::vector<Cursor> cursors;
+    term_id_vec terms;
+    term_freq_vec term_freqs;
+};
+
+}  // namespace pisa
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "query/queries.hpp"
+#include "topk_queue.hpp"
+
+namespace pisa {
+
+enum class CachePolicy { LRU, SDC };
+
+/// Cache of the top-k results of queries, shared by the threads processing them.
+///
+/// With `CachePolicy::LRU`, the whole capacity holds the least recently used entries.
+/// With `CachePolicy::SDC` (static-dynamic cache), a `static_fraction` of the capacity holds the
+/// most frequent queries of a past query log, which are never evicted (see `fill_static`), and
+/// the rest is an LRU cache of the other queries.
+///
+/// The capacity is a bound on the memory used by the entries, keys included. The dynamic part is
+/// split into shards with a lock each, to limit contention between threads.
+class ResultCache {
+  public:
+    using value_type = std::vector<topk_queue::entry_type>;
+
+    /// Identifies the results of a query. The terms are sorted, so that their order does not
+    /// matter, but duplicates are kept, since they change the weights of the terms.
+    struct Key {
+        std::string algorithm;
+        std::string scorer;
+        std::uint64_t k = 0;
+        term_id_vec terms;
+
+        /// Replaces the terms with those of `query`, reusing the memory of the key.
+        void assign(Query const& query)
+        {
+            terms.assign(query.terms.begin(), query.terms.end());
+            std::sort(terms.begin(), terms.end());
+        }
+
+        [[nodiscard]] auto operator==(Key const& other) const -> bool
+        {
+            return k == other.k && terms == other.terms && algorithm == other.algorithm
+                && scorer == other.scorer;
+        }
+    };
+
+    struct KeyHash {
+        [[nodiscard]] auto operator()(Key const& key) const noexcept -> std::size_t
+        {
+            std::size_t hash = std::hash<std::string>{}(key.algorithm);
+            auto combine = [&hash](std::size_t value) {
+                hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6U) + (hash >> 2U);
+            };
+            combine(std::hash<std::string>{}(key.scorer));
+            combine(key.k);
+            for (auto term: key.terms) {
+                combine(term);
+            }
+            return hash;
+        }
+    };
+
+    explicit ResultCache(
+        std::size_t capacity_bytes,
+        CachePolicy policy = CachePolicy::LRU,
+        double static_fraction = 0.5,
+        std::size_t num_shards = 16)
+        : m_static_capacity(
+            policy == CachePolicy::SDC ? static_cast<std::size_t>(capacity_bytes * static_fraction)
+                                       : 0),
+          m_shards(num_shards)
+    {
+        for (auto& shard: m_shards) {
+            shard = std::make_unique<Shard>();
+            shard->capacity = (capacity_bytes - m_static_capacity) / num_shards;
+        }
+    }
+
+    /// Copies the results of `key` to `results` and returns `true` if they are cached.
+    [[nodiscard]] auto find(Key const& key, value_type& results) -> bool
+    {
+        auto hash = KeyHash{}(key);
+        if (auto pos = m_static.find(key); pos != m_static.end()) {
+            results.assign(pos->second.begin(), pos->second.end());
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        auto& shard = *m_shards[hash % m_shards.size()];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (auto pos = shard.entries.find(key); pos != shard.entries.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, pos->second);
+            results.assign(pos->second->second.begin(), pos->second->second.end());
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /// Caches the `results` of `key`, evicting the least recently used entries of the dynamic
+    /// part as needed. Entries larger than a shard are not cached.
+    void insert(Key const& key, value_type const& results)
+    {
+        auto bytes = entry_bytes(key, results);
+        auto& shard = *m_shards[KeyHash{}(key) % m_shards.size()];
+        if (bytes > shard.capacity) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.entries.find(key) != shard.entries.end()) {
+            return;
+        }
+        while (shard.size + bytes > shard.capacity) {
+            auto const& [lru_key, lru_results] = shard.lru.back();
+            shard.size -= entry_bytes(lru_key, lru_results);
+            shard.entries.erase(lru_key);
+            shard.lru.pop_back();
+        }
+        shard.lru.emplace_front(key, results);
+        shard.entries.emplace(shard.lru.front().first, shard.lru.begin());
+        shard.size += bytes;
+    }
+
+    /// Fills the static part with the results of the most frequent queries of `log`, computed
+    /// with `fn(query)`, until it is full. Must be called before sharing the cache between
+    /// threads; does nothing with `CachePolicy::LRU`.
+    template <typename Fn>
+    void fill_static(std::vector<Query> const& log, Key const& prototype, Fn fn)
+    {
+        if (m_static_capacity == 0) {
+            return;
+        }
+        std::unordered_map<Key, std::pair<std::size_t, Query const*>, KeyHash> frequencies;
+        Key key = prototype;
+        for (auto const& query: log) {
+            key.assign(query);
+            frequencies.try_emplace(key, 0, &query).first->second.first += 1;
+        }
+        std::vector<std::pair<std::size_t, Key const*>> ranked;
+        for (auto const& [query_key, entry]: frequencies) {
+            ranked.emplace_back(entry.first, &query_key);
+        }
+        std::sort(ranked.begin(), ranked.end(), [](auto const& lhs, auto const& rhs) {
+            return lhs.first > rhs.first;
+        });
+        for (auto const& [frequency, query_key]: ranked) {
+            value_type results = fn(*frequencies.at(*query_key).second);
+            auto bytes = entry_bytes(*query_key, results);
+            if (m_static_size + bytes > m_static_capacity) {
+                break;
+            }
+            m_static.emplace(*query_key, std::move(results));
+            m_static_size += bytes;
+        }
+    }
+
+    /// Removes the entries of the dynamic part and resets the statistics.
+    void clear()
+    {
+        for (auto& shard: m_shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->entries.clear();
+            shard->lru.clear();
+            shard->size = 0;
+        }
+        m_hits = 0;
+        m_misses = 0;
+    }
+
+    [[nodiscard]] auto hits() const -> std::size_t { return m_hits.load(); }
+    [[nodiscard]] auto misses() const -> std::size_t { return m_misses.load(); }
+
+    [[nodiscard]] auto hit_ratio() const -> double
+    {
+        auto lookups = hits() + misses();
+        return lookups > 0 ? static_cast<double>(hits()) / lookups : 0.0;
+    }
+
+    /// Number of entries in the static and the dynamic parts.
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        std::size_t size = m_static.size();
+        for (auto const& shard: m_shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            size += shard->entries.size();
+        }
+        return size;
+    }
+
+    /// Memory used by the entries of the static and the dynamic parts, in bytes.
+    [[nodiscard]] auto memory_usage() const -> std::size_t
+    {
+        std::size_t bytes = m_static_size;
+        for (auto const& shard: m_shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            bytes += shard->size;
+        }
+        return bytes;
+    }
+
+  private:
+    using entry_type = std::pair<Key, value_type>;
+
+    /// Approximates the memory used by an entry, including the list and hash table nodes.
+    /// The key is counted twice, since the dynamic part stores it in both.
+    [[nodiscard]] static auto entry_bytes(Key const& key, value_type const& results)
+        -> std::size_t
+    {
+        auto key_bytes = sizeof(Key) + key.algorithm.size() + key.scorer.size()
+            + key.terms.size() * sizeof(term_id_type);
+        return 2 * key_bytes + sizeof(value_type) + 6 * sizeof(void*)
+            + results.size() * sizeof(topk_queue::entry_type);
+    }
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<entry_type> lru;
+        std::unordered_map<Key, std::list<entry_type>::iterator, KeyHash> entries;
+        std::size_t size = 0;
+        std::size_t capacity = 0;
+    };
+
+    std::size_t m_static_capacity;
+    std::size_t m_static_size = 0;
+    std::unordered_map<Key, value_type, KeyHash> m_static;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<std::size_t> m_hits{0};
+    std::atomic<std::size_t> m_misses{0};
+};
+
+}  // namespace pisa
@@ -9,7 +9,10 @@
 #include <boost/algorithm/string.hpp>
 #include <mio/mmap.hpp>
 
+#include "front_coded_vector.hpp"
+#include "hash_lexicon.hpp"
 #include "io.hpp"
+#include "mappable/mapper.hpp"
 #include "payload_vector.hpp"
 
 namespace pisa {
@@ -30,34 +33,54 @@ class TermProcessor {
         std::optional<std::string> const& stemmer_type)
     {
         auto source = std::make_shared<mio::mmap_source>(terms_file->c_str());
-        auto terms = Payload_Vector<>::from(*source);
-        auto to_id = [source = std::move(source),
-                      terms = std::move(terms)](auto str) -> std::optional<term_id_type> {
-            // Note: the lexicographical order of the terms matters.
-            auto pos = std::lower_bound(terms.begin(), terms.end(), std::string_view(str));
-            if (*pos == std::string_view(str)) {
-                return std::distance(terms.begin(), pos);
-            }
-            return std::nullopt;
-        };
+        std::function<std::optional<term_id_type>(std::string_view)> to_id;
+        auto mem =
+            gsl::make_span(reinterpret_cast<std::byte const*>(source->data()), source->size());
+        if (Hash_Lexicon::is_hash_lexicon(mem)) {
+            auto lexicon = std::make_shared<Hash_Lexicon>();
+            mapper::map(*lexicon, *source);
+            to_id = [source = std::move(source), lexicon = std::move(lexicon)](auto str) {
+                return (*lexicon)(str);
+            };
+        } else if (Front_Coded_Vector::is_front_coded(mem)) {
+            auto terms = Front_Coded_Vector::from(mem);
+            to_id = [source = std::move(source),
+                     terms = std::move(terms)](auto str) -> std::optional<term_id_type> {
+                auto pos = terms.lower_bound(str);
+                if (pos < terms.size() && terms[pos] == str) {
+                    return pos;
+                }
+                return std::nullopt;
+            };
+        } else {
+            auto terms = Payload_Vector<>::from(*source);
+            to_id = [source = std::move(source),
+                     terms = std::move(terms)](auto str) -> std::optional<term_id_type> {
+                // Note: the lexicographical order of the terms matters.
+                auto pos = std::lower_bound(terms.begin(), terms.end(), str);
+                if (pos != terms.end() && *pos == str) {
+                    return std::distance(terms.begin(), pos);
+                }
+                return std::nullopt;
+            };
+        }
 
-        // Implements '_to_id' method.
+        // Implements '_to_id' method. Stemmers are reused by all calls of a thread.
         if (not stemmer_type) {
             _to_id = [=](auto str) {
                 boost::algorithm::to_lower(str);
-                return to_id(std::move(str));
+                return to_id(str);
             };
         } else if (*stemmer_type == "porter2") {
             _to_id = [=](auto str) {
+                thread_local porter2::Stemmer stemmer{};
                 boost::algorithm::to_lower(str);
-                porter2::Stemmer stemmer{};
-                return to_id(std::move(stemmer.stem(str)));
+                return to_id(stemmer.stem(str));
             };
         } else if (*stemmer_type == "krovetz") {
             _to_id = [=](auto str) {
+                thread_local stem::KrovetzStemmer stemmer{};
                 boost::algorithm::to_lower(str);
-                stem::KrovetzStemmer stemmer{};
-                stemmer.kstem_stemmer(str);
                 return to_id(stemmer.kstem_stemmer(std::move(str)));
             };
         } else {
@@ -75,7 +98,7 @@ class TermProcessor {
         }
     }
 
-    std::optional<term_id_type> operator()(std::string token) { return _to_id(token); }
+    std::optional<term_id_type> operator()(std::string token) { return _to_id(std::move(token)); }
 
     bool is_stopword(const term_id_type term) { return stopwords.find(term) != stopwords.end(); }
 
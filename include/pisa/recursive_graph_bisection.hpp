@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cmath>
 #include <fstream>
 #include <iterator>
@@ -17,7 +18,7 @@
 #include "util/single_init_vector.hpp"
 
 namespace pisa {
-const Log2<4096> log2;
+inline const Log2<4096> log2;
 
 namespace bp {
 
@@ -28,9 +29,97 @@ namespace bp {
         __m128 _result = _mm_mul_ps(_deg, _log);
         float a[4];
         _mm_store_ps(a, _result);
-        return a[3] - a[2] + a[1] - a[0];  // Can we do it with SIMD?
+        return a[3] - a[2] + a[1] - a[0];
     };
 
+    /// Values of `log2` rounded to floats, as `expb` uses them, to be gathered by SIMD lanes.
+    inline const auto float_log2 = [] {
+        std::array<float, 4096> values{};
+        for (size_t n = 0; n < values.size(); ++n) {
+            values[n] = log2(n);
+        }
+        return values;
+    }();
+
+#if defined(__AVX2__)
+    /// Returns `log2` of each lane of `n`, rounded to a float.
+    PISA_ALWAYSINLINE __m256 log2_ps(__m256i n)
+    {
+        const __m256i last = _mm256_set1_epi32(float_log2.size() - 1);
+        __m256 logs = _mm256_i32gather_ps(float_log2.data(), _mm256_min_epu32(n, last), 4);
+        int large = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(n, last)));
+        if (PISA_UNLIKELY(large != 0)) {
+            alignas(32) uint32_t values[8];
+            alignas(32) float lane_logs[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(values), n);
+            _mm256_store_ps(lane_logs, logs);
+            for (int lane = 0; lane < 8; ++lane) {
+                if ((large >> lane) & 1) {
+                    lane_logs[lane] = log2(values[lane]);
+                }
+            }
+            logs = _mm256_load_ps(lane_logs);
+        }
+        return logs;
+    }
+
+    /// Computes `expb` for eight pairs of degrees, with the same float operations.
+    PISA_ALWAYSINLINE __m256 expb_ps(__m256 logn1, __m256 logn2, __m256i deg1, __m256i deg2)
+    {
+        const __m256i one = _mm256_set1_epi32(1);
+        __m256 fdeg1 = _mm256_cvtepi32_ps(deg1);
+        __m256 fdeg2 = _mm256_cvtepi32_ps(deg2);
+        __m256 log_cost1 = _mm256_mul_ps(fdeg1, log2_ps(_mm256_add_epi32(deg1, one)));
+        __m256 cost1 = _mm256_sub_ps(_mm256_mul_ps(fdeg1, logn1), log_cost1);
+        __m256 cost2 = _mm256_mul_ps(fdeg2, logn2);
+        __m256 log_cost2 = _mm256_mul_ps(fdeg2, log2_ps(_mm256_add_epi32(deg2, one)));
+        return _mm256_sub_ps(_mm256_add_ps(cost1, cost2), log_cost2);
+    }
+#endif
+
+    /// Computes the gain of moving a document from a partition of `2^logn1` documents to one of
+    /// `2^logn2` documents for each of `size` terms, whose degrees in the two partitions are
+    /// `from` and `to`: `expb(logn1, logn2, from, to) - expb(logn1, logn2, from - 1, to + 1)`.
+    ///
+    /// With AVX2, eight terms are processed at a time. The compiler may fuse their products with
+    /// the sums that follow, so gains can differ from those of `expb` in the last bits of floats.
+    inline void move_gains(
+        double logn1,
+        double logn2,
+        uint32_t const* from_deg,
+        uint32_t const* to_deg,
+        double* gains,
+        size_t size)
+    {
+        size_t idx = 0;
+#if defined(__AVX2__)
+        const __m256 flogn1 = _mm256_set1_ps(logn1);
+        const __m256 flogn2 = _mm256_set1_ps(logn2);
+        const __m256i one = _mm256_set1_epi32(1);
+        for (; idx + 8 <= size; idx += 8) {
+            __m256i from = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(from_deg + idx));
+            __m256i to = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(to_deg + idx));
+            __m256 before = expb_ps(flogn1, flogn2, from, to);
+            __m256 after = expb_ps(
+                flogn1, flogn2, _mm256_sub_epi32(from, one), _mm256_add_epi32(to, one));
+            _mm256_storeu_pd(
+                gains + idx,
+                _mm256_sub_pd(
+                    _mm256_cvtps_pd(_mm256_castps256_ps128(before)),
+                    _mm256_cvtps_pd(_mm256_castps256_ps128(after))));
+            _mm256_storeu_pd(
+                gains + idx + 4,
+                _mm256_sub_pd(
+                    _mm256_cvtps_pd(_mm256_extractf128_ps(before, 1)),
+                    _mm256_cvtps_pd(_mm256_extractf128_ps(after, 1))));
+        }
+#endif
+        for (; idx < size; ++idx) {
+            gains[idx] = expb(logn1, logn2, from_deg[idx], to_deg[idx])
+                - expb(logn1, logn2, from_deg[idx] - 1, to_deg[idx] + 1);
+        }
+    }
+
 }  // namespace bp
 
 template <class Iterator>
@@ -69,9 +158,11 @@ class document_range {
     }
 
     std::size_t term_count() const { return m_fwdidx.get().term_count(); }
-    std::vector<uint32_t> terms(value_type document) const
+    /// Decodes the terms of `document` into `buffer`, and returns it.
+    std::vector<uint32_t> const& terms(value_type document, std::vector<uint32_t>& buffer) const
     {
-        return m_fwdidx.get().terms(document);
+        m_fwdidx.get().terms(document, buffer);
+        return buffer;
     }
     double gain(value_type document) const { return m_gains.get()[document]; }
     double& gain(value_type document) { return m_gains.get()[document]; }
@@ -135,8 +226,9 @@ auto get_mapping = [](const auto& collection) {
 template <class Iterator>
 void compute_degrees(document_range<Iterator>& range, single_init_vector<size_t>& deg_map)
 {
+    thread_local std::vector<uint32_t> buffer;
     for (const auto& document: range) {
-        auto terms = range.terms(document);
+        auto const& terms = range.terms(document, buffer);
         auto deg_map_inc = [&](const auto& t) { deg_map.set(t, deg_map[t] + 1); };
         std::for_each(std::execution::unseq, terms.begin(), terms.end(), deg_map_inc);
     }
@@ -155,27 +247,46 @@ void compute_move_gains_caching(
 
     thread_local single_init_vector<double> gain_cache(from_lex.size());
     gain_cache.clear();
+    // Terms of a document missing from the cache, whose gains are computed in one batch.
+    thread_local std::vector<uint32_t> batch_terms;
+    thread_local std::vector<uint32_t> batch_from_deg;
+    thread_local std::vector<uint32_t> batch_to_deg;
+    thread_local std::vector<double> batch_gains;
+    thread_local std::vector<uint32_t> buffer;
     auto compute_document_gain = [&](auto& d) {
-        double gain = 0.0;
-        auto terms = range.terms(d);
+        auto const& terms = range.terms(d, buffer);
+        batch_terms.clear();
+        batch_from_deg.clear();
+        batch_to_deg.clear();
+        auto add_to_batch = [&](auto t) {
+            batch_terms.push_back(t);
+            batch_from_deg.push_back(from_lex[t]);
+            batch_to_deg.push_back(to_lex[t]);
+        };
         for (const auto& t: terms) {
             if constexpr (isLikelyCached) {
                 if (PISA_UNLIKELY(not gain_cache.has_value(t))) {
-                    const auto& from_deg = from_lex[t];
-                    const auto& to_deg = to_lex[t];
-                    const auto term_gain = bp::expb(logn1, logn2, from_deg, to_deg)
-                        - bp::expb(logn1, logn2, from_deg - 1, to_deg + 1);
-                    gain_cache.set(t, term_gain);
+                    add_to_batch(t);
                 }
             } else {
                 if (PISA_LIKELY(not gain_cache.has_value(t))) {
-                    const auto& from_deg = from_lex[t];
-                    const auto& to_deg = to_lex[t];
-                    const auto term_gain = bp::expb(logn1, logn2, from_deg, to_deg)
-                        - bp::expb(logn1, logn2, from_deg - 1, to_deg + 1);
-                    gain_cache.set(t, term_gain);
+                    add_to_batch(t);
                 }
             }
+        }
+        batch_gains.resize(batch_terms.size());
+        bp::move_gains(
+            logn1,
+            logn2,
+            batch_from_deg.data(),
+            batch_to_deg.data(),
+            batch_gains.data(),
+            batch_terms.size());
+        for (size_t idx = 0; idx < batch_terms.size(); ++idx) {
+            gain_cache.set(batch_terms[idx], batch_gains[idx]);
+        }
+        double gain = 0.0;
+        for (const auto& t: terms) {
             gain += gain_cache[t];
         }
         range.gain(d) = gain;
@@ -200,20 +311,21 @@ void swap(document_partition<Iterator>& partition, degree_map_pair& degrees)
     auto right = partition.right;
     auto lit = left.begin();
     auto rit = right.begin();
+    thread_local std::vector<uint32_t> buffer;
     for (; lit != left.end() && rit != right.end(); ++lit, ++rit) {
         if (PISA_UNLIKELY(left.gain(*lit) + right.gain(*rit) <= 0)) {
             break;
         }
         {
-            auto terms = left.terms(*lit);
-            for (auto& term: terms) {
+            auto const& terms = left.terms(*lit, buffer);
+            for (auto term: terms) {
                 degrees.left.set(term, degrees.left[term] - 1);
                 degrees.right.set(term, degrees.right[term] + 1);
             }
         }
         {
-            auto terms = right.terms(*rit);
-            for (auto& term: terms) {
+            auto const& terms = right.terms(*rit, buffer);
+            for (auto term: terms) {
                 degrees.left.set(term, degrees.left[term] + 1);
                 degrees.right.set(term, degrees.right[term] - 1);
             }
@@ -20,6 +20,13 @@ struct bm25: public index_scorer<Wand> {
         return f / (f + k1 * (1.0f - b + b * norm_len));
     }
 
+    /// Same as `doc_term_weight` but takes the precomputed `k1 * (1 - b + b * norm_len)`.
+    static float doc_term_weight_from_norm(uint64_t freq, float doc_norm)
+    {
+        float f = (float)freq;
+        return f / (f + doc_norm);
+    }
+
     // IDF (inverse document frequency)
     static float query_term_weight(uint64_t df, uint64_t num_docs)
     {
@@ -29,14 +36,58 @@ struct bm25: public index_scorer<Wand> {
         return std::max(epsilon_score, idf) * (1.0f + k1);
     }
 
+    struct term_scorer_type {
+        Wand const* wdata;
+        float term_weight;
+
+        float operator()(uint32_t doc, uint32_t freq) const
+        {
+            return term_weight * doc_term_weight(freq, wdata->norm_len(doc));
+        }
+    };
+
+    [[nodiscard]] auto typed_term_scorer(uint64_t term_id) const -> term_scorer_type
+    {
+        auto term_len = this->m_wdata.term_posting_count(term_id);
+        return {&this->m_wdata, query_term_weight(term_len, this->m_wdata.num_docs())};
+    }
+
     term_scorer_t term_scorer(uint64_t term_id) const override
+    {
+        return typed_term_scorer(term_id);
+    }
+};
+
+/// BM25 reading the document normalizations precomputed in the WAND data through `Doc_Norms`,
+/// whose type depends on their width (see `wand_data::with_doc_norms`).
+template <typename Wand, typename Doc_Norms>
+struct bm25_doc_norms: public index_scorer<Wand> {
+    bm25_doc_norms(Wand const& wdata, Doc_Norms doc_norms)
+        : index_scorer<Wand>(wdata), m_doc_norms(doc_norms)
+    {}
+
+    struct term_scorer_type {
+        Doc_Norms doc_norms;
+        float term_weight;
+
+        float operator()(uint32_t doc, uint32_t freq) const
+        {
+            return term_weight * bm25<Wand>::doc_term_weight_from_norm(freq, doc_norms(doc));
+        }
+    };
+
+    [[nodiscard]] auto typed_term_scorer(uint64_t term_id) const -> term_scorer_type
     {
         auto term_len = this->m_wdata.term_posting_count(term_id);
-        auto term_weight = query_term_weight(term_len, this->m_wdata.num_docs());
-        auto s = [&, term_weight](uint32_t doc, uint32_t freq) {
-            return term_weight * doc_term_weight(freq, this->m_wdata.norm_len(doc));
-        };
-        return s;
+        return {m_doc_norms, bm25<Wand>::query_term_weight(term_len, this->m_wdata.num_docs())};
     }
+
+    term_scorer_t term_scorer(uint64_t term_id) const override
+    {
+        return typed_term_scorer(term_id);
+    }
+
+  private:
+    Doc_Norms m_doc_norms;
 };
 }  // namespace pisa
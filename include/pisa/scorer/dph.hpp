@@ -18,20 +18,31 @@ struct dph: public index_scorer<Wand> {
 
     static constexpr float c = 1;
 
-    term_scorer_t term_scorer(uint64_t term_id) const override
-    {
-        auto s = [&, term_id](uint32_t doc, uint32_t freq) {
-            float f = (float)freq / this->m_wdata.doc_len(doc);
+    struct term_scorer_type {
+        Wand const* wdata;
+        float inverse_term_prob;
+
+        float operator()(uint32_t doc, uint32_t freq) const
+        {
+            float f = (float)freq / wdata->doc_len(doc);
             float norm = (1.f - f) * (1.f - f) / (freq + 1.f);
             return norm
                 * (freq
                        * std::log2(
-                           (freq * this->m_wdata.avg_len() / this->m_wdata.doc_len(doc))
-                           * ((float)this->m_wdata.num_docs()
-                              / this->m_wdata.term_occurrence_count(term_id)))
+                           (freq * wdata->avg_len() / wdata->doc_len(doc)) * inverse_term_prob)
                    + .5f * std::log2(2.f * M_PI * freq * (1.f - f)));
-        };
-        return s;
+        }
+    };
+
+    [[nodiscard]] auto typed_term_scorer(uint64_t term_id) const -> term_scorer_type
+    {
+        return {&this->m_wdata,
+                (float)this->m_wdata.num_docs() / this->m_wdata.term_occurrence_count(term_id)};
+    }
+
+    term_scorer_t term_scorer(uint64_t term_id) const override
+    {
+        return typed_term_scorer(term_id);
     }
 };
 
@@ -15,10 +15,20 @@ struct index_scorer {
     const Wand& m_wdata;
 
   public:
+    /// Type returned by `typed_term_scorer`. Concrete scorers shadow it with a plain
+    /// function object, so that cursors built from a concrete scorer type can inline
+    /// the scoring function. Through the base class, it falls back to `term_scorer_t`.
+    using term_scorer_type = term_scorer_t;
+
     explicit index_scorer(const Wand& wdata) : m_wdata(wdata) {}
     virtual ~index_scorer() = default;
 
     virtual term_scorer_t term_scorer(uint64_t term_id) const = 0;
+
+    [[nodiscard]] auto typed_term_scorer(uint64_t term_id) const -> term_scorer_type
+    {
+        return term_scorer(term_id);
+    }
 };
 
 }  // namespace pisa
@@ -14,18 +14,29 @@ struct qld: public index_scorer<Wand> {
 
     using index_scorer<Wand>::index_scorer;
 
+    struct term_scorer_type {
+        Wand const* wdata;
+        float mu_collection_prob;
+
+        float operator()(uint32_t doc, uint32_t freq) const
+        {
+            float numerator = 1 + freq / mu_collection_prob;
+            float denominator = mu / (wdata->doc_len(doc) + mu);
+            return std::max(0.f, std::log(numerator) + std::log(denominator));
+        }
+    };
+
+    [[nodiscard]] auto typed_term_scorer(uint64_t term_id) const -> term_scorer_type
+    {
+        return {&this->m_wdata,
+                mu
+                    * ((float)this->m_wdata.term_occurrence_count(term_id)
+                       / this->m_wdata.collection_len())};
+    }
+
     term_scorer_t term_scorer(uint64_t term_id) const override
     {
-        auto s = [&, term_id](uint32_t doc, uint32_t freq) {
-            float numerator = 1
-                + freq
-                    / (this->mu
-                       * ((float)this->m_wdata.term_occurrence_count(term_id)
-                          / this->m_wdata.collection_len()));
-            float denominator = this->mu / (this->m_wdata.doc_len(doc) + this->mu);
-            return std::max(0.f, std::log(numerator) + std::log(denominator));
-        };
-        return s;
+        return typed_term_scorer(term_id);
     }
 };
 
@@ -11,10 +11,19 @@ namespace pisa {
 template <typename Wand>
 struct quantized: public index_scorer<Wand> {
     using index_scorer<Wand>::index_scorer;
-    term_scorer_t term_scorer(uint64_t term_id) const
+
+    struct term_scorer_type {
+        float operator()(uint32_t /* doc */, uint32_t freq) const { return freq; }
+    };
+
+    [[nodiscard]] auto typed_term_scorer(uint64_t /* term_id */) const -> term_scorer_type
+    {
+        return {};
+    }
+
+    term_scorer_t term_scorer(uint64_t term_id) const override
     {
-        auto s = [](uint32_t doc, uint32_t freq) { return freq; };
-        return s;
+        return typed_term_scorer(term_id);
     }
 };
 
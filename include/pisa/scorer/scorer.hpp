@@ -15,19 +15,79 @@ namespace pisa { namespace scorer {
     auto from_name =
         [](std::string const& scorer_name,
            auto const& wdata) -> std::unique_ptr<index_scorer<std::decay_t<decltype(wdata)>>> {
+        using Wand = std::decay_t<decltype(wdata)>;
         if (scorer_name == "bm25") {
-            return std::make_unique<bm25<std::decay_t<decltype(wdata)>>>(wdata);
+            if (wdata.has_doc_norms()) {
+                return wdata.with_doc_norms(
+                    [&](auto doc_norms) -> std::unique_ptr<index_scorer<Wand>> {
+                        return std::make_unique<bm25_doc_norms<Wand, decltype(doc_norms)>>(
+                            wdata, doc_norms);
+                    });
+            }
+            return std::make_unique<bm25<Wand>>(wdata);
         } else if (scorer_name == "qld") {
-            return std::make_unique<qld<std::decay_t<decltype(wdata)>>>(wdata);
+            return std::make_unique<qld<Wand>>(wdata);
         } else if (scorer_name == "pl2") {
-            return std::make_unique<pl2<std::decay_t<decltype(wdata)>>>(wdata);
+            return std::make_unique<pl2<Wand>>(wdata);
         } else if (scorer_name == "dph") {
-            return std::make_unique<dph<std::decay_t<decltype(wdata)>>>(wdata);
+            return std::make_unique<dph<Wand>>(wdata);
         } else if (scorer_name == "quantized") {
-            return std::make_unique<quantized<std::decay_t<decltype(wdata)>>>(wdata);
+            return std::make_unique<quantized<Wand>>(wdata);
         } else {
             spdlog::error("Unknown scorer {}", scorer_name);
             std::abort();
         }
     };
+
+    /// Constructs the concrete scorer named `scorer_name` and passes it to `fn`.
+    ///
+    /// Unlike `from_name`, the scorer type is known statically inside `fn`, so cursors built
+    /// from it call the scoring function directly instead of through `term_scorer_t`.
+    /// The type is resolved once per call, typically once per query or per batch of queries.
+    template <typename Wand, typename Fn>
+    auto with_scorer(std::string const& scorer_name, Wand const& wdata, Fn&& fn)
+    {
+        if (scorer_name == "bm25") {
+            if (wdata.has_doc_norms()) {
+                return wdata.with_doc_norms([&](auto doc_norms) {
+                    return fn(bm25_doc_norms<Wand, decltype(doc_norms)>(wdata, doc_norms));
+                });
+            }
+            return fn(bm25<Wand>(wdata));
+        }
+        if (scorer_name == "qld") {
+            return fn(qld<Wand>(wdata));
+        }
+        if (scorer_name == "pl2") {
+            return fn(pl2<Wand>(wdata));
+        }
+        if (scorer_name == "dph") {
+            return fn(dph<Wand>(wdata));
+        }
+        if (scorer_name == "quantized") {
+            return fn(quantized<Wand>(wdata));
+        }
+        spdlog::error("Unknown scorer {}", scorer_name);
+        std::abort();
+    }
+
+    /// Describes the scorer named `scorer_name` along with its parameters, e.g.,
+    /// "bm25(k1=0.9,b=0.4)", to record which scorer computed the scores stored in a file.
+    template <typename Wand>
+    [[nodiscard]] auto describe(std::string const& scorer_name) -> std::string
+    {
+        if (scorer_name == "bm25") {
+            return fmt::format("bm25(k1={},b={})", bm25<Wand>::k1, bm25<Wand>::b);
+        }
+        if (scorer_name == "qld") {
+            return fmt::format("qld(mu={})", qld<Wand>::mu);
+        }
+        if (scorer_name == "pl2") {
+            return fmt::format("pl2(c={})", pl2<Wand>::c);
+        }
+        if (scorer_name == "dph") {
+            return fmt::format("dph(c={})", dph<Wand>::c);
+        }
+        return scorer_name;
+    }
 }}  // namespace pisa::scorer
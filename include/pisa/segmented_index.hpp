@@ -0,0 +1,1015 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "fmt/format.h"
+#include "gsl/span"
+#include "mio/mmap.hpp"
+#include "spdlog/spdlog.h"
+
+#include "binary_collection.hpp"
+#include "binary_freq_collection.hpp"
+#include "block_freq_index.hpp"
+#include "deleted_documents.hpp"
+#include "global_parameters.hpp"
+#include "invert.hpp"
+#include "io.hpp"
+#include "mappable/mapper.hpp"
+#include "payload_vector.hpp"
+#include "wand_data.hpp"
+#include "wand_utils.hpp"
+
+namespace pisa {
+
+/// An immutable segment of a segmented index. The documents of the segments are numbered
+/// consecutively in the order of the manifest: the first document of a segment follows the last
+/// document of the previous one.
+///
+/// A segment `name` in directory `dir` is stored in the files `dir/name.*`:
+///  - `.docs`, `.freqs`, `.sizes`: the inverted collection. It is kept after compression since
+///    `wand_data` is built from an inverted collection: the WAND data of the segment is rebuilt
+///    from it whenever the statistics of the index change, and that of a merged segment from the
+///    concatenation of the collections of its inputs;
+///  - `.terms`, `.termlex`: the sorted terms of the segment, which are its own term IDs;
+///  - `.documents`, `.doclex`: the titles of its documents, if the forward index had them;
+///  - `.index`, `.wand`: the compressed index and its WAND data, which is computed with the
+///    statistics of all the segments (see `segments::Index_Statistics`);
+///  - `.deleted`: its deleted documents, in its own docids, if any (see `Deleted_Documents`).
+struct Segment {
+    std::string name;
+    std::uint64_t num_docs = 0;
+    /// Generation of the statistics of the index with which the WAND data of the segment was
+    /// computed (see `segments::Index_Statistics::generation`).
+    std::uint64_t statistics_generation = 0;
+};
+
+/// Options of the segments of a segmented index, which must be the same for all segments.
+struct Segment_Options {
+    std::string scorer = "bm25";
+    std::uint64_t block_size = 64;
+    std::size_t batch_size = 100'000;
+    std::size_t threads = std::thread::hardware_concurrency();
+};
+
+namespace segments {
+
+    /// File describing a segmented index, made of the lines:
+    ///  - `scorer <name>` and `block_size <size>`: the options with which all the WAND data was
+    ///    built (see `Segment_Options`);
+    ///  - `statistics <generation>`: the current statistics of the index, stored in the file
+    ///    `statistics.<generation>` (see `Index_Statistics`);
+    ///  - `segment <name> <num_docs> <statistics_generation>`: the segments, in order.
+    constexpr char const* manifest_name = "manifest";
+
+    /// Contents of a manifest.
+    struct Manifest {
+        std::string scorer;
+        std::uint64_t block_size = 0;
+        std::uint64_t statistics_generation = 0;
+        std::vector<Segment> segments;
+    };
+
+    [[nodiscard]] inline auto basename(std::string const& dir, std::string const& name)
+        -> std::string
+    {
+        return (boost::filesystem::path(dir) / name).string();
+    }
+
+    /// Reads the manifest of `dir`, which has no segments and no options if it does not exist.
+    [[nodiscard]] inline auto read_manifest(std::string const& dir) -> Manifest
+    {
+        Manifest manifest;
+        std::ifstream is(basename(dir, manifest_name));
+        std::string key;
+        while (is >> key) {
+            if (key == "scorer") {
+                is >> manifest.scorer;
+            } else if (key == "block_size") {
+                is >> manifest.block_size;
+            } else if (key == "statistics") {
+                is >> manifest.statistics_generation;
+            } else if (key == "segment") {
+                auto& segment = manifest.segments.emplace_back();
+                is >> segment.name >> segment.num_docs >> segment.statistics_generation;
+            } else {
+                throw std::runtime_error(fmt::format("Unknown manifest entry: {}", key));
+            }
+        }
+        return manifest;
+    }
+
+    /// Replaces the manifest of `dir` atomically, so that readers see either the old or the new
+    /// list of segments.
+    inline void write_manifest(
+        std::string const& dir,
+        Segment_Options const& options,
+        std::uint64_t statistics_generation,
+        gsl::span<Segment const> segments)
+    {
+        auto manifest = basename(dir, manifest_name);
+        {
+            std::ofstream os(manifest + ".tmp");
+            os << "scorer " << options.scorer << '\n';
+            os << "block_size " << options.block_size << '\n';
+            os << "statistics " << statistics_generation << '\n';
+            for (auto const& segment: segments) {
+                os << "segment " << segment.name << ' ' << segment.num_docs << ' '
+                   << segment.statistics_generation << '\n';
+            }
+        }
+        boost::filesystem::rename(manifest + ".tmp", manifest);
+    }
+
+    /// Throws if the WAND data of the index described by `manifest` was built with other
+    /// options than `options`, as its segments would then be scored differently.
+    inline void check_options(Manifest const& manifest, Segment_Options const& options)
+    {
+        if (manifest.segments.empty()) {
+            return;
+        }
+        if (manifest.scorer != options.scorer || manifest.block_size != options.block_size) {
+            throw std::invalid_argument(fmt::format(
+                "The segments are scored with {} and WAND blocks of {} postings, not {} and {}: "
+                "pass the same --scorer and --block-size",
+                manifest.scorer,
+                manifest.block_size,
+                options.scorer,
+                options.block_size));
+        }
+    }
+
+    /// Returns the number following the largest segment number of `segments`.
+    [[nodiscard]] inline auto next_segment_number(gsl::span<Segment const> segments)
+        -> std::uint64_t
+    {
+        std::uint64_t next = 0;
+        for (auto const& segment: segments) {
+            auto pos = segment.name.find_last_of('.');
+            next = std::max<std::uint64_t>(next, std::stoull(segment.name.substr(pos + 1)) + 1);
+        }
+        return next;
+    }
+
+    [[nodiscard]] inline auto segment_name(std::uint64_t number) -> std::string
+    {
+        return fmt::format("segment.{}", number);
+    }
+
+    inline void remove_segment(std::string const& dir, std::string const& name)
+    {
+        auto segment_basename = basename(dir, name);
+        for (auto extension:
+             {".docs", ".freqs", ".sizes", ".terms", ".termlex", ".documents", ".doclex", ".index",
+              ".wand", ".deleted"}) {
+            boost::filesystem::remove(segment_basename + extension);
+        }
+    }
+
+}  // namespace segments
+
+/// Selects the segments to merge: segments are grouped in tiers of sizes growing by a factor of
+/// `merge_factor` from `min_segment_docs`, and `merge_factor` adjacent segments of the same tier
+/// are merged into a segment of the next tier. Only adjacent segments are merged, so that the
+/// documents keep their order.
+struct Tiered_Merge_Policy {
+    std::size_t merge_factor = 10;
+    std::uint64_t min_segment_docs = 1000;
+
+    [[nodiscard]] auto tier(std::uint64_t num_docs) const -> std::size_t
+    {
+        std::size_t tier = 0;
+        for (auto size = std::max<std::uint64_t>(min_segment_docs, 1); num_docs > size;
+             size *= merge_factor) {
+            tier += 1;
+        }
+        return tier;
+    }
+
+    /// Returns the range `[first, last)` of the segments to merge next, if any.
+    [[nodiscard]] auto select(gsl::span<Segment const> segments) const
+        -> std::optional<std::pair<std::size_t, std::size_t>>
+    {
+        if (merge_factor < 2) {
+            return std::nullopt;
+        }
+        std::size_t first = 0;
+        while (first < segments.size()) {
+            auto first_tier = tier(segments[first].num_docs);
+            auto last = first + 1;
+            while (last < segments.size() && tier(segments[last].num_docs) == first_tier) {
+                last += 1;
+            }
+            if (last - first >= merge_factor) {
+                return std::make_pair(first, first + merge_factor);
+            }
+            first = last;
+        }
+        return std::nullopt;
+    }
+};
+
+/// Merges sorted lexicons into their sorted union, and returns it along with the mapping of the
+/// term IDs of each lexicon to the IDs in the union.
+[[nodiscard]] inline auto merge_lexicons(std::vector<std::vector<std::string>> const& lexicons)
+    -> std::pair<std::vector<std::string>, std::vector<std::vector<std::uint32_t>>>
+{
+    std::vector<std::string> terms;
+    for (auto const& lexicon: lexicons) {
+        terms.insert(terms.end(), lexicon.begin(), lexicon.end());
+    }
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    std::vector<std::vector<std::uint32_t>> mappings;
+    for (auto const& lexicon: lexicons) {
+        auto& mapping = mappings.emplace_back();
+        mapping.reserve(lexicon.size());
+        auto pos = terms.begin();
+        for (auto const& term: lexicon) {
+            pos = std::lower_bound(pos, terms.end(), term);
+            mapping.push_back(std::distance(terms.begin(), pos));
+        }
+    }
+    return {std::move(terms), std::move(mappings)};
+}
+
+/// Concatenates the inverted collections `inputs` into `output`, where the documents of each
+/// input are shifted by the sizes of the previous inputs, and the terms of input `i` are mapped
+/// with `mappings[i]`, which must be increasing.
+inline void merge_collections(
+    std::vector<std::string> const& inputs,
+    std::vector<std::vector<std::uint32_t>> const& mappings,
+    std::uint32_t term_count,
+    std::string const& output)
+{
+    std::vector<binary_collection> doc_collections;
+    std::vector<binary_collection> freq_collections;
+    std::vector<std::uint32_t> document_sizes;
+    std::vector<std::uint32_t> offsets;
+    for (auto const& input: inputs) {
+        offsets.push_back(document_sizes.size());
+        doc_collections.emplace_back((input + ".docs").c_str());
+        freq_collections.emplace_back((input + ".freqs").c_str());
+        std::ifstream sizes_is(input + ".sizes");
+        read_sequence(sizes_is, document_sizes);
+    }
+
+    std::ofstream sos(output + ".sizes");
+    write_sequence(sos, gsl::span<std::uint32_t const>(document_sizes));
+
+    std::vector<binary_collection::const_iterator> doc_iterators;
+    std::vector<binary_collection::const_iterator> freq_iterators;
+    std::vector<std::size_t> next_terms(inputs.size(), 0);
+    for (std::size_t idx = 0; idx < inputs.size(); ++idx) {
+        doc_iterators.push_back(++doc_collections[idx].begin());
+        freq_iterators.push_back(freq_collections[idx].begin());
+    }
+
+    std::ofstream dos(output + ".docs");
+    std::ofstream fos(output + ".freqs");
+    auto document_count = static_cast<std::uint32_t>(document_sizes.size());
+    write_sequence(dos, gsl::make_span<std::uint32_t const>(&document_count, 1));
+    std::vector<std::uint32_t> dlist;
+    std::vector<std::uint32_t> flist;
+    for (std::uint32_t term_id = 0; term_id < term_count; ++term_id) {
+        dlist.clear();
+        flist.clear();
+        for (std::size_t idx = 0; idx < inputs.size(); ++idx) {
+            auto& next_term = next_terms[idx];
+            if (next_term < mappings[idx].size() && mappings[idx][next_term] == term_id) {
+                auto docs = *doc_iterators[idx];
+                std::transform(
+                    docs.begin(), docs.end(), std::back_inserter(dlist), [&](auto docid) {
+                        return docid + offsets[idx];
+                    });
+                auto freqs = *freq_iterators[idx];
+                flist.insert(flist.end(), freqs.begin(), freqs.end());
+                ++doc_iterators[idx];
+                ++freq_iterators[idx];
+                next_term += 1;
+            }
+        }
+        write_sequence(dos, gsl::span<std::uint32_t const>(dlist));
+        write_sequence(fos, gsl::span<std::uint32_t const>(flist));
+    }
+}
+
+/// The posting list of term `term` of `index`, whose documents are shifted by `offset` when
+/// merged.
+template <typename Index>
+struct Posting_List_Part {
+    Index const* index;
+    std::size_t term;
+    std::uint64_t offset;
+};
+
+/// Number of postings copied as compressed blocks and re-encoded by a merge.
+struct Merge_Stats {
+    std::uint64_t copied_postings = 0;
+    std::uint64_t encoded_postings = 0;
+
+    Merge_Stats& operator+=(Merge_Stats const& other)
+    {
+        copied_postings += other.copied_postings;
+        encoded_postings += other.encoded_postings;
+        return *this;
+    }
+};
+
+/// Concatenates posting lists by decoding and re-encoding them.
+template <typename Index, typename Builder>
+auto merge_posting_lists(std::vector<Posting_List_Part<Index>> const& parts, Builder& builder)
+    -> Merge_Stats
+{
+    std::vector<std::uint64_t> docs;
+    std::vector<std::uint64_t> freqs;
+    std::uint64_t occurrences = 0;
+    for (auto const& part: parts) {
+        auto list = (*part.index)[part.term];
+        for (std::size_t pos = 0; pos < list.size(); ++pos, list.next()) {
+            docs.push_back(list.docid() + part.offset);
+            freqs.push_back(list.freq());
+            occurrences += freqs.back();
+        }
+    }
+    builder.add_posting_list(docs.size(), docs.begin(), freqs.begin(), occurrences);
+    return Merge_Stats{0, docs.size()};
+}
+
+/// A block of a merged posting list, either copied from an input list or re-encoded.
+struct Merged_Block {
+    std::uint32_t index = 0;
+    std::uint32_t max = 0;
+    float max_score = 0;
+    std::vector<std::uint8_t> docs{};
+    std::vector<std::uint8_t> freqs{};
+
+    void append_docs_block(std::vector<std::uint8_t>& out) const
+    {
+        out.insert(out.end(), docs.begin(), docs.end());
+    }
+
+    void append_freqs_block(std::vector<std::uint8_t>& out) const
+    {
+        out.insert(out.end(), freqs.begin(), freqs.end());
+    }
+};
+
+/// Concatenates block posting lists, copying their compressed blocks with
+/// `block_posting_list::write_blocks` whenever possible.
+///
+/// A block is encoded as the gaps from the last document of the previous block, so it can be
+/// copied as long as the document preceding it in the merged list is its previous document
+/// shifted by the same offset: within a list, or at the start of a list that follows another
+/// one immediately. Blocks also have a fixed size but the last, so once a partial last block
+/// has been decoded, the following lists are decoded and re-encoded until they realign.
+template <typename BlockCodec, bool Profile, typename Builder>
+auto merge_posting_lists(
+    std::vector<Posting_List_Part<block_freq_index<BlockCodec, Profile>>> const& parts,
+    Builder& builder) -> Merge_Stats
+{
+    constexpr std::uint64_t block_size = BlockCodec::block_size;
+    Merge_Stats stats;
+    std::vector<Merged_Block> blocks;
+    std::vector<std::uint32_t> docs;
+    std::vector<std::uint32_t> freqs;
+    std::vector<std::uint32_t> buffer;
+    std::int64_t last_docid = -1;
+    std::uint64_t size = 0;
+
+    auto encode = [&](std::size_t count) {
+        auto& block = blocks.emplace_back();
+        block.index = blocks.size() - 1;
+        auto base = static_cast<std::uint32_t>(last_docid + 1);
+        buffer.resize(count);
+        for (std::size_t pos = 0; pos < count; ++pos) {
+            buffer[pos] = docs[pos] - last_docid - 1;
+            last_docid = docs[pos];
+        }
+        block.max = last_docid;
+        BlockCodec::encode(buffer.data(), block.max - base - (count - 1), count, block.docs);
+        for (std::size_t pos = 0; pos < count; ++pos) {
+            buffer[pos] = freqs[pos] - 1;
+        }
+        BlockCodec::encode(buffer.data(), std::uint32_t(-1), count, block.freqs);
+        docs.erase(docs.begin(), std::next(docs.begin(), count));
+        freqs.erase(freqs.begin(), std::next(freqs.begin(), count));
+        stats.encoded_postings += count;
+    };
+
+    for (std::size_t idx = 0; idx < parts.size(); ++idx) {
+        auto const& part = parts[idx];
+        auto list = (*part.index)[part.term];
+        size += list.size();
+        auto input_blocks = list.get_blocks();
+        for (auto const& input_block: input_blocks) {
+            std::int64_t base =
+                input_block.index == 0 ? 0 : input_blocks[input_block.index - 1].max + 1;
+            bool last_block =
+                idx + 1 == parts.size() && input_block.index + 1 == input_blocks.size();
+            if (docs.empty() && base + std::int64_t(part.offset) == last_docid + 1
+                && (input_block.size == block_size || last_block)) {
+                auto& block = blocks.emplace_back();
+                block.index = blocks.size() - 1;
+                block.max = input_block.max + part.offset;
+                input_block.append_docs_block(block.docs);
+                input_block.append_freqs_block(block.freqs);
+                last_docid = block.max;
+                stats.copied_postings += input_block.size;
+                continue;
+            }
+            input_block.decode_doc_gaps(buffer);
+            std::int64_t docid = base - 1;
+            for (auto gap: buffer) {
+                docid += gap + 1;
+                docs.push_back(docid + part.offset);
+            }
+            input_block.decode_freqs(buffer);
+            for (auto freq: buffer) {
+                freqs.push_back(freq + 1);
+            }
+            while (docs.size() >= block_size) {
+                encode(block_size);
+            }
+        }
+    }
+    if (not docs.empty()) {
+        encode(docs.size());
+    }
+    builder.add_posting_list(size, blocks);
+    return stats;
+}
+
+/// Merges `indexes`, whose term IDs are mapped with `mappings` to the `term_count` terms of the
+/// merged index, and whose documents follow each other, into `output`.
+template <typename Index>
+auto merge_indexes(
+    std::vector<Index const*> const& indexes,
+    std::vector<std::vector<std::uint32_t>> const& mappings,
+    std::uint32_t term_count,
+    Index& output) -> Merge_Stats
+{
+    std::uint64_t num_docs = 0;
+    std::vector<std::uint64_t> offsets;
+    for (auto const* index: indexes) {
+        offsets.push_back(num_docs);
+        num_docs += index->num_docs();
+    }
+    global_parameters params;
+    typename Index::builder builder(num_docs, params);
+    Merge_Stats stats;
+    std::vector<std::size_t> next_terms(indexes.size(), 0);
+    std::vector<Posting_List_Part<Index>> parts;
+    for (std::uint32_t term_id = 0; term_id < term_count; ++term_id) {
+        parts.clear();
+        for (std::size_t idx = 0; idx < indexes.size(); ++idx) {
+            auto& next_term = next_terms[idx];
+            if (next_term < mappings[idx].size() && mappings[idx][next_term] == term_id) {
+                parts.push_back(Posting_List_Part<Index>{indexes[idx], next_term, offsets[idx]});
+                next_term += 1;
+            }
+        }
+        stats += merge_posting_lists(parts, builder);
+    }
+    builder.build(output);
+    return stats;
+}
+
+namespace segments {
+
+    /// Statistics of all the segments of a segmented index. Every segment is scored with them,
+    /// so that the scores of different segments can be compared, and do not depend on how the
+    /// documents are split into segments. They are updated with the counts of each new segment,
+    /// rather than recomputed from all the segments, and merges do not change them.
+    struct Index_Statistics {
+        /// Incremented whenever a segment is added, and 0 for an empty index.
+        std::uint64_t generation = 0;
+        std::uint64_t num_docs = 0;
+        std::uint64_t collection_len = 0;
+        /// Sorted terms of all segments, to which the term statistics correspond.
+        std::vector<std::string> terms{};
+        std::vector<std::uint64_t> term_posting_counts{};
+        std::vector<std::uint64_t> term_occurrence_counts{};
+
+        /// Returns the statistics of the terms of a segment, whose sorted terms are `lexicon`.
+        [[nodiscard]] auto for_segment(std::vector<std::string> const& lexicon) const
+            -> Collection_Statistics
+        {
+            Collection_Statistics statistics{num_docs, collection_len, {}, {}};
+            statistics.term_posting_counts.reserve(lexicon.size());
+            statistics.term_occurrence_counts.reserve(lexicon.size());
+            auto pos = terms.begin();
+            for (auto const& term: lexicon) {
+                pos = std::lower_bound(pos, terms.end(), term);
+                if (pos == terms.end() || *pos != term) {
+                    throw std::invalid_argument(fmt::format("No statistics for term {}", term));
+                }
+                auto idx = std::distance(terms.begin(), pos);
+                statistics.term_posting_counts.push_back(term_posting_counts[idx]);
+                statistics.term_occurrence_counts.push_back(term_occurrence_counts[idx]);
+            }
+            return statistics;
+        }
+
+        /// Adds the counts of the segment `segment_basename`, read from its inverted collection,
+        /// and increments the generation.
+        void add(std::string const& segment_basename)
+        {
+            std::vector<std::vector<std::string>> lexicons;
+            lexicons.push_back(std::move(terms));
+            lexicons.push_back(io::read_string_vector(segment_basename + ".terms"));
+            auto [merged_terms, mappings] = merge_lexicons(lexicons);
+            lexicons.clear();
+            std::vector<std::uint64_t> posting_counts(merged_terms.size(), 0);
+            std::vector<std::uint64_t> occurrence_counts(merged_terms.size(), 0);
+            for (std::size_t term = 0; term < mappings[0].size(); ++term) {
+                posting_counts[mappings[0][term]] = term_posting_counts[term];
+                occurrence_counts[mappings[0][term]] = term_occurrence_counts[term];
+            }
+            binary_collection sizes((segment_basename + ".sizes").c_str());
+            auto document_sizes = *sizes.begin();
+            num_docs += document_sizes.size();
+            collection_len += std::accumulate(
+                document_sizes.begin(), document_sizes.end(), std::uint64_t(0));
+            binary_freq_collection collection(segment_basename.c_str());
+            std::size_t term = 0;
+            for (auto const& seq: collection) {
+                auto term_id = mappings[1][term++];
+                posting_counts[term_id] += seq.docs.size();
+                occurrence_counts[term_id] +=
+                    std::accumulate(seq.freqs.begin(), seq.freqs.end(), std::uint64_t(0));
+            }
+            terms = std::move(merged_terms);
+            term_posting_counts = std::move(posting_counts);
+            term_occurrence_counts = std::move(occurrence_counts);
+            generation += 1;
+        }
+    };
+
+    /// File of the statistics of generation `generation`, which holds a line
+    /// `<num_docs> <collection_len>` followed by a line `<term> <postings> <occurrences>` per
+    /// term.
+    [[nodiscard]] inline auto statistics_name(std::uint64_t generation) -> std::string
+    {
+        return fmt::format("statistics.{}", generation);
+    }
+
+    /// Writes `statistics` to `dir`. It is only referenced once the manifest is written, so it
+    /// does not need to be replaced atomically.
+    inline void write_statistics(std::string const& dir, Index_Statistics const& statistics)
+    {
+        std::ofstream os(basename(dir, statistics_name(statistics.generation)));
+        os << statistics.num_docs << ' ' << statistics.collection_len << '\n';
+        for (std::size_t term = 0; term < statistics.terms.size(); ++term) {
+            os << statistics.terms[term] << ' ' << statistics.term_posting_counts[term] << ' '
+               << statistics.term_occurrence_counts[term] << '\n';
+        }
+    }
+
+    /// Reads the statistics of generation `generation` of `dir`, which are empty for generation
+    /// 0.
+    [[nodiscard]] inline auto read_statistics(std::string const& dir, std::uint64_t generation)
+        -> Index_Statistics
+    {
+        Index_Statistics statistics;
+        statistics.generation = generation;
+        if (generation == 0) {
+            return statistics;
+        }
+        auto filename = basename(dir, statistics_name(generation));
+        std::ifstream is(filename);
+        if (not(is >> statistics.num_docs >> statistics.collection_len)) {
+            throw std::runtime_error(fmt::format("Cannot read statistics from {}", filename));
+        }
+        std::string term;
+        std::uint64_t postings = 0;
+        std::uint64_t occurrences = 0;
+        while (is >> term >> postings >> occurrences) {
+            statistics.terms.push_back(term);
+            statistics.term_posting_counts.push_back(postings);
+            statistics.term_occurrence_counts.push_back(occurrences);
+        }
+        return statistics;
+    }
+
+    /// Compresses the inverted collection `basename` to `basename.index`.
+    template <typename Index>
+    void build_index(std::string const& basename)
+    {
+        binary_freq_collection collection(basename.c_str());
+        global_parameters params;
+        typename Index::builder builder(collection.num_docs(), params);
+        for (auto const& plist: collection) {
+            auto occurrences =
+                std::accumulate(plist.freqs.begin(), plist.freqs.end(), std::uint64_t(0));
+            builder.add_posting_list(
+                plist.docs.size(), plist.docs.begin(), plist.freqs.begin(), occurrences);
+        }
+        Index index;
+        builder.build(index);
+        mapper::freeze(index, (basename + ".index").c_str());
+    }
+
+    /// Builds the WAND data of the inverted collection `basename`, scored with the statistics
+    /// of the whole index `statistics`, to `basename.wand`. The file is replaced atomically, so
+    /// that readers still mapping the previous WAND data are not affected.
+    template <typename Wand>
+    void build_wand_data(
+        std::string const& basename,
+        Segment_Options const& options,
+        Index_Statistics const& statistics)
+    {
+        binary_freq_collection collection(basename.c_str());
+        binary_collection sizes((basename + ".sizes").c_str());
+        auto segment_statistics =
+            statistics.for_segment(io::read_string_vector(basename + ".terms"));
+        Wand wdata(
+            sizes.begin()->begin(),
+            collection.num_docs(),
+            collection,
+            options.scorer,
+            BlockSize(FixedBlock(options.block_size)),
+            false,
+            {},
+            0,
+            nullptr,
+            0.0,
+            &segment_statistics);
+        mapper::freeze(wdata, (basename + ".wand.tmp").c_str());
+        boost::filesystem::rename(basename + ".wand.tmp", basename + ".wand");
+    }
+
+    /// Builds segment `name` of `dir` from a forward index produced by `parse_collection`,
+    /// except for its WAND data, which depends on the statistics of all the segments.
+    template <typename Index>
+    auto build_segment(
+        std::string const& forward_index,
+        std::string const& dir,
+        std::string const& name,
+        Segment_Options const& options) -> Segment
+    {
+        using boost::filesystem::copy_file;
+        using boost::filesystem::copy_option;
+        using boost::filesystem::exists;
+        auto output = basename(dir, name);
+        for (auto extension: {".terms", ".termlex", ".documents", ".doclex"}) {
+            if (exists(forward_index + extension)) {
+                copy_file(
+                    forward_index + extension,
+                    output + extension,
+                    copy_option::overwrite_if_exists);
+            }
+        }
+        auto term_count = io::read_string_vector(forward_index + ".terms").size();
+        invert::invert_forward_index(
+            forward_index, output, term_count, options.batch_size, options.threads);
+        build_index<Index>(output);
+        return Segment{name, binary_freq_collection(output.c_str()).num_docs()};
+    }
+
+    /// Writes the deleted documents of the segments `inputs`, with basenames `input_basenames`,
+    /// to those of their merged segment `output`, if any of them has deleted documents.
+    inline void merge_deleted_documents(
+        gsl::span<std::string const> input_basenames,
+        gsl::span<Segment const> inputs,
+        std::string const& output)
+    {
+        if (std::none_of(input_basenames.begin(), input_basenames.end(), [](auto const& input) {
+                return boost::filesystem::exists(input + ".deleted");
+            })) {
+            return;
+        }
+        std::uint64_t num_docs = 0;
+        for (auto const& input: inputs) {
+            num_docs += input.num_docs;
+        }
+        bit_vector_builder merged(num_docs);
+        std::uint64_t first_docid = 0;
+        for (std::size_t idx = 0; idx < inputs.size(); ++idx) {
+            if (boost::filesystem::exists(input_basenames[idx] + ".deleted")) {
+                Deleted_Documents deleted(input_basenames[idx] + ".deleted", inputs[idx].num_docs);
+                for (std::uint64_t docid = 0; docid < inputs[idx].num_docs; ++docid) {
+                    if (deleted.bits()[docid]) {
+                        merged.set(first_docid + docid, true);
+                    }
+                }
+            }
+            first_docid += inputs[idx].num_docs;
+        }
+        bit_vector bits(&merged);
+        mapper::freeze(bits, (output + ".deleted").c_str());
+    }
+
+    /// Merges `inputs`, adjacent segments of `dir`, into segment `name`. The compressed index
+    /// is merged with `merge_indexes`, and the WAND data is rebuilt from the merged collection,
+    /// since its block boundaries change, with the statistics of the whole index `statistics`.
+    template <typename Index, typename Wand>
+    auto merge_segments(
+        std::string const& dir,
+        gsl::span<Segment const> inputs,
+        std::string const& name,
+        Segment_Options const& options,
+        Index_Statistics const& statistics) -> Segment
+    {
+        auto output = basename(dir, name);
+        std::vector<std::string> input_basenames;
+        std::vector<std::vector<std::string>> lexicons;
+        for (auto const& input: inputs) {
+            input_basenames.push_back(basename(dir, input.name));
+            lexicons.push_back(io::read_string_vector(input_basenames.back() + ".terms"));
+        }
+        auto [terms, mappings] = merge_lexicons(lexicons);
+        lexicons.clear();
+        {
+            std::ofstream os(output + ".terms");
+            for (auto const& term: terms) {
+                os << term << '\n';
+            }
+        }
+        encode_payload_vector(gsl::span<std::string const>(terms)).to_file(output + ".termlex");
+        if (std::all_of(input_basenames.begin(), input_basenames.end(), [](auto const& input) {
+                return boost::filesystem::exists(input + ".documents");
+            })) {
+            std::vector<std::string> titles;
+            std::ofstream os(output + ".documents");
+            for (auto const& input: input_basenames) {
+                for (auto& title: io::read_string_vector(input + ".documents")) {
+                    os << title << '\n';
+                    titles.push_back(std::move(title));
+                }
+            }
+            encode_payload_vector(gsl::span<std::string const>(titles)).to_file(output + ".doclex");
+        }
+
+        merge_collections(input_basenames, mappings, terms.size(), output);
+        merge_deleted_documents(input_basenames, inputs, output);
+
+        std::vector<mio::mmap_source> sources;
+        std::vector<Index> indexes(inputs.size());
+        sources.reserve(inputs.size());
+        std::vector<Index const*> index_pointers;
+        for (std::size_t idx = 0; idx < inputs.size(); ++idx) {
+            sources.emplace_back((input_basenames[idx] + ".index").c_str());
+            mapper::map(indexes[idx], sources.back());
+            index_pointers.push_back(&indexes[idx]);
+        }
+        Index merged;
+        auto stats = merge_indexes(index_pointers, mappings, terms.size(), merged);
+        mapper::freeze(merged, (output + ".index").c_str());
+        spdlog::info(
+            "Merged {} segments into {}: {} postings copied, {} encoded",
+            inputs.size(),
+            name,
+            stats.copied_postings,
+            stats.encoded_postings);
+
+        build_wand_data<Wand>(output, options, statistics);
+        return Segment{name, merged.num_docs(), statistics.generation};
+    }
+
+}  // namespace segments
+
+/// Appends segments to the segmented index of a directory, and merges them in the background.
+///
+/// New segments are built on the calling thread, and appended to the manifest once complete,
+/// without waiting for the background work. It runs on a single background thread: it
+/// repeatedly selects the segments to merge with the merge policy, merges them without holding
+/// the lock, and replaces them in the manifest by the merged segment, until there is nothing to
+/// merge. The files of the merged segments are then removed: processes reading the index must
+/// reload the manifest to see the new segments.
+///
+/// All segments are scored with the statistics of the whole index (see
+/// `segments::Index_Statistics`), which each new segment updates with its own counts. The new
+/// segment is scored with the updated statistics, and the others are rescored lazily: merged
+/// segments are scored with the statistics current when the merge starts, and once there is
+/// nothing to merge, the background thread rebuilds the WAND data of the segments scored with
+/// older statistics. Until `wait` returns, segments may thus be scored with different
+/// statistics.
+template <typename Index, typename Wand>
+class Segmented_Index_Writer {
+  public:
+    /// Throws if the index of `dir` was built with another scorer or block size than those of
+    /// `options`.
+    Segmented_Index_Writer(std::string dir, Segment_Options options, Tiered_Merge_Policy policy)
+        : m_dir(std::move(dir)), m_options(std::move(options)), m_policy(policy)
+    {
+        auto manifest = segments::read_manifest(m_dir);
+        segments::check_options(manifest, m_options);
+        m_segments = std::move(manifest.segments);
+        m_next_segment = segments::next_segment_number(m_segments);
+        m_statistics = std::make_shared<segments::Index_Statistics const>(
+            segments::read_statistics(m_dir, manifest.statistics_generation));
+    }
+
+    Segmented_Index_Writer(Segmented_Index_Writer const&) = delete;
+    Segmented_Index_Writer(Segmented_Index_Writer&&) = delete;
+    Segmented_Index_Writer& operator=(Segmented_Index_Writer const&) = delete;
+    Segmented_Index_Writer& operator=(Segmented_Index_Writer&&) = delete;
+
+    ~Segmented_Index_Writer()
+    {
+        if (m_background.valid()) {
+            m_background.wait();
+        }
+    }
+
+    /// Builds a segment from `forward_index` and appends it to the index, along with the
+    /// statistics of the index updated with its counts. The other segments are rescored in the
+    /// background.
+    void add(std::string const& forward_index)
+    {
+        std::lock_guard<std::mutex> update_lock(m_update_mutex);
+        std::string name;
+        std::shared_ptr<segments::Index_Statistics const> previous;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            name = segments::segment_name(m_next_segment++);
+            previous = m_statistics;
+        }
+        spdlog::info("Adding {} as {}", forward_index, name);
+        auto segment = segments::build_segment<Index>(forward_index, m_dir, name, m_options);
+        auto segment_basename = segments::basename(m_dir, name);
+        auto statistics = std::make_shared<segments::Index_Statistics>(*previous);
+        statistics->add(segment_basename);
+        segments::write_statistics(m_dir, *statistics);
+        segments::build_wand_data<Wand>(segment_basename, m_options, *statistics);
+        segment.statistics_generation = statistics->generation;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_statistics = std::move(statistics);
+        m_segments.push_back(segment);
+        write_manifest();
+        boost::filesystem::remove(
+            segments::basename(m_dir, segments::statistics_name(previous->generation)));
+        start_background();
+    }
+
+    /// Starts the background merges of the segments selected by the merge policy, and the
+    /// rescoring of the segments scored with older statistics, if any.
+    void schedule_merges()
+    {
+        std::lock_guard<std::mutex> update_lock(m_update_mutex);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        start_background();
+    }
+
+    /// Merges all segments into one, after the background work.
+    void merge_all()
+    {
+        std::lock_guard<std::mutex> update_lock(m_update_mutex);
+        wait();
+        if (m_segments.size() > 1) {
+            merge(0, m_segments.size());
+        }
+    }
+
+    /// Waits for the background work, and rethrows its exception if any. Once it returns, all
+    /// segments are scored with the current statistics.
+    void wait()
+    {
+        if (m_background.valid()) {
+            m_background.get();
+        }
+    }
+
+    [[nodiscard]] auto segments() const -> std::vector<Segment>
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_segments;
+    }
+
+  private:
+    /// Returns the position of the first segment scored with older statistics, if any; must
+    /// hold the lock.
+    [[nodiscard]] auto stale_segment() const -> std::optional<std::size_t>
+    {
+        for (std::size_t idx = 0; idx < m_segments.size(); ++idx) {
+            if (m_segments[idx].statistics_generation != m_statistics->generation) {
+                return idx;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /// Starts the background work if it is not running and there is work to do; must hold the
+    /// lock.
+    void start_background()
+    {
+        if (m_running or (not m_policy.select(m_segments) and not stale_segment())) {
+            return;
+        }
+        if (m_background.valid()) {
+            m_background.get();
+        }
+        m_running = true;
+        m_background = std::async(std::launch::async, [this]() {
+            try {
+                while (true) {
+                    std::optional<std::pair<std::size_t, std::size_t>> range;
+                    std::optional<std::size_t> stale;
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        // Merges come first, so that segments about to be merged are not
+                        // rescored.
+                        range = m_policy.select(m_segments);
+                        if (not range) {
+                            stale = stale_segment();
+                        }
+                        if (not range and not stale) {
+                            m_running = false;
+                            return;
+                        }
+                    }
+                    if (range) {
+                        merge(range->first, range->second);
+                    } else {
+                        rescore(*stale);
+                    }
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running = false;
+                throw;
+            }
+        });
+    }
+
+    /// Merges the segments `[first, last)`, which only the background thread removes, so they
+    /// stay at the same positions while new segments are appended.
+    void merge(std::size_t first, std::size_t last)
+    {
+        std::vector<Segment> inputs;
+        std::string name;
+        std::shared_ptr<segments::Index_Statistics const> statistics;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            inputs.assign(
+                std::next(m_segments.begin(), first), std::next(m_segments.begin(), last));
+            name = segments::segment_name(m_next_segment++);
+            statistics = m_statistics;
+        }
+        auto merged =
+            segments::merge_segments<Index, Wand>(m_dir, inputs, name, m_options, *statistics);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_segments.erase(
+                std::next(m_segments.begin(), first), std::next(m_segments.begin(), last));
+            m_segments.insert(std::next(m_segments.begin(), first), merged);
+            write_manifest();
+        }
+        for (auto const& input: inputs) {
+            segments::remove_segment(m_dir, input.name);
+        }
+    }
+
+    /// Rebuilds the WAND data of the segment at position `idx` with the current statistics.
+    void rescore(std::size_t idx)
+    {
+        std::string name;
+        std::shared_ptr<segments::Index_Statistics const> statistics;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            name = m_segments[idx].name;
+            statistics = m_statistics;
+        }
+        spdlog::info("Rescoring {}", name);
+        segments::build_wand_data<Wand>(segments::basename(m_dir, name), m_options, *statistics);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_segments[idx].statistics_generation = statistics->generation;
+        write_manifest();
+    }
+
+    /// Must hold the lock.
+    void write_manifest()
+    {
+        segments::write_manifest(m_dir, m_options, m_statistics->generation, m_segments);
+    }
+
+    std::string m_dir;
+    Segment_Options m_options;
+    Tiered_Merge_Policy m_policy;
+    /// Serializes the updates of the index.
+    std::mutex m_update_mutex;
+    mutable std::mutex m_mutex;
+    std::vector<Segment> m_segments;
+    std::uint64_t m_next_segment = 0;
+    /// Replaced by `add`, so that the background thread keeps using the statistics it started
+    /// a merge or a rescoring with.
+    std::shared_ptr<segments::Index_Statistics const> m_statistics;
+    bool m_running = false;
+    std::future<void> m_background;
+};
+
+}  // namespace pisa
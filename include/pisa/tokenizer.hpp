@@ -1,82 +1,193 @@
 #pragma once
 
-#include <algorithm>
-#include <cctype>
+#include <cstdint>
 #include <string>
 #include <string_view>
+#include <vector>
 
-#include <boost/config/warning_disable.hpp>
-#include <boost/iterator/filter_iterator.hpp>
-#include <boost/iterator/transform_iterator.hpp>
-#include <boost/spirit/include/lex_lexertl.hpp>
-#include <boost/spirit/include/phoenix_operator.hpp>
-#include <boost/spirit/include/qi.hpp>
-#include <boost/tokenizer.hpp>
+#include "util/intrinsics.hpp"
 
 namespace pisa {
 
-namespace lex = boost::spirit::lex;
+namespace detail {
 
-enum TokenType { Abbreviature = 1, Possessive = 2, Term = 3, NotValid = 4 };
+    [[nodiscard]] constexpr auto is_letter(char ch) noexcept -> bool
+    {
+        return (static_cast<unsigned char>(ch) | 0x20U) - 'a' < 26U;
+    }
 
-template <typename Lexer>
-struct tokens: lex::lexer<Lexer> {
-    tokens()
+    [[nodiscard]] constexpr auto is_alnum(char ch) noexcept -> bool
     {
-        // Note: parsing process takes the first match from left to right.
-        this->self = lex::token_def<>("([a-zA-Z]+\\.){2,}", TokenType::Abbreviature)
-            | lex::token_def<>("[a-zA-Z0-9]+('[a-zA-Z]+)", TokenType::Possessive)
-            | lex::token_def<>("[a-zA-Z0-9]+", TokenType::Term)
-            | lex::token_def<>(".", TokenType::NotValid);
+        return is_letter(ch) || static_cast<unsigned char>(ch - '0') < 10U;
     }
-};
 
-class TermTokenizer {
-  public:
-    using token_type =
-        lex::lexertl::token<std::string_view::const_iterator, boost::mpl::vector<>, boost::mpl::false_>;
-    using lexer_type = lex::lexertl::actor_lexer<token_type>;
+    /// Returns the position of the first character in `[pos, last)` for which `is_alnum` equals
+    /// `alnum`, or `last` if there is none.
+    ///
+    /// Characters are classified 32 (AVX2) or 16 (SSE2) at a time: a byte is a letter if it is
+    /// in `[a, z]` once its case bit is set, and a digit if it is in `[0, 9]`. Both tests are
+    /// unsigned range checks, `min(ch - lo, hi - lo) == ch - lo`.
+    template <bool alnum>
+    [[nodiscard]] inline auto find_class(char const* pos, char const* last) noexcept -> char const*
+    {
+#if defined(__AVX2__)
+        __m256i const case_bit = _mm256_set1_epi8(0x20);
+        __m256i const a = _mm256_set1_epi8('a');
+        __m256i const zero = _mm256_set1_epi8('0');
+        __m256i const letters = _mm256_set1_epi8(25);
+        __m256i const digits = _mm256_set1_epi8(9);
+        while (pos + 32 <= last) {
+            __m256i chars = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(pos));
+            __m256i letter = _mm256_sub_epi8(_mm256_or_si256(chars, case_bit), a);
+            __m256i digit = _mm256_sub_epi8(chars, zero);
+            __m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, letters), letter);
+            __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, digits), digit);
+            auto mask = static_cast<uint32_t>(
+                _mm256_movemask_epi8(_mm256_or_si256(is_letter, is_digit)));
+            if constexpr (not alnum) {
+                mask = ~mask;
+            }
+            if (mask != 0) {
+                return pos + __builtin_ctz(mask);
+            }
+            pos += 32;
+        }
+#elif defined(__SSE2__)
+        __m128i const case_bit = _mm_set1_epi8(0x20);
+        __m128i const a = _mm_set1_epi8('a');
+        __m128i const zero = _mm_set1_epi8('0');
+        __m128i const letters = _mm_set1_epi8(25);
+        __m128i const digits = _mm_set1_epi8(9);
+        while (pos + 16 <= last) {
+            __m128i chars = _mm_loadu_si128(reinterpret_cast<__m128i const*>(pos));
+            __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, case_bit), a);
+            __m128i digit = _mm_sub_epi8(chars, zero);
+            __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, letters), letter);
+            __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, digits), digit);
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(is_letter, is_digit)));
+            if constexpr (not alnum) {
+                mask = ~mask & 0xFFFFU;
+            }
+            if (mask != 0) {
+                return pos + __builtin_ctz(mask);
+            }
+            pos += 16;
+        }
+#endif
+        while (pos != last && is_alnum(*pos) != alnum) {
+            ++pos;
+        }
+        return pos;
+    }
 
-    TermTokenizer(std::string_view text)
-        : text_(std::move(text)), first_(text_.begin()), last_(text_.end())
-    {}
+}  // namespace detail
 
-    [[nodiscard]] auto begin()
+/// Splits text into terms, which are:
+///  - abbreviations of at least two groups of letters followed by a dot, such as `U.S.A.`,
+///    returned without dots (`USA`);
+///  - possessives, such as `pup's`, returned without the apostrophe and suffix (`pup`);
+///  - any other sequence of ASCII letters and digits.
+/// All other characters separate terms. At each position, the longest of the three matches
+/// is taken, and ties go to the first in the list above.
+///
+/// Terms are views of the text, except abbreviations, which are copied without dots to a
+/// buffer of the tokenizer. Both the buffer and the list of terms are reused by the next call
+/// to `tokenize`, so once they fit the longest text, tokenizing does not allocate.
+class Tokenizer {
+  public:
+    /// Returns the terms of `text`, valid until the next call or until `text` is destroyed.
+    [[nodiscard]] auto tokenize(std::string_view text) -> std::vector<std::string_view> const&
     {
-        first_ = text_.begin();
-        last_ = text_.end();
-        return boost::make_transform_iterator(
-            boost::make_filter_iterator(is_valid, lexer_.begin(first_, last_)), transform);
+        m_terms.clear();
+        m_buffer.clear();
+        // Abbreviations are shorter than the text, so views of the buffer remain valid.
+        m_buffer.reserve(text.size());
+        char const* pos = text.data();
+        char const* last = text.data() + text.size();
+        while (true) {
+            pos = detail::find_class<true>(pos, last);
+            if (pos == last) {
+                break;
+            }
+            char const* term_end = detail::find_class<false>(pos, last);
+            // An abbreviation is always the longest match: its first group ends with a dot,
+            // so the term cannot be longer nor be followed by a possessive suffix.
+            if (char const* abbreviation_end = match_abbreviation(pos, last);
+                abbreviation_end != nullptr) {
+                auto start = m_buffer.size();
+                for (char const* ch = pos; ch != abbreviation_end; ++ch) {
+                    if (*ch != '.') {
+                        m_buffer.push_back(*ch);
+                    }
+                }
+                m_terms.emplace_back(m_buffer.data() + start, m_buffer.size() - start);
+                pos = abbreviation_end;
+            } else {
+                m_terms.emplace_back(pos, term_end - pos);
+                pos = match_possessive(term_end, last);
+            }
+        }
+        return m_terms;
     }
 
-    [[nodiscard]] auto end()
+  private:
+    /// Returns the end of the abbreviation starting at `pos`, or null if there is none.
+    [[nodiscard]] static auto match_abbreviation(char const* pos, char const* last) noexcept
+        -> char const*
     {
-        return boost::make_transform_iterator(
-            boost::make_filter_iterator(is_valid, lexer_.end()), transform);
+        char const* end = nullptr;
+        int groups = 0;
+        while (pos != last && detail::is_letter(*pos)) {
+            while (pos != last && detail::is_letter(*pos)) {
+                ++pos;
+            }
+            if (pos == last || *pos != '.') {
+                break;
+            }
+            ++pos;
+            if (++groups >= 2) {
+                end = pos;
+            }
+        }
+        return end;
     }
 
-  private:
-    static bool is_valid(token_type const& tok) { return tok.id() != TokenType::NotValid; }
-    static std::string transform(token_type const& tok)
+    /// Returns the end of the possessive suffix starting at `term_end`, or `term_end` if there
+    /// is none.
+    [[nodiscard]] static auto match_possessive(char const* term_end, char const* last) noexcept
+        -> char const*
     {
-        auto& val = tok.value();
-        switch (tok.id()) {
-        case TokenType::Abbreviature: {
-            std::string term;
-            std::copy_if(
-                val.begin(), val.end(), std::back_inserter(term), [](char ch) { return ch != '.'; });
-            return term;
+        if (term_end == last || *term_end != '\'' || term_end + 1 == last
+            || not detail::is_letter(term_end[1])) {
+            return term_end;
         }
-        case TokenType::Possessive:
-            return std::string(val.begin(), std::find(val.begin(), val.end(), '\''));
-        default: return std::string(val.begin(), val.end());
+        char const* pos = term_end + 1;
+        while (pos != last && detail::is_letter(*pos)) {
+            ++pos;
         }
+        return pos;
     }
 
-    std::string_view text_;
-    std::string_view::const_iterator first_;
-    std::string_view::const_iterator last_;
-    tokens<lexer_type> lexer_{};
+    std::vector<std::string_view> m_terms;
+    std::string m_buffer;
+};
+
+/// Iterates over the terms of a text (see `Tokenizer`).
+class TermTokenizer {
+  public:
+    explicit TermTokenizer(std::string_view text) : m_terms(m_tokenizer.tokenize(text)) {}
+    TermTokenizer(TermTokenizer const&) = delete;
+    TermTokenizer(TermTokenizer&&) = delete;
+    TermTokenizer& operator=(TermTokenizer const&) = delete;
+    TermTokenizer& operator=(TermTokenizer&&) = delete;
+    ~TermTokenizer() = default;
+
+    [[nodiscard]] auto begin() const { return m_terms.begin(); }
+    [[nodiscard]] auto end() const { return m_terms.end(); }
+
+  private:
+    Tokenizer m_tokenizer;
+    std::vector<std::string_view> const& m_terms;
 };
 
 }  // namespace pisa
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "bit_vector.hpp"
 #include "util/likely.hpp"
+#include "util/query_counters.hpp"
 #include "util/util.hpp"
 #include <algorithm>
+#include <atomic>
 
 namespace pisa {
 
@@ -10,7 +13,13 @@ using Threshold = float;
 struct topk_queue {
     using entry_type = std::pair<float, uint64_t>;
 
-    explicit topk_queue(uint64_t k) : m_threshold(0), m_k(k) { m_q.reserve(m_k + 1); }
+    /// If `deleted` is not null, the documents whose bits are set are never inserted
+    /// (see `deleted_documents.hpp`).
+    explicit topk_queue(uint64_t k, bit_vector const* deleted = nullptr)
+        : m_threshold(0), m_k(k), m_deleted(deleted)
+    {
+        m_q.reserve(m_k + 1);
+    }
     topk_queue(topk_queue const& q) = default;
     topk_queue& operator=(topk_queue const& q) = default;
 
@@ -27,21 +36,34 @@ struct topk_queue {
         if (PISA_UNLIKELY(not would_enter(score))) {
             return false;
         }
+        // Only the documents that would enter the top-k are checked, so deletions cost
+        // next to nothing, and a null pointer test when there are none.
+        if (PISA_UNLIKELY(m_deleted != nullptr) && (*m_deleted)[docid]) {
+            return false;
+        }
+        PISA_QUERY_COUNT(heap_insertions, 1);
         m_q.emplace_back(score, docid);
         if (PISA_UNLIKELY(m_q.size() <= m_k)) {
             std::push_heap(m_q.begin(), m_q.end(), min_heap_order);
             if (PISA_UNLIKELY(m_q.size() == m_k)) {
-                m_threshold = m_q.front().first;
+                update_threshold(m_q.front().first);
             }
         } else {
             std::pop_heap(m_q.begin(), m_q.end(), min_heap_order);
             m_q.pop_back();
-            m_threshold = m_q.front().first;
+            update_threshold(m_q.front().first);
         }
         return true;
     }
 
-    bool would_enter(float score) const { return score >= m_threshold; }
+    bool would_enter(float score) const
+    {
+        if (m_shared_threshold != nullptr) {
+            auto shared = m_shared_threshold->load(std::memory_order_relaxed);
+            return score >= std::max(m_threshold, shared);
+        }
+        return score >= m_threshold;
+    }
 
     void finalize()
     {
@@ -59,6 +81,15 @@ struct topk_queue {
 
     void set_threshold(Threshold t) noexcept { m_threshold = t; }
 
+    [[nodiscard]] auto threshold() const noexcept -> Threshold { return m_threshold; }
+
+    /// Shares the threshold with other queues collecting results of the same query
+    /// over disjoint sets of documents (see `parallel_range_query`).
+    ///
+    /// Each queue raises `shared` to its own threshold when full, and does not accept
+    /// scores below `shared`: these cannot enter the top-k of the union of all documents.
+    void share_threshold(std::atomic<Threshold>* shared) noexcept { m_shared_threshold = shared; }
+
     void clear() noexcept
     {
         m_q.clear();
@@ -67,10 +98,29 @@ struct topk_queue {
 
     [[nodiscard]] uint64_t size() const noexcept { return m_k; }
 
+    /// Returns the deleted documents, which `insert` skips and algorithms filling the queue
+    /// may skip before scoring them, or null if there are none.
+    [[nodiscard]] auto deleted() const noexcept -> bit_vector const* { return m_deleted; }
+
   private:
+    void update_threshold(float threshold)
+    {
+        PISA_QUERY_COUNT(threshold_updates, threshold != m_threshold ? 1 : 0);
+        m_threshold = threshold;
+        if (m_shared_threshold != nullptr) {
+            auto shared = m_shared_threshold->load(std::memory_order_relaxed);
+            while (shared < threshold
+                   && !m_shared_threshold->compare_exchange_weak(
+                       shared, threshold, std::memory_order_relaxed)) {
+            }
+        }
+    }
+
     float m_threshold;
     uint64_t m_k;
     std::vector<entry_type> m_q;
+    std::atomic<Threshold>* m_shared_threshold = nullptr;
+    bit_vector const* m_deleted = nullptr;
 };
 
 }  // namespace pisa
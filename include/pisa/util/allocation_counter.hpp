@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace pisa {
+
+/// Number of calls to the global `operator new` since the program started.
+///
+/// Only counts if the executable replaces `operator new` with
+/// `PISA_COUNT_ALLOCATIONS()` and is compiled with `PISA_ENABLE_QUERY_COUNTERS`;
+/// otherwise, it stays zero.
+inline std::atomic<std::size_t> allocation_count{0};
+
+/// Whether `PISA_COUNT_ALLOCATIONS()` replaces the global allocation functions.
+#if defined(PISA_ENABLE_QUERY_COUNTERS)
+inline constexpr bool count_allocations = true;
+#else
+inline constexpr bool count_allocations = false;
+#endif
+
+}  // namespace pisa
+
+/// Replaces the global `operator new` and `operator delete` with versions counting the
+/// allocations in `pisa::allocation_count`. Must be used at namespace scope in exactly one
+/// translation unit of an executable.
+///
+/// Expands to nothing unless `PISA_ENABLE_QUERY_COUNTERS` is defined, so that default builds
+/// keep the system allocator instead of updating a shared counter on every allocation.
+#if defined(PISA_ENABLE_QUERY_COUNTERS)
+#define PISA_COUNT_ALLOCATIONS()                                                  \
+    void* operator new(std::size_t size)                                          \
+    {                                                                             \
+        pisa::allocation_count.fetch_add(1, std::memory_order_relaxed);           \
+        if (void* ptr = std::malloc(size == 0 ? 1 : size); ptr != nullptr) {      \
+            return ptr;                                                           \
+        }                                                                         \
+        throw std::bad_alloc();                                                   \
+    }                                                                             \
+    void operator delete(void* ptr) noexcept { std::free(ptr); }                  \
+    void operator delete(void* ptr, std::size_t /* size */) noexcept { std::free(ptr); }
+#else
+#define PISA_COUNT_ALLOCATIONS()
+#endif
@@ -26,8 +26,11 @@ void get_size_stats(
     }
 }
 
-template <typename BlockCodec, bool Profile>
-void get_size_stats(block_freq_index<BlockCodec, Profile>& coll, uint64_t& docs_size, uint64_t& freqs_size)
+template <typename BlockCodec, bool Profile, bool BlockMaxScores>
+void get_size_stats(
+    block_freq_index<BlockCodec, Profile, BlockMaxScores>& coll,
+    uint64_t& docs_size,
+    uint64_t& freqs_size)
 {
     auto size_tree = mapper::size_tree_of(coll);
     size_tree->dump();
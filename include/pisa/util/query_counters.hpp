@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#include "util/util.hpp"
+
+namespace pisa {
+
+/// Counts the work done by the query algorithms and the posting list enumerators.
+///
+/// Counting is enabled by compiling with `PISA_ENABLE_QUERY_COUNTERS` (the CMake option of
+/// the same name); otherwise, `PISA_QUERY_COUNT` expands to nothing and the counters stay
+/// zero. Counters are thread-local: `reset()` them before processing a query, and read
+/// `local()` after, on the same thread.
+struct query_counters {
+    static constexpr bool enabled =
+#if defined(PISA_ENABLE_QUERY_COUNTERS)
+        true;
+#else
+        false;
+#endif
+
+    std::uint64_t postings = 0;  ///< Postings decoded
+    std::uint64_t docs_blocks = 0;  ///< Blocks of document IDs decoded
+    std::uint64_t freqs_blocks = 0;  ///< Blocks of frequencies decoded
+    std::uint64_t next_geq = 0;  ///< Calls to `next_geq` on posting lists
+    std::uint64_t pivots = 0;  ///< Pivots selected by WAND algorithms
+    std::uint64_t evaluations = 0;  ///< Documents scored (postings in term-at-a-time)
+    std::uint64_t heap_insertions = 0;  ///< Entries inserted into a top-k queue
+    std::uint64_t threshold_updates = 0;  ///< Changes of the top-k threshold
+
+    [[nodiscard]] static auto local() -> query_counters&
+    {
+        thread_local query_counters counters;
+        return counters;
+    }
+
+    static void reset() { local() = query_counters{}; }
+
+    stats_line& dump(stats_line& line) const
+    {
+        return line("postings", postings)("docs_blocks", docs_blocks)(
+            "freqs_blocks", freqs_blocks)("next_geq", next_geq)("pivots", pivots)(
+            "evaluations", evaluations)("heap_insertions", heap_insertions)(
+            "threshold_updates", threshold_updates);
+    }
+};
+
+}  // namespace pisa
+
+#if defined(PISA_ENABLE_QUERY_COUNTERS)
+    #define PISA_QUERY_COUNT(counter, n) (::pisa::query_counters::local().counter += (n))
+#else
+    #define PISA_QUERY_COUNT(counter, n) ((void)0)
+#endif
@@ -114,21 +114,22 @@ make_function_iterator(State initial_state, AdvanceFunctor, ValueFunctor)
 }
 
 struct stats_line {
-    stats_line() : first(true) { std::cout << "{"; }
+    /// Writes a JSON object on a single line of `os` (`std::cout` by default).
+    explicit stats_line(std::ostream& os = std::cout) : first(true), m_os(os) { m_os << "{"; }
 
-    ~stats_line() { std::cout << "}" << std::endl; }
+    ~stats_line() { m_os << "}" << std::endl; }
 
     template <typename K, typename T>
     stats_line& operator()(K const& key, T const& value)
     {
         if (!first) {
-            std::cout << ", ";
+            m_os << ", ";
         } else {
             first = false;
         }
 
         emit(key);
-        std::cout << ": ";
+        m_os << ": ";
         emit(value);
         return *this;
     }
@@ -143,28 +144,28 @@ struct stats_line {
     template <typename T>
     void emit(T const& v) const
     {
-        std::cout << v;
+        m_os << v;
     }
 
     // XXX properly escape strings
-    void emit(const char* s) const { std::cout << '"' << s << '"'; }
+    void emit(const char* s) const { m_os << '"' << s << '"'; }
 
     void emit(std::string const& s) const { emit(s.c_str()); }
 
     template <typename T>
     void emit(std::vector<T> const& v) const
     {
-        std::cout << "[";
+        m_os << "[";
         bool first = true;
         for (auto const& i: v) {
             if (first) {
                 first = false;
             } else {
-                std::cout << ", ";
+                m_os << ", ";
             }
             emit(i);
         }
-        std::cout << "]";
+        m_os << "]";
     }
 
     template <typename K, typename V>
@@ -178,7 +179,7 @@ struct stats_line {
     typename std::enable_if<Pos != 0, void>::type emit_tuple_helper(Tuple const& t) const
     {
         emit_tuple_helper<Tuple, Pos - 1>(t);
-        std::cout << ", ";
+        m_os << ", ";
         emit(std::get<Pos>(t));
     }
 
@@ -191,9 +192,9 @@ struct stats_line {
     template <typename... Tp>
     void emit(std::tuple<Tp...> const& t) const
     {
-        std::cout << "[";
+        m_os << "[";
         emit_tuple_helper<std::tuple<Tp...>, sizeof...(Tp) - 1>(t);
-        std::cout << "]";
+        m_os << "]";
     }
 
     template <typename T1, typename T2>
@@ -203,6 +204,7 @@ struct stats_line {
     }
 
     bool first;
+    std::ostream& m_os;
 };
 
 }  // namespace pisa
@@ -1,14 +1,27 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "boost/variant.hpp"
 #include "spdlog/spdlog.h"
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/task_arena.h"
 
 #include "binary_freq_collection.hpp"
+#include "deleted_documents.hpp"
 #include "mappable/mappable_vector.hpp"
+#include "util/compiler_attribute.hpp"
 #include "util/progress.hpp"
 #include "util/util.hpp"
 #include "wand_data_raw.hpp"
@@ -19,13 +32,54 @@
 class enumerator;
 namespace pisa {
 
+/// Document normalizations stored in full precision.
+struct Float_Doc_Norms {
+    float const* norms;
+
+    float PISA_ALWAYSINLINE operator()(uint64_t doc_id) const { return norms[doc_id]; }
+};
+
+/// Document normalizations stored as codes into a codebook.
+template <typename Code>
+struct Coded_Doc_Norms {
+    Code const* codes;
+    float const* codebook;
+
+    float PISA_ALWAYSINLINE operator()(uint64_t doc_id) const { return codebook[codes[doc_id]]; }
+};
+
+/// Statistics of a collection of which the indexed documents are a part, such as the segments
+/// of a segmented index, with which these documents are scored instead of their own statistics.
+/// Term statistics are indexed by the term IDs of the indexed documents.
+struct Collection_Statistics {
+    uint64_t num_docs = 0;
+    uint64_t collection_len = 0;
+    std::vector<uint64_t> term_posting_counts{};
+    std::vector<uint64_t> term_occurrence_counts{};
+};
+
 template <typename block_wand_type = wand_data_raw>
 class wand_data {
   public:
     using wand_data_enumerator = typename block_wand_type::enumerator;
 
+    /// Identifies WAND data, stored right after the flags of `mapper::freeze`.
+    static constexpr uint64_t magic = 0x444E415741534950ULL;  // "PISAWAND"
+    /// Incremented whenever the layout changes; version 2 added document normalizations, and
+    /// version 3 widened the term statistics to 64 bits.
+    static constexpr uint64_t version = 3;
+
     wand_data() {}
 
+    /// Lists are processed in parallel, with as many threads as the TBB scheduler allows.
+    ///
+    /// If `deleted` is not null, the score upper bounds of the lists in which at least
+    /// `min_deleted_fraction` of the documents are deleted ignore the deleted documents.
+    /// Term statistics still include them, so that scores do not depend on deletions.
+    ///
+    /// If `statistics` is not null, documents are scored, and their score upper bounds computed,
+    /// with these statistics rather than those of `coll`; `num_docs()` then returns the number
+    /// of documents of the whole collection.
     template <typename LengthsIterator>
     wand_data(
         LengthsIterator len_it,
@@ -34,13 +88,17 @@ class wand_data {
         std::string const& scorer_name,
         BlockSize block_size,
         bool is_quantized,
-        std::unordered_set<size_t> const& terms_to_drop)
+        std::unordered_set<size_t> const& terms_to_drop,
+        uint64_t doc_norm_bits = 0,
+        bit_vector const* deleted = nullptr,
+        double min_deleted_fraction = 0.0,
+        Collection_Statistics const* statistics = nullptr)
         : m_num_docs(num_docs)
     {
         std::vector<uint32_t> doc_lens(num_docs);
         std::vector<float> max_term_weight;
-        std::vector<uint32_t> term_occurrence_counts;
-        std::vector<uint32_t> term_posting_counts;
+        std::vector<uint64_t> term_occurrence_counts;
+        std::vector<uint64_t> term_posting_counts;
         global_parameters params;
         spdlog::info("Reading sizes...");
 
@@ -49,50 +107,121 @@ class wand_data {
             doc_lens[i] = len;
             m_collection_len += len;
         }
+        if (statistics != nullptr) {
+            m_num_docs = statistics->num_docs;
+            m_collection_len = statistics->collection_len;
+        }
 
-        m_avg_len = float(m_collection_len / double(num_docs));
-
-        typename block_wand_type::builder builder(coll, params);
+        m_avg_len = float(m_collection_len / double(m_num_docs));
 
-        {
-            pisa::progress progress("Storing terms statistics", coll.size());
-            size_t term_id = 0;
-            for (auto const& seq: coll) {
-                if (terms_to_drop.find(term_id) != terms_to_drop.end()) {
-                    progress.update(1);
-                    term_id += 1;
-                    continue;
-                }
+        if (doc_norm_bits != 0) {
+            if (scorer_name != "bm25") {
+                throw std::invalid_argument(
+                    "Precomputed document normalization is only supported for bm25");
+            }
+            build_doc_norms(doc_lens, doc_norm_bits);
+        }
 
-                size_t term_occurrence_count = std::accumulate(seq.freqs.begin(), seq.freqs.end(), 0);
-                term_occurrence_counts.push_back(term_occurrence_count);
-                term_posting_counts.push_back(seq.docs.size());
-                term_id += 1;
-                progress.update(1);
+        // Lists of the terms that are kept, so that they can be processed in parallel.
+        std::vector<binary_freq_collection::sequence> lists;
+        std::vector<size_t> list_terms;
+        size_t num_terms = 0;
+        for (auto const& seq: coll) {
+            if (terms_to_drop.find(num_terms) == terms_to_drop.end()) {
+                lists.push_back(seq);
+                list_terms.push_back(num_terms);
             }
+            num_terms += 1;
+        }
+        if (statistics != nullptr && statistics->term_posting_counts.size() != num_terms) {
+            throw std::invalid_argument(fmt::format(
+                "Collection statistics have {} terms instead of {}",
+                statistics->term_posting_counts.size(),
+                num_terms));
+        }
+
+        {
+            pisa::progress progress("Storing terms statistics", num_terms);
+            progress.update(num_terms - lists.size());
+            term_occurrence_counts.resize(lists.size());
+            term_posting_counts.resize(lists.size());
+            tbb::parallel_for(
+                tbb::blocked_range<size_t>(0, lists.size()), [&](auto const& range) {
+                    for (auto term = range.begin(); term != range.end(); ++term) {
+                        if (statistics != nullptr) {
+                            auto term_id = list_terms[term];
+                            term_occurrence_counts[term] =
+                                statistics->term_occurrence_counts[term_id];
+                            term_posting_counts[term] = statistics->term_posting_counts[term_id];
+                            continue;
+                        }
+                        auto const& seq = lists[term];
+                        term_occurrence_counts[term] =
+                            std::accumulate(seq.freqs.begin(), seq.freqs.end(), uint64_t(0));
+                        term_posting_counts[term] = seq.docs.size();
+                    }
+                    progress.update(range.size());
+                });
         }
         m_doc_lens.steal(doc_lens);
         m_term_occurrence_counts.steal(term_occurrence_counts);
         m_term_posting_counts.steal(term_posting_counts);
 
+        spdlog::info("Storing max weight for each list and for each block...");
         auto scorer = scorer::from_name(scorer_name, *this);
+        typename block_wand_type::builder builder(coll, params);
         {
-            pisa::progress progress("Storing score upper bounds", coll.size());
-            size_t term_id = 0;
-            size_t new_term_id = 0;
-            for (auto const& seq: coll) {
-                if (terms_to_drop.find(term_id) != terms_to_drop.end()) {
-                    progress.update(1);
-                    term_id += 1;
-                    continue;
-                }
-                auto v = builder.add_sequence(
-                    seq, coll, doc_lens, m_avg_len, scorer->term_scorer(new_term_id), block_size);
-                max_term_weight.push_back(v);
-                m_index_max_term_weight = std::max(m_index_max_term_weight, v);
-                term_id += 1;
-                new_term_id += 1;
-                progress.update(1);
+            pisa::progress progress("Storing score upper bounds", num_terms);
+            progress.update(num_terms - lists.size());
+            // Each chunk of consecutive lists has its own builder, appended as soon as the chunks
+            // before it are, so the data does not depend on the number of threads. At most
+            // `max_pending` chunks are built at a time, which bounds the builders held back
+            // waiting for an earlier chunk.
+            auto chunks = chunk_lists(lists);
+            size_t num_chunks = chunks.size() - 1;
+            size_t max_pending = 4 * static_cast<size_t>(tbb::this_task_arena::max_concurrency());
+            std::vector<std::unique_ptr<typename block_wand_type::builder>> chunk_builders(
+                num_chunks);
+            size_t next_chunk = 0;
+            std::mutex append_mutex;
+            max_term_weight.resize(lists.size());
+            std::atomic_size_t recomputed = 0;
+            for (size_t first = 0; first < num_chunks; first += max_pending) {
+                size_t last = std::min(first + max_pending, num_chunks);
+                tbb::parallel_for(first, last, [&](size_t chunk) {
+                    auto chunk_builder =
+                        std::make_unique<typename block_wand_type::builder>(coll, params);
+                    for (auto term = chunks[chunk]; term < chunks[chunk + 1]; ++term) {
+                        auto const& seq = lists[term];
+                        auto term_scorer = scorer->term_scorer(term);
+                        if (deleted != nullptr
+                            && deleted_fraction(*deleted, seq.docs) >= min_deleted_fraction) {
+                            auto live_scorer = [&](uint64_t docid, uint64_t freq) {
+                                return (*deleted)[docid] ? 0.0F : term_scorer(docid, freq);
+                            };
+                            max_term_weight[term] = chunk_builder->add_sequence(
+                                seq, coll, doc_lens, m_avg_len, live_scorer, block_size);
+                            recomputed += 1;
+                        } else {
+                            max_term_weight[term] = chunk_builder->add_sequence(
+                                seq, coll, doc_lens, m_avg_len, term_scorer, block_size);
+                        }
+                    }
+                    progress.update(chunks[chunk + 1] - chunks[chunk]);
+                    std::lock_guard<std::mutex> lock(append_mutex);
+                    chunk_builders[chunk] = std::move(chunk_builder);
+                    while (next_chunk < last && chunk_builders[next_chunk] != nullptr) {
+                        builder.append(std::move(*chunk_builders[next_chunk]));
+                        chunk_builders[next_chunk].reset();
+                        next_chunk += 1;
+                    }
+                });
+            }
+            for (auto w: max_term_weight) {
+                m_index_max_term_weight = std::max(m_index_max_term_weight, w);
+            }
+            if (deleted != nullptr) {
+                spdlog::info("Bounds of {} lists exclude deleted documents", recomputed.load());
             }
             if (is_quantized) {
                 LinearQuantizer quantizer(
@@ -109,6 +238,28 @@ class wand_data {
 
     float norm_len(uint64_t doc_id) const { return m_doc_lens[doc_id] / m_avg_len; }
 
+    /// Returns true if the BM25 document normalization `k1 * (1 - b + b * norm_len)`
+    /// was precomputed at build time (see `with_doc_norms`).
+    bool has_doc_norms() const { return m_doc_norm_bits != 0; }
+
+    uint64_t doc_norm_bits() const { return m_doc_norm_bits; }
+
+    /// Calls `fn` with the precomputed document normalizations, as `Float_Doc_Norms` or
+    /// `Coded_Doc_Norms`, so that their width is resolved once rather than for every posting.
+    template <typename Fn>
+    auto with_doc_norms(Fn&& fn) const
+    {
+        switch (m_doc_norm_bits) {
+        case 8:
+            return fn(Coded_Doc_Norms<uint8_t>{m_doc_norms_8.data(), m_doc_norm_codebook.data()});
+        case 16:
+            return fn(
+                Coded_Doc_Norms<uint16_t>{m_doc_norms_16.data(), m_doc_norm_codebook.data()});
+        case 32: return fn(Float_Doc_Norms{m_doc_norms.data()});
+        default: throw std::logic_error("Document normalizations were not precomputed");
+        }
+    }
+
     size_t doc_len(uint64_t doc_id) const { return m_doc_lens[doc_id]; }
 
     size_t term_occurrence_count(uint64_t term_id) const
@@ -138,24 +289,134 @@ class wand_data {
     template <typename Visitor>
     void map(Visitor& visit)
     {
+        // Checked before anything else is read, so that older files are not read past their end.
+        visit(m_magic, "m_magic")(m_version, "m_version");
+        if (m_magic != magic || m_version != version) {
+            throw std::runtime_error(fmt::format(
+                "Unsupported WAND data format{}: rebuild it with create_wand_data",
+                m_magic == magic ? fmt::format(" (version {})", m_version) : ""));
+        }
         visit(m_block_wand, "m_block_wand")(m_doc_lens, "m_doc_lens")(
-
             m_term_occurrence_counts, "m_term_occurrence_counts")(
             m_term_posting_counts, "m_term_posting_counts")(m_avg_len, "m_avg_len")(
             m_collection_len, "m_collection_len")(m_num_docs, "m_num_docs")(
             m_max_term_weight, "m_max_term_weight")(
-            m_index_max_term_weight, "m_index_max_term_weight");
+            m_index_max_term_weight, "m_index_max_term_weight")(
+            m_doc_norm_bits, "m_doc_norm_bits")(m_doc_norms, "m_doc_norms")(
+            m_doc_norms_8, "m_doc_norms_8")(m_doc_norms_16, "m_doc_norms_16")(
+            m_doc_norm_codebook, "m_doc_norm_codebook");
     }
 
   private:
+    /// Splits `lists` into chunks of consecutive lists with about as many postings, and returns
+    /// the boundaries of the chunks.
+    static auto chunk_lists(std::vector<binary_freq_collection::sequence> const& lists)
+        -> std::vector<size_t>
+    {
+        constexpr size_t max_chunks = 1024;
+        size_t postings = 0;
+        for (auto const& seq: lists) {
+            postings += seq.docs.size();
+        }
+        size_t chunk_postings = std::max<size_t>(postings / max_chunks, 1);
+        std::vector<size_t> chunks{0};
+        size_t current_postings = 0;
+        for (size_t term = 0; term < lists.size(); ++term) {
+            current_postings += lists[term].docs.size();
+            if (current_postings >= chunk_postings) {
+                chunks.push_back(term + 1);
+                current_postings = 0;
+            }
+        }
+        if (chunks.back() != lists.size()) {
+            chunks.push_back(lists.size());
+        }
+        return chunks;
+    }
+
+    /// Precomputes the BM25 length normalization of every document.
+    ///
+    /// With 32 bits, values are stored as floats. With 8 or 16 bits, each document stores
+    /// a code into a codebook of at most 2^bits values. Since the normalization only depends
+    /// on the document length, the codebook is exact if there are few distinct lengths;
+    /// otherwise, normalizations are quantized on a logarithmic scale, which bounds the
+    /// relative error of every value.
+    /// The table is built before the score upper bounds, so these remain safe.
+    void build_doc_norms(std::vector<uint32_t> const& doc_lens, uint64_t bits)
+    {
+        using scorer_type = bm25<wand_data>;
+        auto norm = [&](double len) {
+            return scorer_type::k1
+                * (1.0f - scorer_type::b + scorer_type::b * (float(len) / m_avg_len));
+        };
+        if (bits == 32) {
+            spdlog::info("Storing document normalization in full precision");
+            std::vector<float> doc_norms(doc_lens.size());
+            std::transform(doc_lens.begin(), doc_lens.end(), doc_norms.begin(), norm);
+            m_doc_norms.steal(doc_norms);
+            m_doc_norm_bits = bits;
+            return;
+        }
+        if (bits != 8 && bits != 16) {
+            throw std::invalid_argument(fmt::format(
+                "Document normalization must use 8, 16, or 32 bits but {} passed", bits));
+        }
+        spdlog::info("Storing document normalization quantized to {} bits", bits);
+
+        std::set<uint32_t> lengths(doc_lens.begin(), doc_lens.end());
+        size_t const levels = size_t(1) << bits;
+        std::unordered_map<uint32_t, uint32_t> codes;
+        std::vector<float> codebook;
+        if (lengths.size() <= levels) {
+            for (auto len: lengths) {
+                codes[len] = codebook.size();
+                codebook.push_back(norm(len));
+            }
+        } else {
+            float min_norm = norm(*lengths.begin());
+            float max_norm = norm(*lengths.rbegin());
+            double log_min = std::log(min_norm);
+            double step = (std::log(max_norm) - log_min) / (levels - 1);
+            for (size_t code = 0; code < levels; ++code) {
+                codebook.push_back(std::exp(log_min + code * step));
+            }
+            for (auto len: lengths) {
+                codes[len] = std::lround((std::log(norm(len)) - log_min) / step);
+            }
+        }
+
+        if (bits == 8) {
+            std::vector<uint8_t> doc_norms(doc_lens.size());
+            std::transform(doc_lens.begin(), doc_lens.end(), doc_norms.begin(), [&](auto len) {
+                return codes[len];
+            });
+            m_doc_norms_8.steal(doc_norms);
+        } else {
+            std::vector<uint16_t> doc_norms(doc_lens.size());
+            std::transform(doc_lens.begin(), doc_lens.end(), doc_norms.begin(), [&](auto len) {
+                return codes[len];
+            });
+            m_doc_norms_16.steal(doc_norms);
+        }
+        m_doc_norm_codebook.steal(codebook);
+        m_doc_norm_bits = bits;
+    }
+
+    uint64_t m_magic = magic;
+    uint64_t m_version = version;
     uint64_t m_num_docs = 0;
     float m_avg_len = 0;
     uint64_t m_collection_len = 0;
     float m_index_max_term_weight = 0;
     block_wand_type m_block_wand;
     mapper::mappable_vector<uint32_t> m_doc_lens;
-    mapper::mappable_vector<uint32_t> m_term_occurrence_counts;
-    mapper::mappable_vector<uint32_t> m_term_posting_counts;
+    mapper::mappable_vector<uint64_t> m_term_occurrence_counts;
+    mapper::mappable_vector<uint64_t> m_term_posting_counts;
     mapper::mappable_vector<float> m_max_term_weight;
+    uint64_t m_doc_norm_bits = 0;
+    mapper::mappable_vector<float> m_doc_norms;
+    mapper::mappable_vector<uint8_t> m_doc_norms_8;
+    mapper::mappable_vector<uint16_t> m_doc_norms_16;
+    mapper::mappable_vector<float> m_doc_norm_codebook;
 };
 }  // namespace pisa
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <iterator>
+
 #include "boost/variant.hpp"
 #include "spdlog/spdlog.h"
 #include <range/v3/view/zip.hpp>
@@ -100,9 +102,7 @@ class wand_data_compressed {
               total_blocks(0),
               params(params),
               compressor_builder(coll.num_docs(), params)
-        {
-            spdlog::info("Storing max weight for each list and for each block...");
-        }
+        {}
 
         template <typename Scorer>
         float add_sequence(
@@ -129,6 +129,23 @@ class wand_data_compressed {
             return max_term_weight.back();
         }
 
+        /// Appends the lists added to `other`, which follow those added to this builder.
+        void append(builder&& other)
+        {
+            block_max_documents.insert(
+                block_max_documents.end(),
+                std::make_move_iterator(other.block_max_documents.begin()),
+                std::make_move_iterator(other.block_max_documents.end()));
+            unquantized_block_max_scores.insert(
+                unquantized_block_max_scores.end(),
+                std::make_move_iterator(other.unquantized_block_max_scores.begin()),
+                std::make_move_iterator(other.unquantized_block_max_scores.end()));
+            max_term_weight.insert(
+                max_term_weight.end(), other.max_term_weight.begin(), other.max_term_weight.end());
+            total_elements += other.total_elements;
+            total_blocks += other.total_blocks;
+        }
+
         void quantize_block_max_term_weights(float index_max_term_weight) {}
 
         void build(wand_data_compressed& wdata)
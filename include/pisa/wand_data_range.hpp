@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <iterator>
+
 #include "spdlog/spdlog.h"
 
 #include "binary_freq_collection.hpp"
@@ -38,21 +41,12 @@ class wand_data_range {
     class builder {
       public:
         builder(binary_freq_collection const& coll, [[maybe_unused]] global_parameters const& params)
-            : blocks_num(ceil_div(coll.num_docs(), range_size)),
+            : num_docs(coll.num_docs()),
+              blocks_num(ceil_div(coll.num_docs(), range_size)),
               total_elements(0),
               blocks_start{0},
               block_max_term_weight{}
-        {
-            auto posting_lists = std::distance(coll.begin(), coll.end());
-            spdlog::info("Storing max weight for each list and for each block...");
-            spdlog::info(
-                "Range size: {}. Number of docs: {}."
-                "Blocks per posting list: {}. Posting lists: {}.",
-                range_size,
-                coll.num_docs(),
-                blocks_num,
-                posting_lists);
-        }
+        {}
 
         template <typename Scorer>
         float add_sequence(
@@ -85,6 +79,22 @@ class wand_data_range {
             return max_score;
         }
 
+        /// Appends the lists added to `other`, which follow those added to this builder.
+        void append(builder&& other)
+        {
+            auto offset = blocks_start.back();
+            std::transform(
+                std::next(other.blocks_start.begin()),
+                other.blocks_start.end(),
+                std::back_inserter(blocks_start),
+                [offset](auto start) { return start + offset; });
+            block_max_term_weight.insert(
+                block_max_term_weight.end(),
+                other.block_max_term_weight.begin(),
+                other.block_max_term_weight.end());
+            total_elements += other.total_elements;
+        }
+
         void quantize_block_max_term_weights(float index_max_term_weight)
         {
             LinearQuantizer quantizer(index_max_term_weight, configuration::get().quantization_bits);
@@ -95,6 +105,13 @@ class wand_data_range {
 
         void build(wand_data_range& wdata)
         {
+            spdlog::info(
+                "Range size: {}. Number of docs: {}."
+                "Blocks per posting list: {}. Posting lists: {}.",
+                range_size,
+                num_docs,
+                blocks_num,
+                blocks_start.size() - 1);
             wdata.m_blocks_num = blocks_num;
             wdata.m_blocks_start.steal(blocks_start);
             wdata.m_block_max_term_weight.steal(block_max_term_weight);
@@ -103,6 +120,7 @@ class wand_data_range {
                 static_cast<float>(total_elements) / wdata.m_block_max_term_weight.size());
         }
 
+        uint64_t num_docs;
         uint64_t blocks_num;
         uint64_t total_elements;
         std::vector<uint64_t> blocks_start;
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <iterator>
+
 #include "boost/variant.hpp"
 #include "spdlog/spdlog.h"
 
@@ -23,7 +26,6 @@ class wand_data_raw {
         {
             (void)coll;
             (void)params;
-            spdlog::info("Storing max weight for each list and for each block...");
             total_elements = 0;
             total_blocks = 0;
             effective_list = 0;
@@ -56,6 +58,28 @@ class wand_data_raw {
             return max_term_weight.back();
         }
 
+        /// Appends the lists added to `other`, which follow those added to this builder.
+        void append(builder&& other)
+        {
+            auto offset = blocks_start.back();
+            std::transform(
+                std::next(other.blocks_start.begin()),
+                other.blocks_start.end(),
+                std::back_inserter(blocks_start),
+                [offset](auto start) { return start + offset; });
+            block_max_term_weight.insert(
+                block_max_term_weight.end(),
+                other.block_max_term_weight.begin(),
+                other.block_max_term_weight.end());
+            block_docid.insert(
+                block_docid.end(), other.block_docid.begin(), other.block_docid.end());
+            max_term_weight.insert(
+                max_term_weight.end(), other.max_term_weight.begin(), other.max_term_weight.end());
+            total_elements += other.total_elements;
+            total_blocks += other.total_blocks;
+            effective_list += other.effective_list;
+        }
+
         void quantize_block_max_term_weights(float index_max_term_weight)
         {
             LinearQuantizer quantizer(index_max_term_weight, configuration::get().quantization_bits);
@@ -31,7 +31,7 @@ auto parse_query_terms(std::string const& query_string, TermProcessor term_proce
     TermTokenizer tokenizer(raw_query);
     std::vector<term_id_type> parsed_query;
     for (auto term_iter = tokenizer.begin(); term_iter != tokenizer.end(); ++term_iter) {
-        auto raw_term = *term_iter;
+        auto raw_term = std::string(*term_iter);
         auto term = term_processor(raw_term);
         if (term) {
             if (!term_processor.is_stopword(*term)) {
@@ -105,6 +105,13 @@ void remove_duplicate_terms(term_id_vec& terms)
 term_freq_vec query_freqs(term_id_vec terms)
 {
     term_freq_vec query_term_freqs;
+    query_freqs(terms, query_term_freqs);
+    return query_term_freqs;
+}
+
+void query_freqs(term_id_vec& terms, term_freq_vec& query_term_freqs)
+{
+    query_term_freqs.clear();
     std::sort(terms.begin(), terms.end());
     // count query term frequencies
     for (size_t i = 0; i < terms.size(); ++i) {
@@ -114,7 +121,6 @@ term_freq_vec query_freqs(term_id_vec terms)
             query_term_freqs.back().second += 1;
         }
     }
-    return query_term_freqs;
 }
 
 }  // namespace pisa
@@ -0,0 +1,86 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <sstream>
+
+#include "query/algorithm_selector.hpp"
+
+using namespace pisa;
+
+struct MockWandData {
+    std::vector<std::size_t> posting_counts;
+    std::vector<float> max_weights;
+
+    [[nodiscard]] auto term_posting_count(std::uint64_t term_id) const -> std::size_t
+    {
+        return posting_counts[term_id];
+    }
+    [[nodiscard]] auto max_term_weight(std::uint64_t term_id) const -> float
+    {
+        return max_weights[term_id];
+    }
+};
+
+TEST_CASE("Query features", "[algorithm_selector]")
+{
+    MockWandData wdata{{1, 7, 255}, {1.0, 2.0, 5.0}};
+    Query query{std::nullopt, {0, 2}, {}};
+    auto features = QueryFeatures::compute(wdata, query);
+    REQUIRE(features.values[0] == 1.0);
+    REQUIRE(features.values[1] == 2.0);
+    REQUIRE(features.values[2] == Approx(1.0));
+    REQUIRE(features.values[3] == Approx(8.0));
+    REQUIRE(features.values[4] == Approx(std::log2(257.0)));
+    REQUIRE(features.values[5] == Approx(5.0 / 6.0));
+
+    SECTION("Repeated terms are counted once, with their scores weighted")
+    {
+        Query repeated{std::nullopt, {2, 0, 2}, {}};
+        auto features = QueryFeatures::compute(wdata, repeated);
+        REQUIRE(features.values[1] == 2.0);
+        REQUIRE(features.values[2] == Approx(1.0));
+        REQUIRE(features.values[3] == Approx(8.0));
+        REQUIRE(features.values[4] == Approx(std::log2(257.0)));
+        REQUIRE(features.values[5] == Approx(10.0 / 11.0));
+    }
+}
+
+TEST_CASE("Select algorithm", "[algorithm_selector]")
+{
+    auto features_of = [](double num_terms) {
+        QueryFeatures features;
+        features.values = {1.0, num_terms, 0.0, 0.0, 0.0, 0.0};
+        return features;
+    };
+    // `short` is faster on queries with fewer than 4 terms; `long` on queries with more.
+    std::map<std::string, std::vector<AlgorithmSelector::Sample>> samples;
+    for (double num_terms = 1; num_terms <= 8; num_terms += 1) {
+        samples["short"].push_back({features_of(num_terms), std::exp2(num_terms) - 1});
+        samples["long"].push_back({features_of(num_terms), std::exp2(4.0) - 1});
+    }
+    auto selector = AlgorithmSelector::train(samples, 0.0);
+    REQUIRE(selector.algorithms() == std::vector<std::string>{"long", "short"});
+    REQUIRE(selector.predict(1, features_of(3)) == Approx(7.0));
+    REQUIRE(selector.predict(0, features_of(3)) == Approx(15.0));
+    REQUIRE(selector.algorithms()[selector.select(features_of(2))] == "short");
+    REQUIRE(selector.algorithms()[selector.select(features_of(6))] == "long");
+
+    SECTION("Write and read")
+    {
+        std::stringstream model;
+        selector.write(model);
+        auto read = AlgorithmSelector::read(model);
+        REQUIRE(read.algorithms() == selector.algorithms());
+        for (double num_terms = 1; num_terms <= 8; num_terms += 1) {
+            auto features = features_of(num_terms);
+            REQUIRE(read.select(features) == selector.select(features));
+            REQUIRE(read.predict(0, features) == selector.predict(0, features));
+        }
+    }
+
+    SECTION("Invalid model")
+    {
+        std::istringstream model("wand\t1.0\t2.0\n");
+        REQUIRE_THROWS_AS(AlgorithmSelector::read(model), std::invalid_argument);
+    }
+}
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <stdexcept>
 #include <vector>
 
 template <typename BlockCodec>
@@ -64,7 +65,82 @@ void test_block_freq_index()
             }
             REQUIRE(coll.num_docs() == doc_enum.docid());
         }
+        REQUIRE(coll.scorer().empty());
+
+        pisa::block_freq_index<BlockCodec, false, true> with_scores;
+        REQUIRE_THROWS_AS(pisa::mapper::map(with_scores, m), std::invalid_argument);
+    }
+}
+
+template <typename BlockCodec>
+void test_block_freq_index_with_block_max_scores()
+{
+    pisa::global_parameters params;
+    uint64_t universe = 20000;
+    typedef pisa::block_freq_index<BlockCodec, false, true> collection_type;
+    typename collection_type::builder b(universe, params, "bm25(k1=0.9,b=0.4)");
+
+    typedef std::vector<uint64_t> vec_type;
+    std::vector<std::tuple<vec_type, vec_type, std::vector<float>>> posting_lists(30);
+    for (auto& [docs, freqs, scores]: posting_lists) {
+        double avg_gap = 1.1 + double(rand()) / RAND_MAX * 10;
+        uint64_t n = uint64_t(universe / avg_gap);
+        docs = random_sequence(universe, n, true);
+        freqs.resize(n);
+        std::generate(freqs.begin(), freqs.end(), []() { return (rand() % 256) + 1; });
+        scores.resize(n);
+        std::generate(scores.begin(), scores.end(), []() { return float(rand()) / RAND_MAX; });
+
+        b.add_posting_list(n, docs.begin(), freqs.begin(), scores.begin(), 0);
     }
+
+    collection_type coll;
+    b.build(coll);
+
+    uint64_t block_size = BlockCodec::block_size;
+    for (size_t i = 0; i < posting_lists.size(); ++i) {
+        auto const& [docs, freqs, scores] = posting_lists[i];
+        auto doc_enum = coll[i];
+        REQUIRE(docs.size() == doc_enum.size());
+        for (size_t p = 0; p < docs.size(); ++p, doc_enum.next()) {
+            MY_REQUIRE_EQUAL(docs[p], doc_enum.docid(), "i = " << i << " p = " << p);
+            MY_REQUIRE_EQUAL(freqs[p], doc_enum.freq(), "i = " << i << " p = " << p);
+        }
+        REQUIRE(coll.num_docs() == doc_enum.docid());
+
+        auto block_scores = coll[i].block_scores();
+        for (size_t p = 0; p < docs.size(); ++p) {
+            block_scores.next_geq(docs[p]);
+            size_t first = p / block_size * block_size;
+            size_t last = std::min(first + block_size, docs.size());
+            MY_REQUIRE_EQUAL(docs[last - 1], block_scores.docid(), "i = " << i << " p = " << p);
+            REQUIRE(
+                block_scores.score()
+                == *std::max_element(scores.begin() + first, scores.begin() + last));
+        }
+        block_scores.next_geq(universe);
+        REQUIRE(docs.back() == block_scores.docid());
+    }
+
+    Temporary_Directory tmpdir;
+    auto filename = (tmpdir.path() / "index").string();
+    pisa::mapper::freeze(coll, filename.c_str());
+    mio::mmap_source m(filename.c_str());
+    collection_type mapped;
+    pisa::mapper::map(mapped, m);
+    REQUIRE(mapped.size() == posting_lists.size());
+    REQUIRE(mapped.scorer() == "bm25(k1=0.9,b=0.4)");
+    REQUIRE_NOTHROW(mapped.check_scorer("bm25(k1=0.9,b=0.4)"));
+    REQUIRE_THROWS_AS(mapped.check_scorer("qld(mu=1000)"), std::invalid_argument);
+
+    pisa::block_freq_index<BlockCodec> without_scores;
+    REQUIRE_THROWS_AS(pisa::mapper::map(without_scores, m), std::invalid_argument);
+
+    // Files without the header are rejected.
+    std::vector<char> data(m.begin(), m.end());
+    data.erase(data.begin(), data.begin() + 3 * sizeof(uint64_t));
+    collection_type legacy;
+    REQUIRE_THROWS_AS(pisa::mapper::map(legacy, data.data()), std::runtime_error);
 }
 
 TEST_CASE("block_freq_index")
@@ -80,3 +156,9 @@ TEST_CASE("block_freq_index")
     test_block_freq_index<pisa::simple16_block>();
     test_block_freq_index<pisa::simdbp_block>();
 }
+
+TEST_CASE("block_freq_index with block-max scores")
+{
+    test_block_freq_index_with_block_max_scores<pisa::optpfor_block>();
+    test_block_freq_index_with_block_max_scores<pisa::simdbp_block>();
+}
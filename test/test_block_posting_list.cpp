@@ -13,6 +13,7 @@
 #include "codec/varintgb.hpp"
 
 #include "block_posting_list.hpp"
+#include "query/algorithm/block_intersection.hpp"
 
 #include <algorithm>
 #include <cstdlib>
@@ -117,6 +118,108 @@ TEST_CASE("block_posting_list")
     test_block_posting_list<pisa::simple16_block>();
     test_block_posting_list<pisa::simdbp_block>();
 }
+TEST_CASE("block_posting_list_long_skips")
+{
+    typedef pisa::block_posting_list<pisa::optpfor_block> posting_list_type;
+    uint64_t universe = 10'000'000;
+    uint64_t n = 2'000'000;
+    std::vector<uint64_t> docs, freqs;
+    random_posting_data(n, universe, docs, freqs);
+    std::vector<uint8_t> data;
+    posting_list_type::write(data, n, docs.begin(), freqs.begin());
+
+    typename posting_list_type::document_enumerator e(data.data(), universe);
+    REQUIRE(e.num_blocks() > pisa::block_max_skip_threshold);
+    for (uint64_t skip: {1, 100, 1000, 10'000, 100'000, 1'000'000}) {
+        e.reset();
+        for (size_t i = 0; i < n; i += skip) {
+            e.next_geq(docs[i]);
+            MY_REQUIRE_EQUAL(docs[i], e.docid(), "i = " << i << " skip = " << skip);
+            MY_REQUIRE_EQUAL(freqs[i], e.freq(), "i = " << i << " skip = " << skip);
+        }
+        e.next_geq(docs.back() + 1);
+        REQUIRE(universe == e.docid());
+    }
+}
+
+TEST_CASE("find_block_geq")
+{
+    std::vector<uint32_t> block_maxs(5000);
+    uint32_t max = 0;
+    for (auto& m: block_maxs) {
+        max += 1 + rand() % 100;
+        m = max;
+    }
+    for (uint32_t first: {0, 1, 7, 100, 4000, 4999}) {
+        for (uint32_t lower_bound = block_maxs[first] - 1; lower_bound <= block_maxs.back();
+             lower_bound += 1 + rand() % 50) {
+            auto expected =
+                std::lower_bound(block_maxs.begin() + first, block_maxs.end(), lower_bound)
+                - block_maxs.begin();
+            REQUIRE(
+                pisa::find_block_geq(block_maxs.data(), first, block_maxs.size(), lower_bound)
+                == expected);
+        }
+    }
+}
+
+TEST_CASE("block_posting_list_block_docids")
+{
+    typedef pisa::block_posting_list<pisa::optpfor_block> posting_list_type;
+    uint64_t universe = 20000;
+    uint64_t n = 5000;
+    std::vector<uint64_t> docs, freqs;
+    random_posting_data(n, universe, docs, freqs);
+    std::vector<uint8_t> data;
+    posting_list_type::write(data, n, docs.begin(), freqs.begin());
+
+    typename posting_list_type::document_enumerator e(data.data(), universe);
+    size_t pos = 0;
+    for (; e.docid() < universe; e.next_block()) {
+        REQUIRE(e.block_position() == 0);
+        for (size_t i = 0; i < e.current_block_size(); ++i, ++pos) {
+            MY_REQUIRE_EQUAL(docs[pos], e.block_docids()[i], "pos = " << pos);
+        }
+        REQUIRE(e.block_last_docid() == docs[pos - 1]);
+    }
+    REQUIRE(pos == n);
+
+    e.reset();
+    for (size_t i = 0; i < n; i += 1 + rand() % 300) {
+        e.next_geq_block(docs[i]);
+        REQUIRE(e.block_last_docid() >= docs[i]);
+        REQUIRE(e.block_docids()[e.block_position()] <= docs[i]);
+        e.next_geq(docs[i]);
+        REQUIRE(e.block_docids()[e.block_position()] == docs[i]);
+    }
+    e.next_geq_block(docs.back() + 1);
+    REQUIRE(e.docid() == universe);
+}
+
+TEST_CASE("intersect_sorted")
+{
+    std::mt19937 rng(42);
+    auto random_block = [&](uint32_t universe) {
+        std::vector<uint32_t> block(1 + rng() % 128);
+        std::generate(block.begin(), block.end(), [&]() { return rng() % universe; });
+        std::sort(block.begin(), block.end());
+        block.erase(std::unique(block.begin(), block.end()), block.end());
+        return block;
+    };
+    for (uint32_t universe: {130, 300, 1000, 100'000}) {
+        for (size_t t = 0; t < 100; ++t) {
+            auto a = random_block(universe);
+            auto b = random_block(universe);
+            std::vector<uint32_t> expected;
+            std::set_intersection(
+                a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+            std::vector<uint32_t> out(std::min(a.size(), b.size()));
+            out.resize(pisa::intersect_sorted(a.data(), a.size(), b.data(), b.size(), out.data()));
+            REQUIRE(out == expected);
+        }
+    }
+}
+
 TEST_CASE("block_posting_list_reordering")
 {
     test_block_posting_list_reordering<pisa::optpfor_block>();
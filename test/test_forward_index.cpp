@@ -5,6 +5,7 @@
 
 #include "forward_index.hpp"
 
+#include <fstream>
 #include <vector>
 
 TEST_CASE("write_and_read")
@@ -24,6 +25,51 @@ TEST_CASE("write_and_read")
     REQUIRE(fwd.term_count() == fwd_read.term_count());
     for (uint32_t doc = 0; doc < fwd.size(); ++doc) {
         REQUIRE(fwd.term_count(doc) == fwd_read.term_count(doc));
-        REQUIRE(std::equal(fwd[doc].begin(), fwd[doc].end(), fwd_read[doc].begin()));
+        auto encoded_terms = fwd.encoded_terms(doc);
+        auto read_encoded_terms = fwd_read.encoded_terms(doc);
+        REQUIRE(std::equal(
+            encoded_terms.begin(),
+            encoded_terms.end(),
+            read_encoded_terms.begin(),
+            read_encoded_terms.end()));
+        REQUIRE(fwd.terms(doc) == fwd_read.terms(doc));
+    }
+}
+
+
+TEST_CASE("Read forward index written with a header for each entry")
+{
+    // given
+    using namespace pisa;
+    std::string invind_input("test_data/test_collection");
+    std::string fwdind_file("temp_collection_entries");
+    auto fwd = forward_index::from_inverted_index(invind_input, 0, true);
+    {
+        std::ofstream out(fwdind_file);
+        bool compressed = true;
+        std::size_t term_count = fwd.term_count();
+        std::size_t size = fwd.size();
+        out.write(reinterpret_cast<const char*>(&compressed), sizeof(compressed));
+        out.write(reinterpret_cast<const char*>(&term_count), sizeof(term_count));
+        out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        for (uint32_t doc = 0; doc < fwd.size(); ++doc) {
+            auto encoded_terms = fwd.encoded_terms(doc);
+            term_count = fwd.term_count(doc);
+            size = encoded_terms.size();
+            out.write(reinterpret_cast<const char*>(&term_count), sizeof(term_count));
+            out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            out.write(reinterpret_cast<const char*>(encoded_terms.data()), size);
+        }
+    }
+
+    // when
+    auto fwd_read = forward_index::read(fwdind_file);
+
+    // then
+    REQUIRE(fwd.size() == fwd_read.size());
+    REQUIRE(fwd.term_count() == fwd_read.term_count());
+    for (uint32_t doc = 0; doc < fwd.size(); ++doc) {
+        REQUIRE(fwd.term_count(doc) == fwd_read.term_count(doc));
+        REQUIRE(fwd.terms(doc) == fwd_read.terms(doc));
     }
 }
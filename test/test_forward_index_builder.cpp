@@ -273,7 +273,7 @@ TEST_CASE("Merge forward index batches", "[parsing][forward_index]")
 TEST_CASE("Parse HTML content", "[parsing][forward_index][unit]")
 {
     std::vector<std::string> vec;
-    auto map_word = [&](std::string&& word) { vec.push_back(word); };
+    auto map_word = [&](std::string_view word) { vec.emplace_back(word); };
     SECTION("empty")
     {
         parse_html_content(
@@ -0,0 +1,91 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include <gsl/span>
+
+#include "front_coded_vector.hpp"
+#include "payload_vector.hpp"
+#include "query/term_processor.hpp"
+#include "temporary_directory.hpp"
+
+using namespace pisa;
+
+TEST_CASE("Front-coded vector", "[front_coded_vector][unit]")
+{
+    std::vector<std::string> values{
+        "", "a", "ab", "abc", "abd", "b", "ba", "bandana", "bandwidth", "\xc3\xa9t\xc3\xa9"};
+    auto bucket_size = GENERATE(1, 2, 3, 16);
+    auto buffer = encode_front_coded_vector(gsl::make_span(values), bucket_size);
+    auto vec = Front_Coded_Vector::from(buffer.bytes);
+    REQUIRE(vec.size() == values.size());
+    REQUIRE(vec.bucket_size() == bucket_size);
+
+    SECTION("Access by index")
+    {
+        for (std::size_t idx = 0; idx < values.size(); ++idx) {
+            REQUIRE(vec[idx] == values[idx]);
+        }
+        REQUIRE_THROWS_AS(vec[values.size()], std::out_of_range);
+    }
+    SECTION("Iterate")
+    {
+        REQUIRE(std::vector<std::string>(vec.begin(), vec.end()) == values);
+    }
+    SECTION("Lower bound")
+    {
+        auto value = GENERATE(
+            std::string(""),
+            std::string("a"),
+            std::string("aa"),
+            std::string("abc"),
+            std::string("abcd"),
+            std::string("abz"),
+            std::string("ban"),
+            std::string("bandanas"),
+            std::string("bandw"),
+            std::string("c"),
+            std::string("\xff"));
+        CAPTURE(value);
+        auto expected = std::lower_bound(values.begin(), values.end(), value) - values.begin();
+        REQUIRE(vec.lower_bound(value) == static_cast<std::uint64_t>(expected));
+    }
+}
+
+TEST_CASE("Front-coded vector of many strings", "[front_coded_vector][unit]")
+{
+    std::vector<std::string> values;
+    for (int idx = 0; idx < 10'000; ++idx) {
+        values.push_back(fmt::format("clueweb09-en{:04}-{:02}-{:05}", idx / 1000, idx % 97, idx));
+    }
+    std::sort(values.begin(), values.end());
+    auto buffer = encode_front_coded_vector(gsl::make_span(values));
+    auto payload_buffer = encode_payload_vector(gsl::make_span(values));
+    CHECK(buffer.bytes.size() < payload_buffer.payloads.size());
+    auto vec = Front_Coded_Vector::from(buffer.bytes);
+    for (std::size_t idx = 0; idx < values.size(); idx += 7) {
+        REQUIRE(vec[idx] == values[idx]);
+        REQUIRE(vec.lower_bound(values[idx]) == idx);
+    }
+}
+
+TEST_CASE("Term processor with front-coded lexicon", "[front_coded_vector][unit]")
+{
+    Temporary_Directory tmpdir;
+    auto payload_file = (tmpdir.path() / "termlex").string();
+    auto front_coded_file = (tmpdir.path() / "termfc").string();
+    std::vector<std::string> terms{"account", "coffee", "he", "she", "usa", "world"};
+    encode_payload_vector(gsl::make_span(terms)).to_file(payload_file);
+    encode_front_coded_vector(gsl::make_span(terms), 4).to_file(front_coded_file);
+
+    TermProcessor payload_processor(payload_file, std::nullopt, std::nullopt);
+    TermProcessor front_coded_processor(front_coded_file, std::nullopt, std::nullopt);
+    for (auto token: {"Account", "coffee", "WORLD", "sh", "tea", "zzz", ""}) {
+        CAPTURE(token);
+        REQUIRE(front_coded_processor(token) == payload_processor(token));
+    }
+}
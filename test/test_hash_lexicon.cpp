@@ -0,0 +1,103 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include <mio/mmap.hpp>
+
+#include "hash_lexicon.hpp"
+#include "mappable/mapper.hpp"
+#include "payload_vector.hpp"
+#include "query/term_processor.hpp"
+#include "temporary_directory.hpp"
+
+using namespace pisa;
+
+TEST_CASE("Hash lexicon maps terms to their IDs", "[hash_lexicon][unit]")
+{
+    auto num_terms = GENERATE(0, 1, 2, 10, 1000, 100'000);
+    std::vector<std::string> terms;
+    for (int term = 0; term < num_terms; ++term) {
+        terms.push_back(fmt::format("term{}", term));
+    }
+    Hash_Lexicon lexicon(terms);
+    REQUIRE(lexicon.size() == terms.size());
+    for (std::uint32_t term_id = 0; term_id < terms.size(); ++term_id) {
+        REQUIRE(lexicon(terms[term_id]) == std::optional<std::uint32_t>(term_id));
+    }
+    for (int term = 0; term < 1000; ++term) {
+        CHECK_FALSE(lexicon(fmt::format("missing{}", term)).has_value());
+    }
+    CHECK_FALSE(lexicon("").has_value());
+}
+
+TEST_CASE("Hash lexicon rejects duplicate terms", "[hash_lexicon][unit]")
+{
+    std::vector<std::string> terms{"a", "b", "a"};
+    REQUIRE_THROWS_AS(Hash_Lexicon(terms), std::invalid_argument);
+    REQUIRE_THROWS_WITH(Hash_Lexicon(terms), "Duplicate term in hash lexicon: a");
+}
+
+TEST_CASE("Hash lexicon reports exhausted pilots", "[hash_lexicon][unit]")
+{
+    std::vector<std::string> terms;
+    for (int term = 0; term < 1000; ++term) {
+        terms.push_back(fmt::format("term{}", term));
+    }
+    REQUIRE_THROWS_AS(Hash_Lexicon(terms, 1), std::runtime_error);
+}
+
+// Filling every slot takes about as many pilots for the last buckets as there are terms, which
+// exceeded the default pilot limit from about 40 million terms. A limit far below the number of
+// terms reproduces this with fewer terms.
+TEST_CASE("Hash lexicon builds with pilots far fewer than terms", "[hash_lexicon][unit]")
+{
+    std::uint32_t num_terms = 1'000'000;
+    std::vector<std::string> terms;
+    terms.reserve(num_terms);
+    for (std::uint32_t term = 0; term < num_terms; ++term) {
+        terms.push_back(fmt::format("term{}", term));
+    }
+    Hash_Lexicon lexicon(terms, 1U << 16U);
+    REQUIRE(lexicon.size() == num_terms);
+    for (std::uint32_t term_id = 0; term_id < num_terms; ++term_id) {
+        REQUIRE(lexicon(terms[term_id]) == std::optional<std::uint32_t>(term_id));
+    }
+}
+
+TEST_CASE("Frozen hash lexicon is recognized and mapped", "[hash_lexicon][unit]")
+{
+    Temporary_Directory tmpdir;
+    auto hash_file = (tmpdir.path() / "termhash").string();
+    auto payload_file = (tmpdir.path() / "termlex").string();
+    std::vector<std::string> terms{"account", "coffee", "he", "she", "usa", "world"};
+    {
+        Hash_Lexicon lexicon(terms);
+        mapper::freeze(lexicon, hash_file.c_str());
+    }
+    encode_payload_vector(gsl::make_span(terms)).to_file(payload_file);
+
+    auto is_hash_lexicon = [](std::string const& file) {
+        mio::mmap_source source(file.c_str());
+        return Hash_Lexicon::is_hash_lexicon(
+            gsl::make_span(reinterpret_cast<std::byte const*>(source.data()), source.size()));
+    };
+    REQUIRE(is_hash_lexicon(hash_file));
+    REQUIRE_FALSE(is_hash_lexicon(payload_file));
+
+    mio::mmap_source source(hash_file.c_str());
+    Hash_Lexicon lexicon;
+    mapper::map(lexicon, source);
+    for (std::uint32_t term_id = 0; term_id < terms.size(); ++term_id) {
+        REQUIRE(lexicon(terms[term_id]) == std::optional<std::uint32_t>(term_id));
+    }
+
+    TermProcessor hash_processor(hash_file, std::nullopt, std::nullopt);
+    TermProcessor payload_processor(payload_file, std::nullopt, std::nullopt);
+    for (auto token: {"Account", "coffee", "WORLD", "tea", "zzz", ""}) {
+        CAPTURE(token);
+        REQUIRE(hash_processor(token) == payload_processor(token));
+    }
+}
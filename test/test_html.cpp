@@ -2,6 +2,8 @@
 #include "catch2/catch.hpp"
 
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "parsing/html.hpp"
 
@@ -17,3 +19,50 @@ TEST_CASE("Parse HTML", "[html][unit]")
                                                   {"<a><!-- comment --></a>", ""}}));
     GIVEN("Input: " << input) { CHECK(cleantext(input) == expected); }
 }
+
+TEST_CASE("Parse HTML without building a DOM", "[html][unit]")
+{
+    auto [input, expected] = GENERATE(table<std::string, std::string>(
+        {{"text", "text"},
+         {"<a>text</a>text", "text text"},
+         {"<a><!-- <b>comment</b> --></a>", ""},
+         {"<!DOCTYPE html><p class=\"a>b\">text</p>", "text"},
+         {"<P>x</P><script>var s = \"</p>\";</script><STYLE>p {}</STYLE>y", "x y"},
+         {"<script src='a.js'/>text", "text"},
+         {"AT&amp;T&nbsp;a&b", "AT T a b"},
+         {"a < b", "a < b"}}));
+    GIVEN("Input: " << input)
+    {
+        std::vector<std::string_view> runs;
+        REQUIRE(scan_text(input, runs));
+        CHECK(cleantext(input, Html_Parser::fast) == expected);
+    }
+}
+
+TEST_CASE("Pages that are not well-formed are not scanned", "[html][unit]")
+{
+    auto input = GENERATE(
+        std::string("<a>text</a"),
+        std::string("<p class=\"a>text</p>"),
+        std::string("<!-- comment"),
+        std::string("<script>var x;"));
+    GIVEN("Input: " << input)
+    {
+        std::vector<std::string_view> runs;
+        CHECK_FALSE(scan_text(input, runs));
+    }
+}
+
+TEST_CASE("Fast parser falls back to Gumbo", "[html][unit]")
+{
+    Text_Extractor extractor(Html_Parser::fast);
+    std::vector<std::string> runs;
+    auto emit = [&](std::string_view run) { runs.emplace_back(run); };
+    extractor.extract("<a>lorem</a><b>ipsum</b>", emit);
+    CHECK(runs == std::vector<std::string>{"lorem", "ipsum"});
+    CHECK(extractor.fallbacks() == 0);
+    runs.clear();
+    extractor.extract("<a>lorem</a><b>ipsum</b", emit);
+    CHECK(runs == std::vector<std::string>{"lorem", "ipsum"});
+    CHECK(extractor.fallbacks() == 1);
+}
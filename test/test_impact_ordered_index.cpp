@@ -0,0 +1,230 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <map>
+
+#include <tbb/task_scheduler_init.h>
+
+#include "accumulator/lazy_accumulator.hpp"
+#include "configuration.hpp"
+#include "cursor/impact_cursor.hpp"
+#include "cursor/scored_cursor.hpp"
+#include "impact_ordered_index.hpp"
+#include "index_types.hpp"
+#include "io.hpp"
+#include "linear_quantizer.hpp"
+#include "pisa_config.hpp"
+#include "query/algorithm.hpp"
+#include "query/query_context.hpp"
+#include "scorer/scorer.hpp"
+#include "wand_data.hpp"
+#include "wand_data_raw.hpp"
+
+using namespace pisa;
+
+struct ImpactIndexData {
+    ImpactIndexData()
+        : collection(PISA_SOURCE_DIR "/test/test_data/test_collection"),
+          document_sizes(PISA_SOURCE_DIR "/test/test_data/test_collection.sizes"),
+          wdata(
+              document_sizes.begin()->begin(),
+              collection.num_docs(),
+              collection,
+              "bm25",
+              BlockSize(FixedBlock(64)),
+              false,
+              {})
+    {
+        tbb::task_scheduler_init init;
+        auto scorer = scorer::from_name("bm25", wdata);
+        LinearQuantizer quantizer(
+            wdata.index_max_term_weight(), configuration::get().quantization_bits);
+
+        single_index::builder builder(collection.num_docs(), params);
+        impact_ordered_index::builder impact_builder(collection.num_docs(), params);
+        size_t term_id = 0;
+        for (auto const& plist: collection) {
+            auto term_scorer = scorer->term_scorer(term_id);
+            std::vector<uint64_t> quants;
+            for (size_t pos = 0; pos < plist.docs.size(); ++pos) {
+                uint64_t doc = *(plist.docs.begin() + pos);
+                uint64_t freq = *(plist.freqs.begin() + pos);
+                quants.push_back(quantizer(term_scorer(doc, freq)));
+            }
+            uint64_t quants_sum = std::accumulate(quants.begin(), quants.end(), uint64_t(0));
+            builder.add_posting_list(
+                plist.docs.size(), plist.docs.begin(), quants.begin(), quants_sum);
+            impact_builder.add_posting_list(plist.docs.size(), plist.docs.begin(), quants.begin());
+            term_id += 1;
+        }
+        builder.build(index);
+        impact_builder.build(impact_index);
+
+        std::ifstream qfile(PISA_SOURCE_DIR "/test/test_data/queries");
+        io::for_each_line(
+            qfile, [&](std::string const& line) { queries.push_back(parse_query_ids(line)); });
+    }
+
+    [[nodiscard]] static auto get() -> ImpactIndexData const&
+    {
+        static ImpactIndexData data;
+        return data;
+    }
+
+    global_parameters params;
+    binary_freq_collection collection;
+    binary_collection document_sizes;
+    wand_data<wand_data_raw> wdata;
+    single_index index;
+    impact_ordered_index impact_index;
+    std::vector<Query> queries;
+};
+
+/// Scored cursors whose scores are multiplied by the frequency of their term in the query,
+/// as impacts are by `saat_query`.
+template <typename Scorer>
+auto make_weighted_cursors(single_index const& index, Scorer const& scorer, Query const& query)
+{
+    std::vector<scored_cursor<single_index>> cursors;
+    for (auto&& cursor: make_scored_cursors(index, scorer, query)) {
+        cursors.push_back(
+            {cursor.docs_enum,
+             cursor.q_weight,
+             [q_weight = cursor.q_weight, term_scorer = cursor.scorer](
+                 uint32_t doc, uint32_t freq) { return q_weight * term_scorer(doc, freq); }});
+    }
+    return cursors;
+}
+
+TEST_CASE("Impact-ordered index segments", "[impact_ordered_index][integration]")
+{
+    auto const& data = ImpactIndexData::get();
+    REQUIRE(data.impact_index.size() == data.index.size());
+    REQUIRE(data.impact_index.num_docs() == data.index.num_docs());
+
+    for (size_t term_id = 0; term_id < data.index.size(); ++term_id) {
+        std::map<uint64_t, uint32_t> expected;
+        for (auto list = data.index[term_id]; list.docid() < data.index.num_docs(); list.next()) {
+            expected[list.docid()] = list.freq();
+        }
+        std::map<uint64_t, uint32_t> actual;
+        auto segments = data.impact_index[term_id];
+        for (uint64_t idx = 0; idx < segments.num_segments(); ++idx) {
+            if (idx > 0) {
+                REQUIRE(segments.impact(idx - 1) > segments.impact(idx));
+            }
+            auto segment = segments[idx];
+            REQUIRE(segment.impact() == segments.impact(idx));
+            int64_t prev = -1;
+            segment.for_each(segment.size(), [&](auto docid) {
+                REQUIRE(int64_t(docid) > prev);
+                prev = docid;
+                actual[docid] = segment.impact();
+            });
+        }
+        REQUIRE(actual == expected);
+    }
+}
+
+TEST_CASE("SAAT query", "[query][ranked][integration]")
+{
+    auto const& data = ImpactIndexData::get();
+    quantized<wand_data<wand_data_raw>> scorer(data.wdata);
+    Lazy_Accumulator<4> accumulator(data.impact_index.num_docs());
+
+    SECTION("Exhaustive processing is equivalent to ranked OR")
+    {
+        topk_queue topk_1(10);
+        saat_query saat_q(topk_1);
+        topk_queue topk_2(10);
+        ranked_or_query or_q(topk_2);
+        for (auto const& q: data.queries) {
+            saat_q(
+                make_impact_cursors(data.impact_index, q),
+                data.impact_index.num_docs(),
+                accumulator);
+            or_q(make_weighted_cursors(data.index, scorer, q), data.index.num_docs());
+            topk_1.finalize();
+            topk_2.finalize();
+            REQUIRE_FALSE(saat_q.early_terminated());
+            REQUIRE(topk_1.topk().size() == topk_2.topk().size());
+            for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                REQUIRE(topk_1.topk()[i].first == topk_2.topk()[i].first);
+            }
+            topk_1.clear();
+            topk_2.clear();
+        }
+    }
+
+    SECTION("Impacts are weighted by query term frequencies")
+    {
+        topk_queue topk_1(10);
+        saat_query saat_q(topk_1);
+        topk_queue topk_2(10);
+        ranked_or_query or_q(topk_2);
+        QueryContext<impact_cursor, std::nullptr_t> context(10);
+        for (auto q: data.queries) {
+            if (q.terms.empty()) {
+                continue;
+            }
+            q.terms.push_back(q.terms.front());
+            q.terms.push_back(q.terms.front());
+            saat_q(
+                make_impact_cursors(data.impact_index, q),
+                data.impact_index.num_docs(),
+                accumulator);
+            or_q(make_weighted_cursors(data.index, scorer, q), data.index.num_docs());
+            topk_1.finalize();
+            topk_2.finalize();
+            REQUIRE(topk_1.topk().size() == topk_2.topk().size());
+            for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                REQUIRE(topk_1.topk()[i].first == topk_2.topk()[i].first);
+            }
+
+            auto const& cursors = make_impact_cursors(data.impact_index, q, context);
+            auto expected = make_impact_cursors(data.impact_index, q);
+            REQUIRE(cursors.size() == expected.size());
+            uint32_t q_weights = 0;
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                REQUIRE(cursors[i].q_weight == expected[i].q_weight);
+                q_weights += cursors[i].q_weight;
+            }
+            REQUIRE(q_weights == q.terms.size());
+            topk_1.clear();
+            topk_2.clear();
+        }
+    }
+
+    SECTION("Processing stops after the postings budget")
+    {
+        uint64_t budget = 100;
+        topk_queue topk_1(10);
+        saat_query saat_q(topk_1, budget);
+        topk_queue topk_2(10);
+        saat_query exhaustive_q(topk_2);
+        for (auto const& q: data.queries) {
+            saat_q(
+                make_impact_cursors(data.impact_index, q),
+                data.impact_index.num_docs(),
+                accumulator);
+            exhaustive_q(
+                make_impact_cursors(data.impact_index, q),
+                data.impact_index.num_docs(),
+                accumulator);
+            topk_1.finalize();
+            topk_2.finalize();
+            REQUIRE(saat_q.postings() <= budget);
+            REQUIRE(saat_q.early_terminated() == (exhaustive_q.postings() > budget));
+            REQUIRE(topk_1.topk().size() <= topk_2.topk().size());
+            for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                if (saat_q.early_terminated()) {
+                    REQUIRE(topk_1.topk()[i].first <= topk_2.topk()[i].first);
+                } else {
+                    REQUIRE(topk_1.topk()[i].first == topk_2.topk()[i].first);
+                }
+            }
+            topk_1.clear();
+            topk_2.clear();
+        }
+    }
+}
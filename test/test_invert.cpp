@@ -2,6 +2,7 @@
 #include "catch2/catch.hpp"
 
 #include <cstdio>
+#include <random>
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -202,7 +203,7 @@ TEST_CASE("Join Inverted_Index to another", "[invert][unit]")
     }
 }
 
-TEST_CASE("Invert a range of documents from a collection", "[invert][unit]")
+TEST_CASE("Invert a range of documents by counting", "[invert][unit]")
 {
     tbb::task_scheduler_init init;
     std::vector<std::vector<Term_Id>> collection = {
@@ -217,35 +218,46 @@ TEST_CASE("Invert a range of documents from a collection", "[invert][unit]")
         collection.begin(), collection.end(), std::back_inserter(document_range), [](auto const& vec) {
             return gsl::span<Term_Id const>(vec);
         });
-    size_t threads = 1;
+    size_t threads = GENERATE(1, 2, 3);
 
-    auto index = invert::invert_range(document_range, 0_d, threads);
+    auto index = invert::invert_range_flat(document_range, 0_d, 11, threads);
 
-    index_type expected(
-        {{0_t, {0_d, 1_d, 4_d}},
-         {1_t, {2_d, 4_d}},
-         {2_t, {0_d, 1_d}},
-         {3_t, {0_d, 1_d, 4_d}},
-         {4_t, {1_d, 4_d}},
-         {5_t, {1_d, 2_d, 3_d, 4_d}},
-         {6_t, {1_d, 4_d}},
-         {7_t, {1_d}},
-         {8_t, {2_d, 3_d, 4_d}},
-         {9_t, {0_d, 2_d, 3_d, 4_d}}},
-        {{0_t, {2_f, 1_f, 1_f}},
-         {1_t, {1_f, 1_f}},
-         {2_t, {1_f, 1_f}},
-         {3_t, {1_f, 1_f, 1_f}},
-         {4_t, {2_f, 1_f}},
-         {5_t, {2_f, 1_f, 1_f, 1_f}},
-         {6_t, {1_f, 4_f}},
-         {7_t, {1_f}},
-         {8_t, {3_f, 1_f, 1_f}},
-         {9_t, {1_f, 1_f, 1_f, 1_f}}},
-        {5, 9, 6, 3, 11});
-    REQUIRE(index.documents == expected.documents);
-    REQUIRE(index.frequencies == expected.frequencies);
-    REQUIRE(index.document_sizes == expected.document_sizes);
+    std::vector<std::vector<Document_Id>> expected_documents{
+        {0_d, 1_d, 4_d},
+        {2_d, 4_d},
+        {0_d, 1_d},
+        {0_d, 1_d, 4_d},
+        {1_d, 4_d},
+        {1_d, 2_d, 3_d, 4_d},
+        {1_d, 4_d},
+        {1_d},
+        {2_d, 3_d, 4_d},
+        {0_d, 2_d, 3_d, 4_d},
+        {}};
+    std::vector<std::vector<Frequency>> expected_frequencies{
+        {2_f, 1_f, 1_f},
+        {1_f, 1_f},
+        {1_f, 1_f},
+        {1_f, 1_f, 1_f},
+        {2_f, 1_f},
+        {2_f, 1_f, 1_f, 1_f},
+        {1_f, 4_f},
+        {1_f},
+        {3_f, 1_f, 1_f},
+        {1_f, 1_f, 1_f, 1_f},
+        {}};
+    REQUIRE(index.offsets.size() == 12);
+    for (auto term = 0; term < 11; ++term) {
+        auto documents = index.term_documents(Term_Id(term));
+        auto frequencies = index.term_frequencies(Term_Id(term));
+        REQUIRE(
+            std::vector<Document_Id>(documents.begin(), documents.end())
+            == expected_documents[term]);
+        REQUIRE(
+            std::vector<Frequency>(frequencies.begin(), frequencies.end())
+            == expected_frequencies[term]);
+    }
+    REQUIRE(index.document_sizes == std::vector<std::uint32_t>{5, 9, 6, 3, 11});
 }
 
 TEST_CASE("Invert collection", "[invert][unit]")
@@ -329,3 +341,53 @@ TEST_CASE("Invert collection", "[invert][unit]")
         }
     }
 }
+
+TEST_CASE("Invert collection out of core", "[invert][unit]")
+{
+    tbb::task_scheduler_init init;
+    Temporary_Directory tmpdir;
+    uint32_t term_count = 50;
+    auto collection_filename = (tmpdir.path() / "collection").string();
+    {
+        std::mt19937 rng(17);
+        std::vector<uint32_t> collection_data{1, 200};
+        for (uint32_t doc = 0; doc < 200; ++doc) {
+            std::vector<uint32_t> terms(doc == 0 ? term_count : rng() % 30);
+            for (uint32_t pos = 0; pos < terms.size(); ++pos) {
+                terms[pos] = doc == 0 ? pos : rng() % term_count;
+            }
+            collection_data.push_back(terms.size());
+            collection_data.insert(collection_data.end(), terms.begin(), terms.end());
+        }
+        std::ofstream os(collection_filename);
+        os.write(
+            reinterpret_cast<char*>(collection_data.data()),
+            collection_data.size() * sizeof(uint32_t));
+    }
+    auto expected_basename = (tmpdir.path() / "expected").string();
+    invert::invert_forward_index(collection_filename, expected_basename, term_count, 7, 2);
+
+    auto read_file = [](std::string const& filename) {
+        std::ifstream is(filename, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    };
+    std::size_t memory_budget = GENERATE(8, 100, 4096, 1 << 20);
+    WHEN("Run inverting with a memory budget of " << memory_budget << " bytes")
+    {
+        auto index_basename = (tmpdir.path() / "idx").string();
+        invert::invert_forward_index_out_of_core(
+            collection_filename, index_basename, term_count, memory_budget);
+        THEN("The index is identical to the one inverted in memory")
+        {
+            for (auto extension: {".docs", ".freqs", ".sizes"}) {
+                REQUIRE(
+                    read_file(index_basename + extension)
+                    == read_file(expected_basename + extension));
+            }
+            auto run_files = pisa::ls(tmpdir.path().string(), [](auto const& filename) {
+                return filename.find(".run.") != std::string::npos;
+            });
+            REQUIRE(run_files.empty());
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch.hpp>
+
+#include <map>
+#include <numeric>
+#include <vector>
+
+#include <mio/mmap.hpp>
+
+#include "cursor/pair_cursor.hpp"
+#include "index_types.hpp"
+#include "pair_index.hpp"
+#include "pisa_config.hpp"
+#include "query/algorithm.hpp"
+#include "query/query_context.hpp"
+#include "scorer/scorer.hpp"
+#include "temporary_directory.hpp"
+#include "wand_data.hpp"
+#include "wand_data_raw.hpp"
+
+using namespace pisa;
+
+using wand_raw_index = wand_data<wand_data_raw>;
+using scorer_type = bm25<wand_raw_index>;
+using pair_scorer_type = pair_term_scorer<scorer_type::term_scorer_type>;
+
+struct PairIndexData {
+    PairIndexData()
+        : collection(PISA_SOURCE_DIR "/test/test_data/test_collection"),
+          document_sizes(PISA_SOURCE_DIR "/test/test_data/test_collection.sizes"),
+          wdata(
+              document_sizes.begin()->begin(),
+              collection.num_docs(),
+              collection,
+              "bm25",
+              BlockSize(FixedBlock(5)),
+              false,
+              {})
+    {
+        single_index::builder builder(collection.num_docs(), params);
+        for (auto const& plist: collection) {
+            uint64_t freqs_sum =
+                std::accumulate(plist.freqs.begin(), plist.freqs.end(), uint64_t(0));
+            builder.add_posting_list(
+                plist.docs.size(), plist.docs.begin(), plist.freqs.begin(), freqs_sum);
+        }
+        builder.build(index);
+
+        std::ifstream qfile(PISA_SOURCE_DIR "/test/test_data/queries");
+        io::for_each_line(
+            qfile, [&](std::string const& line) { queries.push_back(parse_query_ids(line)); });
+
+        // Materializes the pairs of consecutive query terms.
+        auto scorer = scorer::from_name("bm25", wdata);
+        std::map<std::pair<term_id_type, term_id_type>, int> pairs;
+        for (auto const& query: queries) {
+            for (size_t pos = 1; pos < query.terms.size(); ++pos) {
+                auto first = std::min(query.terms[pos - 1], query.terms[pos]);
+                auto second = std::max(query.terms[pos - 1], query.terms[pos]);
+                if (first != second) {
+                    pairs[{first, second}] = 0;
+                }
+            }
+        }
+        pair_index<single_index>::builder pair_builder(
+            collection.num_docs(), params, scorer::describe<wand_raw_index>("bm25"));
+        for (auto const& [terms, unused]: pairs) {
+            std::vector<uint64_t> docs;
+            std::vector<uint64_t> freqs;
+            std::vector<float> scores;
+            auto first = index[terms.first];
+            auto second = index[terms.second];
+            auto first_scorer = scorer->term_scorer(terms.first);
+            auto second_scorer = scorer->term_scorer(terms.second);
+            for (; first.docid() < index.num_docs(); first.next()) {
+                second.next_geq(first.docid());
+                if (second.docid() == first.docid()) {
+                    docs.push_back(first.docid());
+                    freqs.push_back(pack_freqs(first.freq(), second.freq()));
+                    scores.push_back(
+                        first_scorer(first.docid(), first.freq())
+                        + second_scorer(first.docid(), second.freq()));
+                }
+            }
+            if (not docs.empty()) {
+                pair_builder.add_pair(
+                    terms.first,
+                    terms.second,
+                    docs.size(),
+                    docs.begin(),
+                    freqs.begin(),
+                    scores.begin(),
+                    5);
+            }
+        }
+        pair_builder.build(pair_lists);
+    }
+
+    global_parameters params;
+    binary_freq_collection collection;
+    binary_collection document_sizes;
+    single_index index;
+    pair_index<single_index> pair_lists;
+    std::vector<Query> queries;
+    wand_raw_index wdata;
+};
+
+TEST_CASE("Pack frequencies", "[pair_index]")
+{
+    REQUIRE(pack_freqs(1, 1) == 1);
+    for (uint64_t first = 1; first < 100; ++first) {
+        for (uint64_t second = 1; second < 100; ++second) {
+            auto packed = pack_freqs(first, second);
+            REQUIRE(unpack_freqs(packed) == std::make_pair(first, second));
+        }
+    }
+    REQUIRE(unpack_freqs(pack_freqs(50'000, 3)) == std::make_pair(uint64_t(50'000), uint64_t(3)));
+}
+
+TEST_CASE("Pair index", "[pair_index][integration]")
+{
+    PairIndexData data;
+    auto const& pairs = data.pair_lists;
+    REQUIRE(pairs.size() > 0);
+
+    SECTION("Pairs are found in any order")
+    {
+        for (uint64_t pair = 0; pair < pairs.size(); ++pair) {
+            auto [first, second] = pairs.terms(pair);
+            REQUIRE(first < second);
+            REQUIRE(pairs.find(first, second) == std::optional<uint64_t>(pair));
+            REQUIRE(pairs.find(second, first) == std::optional<uint64_t>(pair));
+            REQUIRE_FALSE(pairs.find(first, first).has_value());
+        }
+    }
+
+    SECTION("Pairs must be added in order")
+    {
+        pair_index<single_index>::builder builder(
+            data.collection.num_docs(), data.params, scorer::describe<wand_raw_index>("bm25"));
+        std::vector<uint64_t> docs{1, 2};
+        std::vector<uint64_t> freqs{1, 1};
+        std::vector<float> scores{1.0, 1.0};
+        builder.add_pair(1, 2, 2, docs.begin(), freqs.begin(), scores.begin(), 5);
+        REQUIRE_THROWS_AS(
+            builder.add_pair(0, 3, 2, docs.begin(), freqs.begin(), scores.begin(), 5),
+            std::invalid_argument);
+        REQUIRE_THROWS_AS(
+            builder.add_pair(4, 3, 2, docs.begin(), freqs.begin(), scores.begin(), 5),
+            std::invalid_argument);
+    }
+
+    SECTION("Pair index records its scorer")
+    {
+        Temporary_Directory tmpdir;
+        auto pair_file = (tmpdir.path() / "pairs").string();
+        mapper::freeze(pairs, pair_file.c_str());
+        mio::mmap_source source(pair_file.c_str());
+        pair_index<single_index> mapped;
+        mapper::map(mapped, source);
+        REQUIRE(mapped.size() == pairs.size());
+        REQUIRE(mapped.scorer() == "bm25(k1=0.9,b=0.4)");
+        REQUIRE_NOTHROW(mapped.check_scorer(scorer::describe<wand_raw_index>("bm25")));
+        REQUIRE_THROWS_AS(
+            mapped.check_scorer(scorer::describe<wand_raw_index>("qld")), std::invalid_argument);
+
+        // Earlier files have the scorer-less lists right after the flags.
+        std::vector<char> data(source.begin(), source.end());
+        data.erase(data.begin() + sizeof(uint64_t), data.begin() + 3 * sizeof(uint64_t));
+        pair_index<single_index> legacy;
+        REQUIRE_THROWS_AS(mapper::map(legacy, data.data()), std::runtime_error);
+    }
+
+    SECTION("Ranked AND with pair lists")
+    {
+        scorer_type scorer(data.wdata);
+        QueryContext<scored_cursor<single_index, scorer_type::term_scorer_type>> expected(10);
+        QueryContext<scored_cursor<single_index, pair_scorer_type>> actual(10);
+        QueryContext<block_max_scored_cursor<single_index, wand_raw_index, pair_scorer_type>>
+            actual_block_max(10);
+        size_t replaced = 0;
+        for (auto const& query: data.queries) {
+            expected.reset();
+            actual.reset();
+            actual_block_max.reset();
+            ranked_and_query{expected.topk}(
+                make_scored_cursors(data.index, scorer, query, expected), data.index.num_docs());
+            auto& cursors = make_pair_scored_cursors(data.index, pairs, scorer, query, actual);
+            replaced += expected.cursors.size() - cursors.size();
+            ranked_and_query{actual.topk}(cursors, data.index.num_docs());
+            block_max_ranked_and_query{actual_block_max.topk}(
+                make_pair_block_max_scored_cursors(
+                    data.index, pairs, data.wdata, scorer, query, actual_block_max),
+                data.index.num_docs());
+            expected.topk.finalize();
+            actual.topk.finalize();
+            actual_block_max.topk.finalize();
+            REQUIRE(actual.topk.topk().size() == expected.topk.topk().size());
+            REQUIRE(actual_block_max.topk.topk().size() == expected.topk.topk().size());
+            for (size_t i = 0; i < expected.topk.topk().size(); ++i) {
+                REQUIRE(
+                    actual.topk.topk()[i].first
+                    == Approx(expected.topk.topk()[i].first).epsilon(0.1));
+                REQUIRE(
+                    actual_block_max.topk.topk()[i].first
+                    == Approx(expected.topk.topk()[i].first).epsilon(0.1));
+            }
+        }
+        REQUIRE(replaced > 0);
+    }
+
+    SECTION("Repeated terms are not paired")
+    {
+        auto [first, second] = pairs.terms(0);
+        Query query{std::nullopt, {first, second, first}, {}};
+        scorer_type scorer(data.wdata);
+        QueryContext<scored_cursor<single_index, pair_scorer_type>> context(10);
+        REQUIRE(make_pair_scored_cursors(data.index, pairs, scorer, query, context).size() == 2);
+        query.terms.pop_back();
+        REQUIRE(make_pair_scored_cursors(data.index, pairs, scorer, query, context).size() == 1);
+    }
+}
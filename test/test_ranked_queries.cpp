@@ -1,18 +1,22 @@
 #define CATCH_CONFIG_MAIN
 
 #include <catch2/catch.hpp>
+#include <atomic>
 #include <functional>
 
 #include <tbb/task_scheduler_init.h>
 
 #include "accumulator/lazy_accumulator.hpp"
 #include "cursor/block_max_scored_cursor.hpp"
+#include "cursor/cursor.hpp"
 #include "cursor/max_scored_cursor.hpp"
 #include "cursor/scored_cursor.hpp"
 #include "index_types.hpp"
 #include "pisa_config.hpp"
 #include "query/algorithm.hpp"
+#include "query/query_context.hpp"
 #include "test_common.hpp"
+#include "util/query_counters.hpp"
 
 using namespace pisa;
 
@@ -35,10 +39,28 @@ struct IndexData {
     {
         tbb::task_scheduler_init init;
         typename Index::builder builder(collection.num_docs(), params);
+        auto scorer = scorer::from_name(scorer_name, wdata);
+        size_t term_id = 0;
         for (auto const& plist: collection) {
             uint64_t freqs_sum = std::accumulate(plist.freqs.begin(), plist.freqs.end(), uint64_t(0));
-            builder.add_posting_list(
-                plist.docs.size(), plist.docs.begin(), plist.freqs.begin(), freqs_sum);
+            if constexpr (has_block_max_scores<Index>::value) {
+                auto term_scorer = scorer->term_scorer(term_id);
+                std::vector<float> scores;
+                for (size_t pos = 0; pos < plist.docs.size(); ++pos) {
+                    scores.push_back(
+                        term_scorer(*(plist.docs.begin() + pos), *(plist.freqs.begin() + pos)));
+                }
+                builder.add_posting_list(
+                    plist.docs.size(),
+                    plist.docs.begin(),
+                    plist.freqs.begin(),
+                    scores.begin(),
+                    freqs_sum);
+            } else {
+                builder.add_posting_list(
+                    plist.docs.size(), plist.docs.begin(), plist.freqs.begin(), freqs_sum);
+            }
+            term_id += 1;
         }
         builder.build(index);
 
@@ -179,6 +201,86 @@ TEMPLATE_TEST_CASE("Ranked AND query test", "[query][ranked][integration]", bloc
     }
 }
 
+TEMPLATE_TEST_CASE(
+    "Ranked query with typed scorer",
+    "[query][ranked][integration]",
+    wand_query,
+    maxscore_query,
+    block_max_wand_query,
+    block_max_maxscore_query)
+{
+    for (auto&& s_name: {"bm25", "qld", "pl2", "dph"}) {
+        std::unordered_set<size_t> dropped_term_ids;
+        auto data = IndexData<single_index>::get(s_name, false, dropped_term_ids);
+        auto erased_scorer = scorer::from_name(s_name, data->wdata);
+        scorer::with_scorer(s_name, data->wdata, [&](auto const& scorer) {
+            topk_queue topk_1(10);
+            TestType op_q(topk_1);
+            topk_queue topk_2(10);
+            TestType erased_q(topk_2);
+            for (auto const& q: data->queries) {
+                op_q(
+                    make_block_max_scored_cursors(data->index, data->wdata, scorer, q),
+                    data->index.num_docs());
+                erased_q(
+                    make_block_max_scored_cursors(data->index, data->wdata, *erased_scorer, q),
+                    data->index.num_docs());
+                topk_1.finalize();
+                topk_2.finalize();
+                REQUIRE(topk_1.topk().size() == topk_2.topk().size());
+                for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                    REQUIRE(topk_1.topk()[i].first == Approx(topk_2.topk()[i].first).epsilon(0.01));
+                }
+                topk_1.clear();
+                topk_2.clear();
+            }
+        });
+    }
+}
+
+TEMPLATE_TEST_CASE(
+    "Parallel range query",
+    "[query][ranked][integration]",
+    ranked_or_query,
+    wand_query,
+    maxscore_query,
+    block_max_wand_query,
+    block_max_maxscore_query)
+{
+    tbb::task_scheduler_init init(4);
+    for (auto&& s_name: {"bm25", "qld"}) {
+        std::unordered_set<size_t> dropped_term_ids;
+        auto data = IndexData<single_index>::get(s_name, false, dropped_term_ids);
+        auto scorer = scorer::from_name(s_name, data->wdata);
+        using cursor_type = typename decltype(make_block_max_scored_cursors(
+            data->index, data->wdata, *scorer, Query{}))::value_type;
+        for (auto range_size: {size_t(128), size_t(1000), size_t(data->index.num_docs())}) {
+            topk_queue topk_1(10);
+            parallel_range_query<TestType, cursor_type> op_q(topk_1);
+            topk_queue topk_2(10);
+            ranked_or_query or_q(topk_2);
+            for (auto const& q: data->queries) {
+                or_q(make_scored_cursors(data->index, *scorer, q), data->index.num_docs());
+                op_q(
+                    [&](auto& context) -> auto& {
+                        return make_block_max_scored_cursors(
+                            data->index, data->wdata, *scorer, q, context);
+                    },
+                    data->index.num_docs(),
+                    range_size);
+                topk_1.finalize();
+                topk_2.finalize();
+                REQUIRE(topk_1.topk().size() == topk_2.topk().size());
+                for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                    REQUIRE(topk_1.topk()[i].first == Approx(topk_2.topk()[i].first).epsilon(0.01));
+                }
+                topk_1.clear();
+                topk_2.clear();
+            }
+        }
+    }
+}
+
 TEST_CASE("Top k")
 {
     for (auto&& s_name: {"bm25", "qld"}) {
@@ -205,3 +307,422 @@ TEST_CASE("Top k")
         }
     }
 }
+
+TEMPLATE_TEST_CASE(
+    "Ranked query with reused context",
+    "[query][ranked][integration]",
+    wand_query,
+    maxscore_query,
+    block_max_wand_query,
+    block_max_maxscore_query)
+{
+    for (auto&& s_name: {"bm25", "qld"}) {
+        std::unordered_set<size_t> dropped_term_ids;
+        auto data = IndexData<single_index>::get(s_name, false, dropped_term_ids);
+        auto scorer = scorer::from_name(s_name, data->wdata);
+        using cursor_type = typename decltype(make_block_max_scored_cursors(
+            data->index, data->wdata, *scorer, Query{}))::value_type;
+        QueryContext<cursor_type> context(10);
+        topk_queue topk(10);
+        TestType expected_q(topk);
+        for (auto const& q: data->queries) {
+            context.reset();
+            TestType op_q(context.topk);
+            op_q(
+                make_block_max_scored_cursors(data->index, data->wdata, *scorer, q, context),
+                data->index.num_docs());
+            expected_q(
+                make_block_max_scored_cursors(data->index, data->wdata, *scorer, q),
+                data->index.num_docs());
+            context.topk.finalize();
+            topk.finalize();
+            REQUIRE(context.topk.topk().size() == topk.topk().size());
+            for (size_t i = 0; i < topk.topk().size(); ++i) {
+                REQUIRE(context.topk.topk()[i].first == Approx(topk.topk()[i].first));
+            }
+            topk.clear();
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE(
+    "Ranked query with embedded block-max scores",
+    "[query][ranked][integration]",
+    block_max_wand_query,
+    block_max_maxscore_query,
+    block_max_ranked_and_query)
+{
+    using index_type = block_freq_index<interpolative_block, false, true>;
+    using reference_type = std::conditional_t<
+        std::is_same_v<TestType, block_max_ranked_and_query>,
+        ranked_and_query,
+        ranked_or_query>;
+    for (auto&& s_name: {"bm25", "qld"}) {
+        std::unordered_set<size_t> dropped_term_ids;
+        auto data = IndexData<index_type>::get(s_name, false, dropped_term_ids);
+        auto scorer = scorer::from_name(s_name, data->wdata);
+        topk_queue topk_1(10);
+        TestType op_q(topk_1);
+        topk_queue topk_2(10);
+        reference_type reference_q(topk_2);
+        for (auto const& q: data->queries) {
+            op_q(
+                make_block_max_scored_cursors(data->index, data->wdata, *scorer, q),
+                data->index.num_docs());
+            reference_q(make_scored_cursors(data->index, *scorer, q), data->index.num_docs());
+            topk_1.finalize();
+            topk_2.finalize();
+            REQUIRE(topk_1.topk().size() == topk_2.topk().size());
+            for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                REQUIRE(topk_1.topk()[i].first == Approx(topk_2.topk()[i].first).epsilon(0.01));
+            }
+            topk_1.clear();
+            topk_2.clear();
+        }
+    }
+}
+
+TEST_CASE("Conjunctive queries with block intersection", "[query][ranked][integration]")
+{
+    for (auto&& s_name: {"bm25", "qld"}) {
+        std::unordered_set<size_t> dropped_term_ids;
+        auto data = IndexData<block_interpolative_index>::get(s_name, false, dropped_term_ids);
+        auto reference = IndexData<single_index>::get(s_name, false, dropped_term_ids);
+        auto scorer = scorer::from_name(s_name, data->wdata);
+        auto reference_scorer = scorer::from_name(s_name, reference->wdata);
+        topk_queue topk_1(10);
+        ranked_and_query ranked_and_q(topk_1);
+        topk_queue topk_2(10);
+        ranked_and_query reference_q(topk_2);
+        for (auto const& q: data->queries) {
+            auto docs = and_query{}(make_cursors(data->index, q), data->index.num_docs());
+            REQUIRE(docs == and_query{}(make_cursors(reference->index, q), data->index.num_docs()));
+
+            auto scored = scored_and_query{}(
+                make_scored_cursors(data->index, *scorer, q), data->index.num_docs());
+            auto reference_scored = scored_and_query{}(
+                make_scored_cursors(reference->index, *reference_scorer, q),
+                data->index.num_docs());
+            REQUIRE(scored.size() == reference_scored.size());
+            for (size_t i = 0; i < scored.size(); ++i) {
+                REQUIRE(scored[i].first == reference_scored[i].first);
+                REQUIRE(scored[i].second == Approx(reference_scored[i].second).epsilon(0.01));
+            }
+
+            ranked_and_q(make_scored_cursors(data->index, *scorer, q), data->index.num_docs());
+            reference_q(
+                make_scored_cursors(reference->index, *reference_scorer, q),
+                data->index.num_docs());
+            topk_1.finalize();
+            topk_2.finalize();
+            REQUIRE(topk_1.topk().size() == topk_2.topk().size());
+            for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                REQUIRE(topk_1.topk()[i].first == Approx(topk_2.topk()[i].first).epsilon(0.01));
+            }
+            topk_1.clear();
+            topk_2.clear();
+        }
+    }
+}
+
+using test_block_max_cursor =
+    block_max_scored_cursor<single_index, wand_data<wand_data_raw>, term_scorer_t>;
+
+TEMPLATE_TEST_CASE(
+    "Ranked query with deleted documents",
+    "[query][ranked][integration]",
+    ranked_or_query,
+    ranked_or_taat_query_acc<Simple_Accumulator>,
+    wand_query,
+    maxscore_query,
+    block_max_wand_query,
+    block_max_maxscore_query,
+    parallel_range_query<wand_query, test_block_max_cursor>)
+{
+    tbb::task_scheduler_init init(4);
+    std::unordered_set<size_t> dropped_term_ids;
+    auto data = IndexData<single_index>::get("bm25", false, dropped_term_ids);
+    auto num_docs = data->index.num_docs();
+    bit_vector_builder builder(num_docs);
+    for (uint64_t docid = 0; docid < num_docs; docid += 3) {
+        builder.set(docid, true);
+    }
+    bit_vector deleted(&builder);
+    wand_data<wand_data_raw> live_wdata(
+        data->document_sizes.begin()->begin(),
+        num_docs,
+        data->collection,
+        "bm25",
+        BlockSize(FixedBlock(5)),
+        false,
+        dropped_term_ids,
+        0,
+        &deleted);
+
+    for (auto* wdata: {&data->wdata, &live_wdata}) {
+        auto scorer = scorer::from_name("bm25", *wdata);
+        for (auto const& q: data->queries) {
+            topk_queue all(num_docs);
+            ranked_or_query or_q(all);
+            or_q(make_scored_cursors(data->index, *scorer, q), num_docs);
+            all.finalize();
+            std::vector<float> expected;
+            for (auto const& [score, docid]: all.topk()) {
+                if (not deleted[docid] && expected.size() < 10) {
+                    expected.push_back(score);
+                }
+            }
+
+            std::atomic_bool scored_deleted = false;
+            auto record_deleted = [&](auto& cursors) -> auto& {
+                for (auto& cursor: cursors) {
+                    cursor.scorer = [&, score = cursor.scorer](uint32_t docid, uint32_t freq) {
+                        if (deleted[docid]) {
+                            scored_deleted = true;
+                        }
+                        return score(docid, freq);
+                    };
+                }
+                return cursors;
+            };
+
+            topk_queue topk(10, &deleted);
+            TestType op_q(topk);
+            if constexpr (std::is_same_v<
+                              TestType,
+                              parallel_range_query<wand_query, test_block_max_cursor>>) {
+                op_q(
+                    [&](auto& context) -> auto& {
+                        return record_deleted(make_block_max_scored_cursors(
+                            data->index, *wdata, *scorer, q, context));
+                    },
+                    num_docs,
+                    128);
+            } else {
+                auto cursors = make_block_max_scored_cursors(data->index, *wdata, *scorer, q);
+                op_q(record_deleted(cursors), num_docs);
+            }
+            topk.finalize();
+            REQUIRE(topk.topk().size() == expected.size());
+            for (size_t i = 0; i < expected.size(); ++i) {
+                REQUIRE_FALSE(deleted[topk.topk()[i].second]);
+                REQUIRE(topk.topk()[i].first == Approx(expected[i]).epsilon(0.01));
+            }
+            // Only term-at-a-time algorithms score deleted documents, which the queue drops.
+            constexpr bool term_at_a_time =
+                std::is_same_v<TestType, ranked_or_taat_query_acc<Simple_Accumulator>>;
+            if constexpr (not term_at_a_time) {
+                REQUIRE_FALSE(scored_deleted);
+            }
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE(
+    "Conjunctive ranked query with deleted documents",
+    "[query][ranked][integration]",
+    ranked_and_query,
+    block_max_ranked_and_query)
+{
+    std::unordered_set<size_t> dropped_term_ids;
+    auto data = IndexData<single_index>::get("bm25", false, dropped_term_ids);
+    auto blocks = IndexData<block_interpolative_index>::get("bm25", false, dropped_term_ids);
+    auto num_docs = data->index.num_docs();
+    bit_vector_builder builder(num_docs);
+    for (uint64_t docid = 0; docid < num_docs; docid += 3) {
+        builder.set(docid, true);
+    }
+    bit_vector deleted(&builder);
+    auto scorer = scorer::from_name("bm25", data->wdata);
+    auto block_scorer = scorer::from_name("bm25", blocks->wdata);
+
+    auto check = [&](auto cursors, std::vector<float> const& expected) {
+        bool scored_deleted = false;
+        for (auto& cursor: cursors) {
+            cursor.scorer = [&, score = cursor.scorer](uint32_t docid, uint32_t freq) {
+                scored_deleted = scored_deleted || deleted[docid];
+                return score(docid, freq);
+            };
+        }
+        topk_queue topk(10, &deleted);
+        TestType op_q(topk);
+        op_q(cursors, num_docs);
+        topk.finalize();
+        REQUIRE_FALSE(scored_deleted);
+        REQUIRE(topk.topk().size() == expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            REQUIRE_FALSE(deleted[topk.topk()[i].second]);
+            REQUIRE(topk.topk()[i].first == Approx(expected[i]).epsilon(0.01));
+        }
+    };
+
+    for (auto const& q: data->queries) {
+        auto scored = scored_and_query(&deleted)(
+            make_scored_cursors(data->index, *scorer, q), num_docs);
+        std::vector<float> expected;
+        for (auto const& [docid, score]: scored) {
+            expected.push_back(score);
+        }
+        std::sort(expected.begin(), expected.end(), std::greater<>());
+        expected.resize(std::min<size_t>(expected.size(), 10));
+
+        check(make_block_max_scored_cursors(data->index, data->wdata, *scorer, q), expected);
+        if constexpr (std::is_same_v<TestType, ranked_and_query>) {
+            // Block indexes intersect whole blocks of candidates at a time.
+            check(make_scored_cursors(blocks->index, *block_scorer, q), expected);
+        }
+    }
+}
+
+TEST_CASE("Unranked query with deleted documents", "[query][integration]")
+{
+    std::unordered_set<size_t> dropped_term_ids;
+    auto data = IndexData<block_interpolative_index>::get("bm25", false, dropped_term_ids);
+    auto reference = IndexData<single_index>::get("bm25", false, dropped_term_ids);
+    auto num_docs = data->index.num_docs();
+    bit_vector_builder builder(num_docs);
+    for (uint64_t docid = 0; docid < num_docs; docid += 3) {
+        builder.set(docid, true);
+    }
+    bit_vector deleted(&builder);
+    auto scorer = scorer::from_name("bm25", data->wdata);
+    auto reference_scorer = scorer::from_name("bm25", reference->wdata);
+    auto live = [&](auto const& docs) {
+        std::vector<uint32_t> live_docs;
+        std::copy_if(docs.begin(), docs.end(), std::back_inserter(live_docs), [&](auto docid) {
+            return not deleted[docid];
+        });
+        return live_docs;
+    };
+    for (auto const& q: data->queries) {
+        auto expected = live(and_query{}(make_cursors(reference->index, q), num_docs));
+        REQUIRE(and_query(&deleted)(make_cursors(data->index, q), num_docs) == expected);
+        REQUIRE(and_query(&deleted)(make_cursors(reference->index, q), num_docs) == expected);
+
+        for (auto const& scored: {
+                 scored_and_query(&deleted)(make_scored_cursors(data->index, *scorer, q), num_docs),
+                 scored_and_query(&deleted)(
+                     make_scored_cursors(reference->index, *reference_scorer, q), num_docs)}) {
+            REQUIRE(scored.size() == expected.size());
+            for (size_t i = 0; i < scored.size(); ++i) {
+                REQUIRE(scored[i].first == expected[i]);
+            }
+        }
+
+        std::vector<uint32_t> any_docs;
+        for (auto term: q.terms) {
+            for (auto cursor = reference->index[term]; cursor.docid() < num_docs; cursor.next()) {
+                any_docs.push_back(cursor.docid());
+            }
+        }
+        std::sort(any_docs.begin(), any_docs.end());
+        any_docs.erase(std::unique(any_docs.begin(), any_docs.end()), any_docs.end());
+        REQUIRE(
+            or_query<false>(&deleted)(make_cursors(data->index, q), num_docs)
+            == live(any_docs).size());
+        REQUIRE(
+            or_query<true>(&deleted)(make_cursors(reference->index, q), num_docs)
+            == live(any_docs).size());
+    }
+}
+
+TEST_CASE("Query budget", "[query]")
+{
+    QueryBudget unlimited;
+    unlimited.start();
+    REQUIRE_FALSE(unlimited.limited());
+    REQUIRE_FALSE(unlimited.spend(1'000'000, 5));
+    REQUIRE(unlimited.exact_until() == QueryBudget::unlimited);
+
+    QueryBudget postings(10);
+    postings.start();
+    REQUIRE_FALSE(postings.spend(9, 5));
+    REQUIRE(postings.spend(1, 7));
+    REQUIRE(postings.exhausted());
+    REQUIRE(postings.exact_until() == 7);
+    postings.start();
+    REQUIRE_FALSE(postings.exhausted());
+
+    QueryBudget deadline(std::chrono::microseconds(0));
+    deadline.start();
+    REQUIRE(deadline.limited());
+    REQUIRE_FALSE(deadline.spend(QueryBudget::check_interval - 1, 3));
+    REQUIRE(deadline.spend(1, 4));
+    REQUIRE(deadline.exact_until() == 4);
+}
+
+TEMPLATE_TEST_CASE(
+    "Ranked query with a budget",
+    "[query][ranked][integration]",
+    ranked_or_query,
+    ranked_or_taat_query_acc<Simple_Accumulator>,
+    wand_query,
+    maxscore_query,
+    block_max_wand_query,
+    block_max_maxscore_query)
+{
+    constexpr bool taat = std::is_same_v<TestType, ranked_or_taat_query_acc<Simple_Accumulator>>;
+    std::unordered_set<size_t> dropped_term_ids;
+    auto data = IndexData<single_index>::get("bm25", false, dropped_term_ids);
+    auto scorer = scorer::from_name("bm25", data->wdata);
+    size_t exhausted = 0;
+    for (uint64_t postings: {uint64_t(20), uint64_t(200), QueryBudget::unlimited}) {
+        QueryBudget budget(postings);
+        for (auto const& q: data->queries) {
+            topk_queue topk_1(10);
+            TestType op_q(topk_1, &budget);
+            budget.start();
+            op_q(
+                make_block_max_scored_cursors(data->index, data->wdata, *scorer, q),
+                data->index.num_docs());
+            topk_1.finalize();
+
+            // The results are those of the documents processed exactly.
+            auto exact_until = std::min(budget.exact_until(), data->index.num_docs());
+            REQUIRE(budget.exhausted() == (exact_until < data->index.num_docs()));
+            if (budget.exhausted()) {
+                exhausted += 1;
+                REQUIRE(budget.postings() >= postings);
+                if (taat) {
+                    continue;
+                }
+            }
+            topk_queue topk_2(10);
+            ranked_or_query or_q(topk_2);
+            or_q(make_scored_cursors(data->index, *scorer, q), exact_until);
+            topk_2.finalize();
+            REQUIRE(topk_1.topk().size() == topk_2.topk().size());
+            for (size_t i = 0; i < topk_1.topk().size(); ++i) {
+                REQUIRE(topk_1.topk()[i].first == Approx(topk_2.topk()[i].first).epsilon(0.01));
+            }
+        }
+    }
+    REQUIRE(exhausted > 0);
+}
+
+TEST_CASE("Query counters")
+{
+    std::unordered_set<size_t> dropped_term_ids;
+    auto data = IndexData<single_index>::get("bm25", false, dropped_term_ids);
+    auto scorer = scorer::from_name("bm25", data->wdata);
+    for (auto const& q: data->queries) {
+        topk_queue topk(10);
+        wand_query wand_q(topk);
+        query_counters::reset();
+        wand_q(
+            make_max_scored_cursors(data->index, data->wdata, *scorer, q),
+            data->index.num_docs());
+        topk.finalize();
+        auto counters = query_counters::local();
+        if constexpr (query_counters::enabled) {
+            REQUIRE(counters.heap_insertions >= topk.topk().size());
+            REQUIRE(counters.evaluations >= counters.heap_insertions);
+            REQUIRE(counters.pivots >= counters.evaluations);
+            REQUIRE(counters.postings >= counters.evaluations);
+        } else {
+            REQUIRE(counters.postings == 0);
+            REQUIRE(counters.evaluations == 0);
+            REQUIRE(counters.heap_insertions == 0);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "recursive_graph_bisection.hpp"
+#include "temporary_directory.hpp"
+
+using namespace pisa;
+
+TEST_CASE("Move gains of a batch of terms are those of expb")
+{
+    std::mt19937 gen(17);
+    auto [max_degree, size] = GENERATE(table<uint32_t, size_t>(
+        {{1, 0}, {5, 3}, {100, 8}, {4000, 29}, {5000, 64}, {1U << 20U, 1001}}));
+    CAPTURE(max_degree);
+    CAPTURE(size);
+    std::uniform_int_distribution<uint32_t> degree(0, max_degree);
+    std::vector<uint32_t> from_deg(size);
+    std::vector<uint32_t> to_deg(size);
+    for (size_t idx = 0; idx < size; ++idx) {
+        from_deg[idx] = std::max(degree(gen), 1U);
+        to_deg[idx] = degree(gen);
+    }
+    double logn1 = pisa::log2(max_degree * 2);
+    double logn2 = pisa::log2(max_degree * 3);
+    std::vector<double> gains(size);
+    bp::move_gains(logn1, logn2, from_deg.data(), to_deg.data(), gains.data(), size);
+    for (size_t idx = 0; idx < size; ++idx) {
+        CAPTURE(idx);
+        // Products may be fused with the sums that follow, so gains can differ from those of
+        // `expb` by the rounding error of its float operations.
+        double margin = 4 * std::numeric_limits<float>::epsilon()
+            * (from_deg[idx] + to_deg[idx] + 2) * std::max(logn1, logn2);
+        REQUIRE(
+            gains[idx]
+            == Approx(
+                   bp::expb(logn1, logn2, from_deg[idx], to_deg[idx])
+                   - bp::expb(logn1, logn2, from_deg[idx] - 1, to_deg[idx] + 1))
+                   .margin(margin));
+    }
+}
+
+TEST_CASE("Reorder documents of a memory-mapped forward index")
+{
+    auto compressed = GENERATE(true, false);
+    CAPTURE(compressed);
+    Temporary_Directory tmpdir;
+    auto fwd_file = (tmpdir.path() / "fwd").string();
+    auto fwd = forward_index::from_inverted_index("test_data/test_collection", 0, compressed);
+    forward_index::write(fwd, fwd_file);
+    auto mapped_fwd = forward_index::read(fwd_file);
+    REQUIRE(mapped_fwd.size() == fwd.size());
+
+    // Reorders the first documents, since reordering all of them would take too long.
+    auto reorder = [](forward_index const& fwd) {
+        std::vector<uint32_t> documents(1000);
+        std::iota(documents.begin(), documents.end(), 0U);
+        std::vector<double> gains(fwd.size(), 0.0);
+        document_range<std::vector<uint32_t>::iterator> range(
+            documents.begin(), documents.end(), fwd, gains);
+        progress p("Graph bisection", range.size() * 3);
+        recursive_graph_bisection(range, 3, 2, p);
+        return documents;
+    };
+    auto documents = reorder(mapped_fwd);
+    REQUIRE(documents == reorder(fwd));
+    std::sort(documents.begin(), documents.end());
+    for (uint32_t doc = 0; doc < documents.size(); ++doc) {
+        REQUIRE(documents[doc] == doc);
+    }
+}
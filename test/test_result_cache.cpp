@@ -0,0 +1,160 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <atomic>
+#include <thread>
+
+#include "query/result_cache.hpp"
+
+using namespace pisa;
+
+namespace {
+
+auto make_query(std::vector<term_id_type> terms) -> Query
+{
+    return Query{std::nullopt, std::move(terms), {}};
+}
+
+auto make_results(uint64_t docid) -> ResultCache::value_type
+{
+    return {{1.0F, docid}, {0.5F, docid + 1}};
+}
+
+}  // namespace
+
+TEST_CASE("Result cache keys", "[result_cache]")
+{
+    ResultCache cache(1 << 20);
+    ResultCache::Key key{"wand", "bm25", 10, {}};
+    key.assign(make_query({3, 1, 2}));
+    cache.insert(key, make_results(7));
+
+    ResultCache::value_type results;
+    key.assign(make_query({1, 2, 3}));
+    REQUIRE(cache.find(key, results));
+    REQUIRE(results == make_results(7));
+
+    key.assign(make_query({1, 2, 3, 3}));
+    REQUIRE_FALSE(cache.find(key, results));
+    key.assign(make_query({1, 2}));
+    REQUIRE_FALSE(cache.find(key, results));
+
+    ResultCache::Key other_k{"wand", "bm25", 100, {}};
+    other_k.assign(make_query({1, 2, 3}));
+    REQUIRE_FALSE(cache.find(other_k, results));
+    ResultCache::Key other_algorithm{"maxscore", "bm25", 10, {}};
+    other_algorithm.assign(make_query({1, 2, 3}));
+    REQUIRE_FALSE(cache.find(other_algorithm, results));
+
+    REQUIRE(cache.hits() == 1);
+    REQUIRE(cache.misses() == 4);
+    REQUIRE(cache.hit_ratio() == Approx(0.2));
+}
+
+TEST_CASE("LRU result cache", "[result_cache]")
+{
+    ResultCache::Key key{"wand", "bm25", 10, {}};
+    key.assign(make_query({0}));
+    ResultCache probe(1 << 20, CachePolicy::LRU, 0.5, 1);
+    probe.insert(key, make_results(0));
+    auto entry_bytes = probe.memory_usage();
+
+    // A single shard fitting three entries.
+    ResultCache cache(3 * entry_bytes, CachePolicy::LRU, 0.5, 1);
+    ResultCache::value_type results;
+    for (term_id_type term = 0; term < 3; ++term) {
+        key.assign(make_query({term}));
+        cache.insert(key, make_results(term));
+    }
+    REQUIRE(cache.size() == 3);
+
+    key.assign(make_query({0}));
+    REQUIRE(cache.find(key, results));  // 0 is now the most recently used
+    key.assign(make_query({3}));
+    cache.insert(key, make_results(3));  // evicts 1
+    REQUIRE(cache.size() == 3);
+    REQUIRE(cache.memory_usage() <= 3 * entry_bytes);
+
+    for (auto [term, cached]: std::vector<std::pair<term_id_type, bool>>{
+             {0, true}, {1, false}, {2, true}, {3, true}}) {
+        key.assign(make_query({term}));
+        REQUIRE(cache.find(key, results) == cached);
+    }
+
+    cache.clear();
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.hits() == 0);
+    REQUIRE(cache.memory_usage() == 0);
+}
+
+TEST_CASE("SDC result cache", "[result_cache]")
+{
+    ResultCache::Key key{"wand", "bm25", 10, {}};
+    key.assign(make_query({0}));
+    ResultCache probe(1 << 20, CachePolicy::LRU, 0.5, 1);
+    probe.insert(key, make_results(0));
+    auto entry_bytes = probe.memory_usage();
+
+    // Two static entries and two dynamic entries, leaving room for longer keys.
+    ResultCache cache(4 * entry_bytes + 64, CachePolicy::SDC, 0.5, 1);
+    std::vector<Query> log{
+        make_query({1}), make_query({2}), make_query({1}), make_query({3}), make_query({2, 4}),
+        make_query({4, 2}), make_query({1})};
+    std::size_t computed = 0;
+    cache.fill_static(log, key, [&](Query const& query) {
+        computed += 1;
+        return make_results(query.terms.front());
+    });
+    REQUIRE(computed == 3);
+    REQUIRE(cache.size() == 2);
+
+    ResultCache::value_type results;
+    for (term_id_type term = 10; term < 20; ++term) {
+        key.assign(make_query({term}));
+        cache.insert(key, make_results(term));
+    }
+    REQUIRE(cache.size() == 4);
+    REQUIRE(cache.memory_usage() <= 4 * entry_bytes + 64);
+
+    key.assign(make_query({1}));
+    REQUIRE(cache.find(key, results));
+    REQUIRE(results == make_results(1));
+    key.assign(make_query({2, 4}));
+    REQUIRE(cache.find(key, results));
+    REQUIRE(results == make_results(2));
+    key.assign(make_query({3}));
+    REQUIRE_FALSE(cache.find(key, results));
+    key.assign(make_query({19}));
+    REQUIRE(cache.find(key, results));
+
+    cache.clear();
+    REQUIRE(cache.size() == 2);
+}
+
+TEST_CASE("Result cache shared between threads", "[result_cache]")
+{
+    ResultCache cache(1 << 16);
+    std::atomic<std::size_t> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 8; ++thread) {
+        threads.emplace_back([&cache, &mismatches]() {
+            ResultCache::Key key{"wand", "bm25", 10, {}};
+            ResultCache::value_type results;
+            for (term_id_type term = 0; term < 10000; ++term) {
+                key.assign(make_query({term % 500, term % 7}));
+                if (cache.find(key, results)) {
+                    mismatches += static_cast<std::size_t>(results != make_results(term % 500));
+                } else {
+                    cache.insert(key, make_results(term % 500));
+                }
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    REQUIRE(mismatches == 0);
+    REQUIRE(cache.hits() > 0);
+    REQUIRE(cache.hits() + cache.misses() == 80000);
+    REQUIRE(cache.memory_usage() <= (1 << 16));
+}
@@ -0,0 +1,493 @@
+#define CATCH_CONFIG_MAIN
+#include "catch2/catch.hpp"
+
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <mio/mmap.hpp>
+
+#include "binary_freq_collection.hpp"
+#include "bit_vector.hpp"
+#include "cursor/block_max_scored_cursor.hpp"
+#include "cursor/scored_cursor.hpp"
+#include "deleted_documents.hpp"
+#include "index_types.hpp"
+#include "invert.hpp"
+#include "io.hpp"
+#include "mappable/mapper.hpp"
+#include "pisa_config.hpp"
+#include "query/algorithm.hpp"
+#include "scorer/scorer.hpp"
+#include "segmented_index.hpp"
+#include "temporary_directory.hpp"
+#include "wand_data.hpp"
+#include "wand_data_raw.hpp"
+
+using namespace pisa;
+using wand_raw_index = wand_data<wand_data_raw>;
+using segment_index_type = block_varintgb_index;
+using segment_scorer_type = bm25<wand_raw_index>;
+
+auto read_file(std::string const& filename) -> std::vector<char>
+{
+    std::ifstream is(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("Tiered merge policy", "[segments][unit]")
+{
+    Tiered_Merge_Policy policy{3, 10};
+    auto segments_of_sizes = [](std::vector<std::uint64_t> const& sizes) {
+        std::vector<Segment> segments;
+        for (auto size: sizes) {
+            segments.push_back(Segment{"segment", size});
+        }
+        return segments;
+    };
+    REQUIRE(policy.tier(1) == 0);
+    REQUIRE(policy.tier(10) == 0);
+    REQUIRE(policy.tier(11) == 1);
+    REQUIRE(policy.tier(30) == 1);
+    REQUIRE(policy.tier(31) == 2);
+    REQUIRE_FALSE(policy.select(segments_of_sizes({})));
+    REQUIRE_FALSE(policy.select(segments_of_sizes({5, 5})));
+    REQUIRE_FALSE(policy.select(segments_of_sizes({5, 5, 20, 5})));
+    REQUIRE(policy.select(segments_of_sizes({5, 5, 5})) == std::make_pair(0UL, 3UL));
+    REQUIRE(policy.select(segments_of_sizes({90, 20, 5, 5, 5, 5})) == std::make_pair(2UL, 5UL));
+    REQUIRE(policy.select(segments_of_sizes({20, 20, 20, 5, 5, 5})) == std::make_pair(0UL, 3UL));
+}
+
+TEST_CASE("Merge lexicons", "[segments][unit]")
+{
+    auto [terms, mappings] = merge_lexicons({{"a", "c", "d"}, {"b", "c"}, {}, {"a", "e"}});
+    REQUIRE(terms == std::vector<std::string>{"a", "b", "c", "d", "e"});
+    REQUIRE(mappings == std::vector<std::vector<std::uint32_t>>{{0, 2, 3}, {1, 2}, {}, {0, 4}});
+}
+
+TEST_CASE("Merge collections", "[segments][unit]")
+{
+    Temporary_Directory tmpdir;
+    auto write_collection = [&](std::string const& name,
+                                std::uint32_t num_docs,
+                                std::vector<std::vector<std::uint32_t>> const& docs,
+                                std::vector<std::vector<std::uint32_t>> const& freqs) {
+        auto basename = (tmpdir.path() / name).string();
+        std::ofstream dos(basename + ".docs");
+        std::ofstream fos(basename + ".freqs");
+        std::ofstream sos(basename + ".sizes");
+        write_sequence(dos, gsl::make_span<std::uint32_t const>(&num_docs, 1));
+        for (std::size_t term = 0; term < docs.size(); ++term) {
+            write_sequence(dos, gsl::span<std::uint32_t const>(docs[term]));
+            write_sequence(fos, gsl::span<std::uint32_t const>(freqs[term]));
+        }
+        std::vector<std::uint32_t> sizes(num_docs, 1);
+        write_sequence(sos, gsl::span<std::uint32_t const>(sizes));
+        return basename;
+    };
+    auto first = write_collection("first", 3, {{0, 2}, {1}}, {{1, 2}, {3}});
+    auto second = write_collection("second", 2, {{0}, {0, 1}}, {{4}, {5, 6}});
+    auto output = (tmpdir.path() / "merged").string();
+    merge_collections({first, second}, {{0, 2}, {1, 2}}, 3, output);
+
+    binary_freq_collection merged(output.c_str());
+    REQUIRE(merged.num_docs() == 5);
+    std::vector<std::vector<std::uint32_t>> docs;
+    std::vector<std::vector<std::uint32_t>> freqs;
+    for (auto const& seq: merged) {
+        docs.emplace_back(seq.docs.begin(), seq.docs.end());
+        freqs.emplace_back(seq.freqs.begin(), seq.freqs.end());
+    }
+    REQUIRE(docs == std::vector<std::vector<std::uint32_t>>{{0, 2}, {3}, {1, 3, 4}});
+    REQUIRE(freqs == std::vector<std::vector<std::uint32_t>>{{1, 2}, {4}, {3, 5, 6}});
+}
+
+TEMPLATE_TEST_CASE(
+    "Merge indexes",
+    "[segments][index]",
+    block_varintgb_index,
+    block_interpolative_index,
+    ef_index)
+{
+    binary_freq_collection collection(PISA_SOURCE_DIR "/test/test_data/test_collection");
+    global_parameters params;
+    std::uint64_t num_docs = collection.num_docs();
+    std::uint64_t segment_count = GENERATE(1, 2, 3, 7);
+
+    typename TestType::builder full_builder(num_docs, params);
+    std::deque<typename TestType::builder> builders;
+    std::vector<std::vector<std::uint32_t>> mappings(segment_count);
+    std::vector<std::uint64_t> offsets;
+    for (std::uint64_t segment = 0; segment <= segment_count; ++segment) {
+        offsets.push_back(num_docs * segment / segment_count);
+    }
+    for (std::uint64_t segment = 0; segment < segment_count; ++segment) {
+        builders.emplace_back(offsets[segment + 1] - offsets[segment], params);
+    }
+    std::uint64_t postings = 0;
+    std::uint32_t term = 0;
+    for (auto const& plist: collection) {
+        std::vector<std::uint64_t> docs(plist.docs.begin(), plist.docs.end());
+        std::vector<std::uint64_t> freqs(plist.freqs.begin(), plist.freqs.end());
+        full_builder.add_posting_list(
+            docs.size(),
+            docs.begin(),
+            freqs.begin(),
+            std::accumulate(freqs.begin(), freqs.end(), std::uint64_t(0)));
+        postings += docs.size();
+        for (std::uint64_t segment = 0; segment < segment_count; ++segment) {
+            auto first = std::lower_bound(docs.begin(), docs.end(), offsets[segment]);
+            auto last = std::lower_bound(docs.begin(), docs.end(), offsets[segment + 1]);
+            if (first == last) {
+                continue;
+            }
+            std::vector<std::uint64_t> segment_docs(first, last);
+            for (auto& docid: segment_docs) {
+                docid -= offsets[segment];
+            }
+            auto segment_freqs = std::next(freqs.begin(), std::distance(docs.begin(), first));
+            builders[segment].add_posting_list(
+                segment_docs.size(),
+                segment_docs.begin(),
+                segment_freqs,
+                std::accumulate(
+                    segment_freqs,
+                    std::next(segment_freqs, segment_docs.size()),
+                    std::uint64_t(0)));
+            mappings[segment].push_back(term);
+        }
+        term += 1;
+    }
+
+    TestType full;
+    full_builder.build(full);
+    std::vector<TestType> indexes(segment_count);
+    std::vector<TestType const*> index_pointers;
+    for (std::uint64_t segment = 0; segment < segment_count; ++segment) {
+        builders[segment].build(indexes[segment]);
+        index_pointers.push_back(&indexes[segment]);
+    }
+
+    TestType merged;
+    auto stats = merge_indexes(index_pointers, mappings, term, merged);
+    REQUIRE(stats.copied_postings + stats.encoded_postings == postings);
+    REQUIRE(merged.size() == full.size());
+    REQUIRE(merged.num_docs() == full.num_docs());
+
+    Temporary_Directory tmpdir;
+    auto merged_filename = (tmpdir.path() / "merged").string();
+    auto full_filename = (tmpdir.path() / "full").string();
+    mapper::freeze(merged, merged_filename.c_str());
+    mapper::freeze(full, full_filename.c_str());
+    REQUIRE(read_file(merged_filename) == read_file(full_filename));
+}
+
+/// Returns `count` documents of terms `t0`, `t1`, ... drawn with a skewed distribution.
+auto random_documents(std::size_t count, std::uint64_t seed)
+    -> std::vector<std::vector<std::string>>
+{
+    std::mt19937_64 rng(seed);
+    std::geometric_distribution<std::size_t> term(0.1);
+    std::uniform_int_distribution<std::size_t> length(1, 30);
+    std::vector<std::vector<std::string>> documents(count);
+    for (auto& document: documents) {
+        for (auto len = length(rng); len > 0; --len) {
+            document.push_back(fmt::format("t{}", term(rng)));
+        }
+    }
+    return documents;
+}
+
+/// Writes `documents` as the forward index `basename`, as `parse_collection` does.
+void write_forward_index(
+    std::string const& basename, gsl::span<std::vector<std::string> const> documents)
+{
+    std::vector<std::string> terms;
+    for (auto const& document: documents) {
+        terms.insert(terms.end(), document.begin(), document.end());
+    }
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    {
+        std::ofstream os(basename + ".terms");
+        for (auto const& term: terms) {
+            os << term << '\n';
+        }
+    }
+    std::ofstream os(basename);
+    auto count = static_cast<std::uint32_t>(documents.size());
+    write_sequence(os, gsl::make_span<std::uint32_t const>(&count, 1));
+    std::vector<std::uint32_t> term_ids;
+    for (auto const& document: documents) {
+        term_ids.clear();
+        for (auto const& term: document) {
+            term_ids.push_back(std::distance(
+                terms.begin(), std::lower_bound(terms.begin(), terms.end(), term)));
+        }
+        write_sequence(os, gsl::span<std::uint32_t const>(term_ids));
+    }
+}
+
+/// Deletes the documents of the segments of `dir` whose docids in the whole index are multiples
+/// of 3, and returns whether a document of the whole index is deleted.
+auto delete_every_third_document(std::string const& dir)
+{
+    std::uint64_t first_docid = 0;
+    for (auto const& segment: segments::read_manifest(dir).segments) {
+        bit_vector_builder builder(segment.num_docs);
+        for (std::uint64_t docid = 0; docid < segment.num_docs; ++docid) {
+            builder.set(docid, (first_docid + docid) % 3 == 0);
+        }
+        bit_vector deleted(&builder);
+        mapper::freeze(deleted, (segments::basename(dir, segment.name) + ".deleted").c_str());
+        first_docid += segment.num_docs;
+    }
+    return [](std::uint64_t docid) { return docid % 3 == 0; };
+}
+
+/// The segments of a segmented index, loaded to be queried with `segmented_query`.
+struct Loaded_Segments {
+    explicit Loaded_Segments(std::string const& dir)
+        : manifest(segments::read_manifest(dir).segments)
+    {
+        indexes.resize(manifest.size());
+        wdata.resize(manifest.size());
+        sources.reserve(2 * manifest.size());
+        for (std::size_t segment = 0; segment < manifest.size(); ++segment) {
+            auto basename = segments::basename(dir, manifest[segment].name);
+            sources.emplace_back((basename + ".index").c_str());
+            mapper::map(indexes[segment], sources.back());
+            sources.emplace_back((basename + ".wand").c_str());
+            mapper::map(wdata[segment], sources.back());
+            lexicons.push_back(io::read_string_vector(basename + ".terms"));
+            num_docs.push_back(manifest[segment].num_docs);
+            if (boost::filesystem::exists(basename + ".deleted")) {
+                deleted_documents.push_back(std::make_unique<Deleted_Documents>(
+                    basename + ".deleted", manifest[segment].num_docs));
+                deleted.push_back(&deleted_documents.back()->bits());
+            } else {
+                deleted.push_back(nullptr);
+            }
+        }
+        for (auto const& segment_wdata: wdata) {
+            scorers.emplace_back(segment_wdata);
+        }
+    }
+
+    /// Returns the top-k of the query of `terms` with `QueryAlg`, whose cursors are built with
+    /// `make_cursors(index, wdata, scorer, query)`.
+    template <typename QueryAlg, typename CursorFactory>
+    auto query(std::vector<std::string> const& terms, std::uint64_t k, CursorFactory make_cursors)
+        -> std::vector<std::pair<float, std::uint64_t>>
+    {
+        std::vector<Query> queries;
+        for (auto const& lexicon: lexicons) {
+            Query query{std::nullopt, {}, {}};
+            for (auto const& term: terms) {
+                if (auto pos = std::lower_bound(lexicon.begin(), lexicon.end(), term);
+                    pos != lexicon.end() && *pos == term) {
+                    query.terms.push_back(std::distance(lexicon.begin(), pos));
+                }
+            }
+            queries.push_back(std::move(query));
+        }
+        topk_queue topk(k);
+        segmented_query<QueryAlg> query_alg(topk);
+        query_alg(
+            [&](std::size_t segment) {
+                return make_cursors(
+                    indexes[segment], wdata[segment], scorers[segment], queries[segment]);
+            },
+            num_docs,
+            deleted);
+        topk.finalize();
+        return topk.topk();
+    }
+
+    std::vector<Segment> manifest;
+    std::vector<mio::mmap_source> sources;
+    std::vector<segment_index_type> indexes;
+    std::vector<wand_raw_index> wdata;
+    std::vector<segment_scorer_type> scorers;
+    std::vector<std::vector<std::string>> lexicons;
+    std::vector<std::uint64_t> num_docs;
+    std::vector<std::unique_ptr<Deleted_Documents>> deleted_documents;
+    std::vector<bit_vector const*> deleted;
+};
+
+TEST_CASE("Segmented index", "[segments][integration]")
+{
+    Temporary_Directory tmpdir;
+    auto documents = random_documents(600, 17);
+    std::vector<std::string> batches;
+    for (std::size_t first = 0; first < documents.size(); first += 100) {
+        batches.push_back((tmpdir.path() / fmt::format("batch.{}", first / 100)).string());
+        write_forward_index(batches.back(), gsl::make_span(documents).subspan(first, 100));
+    }
+    auto full = (tmpdir.path() / "full").string();
+    write_forward_index(full, documents);
+
+    Segment_Options options;
+    options.batch_size = 64;
+    options.threads = 2;
+    auto dir = (tmpdir.path() / "segmented").string();
+    auto direct_dir = (tmpdir.path() / "direct").string();
+    boost::filesystem::create_directories(dir);
+    boost::filesystem::create_directories(direct_dir);
+    {
+        Segmented_Index_Writer<segment_index_type, wand_raw_index> direct(
+            direct_dir, options, Tiered_Merge_Policy{3, 100});
+        direct.add(full);
+        direct.wait();
+    }
+    auto scored = [](auto const& index, auto const&, auto const& scorer, Query const& query) {
+        return make_scored_cursors(index, scorer, query);
+    };
+    auto block_max_scored =
+        [](auto const& index, auto const& wdata, auto const& scorer, Query const& query) {
+            return make_block_max_scored_cursors(index, wdata, scorer, query);
+        };
+    auto require_same_results = [&](std::string const& segmented_dir) {
+        Loaded_Segments expected_segments(direct_dir);
+        REQUIRE(expected_segments.manifest.size() == 1);
+        Loaded_Segments actual_segments(segmented_dir);
+        auto query_documents = random_documents(50, 29);
+        for (auto& terms: query_documents) {
+            terms.resize(std::min<std::size_t>(terms.size(), 4));
+            auto expected = expected_segments.query<ranked_or_query>(terms, 10, scored);
+            auto actual = actual_segments.query<ranked_or_query>(terms, 10, scored);
+            auto actual_block_max =
+                actual_segments.query<block_max_wand_query>(terms, 10, block_max_scored);
+            REQUIRE(actual.size() == expected.size());
+            REQUIRE(actual_block_max.size() == expected.size());
+            for (std::size_t rank = 0; rank < expected.size(); ++rank) {
+                REQUIRE(actual[rank].first == Approx(expected[rank].first));
+                REQUIRE(actual_block_max[rank].first == Approx(expected[rank].first));
+            }
+        }
+    };
+
+    SECTION("Adjacent segments of the same tier are merged in the background")
+    {
+        Segmented_Index_Writer<segment_index_type, wand_raw_index> writer(
+            dir, options, Tiered_Merge_Policy{3, 100});
+        for (auto const& batch: batches) {
+            writer.add(batch);
+        }
+        writer.wait();
+        auto segments = writer.segments();
+        REQUIRE(segments.size() == 2);
+        REQUIRE(segments[0].num_docs == 300);
+        REQUIRE(segments[1].num_docs == 300);
+        auto manifest = segments::read_manifest(dir).segments;
+        REQUIRE(manifest.size() == segments.size());
+        for (std::size_t idx = 0; idx < segments.size(); ++idx) {
+            REQUIRE(manifest[idx].name == segments[idx].name);
+            REQUIRE(manifest[idx].num_docs == segments[idx].num_docs);
+        }
+        for (auto const& name: {"segment.0", "segment.1", "segment.2"}) {
+            REQUIRE_FALSE(boost::filesystem::exists(segments::basename(dir, name) + ".index"));
+        }
+        require_same_results(dir);
+
+        writer.merge_all();
+        REQUIRE(writer.segments().size() == 1);
+        REQUIRE(writer.segments()[0].num_docs == documents.size());
+        require_same_results(dir);
+    }
+
+    SECTION("Segments are scored with the statistics of the whole index")
+    {
+        Segmented_Index_Writer<segment_index_type, wand_raw_index> unmerged(
+            dir, options, Tiered_Merge_Policy{1, 100});
+        for (auto const& batch: batches) {
+            unmerged.add(batch);
+        }
+        unmerged.wait();
+        REQUIRE(unmerged.segments().size() == batches.size());
+        require_same_results(dir);
+    }
+
+    SECTION("The statistics and options of the index are stored with the manifest")
+    {
+        {
+            Segmented_Index_Writer<segment_index_type, wand_raw_index> writer(
+                dir, options, Tiered_Merge_Policy{1, 100});
+            for (auto const& batch: batches) {
+                writer.add(batch);
+            }
+            writer.wait();
+        }
+        auto manifest = segments::read_manifest(dir);
+        REQUIRE(manifest.scorer == options.scorer);
+        REQUIRE(manifest.block_size == options.block_size);
+        REQUIRE(manifest.statistics_generation == batches.size());
+        for (auto const& segment: manifest.segments) {
+            REQUIRE(segment.statistics_generation == manifest.statistics_generation);
+        }
+        auto statistics = segments::read_statistics(dir, manifest.statistics_generation);
+        auto expected = segments::read_statistics(
+            direct_dir, segments::read_manifest(direct_dir).statistics_generation);
+        std::uint64_t collection_len = 0;
+        for (auto const& document: documents) {
+            collection_len += document.size();
+        }
+        REQUIRE(statistics.num_docs == documents.size());
+        REQUIRE(statistics.collection_len == collection_len);
+        REQUIRE(statistics.terms == expected.terms);
+        REQUIRE(statistics.term_posting_counts == expected.term_posting_counts);
+        REQUIRE(statistics.term_occurrence_counts == expected.term_occurrence_counts);
+        REQUIRE_FALSE(boost::filesystem::exists(segments::basename(
+            dir, segments::statistics_name(manifest.statistics_generation - 1))));
+
+        auto open_with = [&](Segment_Options const& other_options) {
+            Segmented_Index_Writer<segment_index_type, wand_raw_index> writer(
+                dir, other_options, Tiered_Merge_Policy{1, 100});
+        };
+        auto other_scorer = options;
+        other_scorer.scorer = "qld";
+        REQUIRE_THROWS_AS(open_with(other_scorer), std::invalid_argument);
+        auto other_block_size = options;
+        other_block_size.block_size = options.block_size / 2;
+        REQUIRE_THROWS_AS(open_with(other_block_size), std::invalid_argument);
+        REQUIRE_NOTHROW(open_with(options));
+    }
+
+    SECTION("Deleted documents of segments are skipped, and kept by merges")
+    {
+        Segmented_Index_Writer<segment_index_type, wand_raw_index> writer(
+            dir, options, Tiered_Merge_Policy{1, 100});
+        for (auto const& batch: batches) {
+            writer.add(batch);
+        }
+        writer.wait();
+        delete_every_third_document(direct_dir);
+        auto is_deleted = delete_every_third_document(dir);
+        auto require_no_deleted_results = [&]() {
+            Loaded_Segments actual_segments(dir);
+            for (auto& terms: random_documents(50, 31)) {
+                for (auto [score, docid]:
+                     actual_segments.query<block_max_wand_query>(terms, 10, block_max_scored)) {
+                    REQUIRE_FALSE(is_deleted(docid));
+                }
+            }
+        };
+        require_no_deleted_results();
+        require_same_results(dir);
+
+        writer.merge_all();
+        REQUIRE(writer.segments().size() == 1);
+        auto merged = segments::basename(dir, writer.segments()[0].name);
+        Deleted_Documents deleted(merged + ".deleted", documents.size());
+        for (std::uint64_t docid = 0; docid < documents.size(); ++docid) {
+            REQUIRE(deleted.bits()[docid] == is_deleted(docid));
+        }
+        require_no_deleted_results();
+        require_same_results(dir);
+    }
+}
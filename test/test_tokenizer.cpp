@@ -3,8 +3,6 @@
 #include <catch2/catch.hpp>
 #include <functional>
 
-#include <boost/iterator/filter_iterator.hpp>
-#include <boost/spirit/include/lex_lexertl.hpp>
 #include <gsl/span>
 
 #include "payload_vector.hpp"
@@ -24,6 +22,39 @@ TEST_CASE("TermTokenizer")
             "a", "1", "12", "w0rd", "token", "izer", "pup", "USa", "us", "hel", "lo"});
 }
 
+TEST_CASE("Tokenizer")
+{
+    Tokenizer tokenizer;
+    auto tokenize = [&](std::string const& text) {
+        auto const& terms = tokenizer.tokenize(text);
+        return std::vector<std::string>(terms.begin(), terms.end());
+    };
+    REQUIRE(tokenize("").empty());
+    REQUIRE(tokenize(" .,'!").empty());
+    REQUIRE(
+        tokenize("a.b.c.d e..f g.h1.i.j.")
+        == std::vector<std::string>{"abc", "d", "e", "f", "g", "h1", "ij"});
+    REQUIRE(
+        tokenize("U.S.A.'s don't 12ab'cd'ef x'")
+        == std::vector<std::string>{"USA", "s", "don", "12ab", "ef", "x"});
+    REQUIRE(
+        tokenize("caf\xc3\xa9\tna\xc3\xafve\nend")
+        == std::vector<std::string>{"caf", "na", "ve", "end"});
+
+    SECTION("Terms across vectorized blocks")
+    {
+        std::string text;
+        std::vector<std::string> expected;
+        for (int length = 1; length < 70; ++length) {
+            expected.emplace_back(length, 'a' + length % 26);
+            text += expected.back();
+            text += std::string(length % 5 + 1, length % 2 == 0 ? ' ' : '-');
+        }
+        REQUIRE(tokenize(text) == expected);
+        REQUIRE(tokenize("U.S.A. " + text + " U.S.A.").size() == expected.size() + 2);
+    }
+}
+
 TEST_CASE("Parse query terms to ids")
 {
     Temporary_Directory tmpdir;
@@ -2,16 +2,20 @@
 #include "catch2/catch.hpp"
 
 #include <functional>
+#include <vector>
 
+#include <mio/mmap.hpp>
 #include <range/v3/view/iota.hpp>
 #include <range/v3/view/zip.hpp>
 #include <tbb/task_scheduler_init.h>
 
 #include "test_common.hpp"
 
+#include "bit_vector.hpp"
 #include "index_types.hpp"
 #include "pisa_config.hpp"
 #include "query/queries.hpp"
+#include "temporary_directory.hpp"
 #include "wand_data.hpp"
 #include "wand_data_range.hpp"
 
@@ -128,3 +132,202 @@ TEST_CASE("wand_data_range")
         }
     }
 }
+
+TEST_CASE("Precomputed BM25 document normalization")
+{
+    using WandType = wand_data<wand_data_raw>;
+
+    binary_freq_collection const collection(PISA_SOURCE_DIR "/test/test_data/test_collection");
+    binary_collection document_sizes(PISA_SOURCE_DIR "/test/test_data/test_collection.sizes");
+    std::unordered_set<size_t> dropped_term_ids;
+    auto build = [&](uint64_t doc_norm_bits) {
+        return WandType(
+            document_sizes.begin()->begin(),
+            collection.num_docs(),
+            collection,
+            "bm25",
+            BlockSize(FixedBlock(64)),
+            false,
+            dropped_term_ids,
+            doc_norm_bits);
+    };
+    WandType reference = build(0);
+    REQUIRE_FALSE(reference.has_doc_norms());
+    auto reference_scorer = scorer::from_name("bm25", reference);
+
+    auto bits = GENERATE(as<uint64_t>{}, 8, 16, 32);
+    WandType wdata = build(bits);
+    REQUIRE(wdata.has_doc_norms());
+    REQUIRE(wdata.doc_norm_bits() == bits);
+    auto scorer = scorer::from_name("bm25", wdata);
+    double tolerance = bits == 8 ? 0.05 : 0.001;
+
+    size_t term_id = 0;
+    for (auto const& seq: collection) {
+        auto expected = reference_scorer->term_scorer(term_id);
+        auto actual = scorer->term_scorer(term_id);
+        auto max = wdata.max_term_weight(term_id);
+        auto w = wdata.getenum(term_id);
+        for (auto&& [docid, freq]: ranges::views::zip(seq.docs, seq.freqs)) {
+            float score = actual(docid, freq);
+            REQUIRE(score == Approx(expected(docid, freq)).epsilon(tolerance));
+            w.next_geq(docid);
+            REQUIRE(w.score() >= score);
+            REQUIRE(score <= max);
+        }
+        term_id += 1;
+    }
+}
+
+TEST_CASE("WAND data written before versioning is rejected")
+{
+    using WandType = wand_data<wand_data_raw>;
+
+    binary_freq_collection const collection(PISA_SOURCE_DIR "/test/test_data/test_collection");
+    binary_collection document_sizes(PISA_SOURCE_DIR "/test/test_data/test_collection.sizes");
+    std::unordered_set<size_t> dropped_term_ids;
+    WandType wdata(
+        document_sizes.begin()->begin(),
+        collection.num_docs(),
+        collection,
+        "bm25",
+        BlockSize(FixedBlock(64)),
+        false,
+        dropped_term_ids,
+        8);
+    Temporary_Directory tmpdir;
+    auto wand_file = (tmpdir.path() / "wand").string();
+    mapper::freeze(wdata, wand_file.c_str());
+
+    std::vector<char> data;
+    {
+        mio::mmap_source source(wand_file.c_str());
+        data.assign(source.begin(), source.end());
+    }
+    WandType mapped;
+    mapper::map(mapped, data.data());
+    REQUIRE(mapped.doc_norm_bits() == 8);
+    auto expected = scorer::from_name("bm25", wdata)->term_scorer(0);
+    auto actual = scorer::from_name("bm25", mapped)->term_scorer(0);
+    auto seq = *collection.begin();
+    for (auto&& [docid, freq]: ranges::views::zip(seq.docs, seq.freqs)) {
+        REQUIRE(actual(docid, freq) == expected(docid, freq));
+    }
+
+    // Earlier files have the block data right after the flags.
+    data.erase(data.begin() + sizeof(uint64_t), data.begin() + 3 * sizeof(uint64_t));
+    WandType legacy;
+    REQUIRE_THROWS_AS(mapper::map(legacy, data.data()), std::runtime_error);
+}
+
+TEST_CASE("Precomputed document normalization is bm25 only")
+{
+    binary_freq_collection const collection(PISA_SOURCE_DIR "/test/test_data/test_collection");
+    binary_collection document_sizes(PISA_SOURCE_DIR "/test/test_data/test_collection.sizes");
+    std::unordered_set<size_t> dropped_term_ids;
+    REQUIRE_THROWS_AS(
+        wand_data<wand_data_raw>(
+            document_sizes.begin()->begin(),
+            collection.num_docs(),
+            collection,
+            "qld",
+            BlockSize(FixedBlock(64)),
+            false,
+            dropped_term_ids,
+            32),
+        std::invalid_argument);
+}
+
+TEST_CASE("Score upper bounds of heavily-deleted lists exclude deleted documents")
+{
+    binary_freq_collection const collection(PISA_SOURCE_DIR "/test/test_data/test_collection");
+    binary_collection document_sizes(PISA_SOURCE_DIR "/test/test_data/test_collection.sizes");
+    std::unordered_set<size_t> dropped_term_ids;
+    auto num_docs = collection.num_docs();
+    bit_vector_builder builder(num_docs);
+    for (uint64_t docid = 0; docid < num_docs / 2; ++docid) {
+        builder.set(docid, true);
+    }
+    bit_vector deleted(&builder);
+    auto build = [&](bit_vector const* deleted, double min_deleted_fraction) {
+        return wand_data<wand_data_raw>(
+            document_sizes.begin()->begin(),
+            num_docs,
+            collection,
+            "bm25",
+            BlockSize(FixedBlock(5)),
+            false,
+            dropped_term_ids,
+            0,
+            deleted,
+            min_deleted_fraction);
+    };
+    auto wdata = build(nullptr, 0.0);
+    auto live_wdata = build(&deleted, 0.5);
+    auto scorer = scorer::from_name("bm25", wdata);
+
+    size_t term_id = 0;
+    size_t lowered = 0;
+    for (auto const& seq: collection) {
+        REQUIRE(live_wdata.max_term_weight(term_id) <= wdata.max_term_weight(term_id));
+        if (deleted_fraction(deleted, seq.docs) < 0.5) {
+            REQUIRE(live_wdata.max_term_weight(term_id) == wdata.max_term_weight(term_id));
+        } else if (live_wdata.max_term_weight(term_id) < wdata.max_term_weight(term_id)) {
+            lowered += 1;
+        }
+        auto w = live_wdata.getenum(term_id);
+        auto s = scorer->term_scorer(term_id);
+        for (auto&& [docid, freq]: ranges::views::zip(seq.docs, seq.freqs)) {
+            if (deleted[docid]) {
+                continue;
+            }
+            float score = s(docid, freq);
+            w.next_geq(docid);
+            REQUIRE(w.score() >= score);
+            REQUIRE(live_wdata.max_term_weight(term_id) >= score);
+        }
+        term_id += 1;
+    }
+    REQUIRE(lowered > 0);
+}
+
+TEST_CASE("Lists built in parallel are stored in term order")
+{
+    binary_freq_collection const collection(PISA_SOURCE_DIR "/test/test_data/test_collection");
+    binary_collection document_sizes(PISA_SOURCE_DIR "/test/test_data/test_collection.sizes");
+    std::unordered_set<size_t> dropped_term_ids{1, 7, 100};
+    float lambda = 12.0;
+    wand_data<wand_data_raw> wdata(
+        document_sizes.begin()->begin(),
+        collection.num_docs(),
+        collection,
+        "bm25",
+        BlockSize(VariableBlock(lambda)),
+        false,
+        dropped_term_ids);
+    auto scorer = scorer::from_name("bm25", wdata);
+
+    size_t term_id = 0;
+    size_t new_term_id = 0;
+    for (auto const& seq: collection) {
+        if (dropped_term_ids.find(term_id) != dropped_term_ids.end()) {
+            term_id += 1;
+            continue;
+        }
+        CAPTURE(term_id);
+        REQUIRE(wdata.term_posting_count(new_term_id) == seq.docs.size());
+        auto [block_docids, block_scores] = variable_block_partition(
+            collection, seq, scorer->term_scorer(new_term_id), lambda);
+        REQUIRE(
+            wdata.max_term_weight(new_term_id)
+            == *std::max_element(block_scores.begin(), block_scores.end()));
+        auto w = wdata.getenum(new_term_id);
+        for (size_t block = 0; block < block_docids.size(); ++block) {
+            REQUIRE(w.docid() == block_docids[block]);
+            REQUIRE(w.score() == block_scores[block]);
+            w.next_geq(block_docids[block] + 1);
+        }
+        term_id += 1;
+        new_term_id += 1;
+    }
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <limits>
+#include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <thread>
 
@@ -10,6 +13,8 @@
 
 #include "io.hpp"
 #include "query/queries.hpp"
+#include "query/query_budget.hpp"
+#include "query/result_cache.hpp"
 
 namespace pisa {
 
@@ -84,14 +89,22 @@ namespace arg {
 
         [[nodiscard]] auto queries() const -> std::vector<::pisa::Query>
         {
-            std::vector<::pisa::Query> q;
-            auto parse_query = resolve_query_parser(q, m_term_lexicon, m_stop_words, m_stemmer);
             if (m_query_file) {
-                std::ifstream is(*m_query_file);
-                io::for_each_line(is, parse_query);
-            } else {
-                io::for_each_line(std::cin, parse_query);
+                return queries(*m_query_file);
             }
+            std::vector<::pisa::Query> q;
+            auto parse_query = resolve_query_parser(q, m_term_lexicon, m_stop_words, m_stemmer);
+            io::for_each_line(std::cin, parse_query);
+            return q;
+        }
+
+        /// Parses the queries in `filename` the same way as those of the query file.
+        [[nodiscard]] auto queries(std::string const& filename) const -> std::vector<::pisa::Query>
+        {
+            std::vector<::pisa::Query> q;
+            auto parse_query = resolve_query_parser(q, m_term_lexicon, m_stop_words, m_stemmer);
+            std::ifstream is(filename);
+            io::for_each_line(is, parse_query);
             return q;
         }
 
@@ -167,6 +180,159 @@ namespace arg {
         CLI::Option* m_option;
     };
 
+    struct ImpactIndex {
+        explicit ImpactIndex(CLI::App* app)
+        {
+            auto* index = app->add_option(
+                "--impact-index", m_impact_index, "Impact-ordered index filename (used by saat)");
+            app->add_option(
+                   "--postings-budget",
+                   m_postings_budget,
+                   "Maximum number of postings processed per query by saat")
+                ->needs(index);
+        }
+
+        [[nodiscard]] auto impact_index_filename() const -> std::optional<std::string> const&
+        {
+            return m_impact_index;
+        }
+        [[nodiscard]] auto postings_budget() const -> std::uint64_t { return m_postings_budget; }
+
+      private:
+        std::optional<std::string> m_impact_index;
+        std::uint64_t m_postings_budget = std::numeric_limits<std::uint64_t>::max();
+    };
+
+    struct BlockMaxScores {
+        explicit BlockMaxScores(CLI::App* app)
+        {
+            app->add_flag(
+                "--block-max-scores",
+                m_block_max_scores,
+                "Read block-max scores embedded in the index (see create_freq_index)");
+        }
+
+        [[nodiscard]] auto block_max_scores() const -> bool { return m_block_max_scores; }
+
+      private:
+        bool m_block_max_scores = false;
+    };
+
+    struct PairIndex {
+        explicit PairIndex(CLI::App* app)
+        {
+            app->add_option(
+                "--pair-index",
+                m_pair_index,
+                "Pair index filename, used by ranked_and and block_max_ranked_and "
+                "(see create_pair_index)");
+        }
+
+        [[nodiscard]] auto pair_index_filename() const -> std::optional<std::string> const&
+        {
+            return m_pair_index;
+        }
+
+      private:
+        std::optional<std::string> m_pair_index;
+    };
+
+    struct DeletedDocuments {
+        explicit DeletedDocuments(CLI::App* app)
+        {
+            app->add_option(
+                "--deleted-docs",
+                m_deleted_docs,
+                "Deleted documents skipped by ranked queries (see delete_documents)");
+        }
+
+        [[nodiscard]] auto deleted_documents_filename() const
+            -> std::optional<std::string> const&
+        {
+            return m_deleted_docs;
+        }
+
+      private:
+        std::optional<std::string> m_deleted_docs;
+    };
+
+    struct ResultCache {
+        explicit ResultCache(CLI::App* app)
+        {
+            auto* size = app->add_option(
+                "--cache-size", m_cache_size, "Memory budget of the result cache in bytes");
+            app->add_option(
+                   "--cache-policy",
+                   m_cache_policy,
+                   "Eviction policy of the result cache: lru or sdc (static-dynamic)",
+                   true)
+                ->needs(size);
+            app->add_option(
+                   "--cache-static-fraction",
+                   m_static_fraction,
+                   "Fraction of the SDC cache holding the most frequent queries",
+                   true)
+                ->needs(size);
+            app->add_option(
+                   "--cache-static-queries",
+                   m_static_queries,
+                   "Query log whose most frequent queries fill the static part of the SDC cache")
+                ->needs(size);
+        }
+
+        /// Returns the result cache requested on the command line, if any. The static part of
+        /// an SDC cache must still be filled with `ResultCache::fill_static`.
+        [[nodiscard]] auto result_cache() const -> std::unique_ptr<::pisa::ResultCache>
+        {
+            if (m_cache_size == 0) {
+                return nullptr;
+            }
+            if (m_cache_policy != "lru" && m_cache_policy != "sdc") {
+                throw std::invalid_argument("Unknown cache policy: " + m_cache_policy);
+            }
+            auto policy = m_cache_policy == "sdc" ? CachePolicy::SDC : CachePolicy::LRU;
+            return std::make_unique<::pisa::ResultCache>(m_cache_size, policy, m_static_fraction);
+        }
+
+        [[nodiscard]] auto cache_static_queries() const -> std::optional<std::string> const&
+        {
+            return m_static_queries;
+        }
+
+      private:
+        std::size_t m_cache_size = 0;
+        std::string m_cache_policy = "lru";
+        double m_static_fraction = 0.5;
+        std::optional<std::string> m_static_queries;
+    };
+
+    struct QueryBudget {
+        explicit QueryBudget(CLI::App* app)
+        {
+            app->add_option(
+                "--time-budget",
+                m_time_budget,
+                "Time in microseconds after which ranked queries stop with partial results");
+            app->add_option(
+                "--work-budget",
+                m_work_budget,
+                "Number of postings after which ranked queries stop with partial results");
+        }
+
+        [[nodiscard]] auto query_budget() const -> ::pisa::QueryBudget
+        {
+            if (m_time_budget) {
+                return ::pisa::QueryBudget(
+                    std::chrono::microseconds(*m_time_budget), m_work_budget);
+            }
+            return ::pisa::QueryBudget(m_work_budget);
+        }
+
+      private:
+        std::optional<std::uint64_t> m_time_budget;
+        std::uint64_t m_work_budget = ::pisa::QueryBudget::unlimited;
+    };
+
     struct Threads {
         explicit Threads(CLI::App* app)
         {
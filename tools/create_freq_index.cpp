@@ -72,7 +72,17 @@ void create_collection(
     spdlog::info("Processing {} documents", input.num_docs());
     double tick = get_time_usecs();
 
-    typename CollectionType::builder builder(input.num_docs(), params);
+    auto builder = [&]() {
+        if constexpr (has_block_max_scores<CollectionType>::value) {
+            // Quantized block-max scores are queried with the quantized scorer.
+            return typename CollectionType::builder(
+                input.num_docs(),
+                params,
+                quantized ? std::string("quantized") : scorer::describe<WandType>(*scorer_name));
+        } else {
+            return typename CollectionType::builder(input.num_docs(), params);
+        }
+    }();
     size_t postings = 0;
     {
         pisa::progress progress("Create index", input.size());
@@ -95,6 +105,7 @@ void create_collection(
         }
 
         size_t term_id = 0;
+        std::vector<float> scores;
         for (auto const& plist: input) {
             size_t size = plist.docs.size();
             if (quantized) {
@@ -112,11 +123,29 @@ void create_collection(
                 assert(quants.size() == size);
                 uint64_t quants_sum =
                     std::accumulate(quants.begin(), quants.begin() + quants.size(), uint64_t(0));
-                builder.add_posting_list(size, plist.docs.begin(), quants.begin(), quants_sum);
+                if constexpr (has_block_max_scores<CollectionType>::value) {
+                    // The quantized scores are the block-max scores.
+                    builder.add_posting_list(
+                        size, plist.docs.begin(), quants.begin(), quants.begin(), quants_sum);
+                } else {
+                    builder.add_posting_list(size, plist.docs.begin(), quants.begin(), quants_sum);
+                }
             } else {
                 uint64_t freqs_sum =
                     std::accumulate(plist.freqs.begin(), plist.freqs.begin() + size, uint64_t(0));
-                builder.add_posting_list(size, plist.docs.begin(), plist.freqs.begin(), freqs_sum);
+                if constexpr (has_block_max_scores<CollectionType>::value) {
+                    auto term_scorer = scorer->term_scorer(term_id);
+                    scores.clear();
+                    for (size_t pos = 0; pos < size; ++pos) {
+                        scores.push_back(
+                            term_scorer(*(plist.docs.begin() + pos), *(plist.freqs.begin() + pos)));
+                    }
+                    builder.add_posting_list(
+                        size, plist.docs.begin(), plist.freqs.begin(), scores.begin(), freqs_sum);
+                } else {
+                    builder.add_posting_list(
+                        size, plist.docs.begin(), plist.freqs.begin(), freqs_sum);
+                }
             }
 
             progress.update(1);
@@ -158,17 +187,51 @@ int main(int argc, char** argv)
     std::string input_basename;
     std::optional<std::string> output_filename;
     bool check = false;
+    bool block_max_scores = false;
 
     App<arg::Encoding, arg::Quantize> app{"Compresses an inverted index"};
     app.add_option("-c,--collection", input_basename, "Collection basename")->required();
     app.add_option("-o,--output", output_filename, "Output filename")->required();
     app.add_flag("--check", check, "Check the correctness of the index");
+    app.add_flag(
+        "--block-max-scores",
+        block_max_scores,
+        "Embed block-max scores in the posting lists of a block index (requires a scorer)");
     CLI11_PARSE(app, argc, argv);
 
+    if (block_max_scores and not app.scorer()) {
+        spdlog::error("Block-max scores require a scorer (--scorer)");
+        return 1;
+    }
+
     binary_freq_collection input(input_basename.c_str());
 
     pisa::global_parameters params;
 
+    if (block_max_scores) {
+        if (false) {
+#define LOOP_BODY(R, DATA, T)                                                                \
+    }                                                                                        \
+    else if (app.index_encoding() == BOOST_PP_STRINGIZE(T))                                  \
+    {                                                                                        \
+        create_collection<with_block_max_scores_t<BOOST_PP_CAT(T, _index)>, wand_raw_index>( \
+            input,                                                                           \
+            params,                                                                          \
+            output_filename,                                                                 \
+            check,                                                                           \
+            app.index_encoding(),                                                            \
+            app.wand_data_path(),                                                            \
+            app.scorer(),                                                                    \
+            app.quantize());                                                                 \
+        /**/
+            BOOST_PP_SEQ_FOR_EACH(LOOP_BODY, _, PISA_BLOCK_INDEX_TYPES);
+#undef LOOP_BODY
+        } else {
+            spdlog::error("Block-max scores are not supported by type {}", app.index_encoding());
+        }
+        return 0;
+    }
+
     if (false) {
 #define LOOP_BODY(R, DATA, T)                                       \
     }                                                               \
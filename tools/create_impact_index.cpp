@@ -0,0 +1,93 @@
+#include <numeric>
+#include <optional>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "binary_freq_collection.hpp"
+#include "configuration.hpp"
+#include "impact_ordered_index.hpp"
+#include "linear_quantizer.hpp"
+#include "mappable/mapper.hpp"
+#include "scorer/scorer.hpp"
+#include "util/progress.hpp"
+#include "util/util.hpp"
+#include "wand_data.hpp"
+#include "wand_data_raw.hpp"
+
+#include "CLI/CLI.hpp"
+
+using namespace pisa;
+
+using wand_raw_index = wand_data<wand_data_raw>;
+
+int main(int argc, char** argv)
+{
+    spdlog::drop("");
+    spdlog::set_default_logger(spdlog::stderr_color_mt(""));
+
+    std::string input_basename;
+    std::string output_filename;
+    std::string wand_data_filename;
+    std::string scorer_name;
+
+    CLI::App app{"Creates an impact-ordered index for score-at-a-time query processing"};
+    app.add_option("-c,--collection", input_basename, "Collection basename")->required();
+    app.add_option("-o,--output", output_filename, "Output filename")->required();
+    app.add_option("-w,--wand", wand_data_filename, "WAND data filename")->required();
+    app.add_option("-s,--scorer", scorer_name, "Scorer function")->required();
+    CLI11_PARSE(app, argc, argv);
+
+    binary_freq_collection input(input_basename.c_str());
+    spdlog::info("Processing {} documents", input.num_docs());
+    double tick = get_time_usecs();
+
+    wand_raw_index wdata;
+    mio::mmap_source md;
+    std::error_code error;
+    md.map(wand_data_filename, error);
+    if (error) {
+        spdlog::error("error mapping file: {}, exiting...", error.message());
+        std::abort();
+    }
+    mapper::map(wdata, md, mapper::map_flags::warmup);
+
+    auto scorer = scorer::from_name(scorer_name, wdata);
+    LinearQuantizer quantizer(wdata.index_max_term_weight(), configuration::get().quantization_bits);
+
+    pisa::global_parameters params;
+    impact_ordered_index::builder builder(input.num_docs(), params);
+    size_t postings = 0;
+    {
+        pisa::progress progress("Create index", input.size());
+        size_t term_id = 0;
+        std::vector<uint32_t> impacts;
+        for (auto const& plist: input) {
+            size_t size = plist.docs.size();
+            auto term_scorer = scorer->term_scorer(term_id);
+            impacts.clear();
+            for (size_t pos = 0; pos < size; ++pos) {
+                uint64_t doc = *(plist.docs.begin() + pos);
+                uint64_t freq = *(plist.freqs.begin() + pos);
+                impacts.push_back(quantizer(term_scorer(doc, freq)));
+            }
+            builder.add_posting_list(size, plist.docs.begin(), impacts.begin());
+            progress.update(1);
+            postings += size;
+            term_id += 1;
+        }
+    }
+
+    impact_ordered_index index;
+    builder.build(index);
+    double elapsed_secs = (get_time_usecs() - tick) / 1000000;
+    spdlog::info("Impact-ordered index built in {} seconds", elapsed_secs);
+
+    stats_line()("type", "impact_ordered")("construction_time", elapsed_secs)(
+        "postings", postings)("segments", index.num_segments())(
+        "segments_per_term", double(index.num_segments()) / index.size());
+
+    mapper::freeze(index, output_filename.c_str());
+    return 0;
+}
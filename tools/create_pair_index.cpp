@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <CLI/CLI.hpp>
+#include <mio/mmap.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "app.hpp"
+#include "index_types.hpp"
+#include "mappable/mapper.hpp"
+#include "pair_index.hpp"
+#include "scorer/scorer.hpp"
+#include "util/util.hpp"
+#include "wand_data.hpp"
+#include "wand_data_raw.hpp"
+
+using namespace pisa;
+
+using term_pair = std::pair<term_id_type, term_id_type>;
+
+/// Counts the queries containing each pair of distinct terms.
+auto count_pairs(std::vector<Query> const& queries) -> std::map<term_pair, std::size_t>
+{
+    std::map<term_pair, std::size_t> counts;
+    for (auto const& query: queries) {
+        auto terms = query.terms;
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+        for (std::size_t i = 0; i < terms.size(); ++i) {
+            for (std::size_t j = i + 1; j < terms.size(); ++j) {
+                counts[{terms[i], terms[j]}] += 1;
+            }
+        }
+    }
+    return counts;
+}
+
+template <typename IndexType, typename WandType>
+void create_pair_index(
+    std::string const& index_filename,
+    std::string const& wand_data_filename,
+    std::vector<Query> const& queries,
+    std::string const& scorer_name,
+    std::size_t min_frequency,
+    std::size_t max_pairs,
+    std::uint64_t max_postings,
+    std::uint64_t block_size,
+    std::string const& output_filename)
+{
+    IndexType index;
+    spdlog::info("Loading index from {}", index_filename);
+    mio::mmap_source m(index_filename.c_str());
+    mapper::map(index, m);
+
+    WandType wdata;
+    mio::mmap_source md(wand_data_filename.c_str());
+    mapper::map(wdata, md, mapper::map_flags::warmup);
+
+    std::vector<std::pair<std::size_t, term_pair>> candidates;
+    for (auto const& [pair, count]: count_pairs(queries)) {
+        if (count >= min_frequency && pair.second < index.size()) {
+            candidates.emplace_back(count, pair);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [](auto const& lhs, auto const& rhs) {
+        return lhs.first > rhs.first;
+    });
+    spdlog::info("{} pairs occur in at least {} queries", candidates.size(), min_frequency);
+
+    // Intersects the most frequent pairs until one of the budgets is exhausted.
+    struct pair_list {
+        std::vector<std::uint64_t> docs;
+        std::vector<std::uint64_t> freqs;
+        std::vector<float> scores;
+    };
+    std::map<term_pair, pair_list> lists;
+    std::uint64_t postings = 0;
+    std::size_t skipped = 0;
+    std::size_t too_large = 0;
+    auto scorer = scorer::from_name(scorer_name, wdata);
+    for (auto const& [count, pair]: candidates) {
+        if (lists.size() == max_pairs || postings == max_postings) {
+            break;
+        }
+        auto first = index[pair.first];
+        auto second = index[pair.second];
+        auto first_scorer = scorer->term_scorer(pair.first);
+        auto second_scorer = scorer->term_scorer(pair.second);
+        pair_list list;
+        bool overflow = false;
+        while (first.docid() < index.num_docs()) {
+            second.next_geq(first.docid());
+            if (second.docid() == first.docid()) {
+                auto docid = first.docid();
+                auto packed = pack_freqs(first.freq(), second.freq());
+                overflow = overflow || packed > std::numeric_limits<std::uint32_t>::max();
+                list.docs.push_back(docid);
+                list.freqs.push_back(packed);
+                list.scores.push_back(
+                    first_scorer(docid, first.freq()) + second_scorer(docid, second.freq()));
+                first.next();
+            } else {
+                first.next_geq(second.docid());
+            }
+        }
+        if (overflow || list.docs.empty()) {
+            skipped += 1;
+            continue;
+        }
+        // A later, less frequent pair may still fit in the remaining budget.
+        if (postings + list.docs.size() > max_postings) {
+            too_large += 1;
+            continue;
+        }
+        postings += list.docs.size();
+        lists.emplace(pair, std::move(list));
+    }
+    if (skipped > 0) {
+        spdlog::info("Skipped {} pairs with no common documents or too large frequencies", skipped);
+    }
+    if (too_large > 0) {
+        spdlog::info("Skipped {} pairs exceeding the remaining postings budget", too_large);
+    }
+
+    spdlog::info("Building pair index with {} pairs and {} postings", lists.size(), postings);
+    typename pair_index<IndexType>::builder builder(
+        index.num_docs(), global_parameters(), scorer::describe<WandType>(scorer_name));
+    for (auto const& [pair, list]: lists) {
+        builder.add_pair(
+            pair.first,
+            pair.second,
+            list.docs.size(),
+            list.docs.begin(),
+            list.freqs.begin(),
+            list.scores.begin(),
+            block_size);
+    }
+    pair_index<IndexType> pairs;
+    builder.build(pairs);
+    auto bytes = mapper::freeze(pairs, output_filename.c_str());
+    stats_line()("pairs", lists.size())("postings", postings)("bytes", bytes);
+}
+
+using wand_raw_index = wand_data<wand_data_raw>;
+
+int main(int argc, const char** argv)
+{
+    spdlog::drop("");
+    spdlog::set_default_logger(spdlog::stderr_color_mt(""));
+
+    std::string scorer_name;
+    std::string output_filename;
+    std::size_t min_frequency = 2;
+    std::size_t max_pairs = std::numeric_limits<std::size_t>::max();
+    std::uint64_t max_postings = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t block_size = 64;
+
+    App<arg::Index, arg::WandData, arg::Query<arg::QueryMode::Unranked>> app{
+        "Materializes the intersections of the term pairs most frequent in a query log."};
+    app.add_option("-s,--scorer", scorer_name, "Scorer used for the max scores")->required();
+    app.add_option("-o,--output", output_filename, "Output pair index filename")->required();
+    app.add_option(
+        "--min-frequency", min_frequency, "Minimum number of queries containing a pair", true);
+    app.add_option("--max-pairs", max_pairs, "Maximum number of pairs");
+    app.add_option("--max-postings", max_postings, "Maximum number of postings of all pairs");
+    app.add_option("--block-size", block_size, "Number of postings per block-max score", true);
+    CLI11_PARSE(app, argc, argv);
+
+    if (not app.wand_data_path()) {
+        spdlog::error("Pair index requires WAND data (--wand)");
+        return 1;
+    }
+    if (app.is_wand_compressed()) {
+        spdlog::error("Pair index requires uncompressed WAND data");
+        return 1;
+    }
+
+    auto params = std::make_tuple(
+        app.index_filename(),
+        *app.wand_data_path(),
+        app.queries(),
+        scorer_name,
+        min_frequency,
+        max_pairs,
+        max_postings,
+        block_size,
+        output_filename);
+
+    /**/
+    if (false) {
+#define LOOP_BODY(R, DATA, T)                                                           \
+    }                                                                                   \
+    else if (app.index_encoding() == BOOST_PP_STRINGIZE(T))                             \
+    {                                                                                   \
+        std::apply(create_pair_index<BOOST_PP_CAT(T, _index), wand_raw_index>, params); \
+        /**/
+
+        BOOST_PP_SEQ_FOR_EACH(LOOP_BODY, _, PISA_INDEX_TYPES);
+#undef LOOP_BODY
+
+    } else {
+        spdlog::error("Unknown type {}", app.index_encoding());
+    }
+}
@@ -1,12 +1,16 @@
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <thread>
 #include <unordered_set>
 
 #include "boost/variant.hpp"
 #include "spdlog/spdlog.h"
+#include "tbb/task_scheduler_init.h"
 
 #include "binary_collection.hpp"
 #include "binary_freq_collection.hpp"
+#include "deleted_documents.hpp"
 #include "mappable/mapper.hpp"
 #include "util/util.hpp"
 #include "wand_data.hpp"
@@ -28,7 +32,11 @@ int main(int argc, const char** argv)
     bool compress = false;
     bool range = false;
     bool quantize = false;
+    uint64_t doc_norm_bits = 0;
     std::string terms_to_drop_filename;
+    std::optional<std::string> deleted_docs_filename;
+    double min_deleted_fraction = 0.1;
+    std::size_t threads = std::thread::hardware_concurrency();
 
     CLI::App app{"create_wand_data - a tool for creating additional data for query processing."};
     app.add_option("-c,--collection", input_basename, "Collection basename")->required();
@@ -47,13 +55,32 @@ int main(int argc, const char** argv)
     app.add_flag("--range", range, "Create docid-range based data")
         ->excludes(block_size_opt)
         ->excludes(block_lambda_opt);
+    app.add_option(
+        "--doc-norm-bits",
+        doc_norm_bits,
+        "Bits of precomputed BM25 document length normalizations: 8, 16, 32 (float), or 0 (none)",
+        true);
     app.add_option(
         "--terms-to-drop",
         terms_to_drop_filename,
         "A filename containing a list of term IDs that we want to drop");
+    auto deleted_docs_opt = app.add_option(
+        "--deleted-docs",
+        deleted_docs_filename,
+        "Deleted documents excluded from the bounds of heavily-deleted lists");
+    app.add_option(
+           "--min-deleted-fraction",
+           min_deleted_fraction,
+           "Fraction of deleted documents above which the bounds of a list exclude them",
+           true)
+        ->needs(deleted_docs_opt);
+    app.add_option("-j,--threads", threads, "Thread count");
 
     CLI11_PARSE(app, argc, argv);
 
+    tbb::task_scheduler_init init(threads);
+    spdlog::info("Number of threads: {}", threads);
+
     std::string partition_type_name = (lambda) ? "variable partition" : "static partition";
     spdlog::info("Block based wand creation with {}", partition_type_name);
 
@@ -69,6 +96,13 @@ int main(int argc, const char** argv)
 
     spdlog::info("Dropping {} terms", dropped_term_ids.size());
 
+    std::optional<Deleted_Documents> deleted_documents;
+    if (deleted_docs_filename) {
+        deleted_documents.emplace(*deleted_docs_filename, coll.num_docs());
+        spdlog::info("Deleted documents: {}", deleted_count(deleted_documents->bits()));
+    }
+    bit_vector const* deleted = deleted_documents ? &deleted_documents->bits() : nullptr;
+
     auto const block_size = [&]() -> BlockSize {
         if (lambda) {
             spdlog::info("Lambda {}", *lambda);
@@ -87,7 +121,10 @@ int main(int argc, const char** argv)
             scorer_name,
             block_size,
             quantize,
-            dropped_term_ids);
+            dropped_term_ids,
+            doc_norm_bits,
+            deleted,
+            min_deleted_fraction);
         mapper::freeze(wdata, output_filename.c_str());
     } else if (range) {
         wand_data<wand_data_range<128, 1024>> wdata(
@@ -97,7 +134,10 @@ int main(int argc, const char** argv)
             scorer_name,
             block_size,
             quantize,
-            dropped_term_ids);
+            dropped_term_ids,
+            doc_norm_bits,
+            deleted,
+            min_deleted_fraction);
         mapper::freeze(wdata, output_filename.c_str());
     } else {
         wand_data<wand_data_raw> wdata(
@@ -107,7 +147,10 @@ int main(int argc, const char** argv)
             scorer_name,
             block_size,
             quantize,
-            dropped_term_ids);
+            dropped_term_ids,
+            doc_norm_bits,
+            deleted,
+            min_deleted_fraction);
         mapper::freeze(wdata, output_filename.c_str());
     }
 }
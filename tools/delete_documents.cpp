@@ -0,0 +1,121 @@
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <CLI/CLI.hpp>
+#include <mio/mmap.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "bit_vector.hpp"
+#include "deleted_documents.hpp"
+#include "io.hpp"
+#include "mappable/mapper.hpp"
+#include "payload_vector.hpp"
+
+using namespace pisa;
+
+int main(int argc, char** argv)
+{
+    spdlog::set_default_logger(spdlog::stderr_color_mt("default"));
+
+    std::string output_filename;
+    std::optional<std::uint64_t> num_docs;
+    std::optional<std::string> documents_filename;
+    std::optional<std::string> previous_filename;
+    std::optional<std::string> input_filename;
+
+    CLI::App app{"Marks documents of an index as deleted without rebuilding it"};
+    app.add_option("-o,--output", output_filename, "Output file of the deleted documents")
+        ->required();
+    auto* num_docs_opt =
+        app.add_option("-n,--num-docs", num_docs, "Number of documents of the index");
+    app.add_option(
+           "--documents",
+           documents_filename,
+           "Document lexicon: documents to delete are given by title instead of ID")
+        ->excludes(num_docs_opt);
+    app.add_option("--deleted", previous_filename, "Previously deleted documents to extend");
+    app.add_option("-i,--input", input_filename, "Documents to delete, one per line (or stdin)");
+    CLI11_PARSE(app, argc, argv);
+
+    std::unique_ptr<mio::mmap_source> documents_source;
+    std::optional<Payload_Vector<>> documents;
+    if (documents_filename) {
+        documents_source = std::make_unique<mio::mmap_source>(documents_filename->c_str());
+        documents = Payload_Vector<>::from(*documents_source);
+        num_docs = documents->size();
+    }
+
+    std::unique_ptr<mio::mmap_source> previous_source;
+    bit_vector previous;
+    if (previous_filename) {
+        previous_source = std::make_unique<mio::mmap_source>(previous_filename->c_str());
+        mapper::map(previous, *previous_source);
+        if (num_docs && *num_docs != previous.size()) {
+            spdlog::error(
+                "Previously deleted documents of {} documents but the index has {}",
+                previous.size(),
+                *num_docs);
+            return 1;
+        }
+        num_docs = previous.size();
+    }
+    if (not num_docs) {
+        spdlog::error("Pass --num-docs, --documents, or --deleted to set the number of documents");
+        return 1;
+    }
+
+    bit_vector_builder deleted(*num_docs);
+    for (std::uint64_t docid = 0; docid < previous.size(); ++docid) {
+        if (previous[docid]) {
+            deleted.set(docid, true);
+        }
+    }
+
+    std::unordered_map<std::string_view, std::uint64_t> docids;
+    if (documents) {
+        docids.reserve(documents->size());
+        std::uint64_t docid = 0;
+        for (auto title: *documents) {
+            docids.emplace(title, docid++);
+        }
+    }
+
+    std::uint64_t requested = 0;
+    std::uint64_t not_found = 0;
+    auto delete_document = [&](std::string const& line) {
+        if (line.empty()) {
+            return;
+        }
+        requested += 1;
+        if (documents) {
+            if (auto pos = docids.find(line); pos != docids.end()) {
+                deleted.set(pos->second, true);
+                return;
+            }
+        } else if (auto docid = std::stoull(line); docid < *num_docs) {
+            deleted.set(docid, true);
+            return;
+        }
+        spdlog::warn("Document not found: {}", line);
+        not_found += 1;
+    };
+    if (input_filename) {
+        std::ifstream is(*input_filename);
+        io::for_each_line(is, delete_document);
+    } else {
+        io::for_each_line(std::cin, delete_document);
+    }
+
+    bit_vector bits(&deleted);
+    auto count = deleted_count(bits);
+    spdlog::info("Requested deletions: {} ({} not found)", requested, not_found);
+    spdlog::info("Deleted documents: {} out of {}", count, *num_docs);
+    mapper::freeze(bits, output_filename.c_str());
+    return 0;
+}
@@ -1,3 +1,5 @@
+#include <array>
+#include <fstream>
 #include <iostream>
 #include <optional>
 #include <thread>
@@ -11,25 +13,46 @@
 #include <range/v3/view/enumerate.hpp>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
+#include <tbb/enumerable_thread_specific.h>
 #include <tbb/parallel_for.h>
 #include <tbb/task_scheduler_init.h>
 
 #include "accumulator/lazy_accumulator.hpp"
 #include "app.hpp"
 #include "cursor/block_max_scored_cursor.hpp"
+#include "cursor/impact_cursor.hpp"
 #include "cursor/max_scored_cursor.hpp"
+#include "cursor/pair_cursor.hpp"
 #include "cursor/scored_cursor.hpp"
+#include "deleted_documents.hpp"
+#include "front_coded_vector.hpp"
+#include "impact_ordered_index.hpp"
 #include "index_types.hpp"
 #include "io.hpp"
+#include "pair_index.hpp"
 #include "query/algorithm.hpp"
+#include "query/algorithm_selector.hpp"
+#include "query/query_context.hpp"
+#include "query/result_cache.hpp"
 #include "scorer/scorer.hpp"
+#include "util/allocation_counter.hpp"
+#include "util/query_counters.hpp"
 #include "util/util.hpp"
 #include "wand_data_compressed.hpp"
 #include "wand_data_raw.hpp"
 
+PISA_COUNT_ALLOCATIONS()
+
 using namespace pisa;
 using ranges::views::enumerate;
 
+/// Returns per-thread copies of `context`, created the first time each thread uses them.
+template <typename Context>
+auto per_thread(Context context)
+{
+    return tbb::enumerable_thread_specific<Context>(std::move(context));
+}
+
 template <typename IndexType, typename WandType>
 void evaluate_queries(
     const std::string& index_filename,
@@ -42,15 +65,31 @@ void evaluate_queries(
     std::string const& documents_filename,
     std::string const& scorer_name,
     std::string const& run_id,
-    std::string const& iteration)
+    std::string const& iteration,
+    std::optional<std::string> const& impact_index_filename,
+    uint64_t postings_budget,
+    std::optional<std::string> const& trace_filename,
+    ResultCache* cache,
+    std::vector<Query> const& cache_static_queries,
+    std::optional<std::string> const& pair_index_filename,
+    std::optional<std::string> const& deleted_docs_filename,
+    std::optional<std::string> const& algorithm_model_filename)
 {
     IndexType index;
     mio::mmap_source m(index_filename.c_str());
     mapper::map(index, m);
+    if constexpr (has_block_max_scores<IndexType>::value) {
+        index.check_scorer(scorer::describe<WandType>(scorer_name));
+    }
 
-    WandType wdata;
+    std::optional<Deleted_Documents> deleted_documents;
+    if (deleted_docs_filename) {
+        deleted_documents.emplace(*deleted_docs_filename, index.num_docs());
+        spdlog::info("Deleted documents: {}", deleted_count(deleted_documents->bits()));
+    }
+    bit_vector const* deleted = deleted_documents ? &deleted_documents->bits() : nullptr;
 
-    auto scorer = scorer::from_name(scorer_name, wdata);
+    WandType wdata;
 
     mio::mmap_source md;
     if (wand_data_filename) {
@@ -63,98 +102,377 @@ void evaluate_queries(
         mapper::map(wdata, md, mapper::map_flags::warmup);
     }
 
-    std::function<std::vector<std::pair<float, uint64_t>>(Query)> query_fun;
+    impact_ordered_index impact_index;
+    mio::mmap_source mi;
+    if (impact_index_filename) {
+        std::error_code error;
+        mi.map(*impact_index_filename, error);
+        if (error) {
+            spdlog::error("error mapping file: {}, exiting...", error.message());
+            std::abort();
+        }
+        mapper::map(impact_index, mi);
+    }
 
-    if (query_type == "wand" && wand_data_filename) {
-        query_fun = [&](Query query) {
-            topk_queue topk(k);
-            wand_query wand_q(topk);
-            wand_q(make_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "block_max_wand" && wand_data_filename) {
-        query_fun = [&](Query query) {
-            topk_queue topk(k);
-            block_max_wand_query block_max_wand_q(topk);
-            block_max_wand_q(
-                make_block_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "block_max_maxscore" && wand_data_filename) {
-        query_fun = [&](Query query) {
-            topk_queue topk(k);
-            block_max_maxscore_query block_max_maxscore_q(topk);
-            block_max_maxscore_q(
-                make_block_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "block_max_ranked_and" && wand_data_filename) {
-        query_fun = [&](Query query) {
-            topk_queue topk(k);
-            block_max_ranked_and_query block_max_ranked_and_q(topk);
-            block_max_ranked_and_q(
-                make_block_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "ranked_and" && wand_data_filename) {
-        query_fun = [&](Query query) {
-            topk_queue topk(k);
-            ranked_and_query ranked_and_q(topk);
-            ranked_and_q(make_scored_cursors(index, *scorer, query), index.num_docs());
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "ranked_or" && wand_data_filename) {
-        query_fun = [&](Query query) {
-            topk_queue topk(k);
-            ranked_or_query ranked_or_q(topk);
-            ranked_or_q(make_scored_cursors(index, *scorer, query), index.num_docs());
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "maxscore" && wand_data_filename) {
-        query_fun = [&](Query query) {
-            topk_queue topk(k);
-            maxscore_query maxscore_q(topk);
-            maxscore_q(make_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "ranked_or_taat" && wand_data_filename) {
-        query_fun = [&, accumulator = Simple_Accumulator(index.num_docs())](Query query) mutable {
-            topk_queue topk(k);
-            ranked_or_taat_query ranked_or_taat_q(topk);
-            ranked_or_taat_q(
-                make_scored_cursors(index, *scorer, query), index.num_docs(), accumulator);
-            topk.finalize();
-            return topk.topk();
-        };
-    } else if (query_type == "ranked_or_taat_lazy" && wand_data_filename) {
-        query_fun = [&, accumulator = Lazy_Accumulator<4>(index.num_docs())](Query query) mutable {
-            topk_queue topk(k);
-            ranked_or_taat_query ranked_or_taat_q(topk);
-            ranked_or_taat_q(
-                make_scored_cursors(index, *scorer, query), index.num_docs(), accumulator);
-            topk.finalize();
-            return topk.topk();
+    pair_index<IndexType> pairs;
+    mio::mmap_source mp;
+    if (pair_index_filename) {
+        std::error_code error;
+        mp.map(*pair_index_filename, error);
+        if (error) {
+            spdlog::error("error mapping file: {}, exiting...", error.message());
+            std::abort();
+        }
+        mapper::map(pairs, mp);
+        pairs.check_scorer(scorer::describe<WandType>(scorer_name));
+    }
+
+    std::optional<AlgorithmSelector> selector;
+    if (algorithm_model_filename) {
+        spdlog::info("Loading algorithm selector from {}", *algorithm_model_filename);
+        std::ifstream model(*algorithm_model_filename);
+        selector = AlgorithmSelector::read(model);
+    }
+
+    mio::mmap_source documents_source(documents_filename.c_str());
+    auto documents = gsl::make_span(
+        reinterpret_cast<std::byte const*>(documents_source.data()), documents_source.size());
+    std::function<std::string(std::uint64_t)> docmap;
+    if (Front_Coded_Vector::is_front_coded(documents)) {
+        docmap = [titles = Front_Coded_Vector::from(documents)](auto docid) {
+            return titles[docid];
         };
     } else {
-        spdlog::error("Unsupported query type: {}", query_type);
+        docmap = [titles = Payload_Vector<>::from(documents)](auto docid) {
+            return std::string(titles[docid]);
+        };
     }
 
-    auto source = std::make_shared<mio::mmap_source>(documents_filename.c_str());
-    auto docmap = Payload_Vector<>::from(*source);
-
     std::vector<std::vector<std::pair<float, uint64_t>>> raw_results(queries.size());
+    std::vector<std::pair<std::int64_t, query_counters>> traces(
+        trace_filename ? queries.size() : 0);
+    std::vector<std::pair<bool, std::int64_t>> cache_lookups(cache != nullptr ? queries.size() : 0);
     auto start_batch = std::chrono::steady_clock::now();
-    tbb::parallel_for(size_t(0), queries.size(), [&, query_fun](size_t query_idx) {
-        raw_results[query_idx] = query_fun(queries[query_idx]);
+    auto allocations_before = allocation_count.load(std::memory_order_relaxed);
+    scorer::with_scorer(scorer_name, wdata, [&](auto const& scorer) {
+        using query_fun_type =
+            std::function<std::vector<std::pair<float, uint64_t>>(Query const&)>;
+
+        using Scorer = std::decay_t<decltype(scorer)>;
+        using scored_cursor_type = scored_cursor<IndexType, typename Scorer::term_scorer_type>;
+        using max_scored_cursor_type =
+            max_scored_cursor<IndexType, typename Scorer::term_scorer_type>;
+        using block_max_scored_cursor_type =
+            block_max_scored_cursor<IndexType, WandType, typename Scorer::term_scorer_type>;
+        using pair_scorer_type = pair_term_scorer<typename Scorer::term_scorer_type>;
+        using block_max_enumerator =
+            typename detail::block_max_enumerator<IndexType, WandType>::type;
+
+        auto make_query_fun = [&](std::string const& algorithm) -> query_fun_type {
+            if (pair_index_filename && algorithm == "ranked_and" && wand_data_filename) {
+                using cursor_type = scored_cursor<IndexType, pair_scorer_type>;
+                return [&, contexts = per_thread(QueryContext<cursor_type>(k, deleted))](
+                           Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    ranked_and_query ranked_and_q(context.topk);
+                    ranked_and_q(
+                        make_pair_scored_cursors(index, pairs, scorer, query, context),
+                        index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (
+                pair_index_filename && algorithm == "block_max_ranked_and" && wand_data_filename) {
+                if constexpr (std::is_same_v<block_max_enumerator, wand_data_raw::enumerator>) {
+                    using cursor_type =
+                        block_max_scored_cursor<IndexType, WandType, pair_scorer_type>;
+                    return [&, contexts = per_thread(QueryContext<cursor_type>(k, deleted))](
+                               Query const& query) mutable {
+                        auto& context = contexts.local();
+                        context.reset();
+                        block_max_ranked_and_query block_max_ranked_and_q(context.topk);
+                        block_max_ranked_and_q(
+                            make_pair_block_max_scored_cursors(
+                                index, pairs, wdata, scorer, query, context),
+                            index.num_docs());
+                        context.topk.finalize();
+                        return context.topk.topk();
+                    };
+                } else {
+                    spdlog::error("The pair index requires uncompressed WAND data");
+                }
+            } else if (algorithm == "wand" && wand_data_filename) {
+                auto contexts = per_thread(QueryContext<max_scored_cursor_type>(k, deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    wand_query wand_q(context.topk);
+                    wand_q(
+                        make_max_scored_cursors(index, wdata, scorer, query, context),
+                        index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "block_max_wand" && wand_data_filename) {
+                auto contexts = per_thread(QueryContext<block_max_scored_cursor_type>(k, deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    block_max_wand_query block_max_wand_q(context.topk);
+                    block_max_wand_q(
+                        make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                        index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "block_max_maxscore" && wand_data_filename) {
+                auto contexts = per_thread(QueryContext<block_max_scored_cursor_type>(k, deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    block_max_maxscore_query block_max_maxscore_q(context.topk);
+                    block_max_maxscore_q(
+                        make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                        index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "block_max_ranked_and" && wand_data_filename) {
+                auto contexts = per_thread(QueryContext<block_max_scored_cursor_type>(k, deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    block_max_ranked_and_query block_max_ranked_and_q(context.topk);
+                    block_max_ranked_and_q(
+                        make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                        index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "ranked_and" && wand_data_filename) {
+                return [&, contexts = per_thread(QueryContext<scored_cursor_type>(k, deleted))](
+                           Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    ranked_and_query ranked_and_q(context.topk);
+                    ranked_and_q(
+                        make_scored_cursors(index, scorer, query, context), index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "ranked_or" && wand_data_filename) {
+                return [&, contexts = per_thread(QueryContext<scored_cursor_type>(k, deleted))](
+                           Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    ranked_or_query ranked_or_q(context.topk);
+                    ranked_or_q(
+                        make_scored_cursors(index, scorer, query, context), index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "maxscore" && wand_data_filename) {
+                auto contexts = per_thread(QueryContext<max_scored_cursor_type>(k, deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    maxscore_query maxscore_q(context.topk);
+                    maxscore_q(
+                        make_max_scored_cursors(index, wdata, scorer, query, context),
+                        index.num_docs());
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "parallel_ranked_or" && wand_data_filename) {
+                return [&](Query const& query) {
+                    // Not per thread: this thread may process another query while it waits
+                    // for the ranges of this one.
+                    topk_queue topk(k, deleted);
+                    parallel_range_query<ranked_or_query, scored_cursor_type> parallel_q(topk);
+                    parallel_q(
+                        [&](auto& range_context) -> auto& {
+                            return make_scored_cursors(index, scorer, query, range_context);
+                        },
+                        index.num_docs());
+                    topk.finalize();
+                    return topk.topk();
+                };
+            } else if (algorithm == "parallel_wand" && wand_data_filename) {
+                return [&](Query const& query) {
+                    // Not per thread: this thread may process another query while it waits
+                    // for the ranges of this one.
+                    topk_queue topk(k, deleted);
+                    parallel_range_query<wand_query, max_scored_cursor_type> parallel_q(topk);
+                    parallel_q(
+                        [&](auto& range_context) -> auto& {
+                            return make_max_scored_cursors(
+                                index, wdata, scorer, query, range_context);
+                        },
+                        index.num_docs());
+                    topk.finalize();
+                    return topk.topk();
+                };
+            } else if (algorithm == "parallel_maxscore" && wand_data_filename) {
+                return [&](Query const& query) {
+                    // Not per thread: this thread may process another query while it waits
+                    // for the ranges of this one.
+                    topk_queue topk(k, deleted);
+                    parallel_range_query<maxscore_query, max_scored_cursor_type> parallel_q(topk);
+                    parallel_q(
+                        [&](auto& range_context) -> auto& {
+                            return make_max_scored_cursors(
+                                index, wdata, scorer, query, range_context);
+                        },
+                        index.num_docs());
+                    topk.finalize();
+                    return topk.topk();
+                };
+            } else if (algorithm == "parallel_block_max_wand" && wand_data_filename) {
+                return [&](Query const& query) {
+                    // Not per thread: this thread may process another query while it waits
+                    // for the ranges of this one.
+                    topk_queue topk(k, deleted);
+                    parallel_range_query<block_max_wand_query, block_max_scored_cursor_type>
+                        parallel_q(topk);
+                    parallel_q(
+                        [&](auto& range_context) -> auto& {
+                            return make_block_max_scored_cursors(
+                                index, wdata, scorer, query, range_context);
+                        },
+                        index.num_docs());
+                    topk.finalize();
+                    return topk.topk();
+                };
+            } else if (algorithm == "parallel_block_max_maxscore" && wand_data_filename) {
+                return [&](Query const& query) {
+                    // Not per thread: this thread may process another query while it waits
+                    // for the ranges of this one.
+                    topk_queue topk(k, deleted);
+                    parallel_range_query<block_max_maxscore_query, block_max_scored_cursor_type>
+                        parallel_q(topk);
+                    parallel_q(
+                        [&](auto& range_context) -> auto& {
+                            return make_block_max_scored_cursors(
+                                index, wdata, scorer, query, range_context);
+                        },
+                        index.num_docs());
+                    topk.finalize();
+                    return topk.topk();
+                };
+            } else if (algorithm == "ranked_or_taat" && wand_data_filename) {
+                using context_type = QueryContext<scored_cursor_type, Simple_Accumulator>;
+                auto contexts =
+                    per_thread(context_type(k, Simple_Accumulator(index.num_docs()), deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    ranked_or_taat_query ranked_or_taat_q(context.topk);
+                    ranked_or_taat_q(
+                        make_scored_cursors(index, scorer, query, context),
+                        index.num_docs(),
+                        context.accumulator);
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "ranked_or_taat_lazy" && wand_data_filename) {
+                using context_type = QueryContext<scored_cursor_type, Lazy_Accumulator<4>>;
+                auto contexts =
+                    per_thread(context_type(k, Lazy_Accumulator<4>(index.num_docs()), deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    ranked_or_taat_query ranked_or_taat_q(context.topk);
+                    ranked_or_taat_q(
+                        make_scored_cursors(index, scorer, query, context),
+                        index.num_docs(),
+                        context.accumulator);
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            } else if (algorithm == "saat" && impact_index_filename) {
+                using context_type = QueryContext<impact_cursor, Lazy_Accumulator<4>>;
+                auto contexts = per_thread(
+                    context_type(k, Lazy_Accumulator<4>(impact_index.num_docs()), deleted));
+                return [&, contexts = std::move(contexts)](Query const& query) mutable {
+                    auto& context = contexts.local();
+                    context.reset();
+                    saat_query saat_q(context.topk, postings_budget);
+                    saat_q(
+                        make_impact_cursors(impact_index, query, context),
+                        impact_index.num_docs(),
+                        context.accumulator);
+                    context.topk.finalize();
+                    return context.topk.topk();
+                };
+            }
+            return {};
+        };
+
+        query_fun_type query_fun;
+        if (query_type == "auto") {
+            if (not selector) {
+                spdlog::error("Query type auto requires --algorithm-model");
+                return;
+            }
+            std::vector<query_fun_type> query_funs;
+            for (auto const& algorithm: selector->algorithms()) {
+                query_funs.push_back(make_query_fun(algorithm));
+                if (not query_funs.back()) {
+                    spdlog::error("Unsupported query type in algorithm selector: {}", algorithm);
+                    return;
+                }
+            }
+            query_fun = [&, query_funs = std::move(query_funs)](Query const& query) {
+                return query_funs[selector->select(QueryFeatures::compute(wdata, query))](query);
+            };
+        } else {
+            query_fun = make_query_fun(query_type);
+            if (not query_fun) {
+                spdlog::error("Unsupported query type: {}", query_type);
+                return;
+            }
+        }
+
+        ResultCache::Key cache_key{query_type, scorer_name, k, {}};
+        if (cache != nullptr) {
+            cache->fill_static(cache_static_queries, cache_key, query_fun);
+        }
+        auto cache_keys = per_thread(cache_key);
+
+        tbb::parallel_for(size_t(0), queries.size(), [&](size_t query_idx) {
+            if (not trace_filename and cache == nullptr) {
+                raw_results[query_idx] = query_fun(queries[query_idx]);
+                return;
+            }
+            // Counters are per thread, so they miss work that parallel_* algorithms
+            // delegate to other threads.
+            query_counters::reset();
+            auto start = std::chrono::steady_clock::now();
+            bool hit = false;
+            if (cache != nullptr) {
+                auto& key = cache_keys.local();
+                key.assign(queries[query_idx]);
+                hit = cache->find(key, raw_results[query_idx]);
+                if (not hit) {
+                    raw_results[query_idx] = query_fun(queries[query_idx]);
+                    cache->insert(key, raw_results[query_idx]);
+                }
+            } else {
+                raw_results[query_idx] = query_fun(queries[query_idx]);
+            }
+            auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start);
+            if (trace_filename) {
+                traces[query_idx] = {usecs.count(), query_counters::local()};
+            }
+            if (cache != nullptr) {
+                cache_lookups[query_idx] = {hit, usecs.count()};
+            }
+        });
     });
     auto end_batch = std::chrono::steady_clock::now();
+    auto allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
 
     for (size_t query_idx = 0; query_idx < raw_results.size(); ++query_idx) {
         auto results = raw_results[query_idx];
@@ -164,7 +482,7 @@ void evaluate_queries(
                 "{}\t{}\t{}\t{}\t{}\t{}\n",
                 qid.value_or(std::to_string(query_idx)),
                 iteration,
-                docmap[result.second],
+                docmap(result.second),
                 rank,
                 result.first,
                 run_id);
@@ -177,6 +495,38 @@ void evaluate_queries(
         std::chrono::duration_cast<std::chrono::milliseconds>(end_print - start_batch).count();
     spdlog::info("Time taken to process queries: {}ms", batch_ms);
     spdlog::info("Time taken to process queries with printing: {}ms", batch_with_print_ms);
+    if constexpr (count_allocations) {
+        spdlog::info("Allocations per query: {}", double(allocations) / queries.size());
+    }
+    if (cache != nullptr) {
+        std::array<std::int64_t, 2> usecs{0, 0};
+        std::array<std::size_t, 2> counts{0, 0};
+        for (auto [hit, query_usecs]: cache_lookups) {
+            usecs[hit] += query_usecs;
+            counts[hit] += 1;
+        }
+        auto mean = [&](bool hit) {
+            return counts[hit] > 0 ? double(usecs[hit]) / counts[hit] : 0.0;
+        };
+        spdlog::info("Cache hit ratio: {}", double(counts[1]) / queries.size());
+        spdlog::info("Mean time of hits: {}us", mean(true));
+        spdlog::info("Mean time of misses: {}us", mean(false));
+    }
+
+    if (trace_filename) {
+        if constexpr (not query_counters::enabled) {
+            spdlog::warn("Query counters are disabled: tracing only query times");
+        }
+        std::ofstream trace(*trace_filename);
+        for (auto&& [query_idx, entry]: enumerate(traces)) {
+            stats_line line(trace);
+            line("query", queries[query_idx].id.value_or(std::to_string(query_idx)))(
+                "type", type)("algorithm", query_type)("usec", entry.first);
+            if constexpr (query_counters::enabled) {
+                line(entry.second);
+            }
+        }
+    }
 }
 
 using wand_raw_index = wand_data<wand_data_raw>;
@@ -190,12 +540,33 @@ int main(int argc, const char** argv)
     std::string documents_file;
     std::string run_id = "R0";
     bool quantized = false;
+    std::optional<std::string> trace_filename;
+    std::optional<std::string> algorithm_model_filename;
 
-    App<arg::Index, arg::WandData, arg::Query<arg::QueryMode::Ranked>, arg::Algorithm, arg::Scorer, arg::Thresholds, arg::Threads>
+    App<arg::Index,
+        arg::WandData,
+        arg::Query<arg::QueryMode::Ranked>,
+        arg::Algorithm,
+        arg::Scorer,
+        arg::Thresholds,
+        arg::Threads,
+        arg::ImpactIndex,
+        arg::BlockMaxScores,
+        arg::ResultCache,
+        arg::PairIndex,
+        arg::DeletedDocuments>
         app{"Retrieves query results in TREC format."};
     app.add_option("-r,--run", run_id, "Run identifier");
     app.add_option("--documents", documents_file, "Document lexicon")->required();
     app.add_flag("--quantized", quantized, "Quantized scores");
+    app.add_option(
+        "--trace",
+        trace_filename,
+        "Write the time and execution counters of each query to this file as JSON lines");
+    app.add_option(
+        "--algorithm-model",
+        algorithm_model_filename,
+        "Algorithm selection model used by `-a auto` (see train_algorithm_selector)");
 
     CLI11_PARSE(app, argc, argv);
 
@@ -208,6 +579,8 @@ int main(int argc, const char** argv)
 
     auto iteration = "Q0";
 
+    auto cache = app.result_cache();
+
     auto params = std::make_tuple(
         app.index_filename(),
         app.wand_data_path(),
@@ -219,7 +592,42 @@ int main(int argc, const char** argv)
         documents_file,
         app.scorer(),
         run_id,
-        iteration);
+        iteration,
+        app.impact_index_filename(),
+        app.postings_budget(),
+        trace_filename,
+        cache.get(),
+        app.cache_static_queries() ? app.queries(*app.cache_static_queries())
+                                   : std::vector<Query>{},
+        app.pair_index_filename(),
+        app.deleted_documents_filename(),
+        algorithm_model_filename);
+
+    if (app.block_max_scores()) {
+        if (app.pair_index_filename()) {
+            spdlog::error("The pair index does not support embedded block-max scores");
+            return 1;
+        }
+        if (app.is_wand_compressed()) {
+            spdlog::error("Embedded block-max scores are used instead of compressed WAND data");
+            return 1;
+        }
+        if (false) {  // NOLINT
+#define LOOP_BODY(R, DATA, T)                                                                   \
+    }                                                                                           \
+    else if (app.index_encoding() == BOOST_PP_STRINGIZE(T))                                     \
+    {                                                                                           \
+        std::apply(                                                                             \
+            evaluate_queries<with_block_max_scores_t<BOOST_PP_CAT(T, _index)>, wand_raw_index>, \
+            params);                                                                            \
+        /**/
+            BOOST_PP_SEQ_FOR_EACH(LOOP_BODY, _, PISA_BLOCK_INDEX_TYPES);
+#undef LOOP_BODY
+        } else {
+            spdlog::error("Block-max scores are not supported by type {}", app.index_encoding());
+        }
+        return 0;
+    }
 
     /**/
     if (false) {  // NOLINT
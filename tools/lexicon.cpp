@@ -2,23 +2,71 @@
 #include <mio/mmap.hpp>
 #include <spdlog/spdlog.h>
 
+#include "front_coded_vector.hpp"
+#include "hash_lexicon.hpp"
 #include "io.hpp"
+#include "mappable/mapper.hpp"
 #include "payload_vector.hpp"
 
 using namespace pisa;
 
+/// Prints all elements, looks up the element at `idx`, or looks up the index of `value` in a
+/// lexicon whose `lower_bound` returns the index of the first element not less than a value.
+template <typename Lexicon, typename LowerBound>
+auto query_lexicon(
+    Lexicon const& lexicon,
+    LowerBound lower_bound,
+    bool print,
+    bool lookup,
+    std::size_t idx,
+    std::string const& value) -> int
+{
+    if (print) {
+        for (auto const& elem: lexicon) {
+            std::cout << elem << '\n';
+        }
+        return 0;
+    }
+    if (lookup) {
+        if (idx < lexicon.size()) {
+            std::cout << lexicon[idx] << '\n';
+            return 0;
+        }
+        spdlog::error("Requested index {} too large for vector of size {}", idx, lexicon.size());
+        return 1;
+    }
+    std::size_t pos = lower_bound(value);
+    if (pos < lexicon.size() and lexicon[pos] == value) {
+        std::cout << pos << '\n';
+        return 0;
+    }
+    spdlog::error("Requested term {} was not found", value);
+    return 1;
+}
+
 int main(int argc, char** argv)
 {
     std::string text_file;
     std::string lexicon_file;
     std::size_t idx;
     std::string value;
+    bool hash = false;
+    bool front_coded = false;
+    std::uint64_t bucket_size = Front_Coded_Vector::default_bucket_size;
 
     CLI::App app{"Build, print, or query lexicon"};
     app.require_subcommand();
     auto build = app.add_subcommand("build", "Build a lexicon");
     build->add_option("input", text_file, "Input text file")->required();
     build->add_option("output", lexicon_file, "Output file")->required();
+    build->add_flag(
+        "--hash",
+        hash,
+        "Build a hash lexicon: faster term lookups, but terms cannot be retrieved by index");
+    auto front_coded_opt = build->add_flag(
+        "--front-coded", front_coded, "Build a smaller, front-coded lexicon of sorted strings");
+    build->add_option("--bucket-size", bucket_size, "Strings per front-coded bucket", true)
+        ->needs(front_coded_opt);
     auto lookup = app.add_subcommand("lookup", "Retrieve the payload at index");
     lookup->add_option("lexicon", lexicon_file, "Lexicon file path")->required();
     lookup->add_option("idx", idx, "Index of requested element")->required();
@@ -31,39 +79,63 @@ int main(int argc, char** argv)
 
     try {
         if (*build) {
+            if (hash) {
+                Hash_Lexicon lexicon(io::read_string_vector(text_file));
+                mapper::freeze(lexicon, lexicon_file.c_str());
+                return 0;
+            }
             std::ifstream is(text_file);
+            if (front_coded) {
+                encode_front_coded_vector(
+                    std::istream_iterator<io::Line>(is),
+                    std::istream_iterator<io::Line>(),
+                    bucket_size)
+                    .to_file(lexicon_file);
+                return 0;
+            }
             encode_payload_vector(
                 std::istream_iterator<io::Line>(is), std::istream_iterator<io::Line>())
                 .to_file(lexicon_file);
             return 0;
         }
         mio::mmap_source m(lexicon_file.c_str());
-        auto lexicon = Payload_Vector<>::from(m);
-        if (*print) {
-            for (auto const& elem: lexicon) {
-                std::cout << elem << '\n';
-            }
-            return 0;
-        } else if (*lookup) {
-            if (idx < lexicon.size()) {
-                std::cout << lexicon[idx] << '\n';
-                return 0;
-            } else {
-                spdlog::error(
-                    "Requested index {} too large for vector of size {}", idx, lexicon.size());
+        if (Hash_Lexicon::is_hash_lexicon(
+                gsl::make_span(reinterpret_cast<std::byte const*>(m.data()), m.size()))) {
+            if (not *rlookup) {
+                spdlog::error("Hash lexicons only support rlookup");
                 return 1;
             }
-        } else if (*rlookup) {
-            auto pos = std::lower_bound(lexicon.begin(), lexicon.end(), std::string_view(value));
-            if (pos != lexicon.end() and *pos == std::string_view(value)) {
-                std::cout << std::distance(lexicon.begin(), pos) << '\n';
+            Hash_Lexicon lexicon;
+            mapper::map(lexicon, m);
+            if (auto term_id = lexicon(value); term_id) {
+                std::cout << *term_id << '\n';
                 return 0;
-            } else {
-                spdlog::error("Requested term {} was not found", value);
-                return 1;
             }
+            spdlog::error("Requested term {} was not found", value);
+            return 1;
         }
-        return 1;
+        if (Front_Coded_Vector::is_front_coded(
+                gsl::make_span(reinterpret_cast<std::byte const*>(m.data()), m.size()))) {
+            auto lexicon = Front_Coded_Vector::from(m);
+            return query_lexicon(
+                lexicon,
+                [&](std::string_view value) { return lexicon.lower_bound(value); },
+                static_cast<bool>(*print),
+                static_cast<bool>(*lookup),
+                idx,
+                value);
+        }
+        auto lexicon = Payload_Vector<>::from(m);
+        return query_lexicon(
+            lexicon,
+            [&](std::string_view value) {
+                return std::distance(
+                    lexicon.begin(), std::lower_bound(lexicon.begin(), lexicon.end(), value));
+            },
+            static_cast<bool>(*print),
+            static_cast<bool>(*lookup),
+            idx,
+            value);
     } catch (std::runtime_error const& err) {
         spdlog::error("{}", err.what());
         return 0;
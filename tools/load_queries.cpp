@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <CLI/CLI.hpp>
+#include <mio/mmap.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <tbb/enumerable_thread_specific.h>
+
+#include "app.hpp"
+#include "cursor/block_max_scored_cursor.hpp"
+#include "cursor/cursor.hpp"
+#include "cursor/max_scored_cursor.hpp"
+#include "cursor/scored_cursor.hpp"
+#include "deleted_documents.hpp"
+#include "index_types.hpp"
+#include "mappable/mapper.hpp"
+#include "query/algorithm.hpp"
+#include "query/query_context.hpp"
+#include "scorer/scorer.hpp"
+#include "util/util.hpp"
+#include "wand_data_compressed.hpp"
+#include "wand_data_raw.hpp"
+
+using namespace pisa;
+using std::chrono::microseconds;
+
+constexpr int max_sweep_steps = 32;
+
+/// Returns per-thread copies of `context`, created the first time each thread uses them.
+template <typename Context>
+auto per_thread(Context context)
+{
+    return tbb::enumerable_thread_specific<Context>(std::move(context));
+}
+
+/// Returns the arrival times of `count` queries at `qps` queries per second on average, with
+/// exponentially distributed interarrival times (a Poisson process).
+auto poisson_arrivals(std::size_t count, double qps, std::uint64_t seed)
+    -> std::vector<microseconds>
+{
+    std::mt19937_64 rng(seed);
+    std::exponential_distribution<double> interarrival(qps / 1'000'000.0);
+    std::vector<microseconds> arrivals(count);
+    double time = 0.0;
+    for (auto& arrival: arrivals) {
+        arrival = microseconds(static_cast<std::int64_t>(time));
+        time += interarrival(rng);
+    }
+    return arrivals;
+}
+
+/// Returns the arrival times of `recorded`, which are relative to the first one, sped up or
+/// slowed down to `qps` queries per second on average.
+auto scaled_arrivals(std::vector<microseconds> const& recorded, double qps)
+    -> std::vector<microseconds>
+{
+    auto span = static_cast<double>((recorded.back() - recorded.front()).count());
+    double recorded_qps = span > 0 ? (recorded.size() - 1) * 1'000'000.0 / span : qps;
+    double factor = recorded_qps / qps;
+    std::vector<microseconds> arrivals(recorded.size());
+    std::transform(recorded.begin(), recorded.end(), arrivals.begin(), [&](auto arrival) {
+        return microseconds(
+            static_cast<std::int64_t>((arrival - recorded.front()).count() * factor));
+    });
+    return arrivals;
+}
+
+/// Reads `count` arrival times in microseconds, one per line and in increasing order.
+auto read_arrivals(std::string const& filename, std::size_t count) -> std::vector<microseconds>
+{
+    std::vector<microseconds> arrivals;
+    std::ifstream is(filename);
+    io::for_each_line(is, [&](std::string const& line) {
+        if (arrivals.size() < count) {
+            arrivals.emplace_back(std::stoll(line));
+        }
+    });
+    if (arrivals.size() < count) {
+        throw std::invalid_argument(fmt::format(
+            "{} holds {} arrivals, but {} queries are replayed", filename, arrivals.size(), count));
+    }
+    if (not std::is_sorted(arrivals.begin(), arrivals.end())) {
+        throw std::invalid_argument("Arrival times must be in increasing order");
+    }
+    return arrivals;
+}
+
+/// User and system CPU time used by the process so far.
+auto cpu_time() -> microseconds
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    auto to_usecs = [](timeval const& time) {
+        return microseconds(time.tv_sec * 1'000'000 + time.tv_usec);
+    };
+    return to_usecs(usage.ru_utime) + to_usecs(usage.ru_stime);
+}
+
+struct LoadReport {
+    double offered_qps;
+    double throughput;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double queueing_avg;
+    double cpu_utilization;
+
+    /// Whether the throughput fell short of the offered load, i.e., the queue kept growing.
+    [[nodiscard]] auto saturated() const -> bool { return throughput < 0.95 * offered_qps; }
+};
+
+/// Replays `queries` in order, query `i` (modulo the number of queries) arriving at
+/// `arrivals[i]`, on `threads` workers. Each idle worker takes the next arrival, so that a
+/// query waits in the queue when all the workers are busy at its arrival. Latencies are
+/// measured from the arrival, so they include the queueing delay. Without arrivals, the report
+/// is empty.
+template <typename Fn>
+auto replay(
+    Fn const& query_fun,
+    std::vector<Query> const& queries,
+    std::vector<microseconds> const& arrivals,
+    double offered_qps,
+    std::size_t threads) -> LoadReport
+{
+    if (arrivals.empty()) {
+        return LoadReport{offered_qps, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    }
+    std::vector<double> latencies(arrivals.size());
+    std::vector<double> queueing(arrivals.size());
+    std::atomic_size_t next{0};
+    auto cpu_before = cpu_time();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (std::size_t worker = 0; worker < threads; ++worker) {
+        workers.emplace_back([&]() {
+            for (auto idx = next++; idx < arrivals.size(); idx = next++) {
+                auto arrival = start + arrivals[idx];
+                std::this_thread::sleep_until(arrival);
+                auto begin = std::chrono::steady_clock::now();
+                do_not_optimize_away(query_fun(queries[idx % queries.size()]));
+                auto end = std::chrono::steady_clock::now();
+                latencies[idx] = std::chrono::duration<double, std::micro>(end - arrival).count();
+                queueing[idx] = std::chrono::duration<double, std::micro>(begin - arrival).count();
+            }
+        });
+    }
+    for (auto& worker: workers) {
+        worker.join();
+    }
+    auto elapsed =
+        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+    auto cpu = static_cast<double>((cpu_time() - cpu_before).count());
+
+    std::sort(latencies.begin(), latencies.end());
+    auto quantile = [&](double q) {
+        return latencies[std::min(
+            latencies.size() - 1, static_cast<std::size_t>(q * latencies.size()))];
+    };
+    return LoadReport{
+        offered_qps,
+        arrivals.size() * 1'000'000.0 / elapsed.count(),
+        quantile(0.5),
+        quantile(0.9),
+        quantile(0.99),
+        quantile(0.999),
+        std::accumulate(queueing.begin(), queueing.end(), 0.0) / queueing.size(),
+        cpu / (elapsed.count() * threads)};
+}
+
+template <typename IndexType, typename WandType>
+void load_queries(
+    std::string const& index_filename,
+    std::optional<std::string> const& wand_data_filename,
+    std::vector<Query> const& queries,
+    std::string const& type,
+    std::string const& query_type,
+    uint64_t k,
+    std::string const& scorer_name,
+    std::size_t threads,
+    std::vector<double> const& rates,
+    std::optional<std::string> const& arrivals_filename,
+    std::size_t num_queries,
+    bool sweep,
+    double sweep_factor,
+    std::uint64_t seed,
+    std::optional<std::string> const& deleted_docs_filename)
+{
+    IndexType index;
+    spdlog::info("Loading index from {}", index_filename);
+    mio::mmap_source m(index_filename.c_str());
+    mapper::map(index, m);
+
+    std::optional<Deleted_Documents> deleted_documents;
+    if (deleted_docs_filename) {
+        deleted_documents.emplace(*deleted_docs_filename, index.num_docs());
+        spdlog::info("Deleted documents: {}", deleted_count(deleted_documents->bits()));
+    }
+    bit_vector const* deleted = deleted_documents ? &deleted_documents->bits() : nullptr;
+
+    spdlog::info("Warming up posting lists");
+    std::unordered_set<term_id_type> warmed_up;
+    for (auto const& q: queries) {
+        for (auto t: q.terms) {
+            if (warmed_up.insert(t).second) {
+                index.warmup(t);
+            }
+        }
+    }
+
+    WandType wdata;
+    mio::mmap_source md;
+    if (wand_data_filename) {
+        std::error_code error;
+        md.map(*wand_data_filename, error);
+        if (error) {
+            spdlog::error("error mapping file: {}, exiting...", error.message());
+            std::abort();
+        }
+        mapper::map(wdata, md, mapper::map_flags::warmup);
+    }
+
+    std::vector<microseconds> recorded;
+    if (arrivals_filename) {
+        recorded = read_arrivals(*arrivals_filename, num_queries);
+    }
+
+    scorer::with_scorer(scorer_name, wdata, [&](auto const& scorer) {
+        std::function<uint64_t(Query const&)> query_fun;
+
+        using Scorer = std::decay_t<decltype(scorer)>;
+        using scored_cursor_type = scored_cursor<IndexType, typename Scorer::term_scorer_type>;
+        using max_scored_cursor_type =
+            max_scored_cursor<IndexType, typename Scorer::term_scorer_type>;
+        using block_max_scored_cursor_type =
+            block_max_scored_cursor<IndexType, WandType, typename Scorer::term_scorer_type>;
+
+        if (query_type == "and") {
+            query_fun = [&](Query const& query) {
+                and_query and_q(deleted);
+                return and_q(make_cursors(index, query), index.num_docs()).size();
+            };
+        } else if (query_type == "ranked_and" && wand_data_filename) {
+            auto contexts = per_thread(QueryContext<scored_cursor_type>(k, deleted));
+            query_fun = [&, contexts = std::move(contexts)](Query const& query) mutable {
+                auto& context = contexts.local();
+                context.reset();
+                ranked_and_query ranked_and_q(context.topk);
+                ranked_and_q(make_scored_cursors(index, scorer, query, context), index.num_docs());
+                context.topk.finalize();
+                return context.topk.topk().size();
+            };
+        } else if (query_type == "ranked_or" && wand_data_filename) {
+            auto contexts = per_thread(QueryContext<scored_cursor_type>(k, deleted));
+            query_fun = [&, contexts = std::move(contexts)](Query const& query) mutable {
+                auto& context = contexts.local();
+                context.reset();
+                ranked_or_query ranked_or_q(context.topk);
+                ranked_or_q(make_scored_cursors(index, scorer, query, context), index.num_docs());
+                context.topk.finalize();
+                return context.topk.topk().size();
+            };
+        } else if (query_type == "wand" && wand_data_filename) {
+            auto contexts = per_thread(QueryContext<max_scored_cursor_type>(k, deleted));
+            query_fun = [&, contexts = std::move(contexts)](Query const& query) mutable {
+                auto& context = contexts.local();
+                context.reset();
+                wand_query wand_q(context.topk);
+                wand_q(
+                    make_max_scored_cursors(index, wdata, scorer, query, context),
+                    index.num_docs());
+                context.topk.finalize();
+                return context.topk.topk().size();
+            };
+        } else if (query_type == "maxscore" && wand_data_filename) {
+            auto contexts = per_thread(QueryContext<max_scored_cursor_type>(k, deleted));
+            query_fun = [&, contexts = std::move(contexts)](Query const& query) mutable {
+                auto& context = contexts.local();
+                context.reset();
+                maxscore_query maxscore_q(context.topk);
+                maxscore_q(
+                    make_max_scored_cursors(index, wdata, scorer, query, context),
+                    index.num_docs());
+                context.topk.finalize();
+                return context.topk.topk().size();
+            };
+        } else if (query_type == "block_max_wand" && wand_data_filename) {
+            auto contexts = per_thread(QueryContext<block_max_scored_cursor_type>(k, deleted));
+            query_fun = [&, contexts = std::move(contexts)](Query const& query) mutable {
+                auto& context = contexts.local();
+                context.reset();
+                block_max_wand_query block_max_wand_q(context.topk);
+                block_max_wand_q(
+                    make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                    index.num_docs());
+                context.topk.finalize();
+                return context.topk.topk().size();
+            };
+        } else if (query_type == "block_max_maxscore" && wand_data_filename) {
+            auto contexts = per_thread(QueryContext<block_max_scored_cursor_type>(k, deleted));
+            query_fun = [&, contexts = std::move(contexts)](Query const& query) mutable {
+                auto& context = contexts.local();
+                context.reset();
+                block_max_maxscore_query block_max_maxscore_q(context.topk);
+                block_max_maxscore_q(
+                    make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                    index.num_docs());
+                context.topk.finalize();
+                return context.topk.topk().size();
+            };
+        } else {
+            spdlog::error("Unsupported query type: {}", query_type);
+            return;
+        }
+
+        auto run = [&](double qps) {
+            auto arrivals = arrivals_filename ? scaled_arrivals(recorded, qps)
+                                              : poisson_arrivals(num_queries, qps, seed);
+            auto report = replay(query_fun, queries, arrivals, qps, threads);
+            spdlog::info("---- {} {} at {} QPS on {} threads", type, query_type, qps, threads);
+            spdlog::info("Throughput: {} QPS", report.throughput);
+            spdlog::info(
+                "Latency quantiles (50/90/99/99.9%): {}us {}us {}us {}us",
+                report.p50,
+                report.p90,
+                report.p99,
+                report.p999);
+            spdlog::info("Mean queueing delay: {}us", report.queueing_avg);
+            spdlog::info("CPU utilization: {}", report.cpu_utilization);
+            stats_line()("type", type)("query", query_type)("threads", threads)(
+                "offered_qps", qps)("throughput", report.throughput)("q50", report.p50)(
+                "q90", report.p90)("q99", report.p99)("q999", report.p999)(
+                "queueing_avg", report.queueing_avg)("cpu_utilization", report.cpu_utilization);
+            return report;
+        };
+
+        // Warms up the per-thread contexts and the caches.
+        replay(query_fun, queries, std::vector<microseconds>(queries.size()), 0.0, threads);
+
+        if (not sweep) {
+            for (auto qps: rates) {
+                run(qps);
+            }
+            return;
+        }
+        // Increases the load geometrically until the workers cannot keep up with it.
+        std::optional<double> sustained;
+        double qps = rates.front();
+        for (int step = 0; step < max_sweep_steps; ++step, qps *= sweep_factor) {
+            auto report = run(qps);
+            if (report.saturated()) {
+                break;
+            }
+            sustained = qps;
+        }
+        if (sustained) {
+            spdlog::info("Saturation point: {} QPS on {} threads", *sustained, threads);
+            stats_line()("type", type)("query", query_type)("threads", threads)(
+                "saturation_qps", *sustained);
+        } else {
+            spdlog::warn("Saturated at the lowest rate ({} QPS)", rates.front());
+        }
+    });
+}
+
+using wand_raw_index = wand_data<wand_data_raw>;
+using wand_uniform_index = wand_data<wand_data_compressed<>>;
+using wand_uniform_index_quantized = wand_data<wand_data_compressed<PayloadType::Quantized>>;
+
+int main(int argc, const char** argv)
+{
+    spdlog::drop("");
+    spdlog::set_default_logger(spdlog::stderr_color_mt(""));
+
+    bool quantized = false;
+    std::vector<double> rates;
+    std::optional<std::string> arrivals_filename;
+    std::optional<std::size_t> num_queries;
+    bool sweep = false;
+    double sweep_factor = 1.5;
+    std::uint64_t seed = 0;
+
+    App<arg::Index,
+        arg::WandData,
+        arg::Query<arg::QueryMode::Ranked>,
+        arg::Algorithm,
+        arg::Scorer,
+        arg::Threads,
+        arg::DeletedDocuments>
+        app{"Replays queries at a target rate and reports throughput and tail latency."};
+    app.add_flag("--quantized", quantized, "Quantized scores");
+    app.add_option("--qps", rates, "Mean arrival rates in queries per second")->required();
+    app.add_option(
+        "--arrivals",
+        arrivals_filename,
+        "Recorded arrival times in microseconds, one per query, rescaled to each rate "
+        "(Poisson arrivals by default)");
+    app.add_option(
+        "--num-queries", num_queries, "Number of queries replayed, cycling over the query log");
+    app.add_flag(
+        "--sweep", sweep, "Increase the rate from the first --qps until the workers saturate");
+    app.add_option("--sweep-factor", sweep_factor, "Rate increase of each sweep step", true);
+    app.add_option("--seed", seed, "Seed of the Poisson arrivals", true);
+    CLI11_PARSE(app, argc, argv);
+
+    if (sweep_factor <= 1.0) {
+        spdlog::error("The sweep factor must be greater than 1");
+        return 1;
+    }
+    if (std::any_of(rates.begin(), rates.end(), [](double qps) { return qps <= 0.0; })) {
+        spdlog::error("Rates must be positive");
+        return 1;
+    }
+    if (num_queries && *num_queries == 0) {
+        spdlog::error("The number of queries must be positive");
+        return 1;
+    }
+    auto queries = app.queries();
+    if (queries.empty()) {
+        spdlog::error("No queries to replay");
+        return 1;
+    }
+
+    auto params = std::make_tuple(
+        app.index_filename(),
+        app.wand_data_path(),
+        queries,
+        app.index_encoding(),
+        app.algorithm(),
+        app.k(),
+        app.scorer(),
+        app.threads(),
+        rates,
+        arrivals_filename,
+        num_queries.value_or(queries.size()),
+        sweep,
+        sweep_factor,
+        seed,
+        app.deleted_documents_filename());
+
+    /**/
+    if (false) {  // NOLINT
+#define LOOP_BODY(R, DATA, T)                                                                    \
+    }                                                                                            \
+    else if (app.index_encoding() == BOOST_PP_STRINGIZE(T))                                      \
+    {                                                                                            \
+        if (app.is_wand_compressed()) {                                                          \
+            if (quantized) {                                                                     \
+                std::apply(                                                                      \
+                    load_queries<BOOST_PP_CAT(T, _index), wand_uniform_index_quantized>, params); \
+            } else {                                                                             \
+                std::apply(load_queries<BOOST_PP_CAT(T, _index), wand_uniform_index>, params);   \
+            }                                                                                    \
+        } else {                                                                                 \
+            std::apply(load_queries<BOOST_PP_CAT(T, _index), wand_raw_index>, params);           \
+        }                                                                                        \
+        /**/
+
+        BOOST_PP_SEQ_FOR_EACH(LOOP_BODY, _, PISA_INDEX_TYPES);
+#undef LOOP_BODY
+    } else {
+        spdlog::error("Unknown type {}", app.index_encoding());
+    }
+}
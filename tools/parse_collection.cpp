@@ -164,14 +164,22 @@ std::function<std::string(std::string&&)> term_processor(std::optional<std::stri
     std::abort();
 }
 
-std::function<void(std::string&& constent, std::function<void(std::string&&)>)>
+std::function<void(std::string&& constent, std::function<void(std::string_view)>)>
 content_parser(std::optional<std::string> const& type)
 {
     if (not type) {
         return parse_plaintext_content;
     }
     if (*type == "html") {
-        return parse_html_content;
+        return [](std::string&& content, std::function<void(std::string_view)> process) {
+            parse_html_content(std::move(content), std::move(process));
+        };
+    }
+    if (*type == "html-fast") {
+        return [](std::string&& content, std::function<void(std::string_view)> process) {
+            parse_html_content(
+                std::move(content), std::move(process), parsing::html::Html_Parser::fast);
+        };
     }
     spdlog::error("Unknown content parser type: {}", *type);
     std::abort();
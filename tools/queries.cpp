@@ -1,5 +1,8 @@
 #include <algorithm>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <numeric>
 #include <optional>
 #include <string>
@@ -17,18 +20,30 @@
 #include "app.hpp"
 #include "cursor/block_max_scored_cursor.hpp"
 #include "cursor/cursor.hpp"
+#include "cursor/impact_cursor.hpp"
 #include "cursor/max_scored_cursor.hpp"
+#include "cursor/pair_cursor.hpp"
 #include "cursor/scored_cursor.hpp"
+#include "deleted_documents.hpp"
+#include "impact_ordered_index.hpp"
 #include "index_types.hpp"
 #include "mappable/mapper.hpp"
+#include "pair_index.hpp"
 #include "query/algorithm.hpp"
+#include "query/algorithm_selector.hpp"
+#include "query/query_context.hpp"
+#include "query/result_cache.hpp"
 #include "scorer/scorer.hpp"
 #include "timer.hpp"
 #include "topk_queue.hpp"
+#include "util/allocation_counter.hpp"
+#include "util/query_counters.hpp"
 #include "util/util.hpp"
 #include "wand_data_compressed.hpp"
 #include "wand_data_raw.hpp"
 
+PISA_COUNT_ALLOCATIONS()
+
 using namespace pisa;
 using ranges::views::enumerate;
 
@@ -51,12 +66,39 @@ void extract_times(
                 .count();
         });
         auto mean = std::accumulate(times.begin(), times.end(), std::size_t{0}, std::plus<>()) / runs;
-        os << fmt::format("{}\t{}\n", query.id.value_or(std::to_string(qid)), mean);
+        os << fmt::format(
+            "{}\t{}\t{}\n", query.id.value_or(std::to_string(qid)), query_type, mean);
+    }
+}
+
+/// Writes a JSON line per query with its time and, if compiled with query counters, the
+/// work it did (see `query_counters`).
+template <typename Fn>
+void trace_queries(
+    Fn fn,
+    std::vector<Query> const& queries,
+    std::vector<Threshold> const& thresholds,
+    std::string const& index_type,
+    std::string const& query_type,
+    std::ostream& os)
+{
+    for (auto&& [qid, query]: enumerate(queries)) {
+        do_not_optimize_away(fn(query, thresholds[qid]));
+        query_counters::reset();
+        auto usecs = run_with_timer<std::chrono::microseconds>(
+            [&]() { do_not_optimize_away(fn(query, thresholds[qid])); });
+        auto counters = query_counters::local();
+        stats_line line(os);
+        line("query", query.id.value_or(std::to_string(qid)))("type", index_type)(
+            "algorithm", query_type)("usec", usecs.count());
+        if constexpr (query_counters::enabled) {
+            line(counters);
+        }
     }
 }
 
 template <typename Functor>
-void op_perftest(
+double op_perftest(
     Functor query_func,
     std::vector<Query> const& queries,
     std::vector<Threshold> const& thresholds,
@@ -64,15 +106,25 @@ void op_perftest(
     std::string const& query_type,
     size_t runs,
     std::uint64_t k,
-    bool safe)
+    bool safe,
+    ResultCache* cache = nullptr)
 {
     std::vector<double> query_times;
+    query_times.reserve(runs * queries.size());
     std::size_t num_reruns = 0;
+    std::size_t allocations = 0;
+    std::vector<double> hit_times;
+    std::vector<double> miss_times;
     spdlog::info("Safe: {}", safe);
 
     for (size_t run = 0; run <= runs; ++run) {
+        if (cache != nullptr) {  // each run replays the queries from an empty dynamic cache
+            cache->clear();
+        }
         size_t idx = 0;
         for (auto const& query: queries) {
+            auto allocations_before = allocation_count.load(std::memory_order_relaxed);
+            auto hits_before = cache != nullptr ? cache->hits() : 0;
             auto usecs = run_with_timer<std::chrono::microseconds>([&]() {
                 uint64_t result = query_func(query, thresholds[idx]);
                 if (safe && result < k) {
@@ -83,34 +135,469 @@ void op_perftest(
             });
             if (run != 0) {  // first run is not timed
                 query_times.push_back(usecs.count());
+                allocations += allocation_count.load(std::memory_order_relaxed) - allocations_before;
+                if (cache != nullptr) {
+                    auto& times = cache->hits() > hits_before ? hit_times : miss_times;
+                    times.push_back(usecs.count());
+                }
             }
             idx += 1;
         }
     }
 
-    if (false) {
-        for (auto t: query_times) {
-            std::cout << (t / 1000) << std::endl;
+    std::sort(query_times.begin(), query_times.end());
+    double avg =
+        std::accumulate(query_times.begin(), query_times.end(), double()) / query_times.size();
+    double q50 = query_times[query_times.size() / 2];
+    double q90 = query_times[90 * query_times.size() / 100];
+    double q95 = query_times[95 * query_times.size() / 100];
+    double q99 = query_times[99 * query_times.size() / 100];
+
+    spdlog::info("---- {} {}", index_type, query_type);
+    spdlog::info("Mean: {}", avg);
+    spdlog::info("50% quantile: {}", q50);
+    spdlog::info("90% quantile: {}", q90);
+    spdlog::info("95% quantile: {}", q95);
+    spdlog::info("99% quantile: {}", q99);
+    spdlog::info("Num. reruns: {}", num_reruns);
+
+    stats_line line;
+    line("type", index_type)("query", query_type)("avg", avg)("q50", q50)("q90", q90)("q95", q95)(
+        "q99", q99);
+    if constexpr (count_allocations) {
+        double allocations_per_query = double(allocations) / query_times.size();
+        spdlog::info("Allocations per query: {}", allocations_per_query);
+        line("allocations_per_query", allocations_per_query);
+    }
+    if (cache != nullptr) {
+        auto mean = [](std::vector<double> const& times) {
+            return times.empty() ? 0.0
+                                 : std::accumulate(times.begin(), times.end(), 0.0) / times.size();
+        };
+        double hit_ratio = double(hit_times.size()) / query_times.size();
+        spdlog::info("Cache hit ratio: {}", hit_ratio);
+        spdlog::info("Mean of hits: {}", mean(hit_times));
+        spdlog::info("Mean of misses: {}", mean(miss_times));
+        line("cache_hit_ratio", hit_ratio)("cache_hit_avg", mean(hit_times))(
+            "cache_miss_avg", mean(miss_times));
+    }
+    return avg;
+}
+
+/// Finalizes `topk`, copies its results to `results` if not null, and returns their number.
+auto finish(topk_queue& topk, ResultCache::value_type* results) -> uint64_t
+{
+    topk.finalize();
+    if (results != nullptr) {
+        results->assign(topk.topk().begin(), topk.topk().end());
+    }
+    return topk.topk().size();
+}
+
+/// Whether `make_query_function` passes the query budget to the algorithm `query_type`.
+auto supports_budget(std::string const& query_type) -> bool
+{
+    return query_type == "wand" || query_type == "block_max_wand" || query_type == "maxscore"
+        || query_type == "block_max_maxscore" || query_type == "ranked_or"
+        || query_type == "ranked_or_taat" || query_type == "ranked_or_taat_lazy";
+}
+
+/// Runs each query with `budgeted_fun`, which stops when `budget` is exhausted, and with
+/// `exhaustive_fun`, which write their results to `budgeted` and `exhaustive` respectively,
+/// and reports how many queries were stopped and the mean recall of their results.
+template <typename Fn>
+void evaluate_budget(
+    Fn const& budgeted_fun,
+    Fn const& exhaustive_fun,
+    QueryBudget const& budget,
+    ResultCache::value_type const& budgeted,
+    ResultCache::value_type const& exhaustive,
+    std::vector<Query> const& queries,
+    std::vector<Threshold> const& thresholds,
+    std::string const& index_type,
+    std::string const& query_type)
+{
+    std::size_t exhausted = 0;
+    double recall = 0.0;
+    std::vector<uint64_t> expected;
+    for (auto&& [qid, query]: enumerate(queries)) {
+        budgeted_fun(query, thresholds[qid]);
+        exhausted += budget.exhausted() ? 1 : 0;
+        exhaustive_fun(query, thresholds[qid]);
+        if (exhaustive.empty()) {
+            recall += 1.0;
+            continue;
         }
-    } else {
-        std::sort(query_times.begin(), query_times.end());
-        double avg =
-            std::accumulate(query_times.begin(), query_times.end(), double()) / query_times.size();
-        double q50 = query_times[query_times.size() / 2];
-        double q90 = query_times[90 * query_times.size() / 100];
-        double q95 = query_times[95 * query_times.size() / 100];
-        double q99 = query_times[99 * query_times.size() / 100];
-
-        spdlog::info("---- {} {}", index_type, query_type);
-        spdlog::info("Mean: {}", avg);
-        spdlog::info("50% quantile: {}", q50);
-        spdlog::info("90% quantile: {}", q90);
-        spdlog::info("95% quantile: {}", q95);
-        spdlog::info("99% quantile: {}", q99);
-        spdlog::info("Num. reruns: {}", num_reruns);
-
-        stats_line()("type", index_type)("query", query_type)("avg", avg)("q50", q50)("q90", q90)(
-            "q95", q95)("q99", q99);
+        expected.clear();
+        for (auto const& entry: exhaustive) {
+            expected.push_back(entry.second);
+        }
+        std::sort(expected.begin(), expected.end());
+        auto found = std::count_if(budgeted.begin(), budgeted.end(), [&](auto const& entry) {
+            return std::binary_search(expected.begin(), expected.end(), entry.second);
+        });
+        recall += static_cast<double>(found) / exhaustive.size();
+    }
+    recall /= queries.size();
+    spdlog::info("Queries stopped by the budget: {}", exhausted);
+    spdlog::info("Recall against exhaustive results: {}", recall);
+    stats_line()("type", index_type)("query", query_type)("budget_exhausted", exhausted)(
+        "budget_recall", recall);
+}
+
+/// Returns the function processing a single query with algorithm `query_type`,
+/// or an empty function if the algorithm is not supported.
+///
+/// If `results` is not null, ranked algorithms copy the results of each query to it.
+/// If `budget` is not null, the algorithms supporting it (see `supports_budget`) stop when it
+/// is exhausted; it must be started before each query.
+/// If `deleted` is not null, all algorithms skip the deleted documents.
+///
+/// If `scorer` is a concrete scorer type (see `scorer::with_scorer`), the cursors call
+/// its term scorers directly; if it is an `index_scorer`, they go through `term_scorer_t`.
+template <typename IndexType, typename WandType, typename Scorer>
+auto make_query_function(
+    IndexType const& index,
+    WandType const& wdata,
+    Scorer const& scorer,
+    std::string const& query_type,
+    uint64_t k,
+    bool with_wand_data,
+    ResultCache::value_type* results = nullptr,
+    QueryBudget* budget = nullptr,
+    bit_vector const* deleted = nullptr) -> std::function<uint64_t(Query const&, Threshold)>
+{
+    if (query_type == "and") {
+        return [&, deleted](Query const& query, Threshold) {
+            and_query and_q(deleted);
+            return and_q(make_cursors(index, query), index.num_docs()).size();
+        };
+    }
+    if (query_type == "or") {
+        return [&, deleted](Query const& query, Threshold) {
+            or_query<false> or_q(deleted);
+            return or_q(make_cursors(index, query), index.num_docs());
+        };
+    }
+    if (query_type == "or_freq") {
+        return [&, deleted](Query const& query, Threshold) {
+            or_query<true> or_q(deleted);
+            return or_q(make_cursors(index, query), index.num_docs());
+        };
+    }
+    if (not with_wand_data) {
+        return {};
+    }
+    using scored_cursor_type = scored_cursor<IndexType, typename Scorer::term_scorer_type>;
+    using max_scored_cursor_type = max_scored_cursor<IndexType, typename Scorer::term_scorer_type>;
+    using block_max_scored_cursor_type =
+        block_max_scored_cursor<IndexType, WandType, typename Scorer::term_scorer_type>;
+    if (query_type == "wand") {
+        return [&, results, budget, context = QueryContext<max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            wand_query wand_q(context.topk, budget);
+            wand_q(make_max_scored_cursors(index, wdata, scorer, query, context), index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "block_max_wand") {
+        return [&,
+                results,
+                budget,
+                context = QueryContext<block_max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            block_max_wand_query block_max_wand_q(context.topk, budget);
+            block_max_wand_q(
+                make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "block_max_maxscore") {
+        return [&,
+                results,
+                budget,
+                context = QueryContext<block_max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            block_max_maxscore_query block_max_maxscore_q(context.topk, budget);
+            block_max_maxscore_q(
+                make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "ranked_and") {
+        return [&, results, context = QueryContext<scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            ranked_and_query ranked_and_q(context.topk);
+            ranked_and_q(make_scored_cursors(index, scorer, query, context), index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "block_max_ranked_and") {
+        return [&, results, context = QueryContext<block_max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            block_max_ranked_and_query block_max_ranked_and_q(context.topk);
+            block_max_ranked_and_q(
+                make_block_max_scored_cursors(index, wdata, scorer, query, context),
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "ranked_or") {
+        return [&, results, budget, context = QueryContext<scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            ranked_or_query ranked_or_q(context.topk, budget);
+            ranked_or_q(make_scored_cursors(index, scorer, query, context), index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "maxscore") {
+        return [&, results, budget, context = QueryContext<max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            maxscore_query maxscore_q(context.topk, budget);
+            maxscore_q(
+                make_max_scored_cursors(index, wdata, scorer, query, context),
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "parallel_ranked_or") {
+        return [&, results, context = QueryContext<scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            parallel_range_query<ranked_or_query, scored_cursor_type> parallel_q(context.topk);
+            parallel_q(
+                [&](auto& range_context) -> auto& {
+                    return make_scored_cursors(index, scorer, query, range_context);
+                },
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "parallel_wand") {
+        return [&, results, context = QueryContext<max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            parallel_range_query<wand_query, max_scored_cursor_type> parallel_q(context.topk);
+            parallel_q(
+                [&](auto& range_context) -> auto& {
+                    return make_max_scored_cursors(index, wdata, scorer, query, range_context);
+                },
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "parallel_maxscore") {
+        return [&, results, context = QueryContext<max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            parallel_range_query<maxscore_query, max_scored_cursor_type> parallel_q(context.topk);
+            parallel_q(
+                [&](auto& range_context) -> auto& {
+                    return make_max_scored_cursors(index, wdata, scorer, query, range_context);
+                },
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "parallel_block_max_wand") {
+        return [&, results, context = QueryContext<block_max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            parallel_range_query<block_max_wand_query, block_max_scored_cursor_type> parallel_q(
+                context.topk);
+            parallel_q(
+                [&](auto& range_context) -> auto& {
+                    return make_block_max_scored_cursors(
+                        index, wdata, scorer, query, range_context);
+                },
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "parallel_block_max_maxscore") {
+        return [&, results, context = QueryContext<block_max_scored_cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            parallel_range_query<block_max_maxscore_query, block_max_scored_cursor_type> parallel_q(
+                context.topk);
+            parallel_q(
+                [&](auto& range_context) -> auto& {
+                    return make_block_max_scored_cursors(
+                        index, wdata, scorer, query, range_context);
+                },
+                index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "ranked_or_taat") {
+        using context_type = QueryContext<scored_cursor_type, Simple_Accumulator>;
+        return [&,
+                results,
+                budget,
+                context = context_type(k, Simple_Accumulator(index.num_docs()), deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            ranked_or_taat_query ranked_or_taat_q(context.topk, budget);
+            ranked_or_taat_q(
+                make_scored_cursors(index, scorer, query, context),
+                index.num_docs(),
+                context.accumulator);
+            return finish(context.topk, results);
+        };
+    }
+    if (query_type == "ranked_or_taat_lazy") {
+        using context_type = QueryContext<scored_cursor_type, Lazy_Accumulator<4>>;
+        return [&,
+                results,
+                budget,
+                context = context_type(k, Lazy_Accumulator<4>(index.num_docs()), deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            ranked_or_taat_query ranked_or_taat_q(context.topk, budget);
+            ranked_or_taat_q(
+                make_scored_cursors(index, scorer, query, context),
+                index.num_docs(),
+                context.accumulator);
+            return finish(context.topk, results);
+        };
+    }
+    return {};
+}
+
+/// Returns the function processing each query with the algorithm `selector` predicts to be
+/// the fastest for it, or an empty function if any of its algorithms is not supported.
+template <typename IndexType, typename WandType, typename Scorer>
+auto make_auto_query_function(
+    IndexType const& index,
+    WandType const& wdata,
+    Scorer const& scorer,
+    AlgorithmSelector const& selector,
+    uint64_t k,
+    ResultCache::value_type* results = nullptr,
+    QueryBudget* budget = nullptr,
+    bit_vector const* deleted = nullptr) -> std::function<uint64_t(Query const&, Threshold)>
+{
+    std::vector<std::function<uint64_t(Query const&, Threshold)>> query_funs;
+    for (auto const& algorithm: selector.algorithms()) {
+        auto query_fun = make_query_function(
+            index, wdata, scorer, algorithm, k, true, results, budget, deleted);
+        if (not query_fun) {
+            spdlog::error("Unsupported query type in algorithm selector: {}", algorithm);
+            return {};
+        }
+        query_funs.push_back(std::move(query_fun));
+    }
+    return [&, query_funs = std::move(query_funs)](Query const& query, Threshold t) {
+        return query_funs[selector.select(QueryFeatures::compute(wdata, query))](query, t);
+    };
+}
+
+/// Returns the function processing a single query with algorithm `query_type`, which replaces
+/// the cursors of two terms with a single cursor over their intersection whenever `pairs`
+/// stores it, or an empty function if the algorithm does not support pair lists.
+template <typename IndexType, typename WandType, typename Scorer>
+auto make_pair_query_function(
+    IndexType const& index,
+    pair_index<IndexType> const& pairs,
+    WandType const& wdata,
+    Scorer const& scorer,
+    std::string const& query_type,
+    uint64_t k,
+    ResultCache::value_type* results = nullptr,
+    bit_vector const* deleted = nullptr) -> std::function<uint64_t(Query const&, Threshold)>
+{
+    using term_scorer_type = pair_term_scorer<typename Scorer::term_scorer_type>;
+    using block_max_enumerator = typename detail::block_max_enumerator<IndexType, WandType>::type;
+    if (query_type == "ranked_and") {
+        using cursor_type = scored_cursor<IndexType, term_scorer_type>;
+        return [&, results, context = QueryContext<cursor_type>(k, deleted)](
+                   Query const& query, Threshold t) mutable {
+            context.reset(t);
+            ranked_and_query ranked_and_q(context.topk);
+            ranked_and_q(
+                make_pair_scored_cursors(index, pairs, scorer, query, context), index.num_docs());
+            return finish(context.topk, results);
+        };
+    }
+    if constexpr (std::is_same_v<block_max_enumerator, wand_data_raw::enumerator>) {
+        if (query_type == "block_max_ranked_and") {
+            using cursor_type = block_max_scored_cursor<IndexType, WandType, term_scorer_type>;
+            return [&, results, context = QueryContext<cursor_type>(k, deleted)](
+                       Query const& query, Threshold t) mutable {
+                context.reset(t);
+                block_max_ranked_and_query block_max_ranked_and_q(context.topk);
+                block_max_ranked_and_q(
+                    make_pair_block_max_scored_cursors(index, pairs, wdata, scorer, query, context),
+                    index.num_docs());
+                return finish(context.topk, results);
+            };
+        }
+    }
+    return {};
+}
+
+/// Returns the function processing a single query score-at-a-time over `index`,
+/// stopping after `postings_budget` postings.
+auto make_saat_query_function(
+    impact_ordered_index const& index,
+    uint64_t k,
+    uint64_t postings_budget,
+    ResultCache::value_type* results = nullptr,
+    bit_vector const* deleted = nullptr) -> std::function<uint64_t(Query const&, Threshold)>
+{
+    using context_type = QueryContext<impact_cursor, Lazy_Accumulator<4>>;
+    return [&,
+            postings_budget,
+            results,
+            context = context_type(k, Lazy_Accumulator<4>(index.num_docs()), deleted)](
+               Query const& query, Threshold t) mutable {
+        context.reset(t);
+        saat_query saat_q(context.topk, postings_budget);
+        saat_q(make_impact_cursors(index, query, context), index.num_docs(), context.accumulator);
+        return finish(context.topk, results);
+    };
+}
+
+/// Returns a function looking up the results of each query in `cache` before processing it with
+/// `query_fun`, which must write its results to `results`. Misses are added to the cache.
+auto make_cached_query_function(
+    std::function<uint64_t(Query const&, Threshold)> query_fun,
+    std::shared_ptr<ResultCache::value_type> results,
+    ResultCache& cache,
+    ResultCache::Key key) -> std::function<uint64_t(Query const&, Threshold)>
+{
+    return [&cache, query_fun = std::move(query_fun), results = std::move(results), key](
+               Query const& query, Threshold t) mutable {
+        key.assign(query);
+        if (cache.find(key, *results)) {
+            return results->size();
+        }
+        query_fun(query, t);
+        cache.insert(key, *results);
+        return results->size();
+    };
+}
+
+/// Logs how many of `queries` are assigned to each algorithm of `selector`.
+template <typename WandType>
+void log_selected_algorithms(
+    AlgorithmSelector const& selector, WandType const& wdata, std::vector<Query> const& queries)
+{
+    std::vector<std::size_t> counts(selector.algorithms().size(), 0);
+    for (auto const& query: queries) {
+        counts[selector.select(QueryFeatures::compute(wdata, query))] += 1;
+    }
+    for (auto&& [alg, count]: enumerate(counts)) {
+        spdlog::info("Selected {} for {} queries", selector.algorithms()[alg], count);
     }
 }
 
@@ -125,12 +612,25 @@ void perftest(
     uint64_t k,
     std::string const& scorer_name,
     bool extract,
-    bool safe)
+    bool safe,
+    bool scorer_speedup,
+    std::optional<std::string> const& impact_index_filename,
+    uint64_t postings_budget,
+    std::optional<std::string> const& trace_filename,
+    std::optional<std::string> const& algorithm_model_filename,
+    std::function<std::unique_ptr<ResultCache>()> const& make_cache,
+    std::vector<Query> const& cache_static_queries,
+    std::optional<std::string> const& pair_index_filename,
+    std::optional<std::string> const& deleted_docs_filename,
+    QueryBudget query_budget)
 {
     IndexType index;
     spdlog::info("Loading index from {}", index_filename);
     mio::mmap_source m(index_filename.c_str());
     mapper::map(index, m);
+    if constexpr (has_block_max_scores<IndexType>::value) {
+        index.check_scorer(scorer::describe<WandType>(scorer_name));
+    }
 
     spdlog::info("Warming up posting lists");
     std::unordered_set<term_id_type> warmed_up;
@@ -158,6 +658,41 @@ void perftest(
         mapper::map(wdata, md, mapper::map_flags::warmup);
     }
 
+    impact_ordered_index impact_index;
+    mio::mmap_source mi;
+    if (impact_index_filename) {
+        spdlog::info("Loading impact-ordered index from {}", *impact_index_filename);
+        std::error_code error;
+        mi.map(*impact_index_filename, error);
+        if (error) {
+            std::cerr << "error mapping file: " << error.message() << ", exiting..." << std::endl;
+            throw std::runtime_error("Error opening file");
+        }
+        mapper::map(impact_index, mi);
+    }
+
+    pair_index<IndexType> pairs;
+    mio::mmap_source mp;
+    if (pair_index_filename) {
+        spdlog::info("Loading pair index from {}", *pair_index_filename);
+        std::error_code error;
+        mp.map(*pair_index_filename, error);
+        if (error) {
+            std::cerr << "error mapping file: " << error.message() << ", exiting..." << std::endl;
+            throw std::runtime_error("Error opening file");
+        }
+        mapper::map(pairs, mp);
+        pairs.check_scorer(scorer::describe<WandType>(scorer_name));
+    }
+
+    std::optional<Deleted_Documents> deleted_documents;
+    if (deleted_docs_filename) {
+        spdlog::info("Loading deleted documents from {}", *deleted_docs_filename);
+        deleted_documents.emplace(*deleted_docs_filename, index.num_docs());
+        spdlog::info("Deleted documents: {}", deleted_count(deleted_documents->bits()));
+    }
+    bit_vector const* deleted = deleted_documents ? &deleted_documents->bits() : nullptr;
+
     std::vector<Threshold> thresholds(queries.size(), 0.0);
     if (thresholds_filename) {
         std::string t;
@@ -172,127 +707,168 @@ void perftest(
         }
     }
 
-    auto scorer = scorer::from_name(scorer_name, wdata);
+    AlgorithmSelector selector;
+    if (algorithm_model_filename) {
+        spdlog::info("Loading algorithm selector from {}", *algorithm_model_filename);
+        std::ifstream model(*algorithm_model_filename);
+        selector = AlgorithmSelector::read(model);
+    }
+
+    std::ofstream trace;
+    if (trace_filename) {
+        trace.open(*trace_filename);
+        if constexpr (not query_counters::enabled) {
+            spdlog::warn("Query counters are disabled: tracing only query times");
+        }
+    }
 
     spdlog::info("Performing {} queries", type);
     spdlog::info("K: {}", k);
 
-    for (auto&& t: query_types) {
-        spdlog::info("Query type: {}", t);
-        std::function<uint64_t(Query, Threshold)> query_fun;
-        if (t == "and") {
-            query_fun = [&](Query query, Threshold) {
-                and_query and_q;
-                return and_q(make_cursors(index, query), index.num_docs()).size();
-            };
-        } else if (t == "or") {
-            query_fun = [&](Query query, Threshold) {
-                or_query<false> or_q;
-                return or_q(make_cursors(index, query), index.num_docs());
-            };
-        } else if (t == "or_freq") {
-            query_fun = [&](Query query, Threshold) {
-                or_query<true> or_q;
-                return or_q(make_cursors(index, query), index.num_docs());
-            };
-        } else if (t == "wand" && wand_data_filename) {
-            query_fun = [&](Query query, Threshold t) {
-                topk_queue topk(k);
-                topk.set_threshold(t);
-                wand_query wand_q(topk);
-                wand_q(make_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "block_max_wand" && wand_data_filename) {
-            query_fun = [&](Query query, Threshold t) {
-                topk_queue topk(k);
-                topk.set_threshold(t);
-                block_max_wand_query block_max_wand_q(topk);
-                block_max_wand_q(
-                    make_block_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "block_max_maxscore" && wand_data_filename) {
-            query_fun = [&](Query query, Threshold t) {
-                topk_queue topk(k);
-                topk.set_threshold(t);
-                block_max_maxscore_query block_max_maxscore_q(topk);
-                block_max_maxscore_q(
-                    make_block_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "ranked_and" && wand_data_filename) {
-            query_fun = [&](Query query, Threshold t) {
-                topk_queue topk(k);
-                topk.set_threshold(t);
-                ranked_and_query ranked_and_q(topk);
-                ranked_and_q(make_scored_cursors(index, *scorer, query), index.num_docs());
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "block_max_ranked_and" && wand_data_filename) {
-            query_fun = [&](Query query, Threshold t) {
-                topk_queue topk(k);
-                topk.set_threshold(t);
-                block_max_ranked_and_query block_max_ranked_and_q(topk);
-                block_max_ranked_and_q(
-                    make_block_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "ranked_or" && wand_data_filename) {
-            query_fun = [&](Query query, Threshold t) {
-                topk_queue topk(k);
-                topk.set_threshold(t);
-                ranked_or_query ranked_or_q(topk);
-                ranked_or_q(make_scored_cursors(index, *scorer, query), index.num_docs());
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "maxscore" && wand_data_filename) {
-            query_fun = [&](Query query, Threshold t) {
-                topk_queue topk(k);
-                topk.set_threshold(t);
-                maxscore_query maxscore_q(topk);
-                maxscore_q(make_max_scored_cursors(index, wdata, *scorer, query), index.num_docs());
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "ranked_or_taat" && wand_data_filename) {
-            Simple_Accumulator accumulator(index.num_docs());
-            topk_queue topk(k);
-            ranked_or_taat_query ranked_or_taat_q(topk);
-            query_fun = [&, ranked_or_taat_q, accumulator](Query query, Threshold t) mutable {
-                topk.set_threshold(t);
-                ranked_or_taat_q(
-                    make_scored_cursors(index, *scorer, query), index.num_docs(), accumulator);
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else if (t == "ranked_or_taat_lazy" && wand_data_filename) {
-            Lazy_Accumulator<4> accumulator(index.num_docs());
-            topk_queue topk(k);
-            ranked_or_taat_query ranked_or_taat_q(topk);
-            query_fun = [&, ranked_or_taat_q, accumulator](Query query, Threshold t) mutable {
-                topk.set_threshold(t);
-                ranked_or_taat_q(
-                    make_scored_cursors(index, *scorer, query), index.num_docs(), accumulator);
-                topk.finalize();
-                return topk.topk().size();
-            };
-        } else {
-            spdlog::error("Unsupported query type: {}", t);
-            break;
-        }
-        if (extract) {
-            extract_times(query_fun, queries, thresholds, type, t, 2, std::cout);
-        } else {
-            op_perftest(query_fun, queries, thresholds, type, t, 2, k, safe);
+    scorer::with_scorer(scorer_name, wdata, [&](auto const& scorer) {
+        index_scorer<WandType> const& erased_scorer = scorer;
+        for (auto&& t: query_types) {
+            spdlog::info("Query type: {}", t);
+            bool saat = t == "saat";
+            if (saat and not impact_index_filename) {
+                spdlog::error("Query type saat requires an impact-ordered index (--impact-index)");
+                break;
+            }
+            bool selected = t == "auto";
+            if (selected and not (algorithm_model_filename and wand_data_filename)) {
+                spdlog::error("Query type auto requires WAND data and --algorithm-model");
+                break;
+            }
+            QueryBudget* budget = nullptr;
+            if (query_budget.limited()) {
+                auto const& algorithms = selected ? selector.algorithms() : std::vector{t};
+                if (std::all_of(algorithms.begin(), algorithms.end(), supports_budget)) {
+                    budget = &query_budget;
+                } else {
+                    spdlog::warn("Query type {} does not support the query budget", t);
+                }
+            }
+            auto cache = make_cache();
+            if (cache and (t == "and" or t == "or" or t == "or_freq")) {
+                spdlog::warn("The result cache is only used by ranked query types");
+                cache.reset();
+            }
+            if (cache and budget != nullptr) {
+                spdlog::warn("The result cache is not used with a query budget");
+                cache.reset();
+            }
+            auto results = cache or budget != nullptr
+                ? std::make_shared<ResultCache::value_type>()
+                : nullptr;
+            auto query_fun = [&]() -> std::function<uint64_t(Query const&, Threshold)> {
+                if (saat) {
+                    return make_saat_query_function(
+                        impact_index, k, postings_budget, results.get(), deleted);
+                }
+                if (selected) {
+                    log_selected_algorithms(selector, wdata, queries);
+                    return make_auto_query_function(
+                        index, wdata, scorer, selector, k, results.get(), budget, deleted);
+                }
+                if (pair_index_filename) {
+                    if (auto query_fun = make_pair_query_function(
+                            index, pairs, wdata, scorer, t, k, results.get(), deleted);
+                        query_fun) {
+                        return query_fun;
+                    }
+                    spdlog::warn("The pair index is not used by query type {}", t);
+                }
+                return make_query_function(
+                    index,
+                    wdata,
+                    scorer,
+                    t,
+                    k,
+                    wand_data_filename.has_value(),
+                    results.get(),
+                    budget,
+                    deleted);
+            }();
+            if (not query_fun) {
+                spdlog::error("Unsupported query type: {}", t);
+                break;
+            }
+            if (budget != nullptr) {
+                query_fun = [budget, query_fun = std::move(query_fun)](
+                                Query const& query, Threshold t) {
+                    budget->start();
+                    return query_fun(query, t);
+                };
+            }
+            if (trace_filename) {
+                trace_queries(query_fun, queries, thresholds, type, t, trace);
+            }
+            if (extract) {
+                extract_times(query_fun, queries, thresholds, type, t, 2, std::cout);
+                continue;
+            }
+            auto avg = op_perftest(query_fun, queries, thresholds, type, t, 2, k, safe);
+            if (budget != nullptr) {
+                ResultCache::value_type exhaustive;
+                auto exhaustive_fun = selected
+                    ? make_auto_query_function(
+                        index, wdata, scorer, selector, k, &exhaustive, nullptr, deleted)
+                    : make_query_function(
+                        index,
+                        wdata,
+                        scorer,
+                        t,
+                        k,
+                        wand_data_filename.has_value(),
+                        &exhaustive,
+                        nullptr,
+                        deleted);
+                evaluate_budget(
+                    query_fun,
+                    exhaustive_fun,
+                    *budget,
+                    *results,
+                    exhaustive,
+                    queries,
+                    thresholds,
+                    type,
+                    t);
+            }
+            if (cache) {
+                ResultCache::Key key{t, scorer_name, k, {}};
+                cache->fill_static(cache_static_queries, key, [&](Query const& query) {
+                    query_fun(query, 0);
+                    return *results;
+                });
+                op_perftest(
+                    make_cached_query_function(query_fun, results, *cache, key),
+                    queries,
+                    thresholds,
+                    type,
+                    t + " (cached)",
+                    2,
+                    k,
+                    safe,
+                    cache.get());
+            }
+            if (scorer_speedup and not saat and not selected and not pair_index_filename) {
+                auto erased_query_fun = make_query_function(
+                    index,
+                    wdata,
+                    erased_scorer,
+                    t,
+                    k,
+                    wand_data_filename.has_value(),
+                    nullptr,
+                    nullptr,
+                    deleted);
+                auto erased_avg = op_perftest(
+                    erased_query_fun, queries, thresholds, type, t + " (erased scorer)", 2, k, safe);
+                spdlog::info("---- {} {} scorer speedup: {:.2f}x", type, t, erased_avg / avg);
+                stats_line()("type", type)("query", t)("scorer_speedup", erased_avg / avg);
+            }
         }
-    }
+    });
 }
 
 using wand_raw_index = wand_data<wand_data_raw>;
@@ -305,14 +881,40 @@ int main(int argc, const char** argv)
     bool silent = false;
     bool safe = false;
     bool quantized = false;
+    bool scorer_speedup = false;
+    std::optional<std::string> trace_filename;
+    std::optional<std::string> algorithm_model_filename;
 
-    App<arg::Index, arg::WandData, arg::Query<arg::QueryMode::Ranked>, arg::Algorithm, arg::Scorer, arg::Thresholds>
+    App<arg::Index,
+        arg::WandData,
+        arg::Query<arg::QueryMode::Ranked>,
+        arg::Algorithm,
+        arg::Scorer,
+        arg::Thresholds,
+        arg::ImpactIndex,
+        arg::BlockMaxScores,
+        arg::ResultCache,
+        arg::PairIndex,
+        arg::DeletedDocuments,
+        arg::QueryBudget>
         app{"Benchmarks queries on a given index."};
     app.add_flag("--quantized", quantized, "Quantized scores");
     app.add_flag("--extract", extract, "Extract individual query times");
     app.add_flag("--silent", silent, "Suppress logging");
     app.add_flag("--safe", safe, "Rerun if not enough results with pruning.")
         ->needs(app.thresholds_option());
+    app.add_flag(
+        "--scorer-speedup",
+        scorer_speedup,
+        "Also run each algorithm with the type-erased scorer and report the speedup");
+    app.add_option(
+        "--trace",
+        trace_filename,
+        "Write the time and execution counters of each query to this file as JSON lines");
+    app.add_option(
+        "--algorithm-model",
+        algorithm_model_filename,
+        "Algorithm selection model used by `-a auto` (see train_algorithm_selector)");
     CLI11_PARSE(app, argc, argv);
 
     if (silent) {
@@ -321,7 +923,7 @@ int main(int argc, const char** argv)
         spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
     }
     if (extract) {
-        std::cout << "qid\tusec\n";
+        std::cout << "qid\talgorithm\tusec\n";
     }
 
     auto params = std::make_tuple(
@@ -334,7 +936,48 @@ int main(int argc, const char** argv)
         app.k(),
         app.scorer(),
         extract,
-        safe);
+        safe,
+        scorer_speedup,
+        app.impact_index_filename(),
+        app.postings_budget(),
+        trace_filename,
+        algorithm_model_filename,
+        std::function<std::unique_ptr<ResultCache>()>([&app]() { return app.result_cache(); }),
+        app.cache_static_queries() ? app.queries(*app.cache_static_queries())
+                                   : std::vector<Query>{},
+        app.pair_index_filename(),
+        app.deleted_documents_filename(),
+        app.query_budget());
+    if (app.pair_index_filename() and not app.wand_data_path()) {
+        spdlog::error("The pair index requires WAND data (--wand)");
+        return 1;
+    }
+    if (app.block_max_scores()) {
+        if (app.pair_index_filename()) {
+            spdlog::error("The pair index does not support embedded block-max scores");
+            return 1;
+        }
+        if (app.is_wand_compressed()) {
+            spdlog::error("Embedded block-max scores are used instead of compressed WAND data");
+            return 1;
+        }
+        if (false) {  // NOLINT
+#define LOOP_BODY(R, DATA, T)                                                           \
+    }                                                                                   \
+    else if (app.index_encoding() == BOOST_PP_STRINGIZE(T))                             \
+    {                                                                                   \
+        std::apply(                                                                     \
+            perftest<with_block_max_scores_t<BOOST_PP_CAT(T, _index)>, wand_raw_index>, \
+            params);                                                                    \
+        /**/
+            BOOST_PP_SEQ_FOR_EACH(LOOP_BODY, _, PISA_BLOCK_INDEX_TYPES);
+#undef LOOP_BODY
+        } else {
+            spdlog::error("Block-max scores are not supported by type {}", app.index_encoding());
+        }
+        return 0;
+    }
+
     /**/
     if (false) {
 #define LOOP_BODY(R, DATA, T)                                                                        \
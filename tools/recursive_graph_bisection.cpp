@@ -99,6 +99,9 @@ int main(int argc, char const* argv[])
         : forward_index::from_inverted_index(input_basename, min_len, not nogb);
     if (app.count("--store-fwdidx") > 0u) {
         forward_index::write(fwd, output_fwd);
+        if (output_provided) {
+            fwd = forward_index::read(output_fwd);
+        }
     }
 
     if (output_provided) {
@@ -121,7 +124,7 @@ int main(int argc, char const* argv[])
             }
         }
         auto mapping = get_mapping(documents);
-        fwd.clear();
+        fwd = forward_index();
         documents.clear();
         reorder_inverted_index(input_basename, output_basename, mapping);
 
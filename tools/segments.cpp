@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <CLI/CLI.hpp>
+#include <boost/algorithm/string.hpp>
+#include <mio/mmap.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+#include <tbb/task_scheduler_init.h>
+
+#include "cursor/block_max_scored_cursor.hpp"
+#include "cursor/max_scored_cursor.hpp"
+#include "cursor/scored_cursor.hpp"
+#include "deleted_documents.hpp"
+#include "index_types.hpp"
+#include "io.hpp"
+#include "mappable/mapper.hpp"
+#include "payload_vector.hpp"
+#include "query/algorithm.hpp"
+#include "query/queries.hpp"
+#include "query/term_processor.hpp"
+#include "scorer/scorer.hpp"
+#include "segmented_index.hpp"
+#include "tokenizer.hpp"
+#include "util/util.hpp"
+#include "wand_data.hpp"
+#include "wand_data_raw.hpp"
+
+using namespace pisa;
+using wand_raw_index = wand_data<wand_data_raw>;
+
+template <typename Index, typename Wand>
+void add_to_segmented_index(
+    std::string const& dir,
+    std::vector<std::string> const& forward_indexes,
+    Segment_Options const& options,
+    Tiered_Merge_Policy const& policy)
+{
+    boost::filesystem::create_directories(dir);
+    Segmented_Index_Writer<Index, Wand> writer(dir, options, policy);
+    for (auto const& forward_index: forward_indexes) {
+        writer.add(forward_index);
+    }
+    writer.wait();
+    spdlog::info("Index has {} segments", writer.segments().size());
+}
+
+template <typename Index, typename Wand>
+void merge_segmented_index(
+    std::string const& dir,
+    Segment_Options const& options,
+    Tiered_Merge_Policy const& policy,
+    bool all)
+{
+    Segmented_Index_Writer<Index, Wand> writer(dir, options, policy);
+    if (all) {
+        writer.merge_all();
+    } else {
+        writer.schedule_merges();
+        writer.wait();
+    }
+    spdlog::info("Index has {} segments", writer.segments().size());
+}
+
+/// A segment loaded for querying, along with its deleted documents if any. Its WAND data holds
+/// the statistics of the whole index, so that its scores can be compared with those of the other
+/// segments.
+template <typename Index, typename Wand>
+struct Loaded_Segment {
+    Loaded_Segment(std::string const& basename, std::optional<std::string> const& stemmer)
+        : index_source((basename + ".index").c_str()),
+          wand_source((basename + ".wand").c_str()),
+          term_processor(basename + ".termlex", std::nullopt, stemmer)
+    {
+        mapper::map(index, index_source);
+        mapper::map(wdata, wand_source, mapper::map_flags::warmup);
+        if (boost::filesystem::exists(basename + ".doclex")) {
+            doclex_source = std::make_unique<mio::mmap_source>((basename + ".doclex").c_str());
+            doclex = Payload_Vector<>::from(*doclex_source);
+        }
+        if (boost::filesystem::exists(basename + ".deleted")) {
+            deleted.emplace(basename + ".deleted", index.num_docs());
+        }
+    }
+
+    mio::mmap_source index_source;
+    mio::mmap_source wand_source;
+    Index index;
+    Wand wdata;
+    TermProcessor term_processor;
+    std::unique_ptr<mio::mmap_source> doclex_source;
+    std::optional<Payload_Vector<>> doclex;
+    std::optional<Deleted_Documents> deleted;
+};
+
+/// Returns the scorer of type `Scorer`, named `scorer_name`, of each segment.
+template <typename Scorer, typename Segments>
+auto segment_scorers(Segments const& segments, std::string const& scorer_name)
+    -> std::vector<Scorer>
+{
+    std::vector<Scorer> scorers;
+    for (auto const& segment: segments) {
+        scorer::with_scorer(scorer_name, segment->wdata, [&](auto const& scorer) {
+            if constexpr (std::is_same_v<std::decay_t<decltype(scorer)>, Scorer>) {
+                scorers.push_back(scorer);
+            } else {
+                throw std::invalid_argument("Segments must have the same WAND data options");
+            }
+        });
+    }
+    return scorers;
+}
+
+/// Runs `QueryAlg` over all segments, where `queries[segment]` has the term IDs of the segment,
+/// skipping the documents of `deleted[segment]`.
+template <typename QueryAlg, typename Segments, typename Scorers, typename CursorFactory>
+void run_segmented(
+    Segments const& segments,
+    Scorers const& scorers,
+    std::vector<Query> const& queries,
+    std::vector<std::uint64_t> const& num_docs,
+    std::vector<bit_vector const*> const& deleted,
+    CursorFactory make_cursors,
+    topk_queue& topk)
+{
+    segmented_query<QueryAlg> query_alg(topk);
+    query_alg(
+        [&](std::size_t segment) {
+            return make_cursors(*segments[segment], scorers[segment], queries[segment]);
+        },
+        num_docs,
+        deleted);
+}
+
+template <typename Index, typename Wand>
+void query_segmented_index(
+    std::string const& dir,
+    std::string const& scorer_name,
+    std::optional<std::string> const& stemmer,
+    std::string const& algorithm,
+    std::vector<std::string> const& query_lines,
+    std::uint64_t k,
+    std::string const& run_id)
+{
+    auto manifest = segments::read_manifest(dir);
+    if (not manifest.segments.empty() && manifest.scorer != scorer_name) {
+        spdlog::error("The segments are scored with {}, not {}", manifest.scorer, scorer_name);
+        return;
+    }
+    spdlog::info("Loading {} segments", manifest.segments.size());
+    std::vector<std::unique_ptr<Loaded_Segment<Index, Wand>>> loaded;
+    std::vector<std::uint64_t> num_docs;
+    std::vector<std::uint64_t> first_docids;
+    std::vector<bit_vector const*> deleted;
+    std::uint64_t total_docs = 0;
+    for (auto const& segment: manifest.segments) {
+        loaded.push_back(std::make_unique<Loaded_Segment<Index, Wand>>(
+            segments::basename(dir, segment.name), stemmer));
+        auto const& segment_deleted = loaded.back()->deleted;
+        deleted.push_back(segment_deleted ? &segment_deleted->bits() : nullptr);
+        num_docs.push_back(segment.num_docs);
+        first_docids.push_back(total_docs);
+        total_docs += segment.num_docs;
+    }
+
+    if (loaded.empty()) {
+        spdlog::error("The index has no segments");
+        return;
+    }
+
+    using std::chrono::steady_clock;
+    std::vector<double> times;
+    scorer::with_scorer(scorer_name, loaded.front()->wdata, [&](auto const& first_scorer) {
+        using Scorer = std::decay_t<decltype(first_scorer)>;
+        auto scorers = segment_scorers<Scorer>(loaded, scorer_name);
+        for (std::size_t query_idx = 0; query_idx < query_lines.size(); ++query_idx) {
+            auto [id, raw_query] = split_query_at_colon(query_lines[query_idx]);
+            std::vector<Query> queries;
+            for (auto& segment: loaded) {
+                Query query{id, {}, {}};
+                TermTokenizer tokenizer(raw_query);
+                for (auto term = tokenizer.begin(); term != tokenizer.end(); ++term) {
+                    if (auto term_id = segment->term_processor(std::string(*term)); term_id) {
+                        query.terms.push_back(*term_id);
+                    }
+                }
+                queries.push_back(std::move(query));
+            }
+
+            topk_queue topk(k);
+            auto start = steady_clock::now();
+            auto scored = [](auto& segment, auto const& scorer, Query const& query) {
+                return make_scored_cursors(segment.index, scorer, query);
+            };
+            auto max_scored = [](auto& segment, auto const& scorer, Query const& query) {
+                return make_max_scored_cursors(segment.index, segment.wdata, scorer, query);
+            };
+            auto block_max_scored = [](auto& segment, auto const& scorer, Query const& query) {
+                return make_block_max_scored_cursors(segment.index, segment.wdata, scorer, query);
+            };
+            if (algorithm == "ranked_or") {
+                run_segmented<ranked_or_query>(
+                    loaded, scorers, queries, num_docs, deleted, scored, topk);
+            } else if (algorithm == "wand") {
+                run_segmented<wand_query>(
+                    loaded, scorers, queries, num_docs, deleted, max_scored, topk);
+            } else if (algorithm == "maxscore") {
+                run_segmented<maxscore_query>(
+                    loaded, scorers, queries, num_docs, deleted, max_scored, topk);
+            } else if (algorithm == "block_max_wand") {
+                run_segmented<block_max_wand_query>(
+                    loaded, scorers, queries, num_docs, deleted, block_max_scored, topk);
+            } else if (algorithm == "block_max_maxscore") {
+                run_segmented<block_max_maxscore_query>(
+                    loaded, scorers, queries, num_docs, deleted, block_max_scored, topk);
+            } else {
+                spdlog::error("Unsupported query type: {}", algorithm);
+                return;
+            }
+            topk.finalize();
+            times.push_back(
+                std::chrono::duration<double, std::micro>(steady_clock::now() - start).count());
+
+            std::size_t rank = 0;
+            for (auto const& [score, docid]: topk.topk()) {
+                auto next_segment =
+                    std::upper_bound(first_docids.begin(), first_docids.end(), docid);
+                auto segment = std::distance(first_docids.begin(), next_segment) - 1;
+                auto const& doclex = loaded[segment]->doclex;
+                std::cout << fmt::format(
+                    "{}\t{}\t{}\t{}\t{}\t{}\n",
+                    id.value_or(std::to_string(query_idx)),
+                    "Q0",
+                    doclex ? std::string((*doclex)[docid - first_docids[segment]])
+                           : std::to_string(docid),
+                    rank++,
+                    score,
+                    run_id);
+            }
+        }
+    });
+    if (not times.empty()) {
+        double mean = std::accumulate(times.begin(), times.end(), double()) / times.size();
+        spdlog::info("Mean query time: {} usec", mean);
+        stats_line()("type", algorithm)("segments", manifest.segments.size())("query", mean);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    spdlog::set_default_logger(spdlog::stderr_color_mt("default"));
+
+    std::string encoding;
+    std::string dir;
+    Segment_Options options;
+    Tiered_Merge_Policy policy;
+    std::vector<std::string> forward_indexes;
+    bool merge_all = false;
+    std::string algorithm;
+    std::string query_file;
+    std::optional<std::string> stemmer;
+    std::uint64_t k = 10;
+    std::string run_id = "R0";
+
+    CLI::App app{"Builds, merges, and queries an index made of immutable segments"};
+    app.require_subcommand(1);
+    app.add_option("-e,--encoding", encoding, "Index encoding")->required();
+    app.add_option("-d,--dir", dir, "Directory of the segmented index")->required();
+    app.add_option("-s,--scorer", options.scorer, "Scorer function", true);
+    app.add_option("--threads", options.threads, "Number of threads", true);
+
+    auto add = app.add_subcommand("add", "Add forward indexes as new segments");
+    add->add_option("forward_index", forward_indexes, "Basenames of forward indexes")->required();
+    add->add_option("-b,--batch-size", options.batch_size, "Inversion batch size", true);
+    add->add_option("--block-size", options.block_size, "WAND data block size", true);
+    auto merge = app.add_subcommand("merge", "Merge segments with the merge policy");
+    merge->add_flag("--all", merge_all, "Merge all segments into one");
+    merge->add_option("--block-size", options.block_size, "WAND data block size", true);
+    for (auto* command: {add, merge}) {
+        command->add_option(
+            "--merge-factor", policy.merge_factor, "Number of segments merged at once", true);
+        command->add_option(
+            "--min-segment-docs", policy.min_segment_docs, "Documents of the smallest tier", true);
+    }
+    auto query = app.add_subcommand("query", "Query the segments");
+    query->add_option("-a,--algorithm", algorithm, "Query processing algorithm")->required();
+    query->add_option("-q,--queries", query_file, "Path to file with queries")->required();
+    query->add_option("-k", k, "The number of top results to return", true);
+    query->add_option("--stemmer", stemmer, "Stemmer type");
+    query->add_option("-r,--run", run_id, "Run identifier", true);
+    CLI11_PARSE(app, argc, argv);
+
+    tbb::task_scheduler_init init(options.threads);
+    std::vector<std::string> query_lines;
+    if (*query) {
+        query_lines = io::read_string_vector(query_file);
+    }
+
+    /**/
+    if (false) {
+#define LOOP_BODY(R, DATA, T)                                                     \
+    }                                                                             \
+    else if (encoding == BOOST_PP_STRINGIZE(T))                                   \
+    {                                                                             \
+        using index_type = BOOST_PP_CAT(T, _index);                               \
+        if (*add) {                                                               \
+            add_to_segmented_index<index_type, wand_raw_index>(                   \
+                dir, forward_indexes, options, policy);                           \
+        } else if (*merge) {                                                      \
+            merge_segmented_index<index_type, wand_raw_index>(                    \
+                dir, options, policy, merge_all);                                 \
+        } else {                                                                  \
+            query_segmented_index<index_type, wand_raw_index>(                    \
+                dir, options.scorer, stemmer, algorithm, query_lines, k, run_id); \
+        }                                                                         \
+        /**/
+
+        BOOST_PP_SEQ_FOR_EACH(LOOP_BODY, _, PISA_INDEX_TYPES);
+#undef LOOP_BODY
+
+    } else {
+        spdlog::error("Unknown type {}", encoding);
+        return 1;
+    }
+    return 0;
+}
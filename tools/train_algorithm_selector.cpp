@@ -0,0 +1,148 @@
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <CLI/CLI.hpp>
+#include <mio/mmap.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <spdlog/spdlog.h>
+
+#include "app.hpp"
+#include "io.hpp"
+#include "mappable/mapper.hpp"
+#include "query/algorithm_selector.hpp"
+#include "wand_data.hpp"
+#include "wand_data_compressed.hpp"
+#include "wand_data_raw.hpp"
+
+using namespace pisa;
+
+/// Per-query times of each algorithm, as written by `queries --extract`, along with the
+/// features of the queries.
+struct TrainingData {
+    std::map<std::string, QueryFeatures> features;
+    std::map<std::string, std::map<std::string, double>> times;
+
+    [[nodiscard]] auto samples() const
+        -> std::map<std::string, std::vector<AlgorithmSelector::Sample>>
+    {
+        std::map<std::string, std::vector<AlgorithmSelector::Sample>> samples;
+        for (auto const& [qid, query_times]: times) {
+            for (auto const& [algorithm, usecs]: query_times) {
+                samples[algorithm].push_back({features.at(qid), usecs});
+            }
+        }
+        return samples;
+    }
+};
+
+/// Reads the times in `times_filenames`, computing the features of the queries from
+/// the WAND data.
+template <typename WandType>
+auto read_training_data(
+    std::string const& wand_data_filename,
+    std::vector<Query> const& queries,
+    std::vector<std::string> const& times_filenames) -> TrainingData
+{
+    WandType wdata;
+    mio::mmap_source md;
+    std::error_code error;
+    md.map(wand_data_filename, error);
+    if (error) {
+        spdlog::error("error mapping file: {}, exiting...", error.message());
+        std::abort();
+    }
+    mapper::map(wdata, md);
+
+    TrainingData data;
+    for (std::size_t idx = 0; idx < queries.size(); ++idx) {
+        data.features[queries[idx].id.value_or(std::to_string(idx))] =
+            QueryFeatures::compute(wdata, queries[idx]);
+    }
+
+    std::size_t unknown = 0;
+    for (auto const& filename: times_filenames) {
+        std::ifstream is(filename);
+        io::for_each_line(is, [&](std::string const& line) {
+            std::istringstream fields(line);
+            std::string qid;
+            std::string algorithm;
+            double usecs = 0;
+            if (!(fields >> qid >> algorithm >> usecs)) {
+                return;  // header
+            }
+            if (data.features.find(qid) != data.features.end()) {
+                data.times[qid][algorithm] = usecs;
+            } else {
+                unknown += 1;
+            }
+        });
+    }
+    if (unknown > 0) {
+        spdlog::warn("Skipped {} times of queries missing from the query file", unknown);
+    }
+    return data;
+}
+
+int main(int argc, const char** argv)
+{
+    spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+
+    std::vector<std::string> times_filenames;
+    std::string output_filename;
+    double ridge = 1e-3;
+
+    App<arg::WandData, arg::Query<arg::QueryMode::Unranked>> app{
+        "Trains the model selecting the query algorithm used by `queries -a auto`."};
+    app.add_option(
+           "--times",
+           times_filenames,
+           "Per-query times written by `queries --extract` (one or more files)")
+        ->required();
+    app.add_option("-o,--output", output_filename, "Output model filename")->required();
+    app.add_option("--ridge", ridge, "Weight of the regularization of the model", true);
+    CLI11_PARSE(app, argc, argv);
+
+    if (not app.wand_data_path()) {
+        spdlog::error("WAND data (-w) is required to compute query features");
+        return 1;
+    }
+
+    auto queries = app.queries();
+    auto data = app.is_wand_compressed()
+        ? read_training_data<wand_data<wand_data_compressed<>>>(
+            *app.wand_data_path(), queries, times_filenames)
+        : read_training_data<wand_data<wand_data_raw>>(
+            *app.wand_data_path(), queries, times_filenames);
+    auto selector = AlgorithmSelector::train(data.samples(), ridge);
+
+    // Compares the selection with each fixed algorithm on the queries timed with all of them.
+    std::vector<double> fixed(selector.algorithms().size(), 0.0);
+    double selected = 0;
+    std::size_t num_queries = 0;
+    for (auto const& [qid, query_times]: data.times) {
+        if (query_times.size() != selector.algorithms().size()) {
+            continue;
+        }
+        for (std::size_t alg = 0; alg < fixed.size(); ++alg) {
+            fixed[alg] += query_times.at(selector.algorithms()[alg]);
+        }
+        auto alg = selector.select(data.features.at(qid));
+        selected += query_times.at(selector.algorithms()[alg]);
+        num_queries += 1;
+    }
+    if (num_queries > 0) {
+        for (std::size_t alg = 0; alg < fixed.size(); ++alg) {
+            spdlog::info(
+                "Mean time of {}: {} us", selector.algorithms()[alg], fixed[alg] / num_queries);
+        }
+        spdlog::info("Mean time of selected algorithms: {} us", selected / num_queries);
+    }
+
+    std::ofstream os(output_filename);
+    selector.write(os);
+    return 0;
+}